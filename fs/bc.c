@@ -104,6 +104,30 @@ flush_block(void *addr)
 		panic("page map failed, %e", r);
 }
 
+// Give the block cache a page of its own for the block containing VA,
+// if its page is also mapped by someone else: serve_map_child and
+// image_map hand block pages to spawned children as their program text,
+// and writing the block must not change code that is already running.
+// The block is flushed first, so the copy starts out clean.
+// Returns 0 on success, < 0 on error.
+int
+block_unshare(void *addr)
+{
+	int r;
+
+	addr = ROUNDDOWN(addr, PGSIZE);
+	if (pageref(addr) <= 1)
+		return 0;
+
+	flush_block(addr);
+	if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+		return r;
+	memmove(UTEMP, addr, PGSIZE);
+	r = sys_page_map(0, UTEMP, 0, addr, uvpt[PGNUM(addr)] & PTE_SYSCALL);
+	sys_page_unmap(0, UTEMP);
+	return r;
+}
+
 // Test that the block cache works, by smashing the superblock and
 // reading it back.
 static void
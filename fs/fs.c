@@ -44,6 +44,10 @@ free_block(uint32_t blockno)
 	if (blockno == 0)
 		panic("attempt to free zero block");
 	bitmap[blockno/32] |= 1<<(blockno%32);
+	// A child may still map the block's page; let it keep the page,
+	// and read the block afresh if it is used again.
+	if (pageref(diskaddr(blockno)) > 1)
+		sys_page_unmap(0, diskaddr(blockno));
 }
 
 // Search the bitmap for a free block and allocate it.  When you
@@ -408,6 +412,8 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
 	off_t pos;
 	char *blk;
 
+	image_forget(f);
+
 	// Extend file if necessary
 	if (offset + count > f->f_size)
 		if ((r = file_set_size(f, offset + count)) < 0)
@@ -416,6 +422,8 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
 	for (pos = offset; pos < offset + count; ) {
 		if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
 			return r;
+		if ((r = block_unshare(blk)) < 0)
+			return r;
 		bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
 		memmove(blk + pos % BLKSIZE, buf, bn);
 		pos += bn;
@@ -473,6 +481,7 @@ file_truncate_blocks(struct File *f, off_t newsize)
 int
 file_set_size(struct File *f, off_t newsize)
 {
+	image_forget(f);
 	if (f->f_size > newsize)
 		file_truncate_blocks(f, newsize);
 	f->f_size = newsize;
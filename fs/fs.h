@@ -26,6 +26,7 @@ void*	diskaddr(uint32_t blockno);
 bool	va_is_mapped(void *va);
 bool	va_is_dirty(void *va);
 void	flush_block(void *addr);
+int	block_unshare(void *addr);
 void	bc_init(void);
 
 /* fs.c */
@@ -44,6 +45,11 @@ void	fs_sync(void);
 bool	block_is_free(uint32_t blockno);
 int	alloc_block(void);
 
+/* image.c */
+void	image_init(void);
+void	image_forget(struct File *f);
+int	image_map(struct File *f, envid_t child);
+
 /* test.c */
 void	fs_test(void);
 
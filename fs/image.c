@@ -0,0 +1,283 @@
+#include <inc/lib.h>
+#include <inc/elf.h>
+
+#include "fs.h"
+
+// Program image cache.  The first spawn of a program has us work out,
+// from its ELF headers, the page each page of the child's address space
+// should be: a block of the file straight from the block cache, a page
+// of ours holding a part of the file that does not sit in whole blocks,
+// or the zero page.  Every later spawn of the program just maps those
+// pages into the child, read-only, or copy-on-write for writable
+// segments, without reading the file at all.  An image stays until the
+// file changes, or its slot goes to another program.
+
+#define NIMAGE		16
+#define IMAGE_MAXPAGES	256		// pages in one image
+
+// Our zero page, then IMAGE_MAXPAGES pages for the pages each image
+// builds, above serv.c's Fd pages.
+#define IMAGEVA		0xD0400000
+#define ZEROPAGE	((void*) IMAGEVA)
+
+struct ImagePage {
+	void *ip_src;		// our page
+	uintptr_t ip_va;	// where it goes in the child
+	int ip_perm;
+};
+
+struct Image {
+	struct File *im_file;	// 0 if the slot is free
+	uint32_t im_used;	// when last spawned, to pick a slot to reuse
+	uintptr_t im_entry;
+	int im_npages;
+	int im_nbuilt;		// pages of ours in im_pages
+	struct ImagePage im_pages[IMAGE_MAXPAGES];
+};
+
+static struct Image images[NIMAGE];
+static uint32_t image_clock;
+
+// Where the image's nth page of its own is.
+static char *
+image_built(struct Image *im, int n)
+{
+	return (char*) IMAGEVA + PGSIZE
+		+ ((im - images) * IMAGE_MAXPAGES + n) * PGSIZE;
+}
+
+void
+image_init(void)
+{
+	int r;
+
+	if ((r = sys_page_alloc(0, ZEROPAGE, PTE_P|PTE_U)) < 0)
+		panic("image_init: %e", r);
+}
+
+static void
+image_drop(struct Image *im)
+{
+	int i;
+
+	for (i = 0; i < im->im_nbuilt; i++)
+		sys_page_unmap(0, image_built(im, i));
+	im->im_file = 0;
+	im->im_used = 0;
+}
+
+// Forget the image of f, if there is one, because f is changing.
+// Children already running keep the pages they have.
+void
+image_forget(struct File *f)
+{
+	int i;
+
+	for (i = 0; i < NIMAGE; i++)
+		if (images[i].im_file == f)
+			image_drop(&images[i]);
+}
+
+static int
+image_add(struct Image *im, void *src, uintptr_t va, int perm)
+{
+	struct ImagePage *ip;
+
+	if (im->im_npages == IMAGE_MAXPAGES)
+		return -E_NO_MEM;
+	ip = &im->im_pages[im->im_npages++];
+	ip->ip_src = src;
+	ip->ip_va = va;
+	ip->ip_perm = perm;
+	return 0;
+}
+
+// Add the pages of one segment to im, the way spawn's map_segment maps
+// them.
+static int
+image_segment(struct Image *im, struct File *f, uintptr_t va, size_t memsz,
+	      size_t filesz, off_t fileoffset, int perm)
+{
+	char *pg;
+	int i, r;
+
+	if ((i = PGOFF(va))) {
+		va -= i;
+		memsz += i;
+		filesz += i;
+		fileoffset -= i;
+	}
+	if (fileoffset < 0)
+		return -E_NOT_EXEC;
+
+	for (i = 0; i < memsz; i += PGSIZE) {
+		if (PGOFF(fileoffset) == 0 && i < filesz
+		    && (i + PGSIZE <= filesz || memsz <= filesz)) {
+			// a whole block
+			if ((r = file_get_block(f, (fileoffset + i) / BLKSIZE,
+						&pg)) < 0)
+				return r;
+			if (!va_is_mapped(pg))
+				(void) *(volatile char *) pg;
+		} else if (i >= filesz) {
+			pg = ZEROPAGE;
+		} else {
+			// a page of our own, read from the file and zeroed
+			if (im->im_nbuilt == IMAGE_MAXPAGES)
+				return -E_NO_MEM;
+			pg = image_built(im, im->im_nbuilt);
+			if ((r = sys_page_alloc(0, pg, PTE_P|PTE_U|PTE_W)) < 0)
+				return r;
+			im->im_nbuilt++;
+			if ((r = file_read(f, pg, MIN(PGSIZE, filesz - i),
+					   fileoffset + i)) < 0)
+				return r;
+		}
+		if ((r = image_add(im, pg, va + i, perm)) < 0)
+			return r;
+	}
+	return 0;
+}
+
+// Find f's ELF header, which must hold all of its program headers, in
+// its first block.
+static int
+image_elf(struct File *f, struct Elf **elf_store)
+{
+	struct Elf *elf;
+	char *blk;
+	int r;
+
+	if (f->f_size < sizeof(struct Elf))
+		return -E_NOT_EXEC;
+	if ((r = file_get_block(f, 0, &blk)) < 0)
+		return r;
+	elf = (struct Elf*) blk;
+	if (elf->e_magic != ELF_MAGIC
+	    || elf->e_phoff + elf->e_phnum * sizeof(struct Proghdr)
+	       > MIN(BLKSIZE, f->f_size))
+		return -E_NOT_EXEC;
+	*elf_store = elf;
+	return 0;
+}
+
+// Whether the program fits in an image: its segments take at most
+// IMAGE_MAXPAGES pages, which also bounds the pages the image builds.
+static bool
+image_fits(struct Elf *elf)
+{
+	struct Proghdr *ph = (struct Proghdr*) ((char*) elf + elf->e_phoff);
+	uint32_t npages = 0;
+	int i;
+
+	for (i = 0; i < elf->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD)
+			continue;
+		if (ph->p_memsz > IMAGE_MAXPAGES * PGSIZE)
+			return 0;
+		npages += ROUNDUP(PGOFF(ph->p_va) + ph->p_memsz, PGSIZE) / PGSIZE;
+		if (npages > IMAGE_MAXPAGES)
+			return 0;
+	}
+	return 1;
+}
+
+static int
+image_load(struct Image *im, struct File *f)
+{
+	struct Elf *elf;
+	struct Proghdr *ph;
+	int i, r;
+
+	if ((r = image_elf(f, &elf)) < 0)
+		return r;
+
+	im->im_file = f;
+	im->im_entry = elf->e_entry;
+	im->im_npages = 0;
+	im->im_nbuilt = 0;
+
+	ph = (struct Proghdr*) ((char*) elf + elf->e_phoff);
+	for (i = 0; i < elf->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD)
+			continue;
+		if ((r = image_segment(im, f, ph->p_va, ph->p_memsz,
+				       ph->p_filesz, ph->p_offset,
+				       (ph->p_flags & ELF_PROG_FLAG_WRITE)
+				       ? PTE_P|PTE_U|PTE_COW
+				       : PTE_P|PTE_U)) < 0) {
+			image_drop(im);
+			return r;
+		}
+	}
+	return 0;
+}
+
+// Unmap the first npages pages of im from child, after mapping them
+// failed partway.  Pages that never got mapped are skipped silently.
+static void
+image_unmap(struct Image *im, envid_t child, int npages)
+{
+	struct PageOp ops[PAGEOP_MAX];
+	int i, j, n;
+
+	for (i = 0; i < npages; i += n) {
+		n = MIN(npages - i, PAGEOP_MAX);
+		for (j = 0; j < n; j++) {
+			ops[j].po_op = PAGEOP_UNMAP;
+			ops[j].po_dstenv = child;
+			ops[j].po_dstva = (void*) im->im_pages[i + j].ip_va;
+		}
+		sys_page_map_batch(ops, n);
+	}
+}
+
+// Map the program in f into child, loading its image first if it is not
+// cached.  Returns the program's entry point, -E_NOT_EXEC if f is not a
+// program, -E_NO_MEM if it does not fit in an image, or < 0 on error,
+// with nothing left mapped.
+int
+image_map(struct File *f, envid_t child)
+{
+	struct PageOp ops[PAGEOP_MAX];
+	struct Image *im, *lru = &images[0];
+	struct Elf *elf;
+	int i, j, n, r;
+
+	for (im = images; im < images + NIMAGE; im++) {
+		if (im->im_file == f)
+			break;
+		if (im->im_used < lru->im_used)
+			lru = im;
+	}
+	if (im == images + NIMAGE) {
+		// Evict nothing for a program that cannot be cached anyway
+		if ((r = image_elf(f, &elf)) < 0)
+			return r;
+		if (!image_fits(elf))
+			return -E_NO_MEM;
+		im = lru;
+		if (im->im_file)
+			image_drop(im);
+		if ((r = image_load(im, f)) < 0)
+			return r;
+	}
+	im->im_used = ++image_clock;
+
+	for (i = 0; i < im->im_npages; i += n) {
+		n = MIN(im->im_npages - i, PAGEOP_MAX);
+		for (j = 0; j < n; j++) {
+			ops[j].po_op = PAGEOP_MAP;
+			ops[j].po_srcenv = 0;
+			ops[j].po_srcva = im->im_pages[i + j].ip_src;
+			ops[j].po_dstenv = child;
+			ops[j].po_dstva = (void*) im->im_pages[i + j].ip_va;
+			ops[j].po_perm = im->im_pages[i + j].ip_perm;
+		}
+		if ((r = sys_page_map_batch(ops, n)) < 0) {
+			image_unmap(im, child, i + n);
+			return r;
+		}
+	}
+	return im->im_entry;
+}
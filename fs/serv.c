@@ -227,6 +227,122 @@ serve_read(envid_t envid, union Fsipc *ipc)
 }
 
 
+// Share the block of req->req_fileid that holds byte req->req_offset,
+// storing the block cache page and its permissions in *pg_store and
+// *perm_store.  The page is read-only, so the caller cannot write the
+// file behind our back; the bytes past the end of the file are zero.
+// Returns the number of file bytes in the block, 0 at the end of the
+// file (sharing no page), or < 0 on error.
+int
+serve_map(envid_t envid, struct Fsreq_map *req, void **pg_store,
+	  int *perm_store)
+{
+	struct OpenFile *o;
+	char *blk;
+	off_t start;
+	int r;
+
+	if (debug)
+		cprintf("serve_map %08x %08x %08x\n", envid, req->req_fileid, req->req_offset);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if (req->req_offset < 0)
+		return -E_INVAL;
+	if (req->req_offset >= o->o_file->f_size)
+		return 0;
+
+	start = ROUNDDOWN(req->req_offset, BLKSIZE);
+	if ((r = file_get_block(o->o_file, start / BLKSIZE, &blk)) < 0)
+		return r;
+	// Fault the block in before handing out the page
+	if (!va_is_mapped(blk))
+		(void) *(volatile char *) blk;
+
+	*pg_store = blk;
+	*perm_store = PTE_P|PTE_U;
+	return MIN(BLKSIZE, o->o_file->f_size - start);
+}
+
+// Map req->req_npages blocks of req->req_fileid, from req->req_offset
+// on, into req->req_child, which must be a child of envid that has made
+// us its mapper (see sys_env_set_mapper), at req->req_va, with
+// req->req_perm: read-only, and copy-on-write if the child may write
+// them.  This lets spawn load a program without reading it, and shares
+// its text among all the envs running it.  If we write the file later,
+// file_write copies the blocks first, so the child keeps what it mapped.
+// Returns the number of pages mapped, fewer than asked for at the end of
+// the file, or < 0 on error.
+int
+serve_map_child(envid_t envid, struct Fsreq_map_child *req)
+{
+	struct PageOp ops[PAGEOP_MAX];
+	const volatile struct Env *child = &envs[ENVX(req->req_child)];
+	struct OpenFile *o;
+	char *blk;
+	off_t offset;
+	int i, r;
+
+	if (debug)
+		cprintf("serve_map_child %08x %08x %08x %d -> %08x\n", envid,
+			req->req_fileid, req->req_offset, req->req_npages,
+			req->req_child);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if (req->req_offset < 0 || req->req_offset % BLKSIZE
+	    || req->req_npages < 0 || req->req_npages > PAGEOP_MAX
+	    || (req->req_perm & ~(PTE_P|PTE_U|PTE_COW))
+	    || !(req->req_perm & PTE_P))
+		return -E_INVAL;
+	if (child->env_id != req->req_child || child->env_parent_id != envid)
+		return -E_BAD_ENV;
+
+	for (i = 0; i < req->req_npages; i++) {
+		offset = req->req_offset + i * BLKSIZE;
+		if (offset >= o->o_file->f_size)
+			break;
+		if ((r = file_get_block(o->o_file, offset / BLKSIZE, &blk)) < 0)
+			return r;
+		// Fault the block in before handing out the page
+		if (!va_is_mapped(blk))
+			(void) *(volatile char *) blk;
+
+		ops[i].po_op = PAGEOP_MAP;
+		ops[i].po_srcenv = 0;
+		ops[i].po_srcva = blk;
+		ops[i].po_dstenv = req->req_child;
+		ops[i].po_dstva = req->req_va + i * PGSIZE;
+		ops[i].po_perm = req->req_perm;
+	}
+	if ((r = sys_page_map_batch(ops, i)) < 0)
+		return r;
+	return i;
+}
+
+// Map the program open as req->req_fileid into req->req_child, which
+// must be a child of envid, have made us its mapper, and have nothing
+// mapped yet, from the cache
+// of program images.  Returns the program's entry point, -E_NO_MEM if
+// the program is too big for the cache, or < 0 on other errors.
+int
+serve_map_image(envid_t envid, struct Fsreq_map_image *req)
+{
+	const volatile struct Env *child = &envs[ENVX(req->req_child)];
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_map_image %08x %08x -> %08x\n", envid,
+			req->req_fileid, req->req_child);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if (child->env_id != req->req_child || child->env_parent_id != envid)
+		return -E_BAD_ENV;
+	return image_map(o->o_file, req->req_child);
+}
+
 // Write req->req_n bytes from req->req_buf to req_fileid, starting at
 // the current seek position, and update the seek position
 // accordingly.  Extend the file if necessary.  Returns the number of
@@ -300,14 +416,17 @@ serve_sync(envid_t envid, union Fsipc *req)
 typedef int (*fshandler)(envid_t envid, union Fsipc *req);
 
 fshandler handlers[] = {
-	// Open is handled specially because it passes pages
+	// Open and map are handled specially because they pass pages
 	/* [FSREQ_OPEN] =	(fshandler)serve_open, */
+	/* [FSREQ_MAP] =	(fshandler)serve_map, */
 	[FSREQ_READ] =		serve_read,
 	[FSREQ_STAT] =		serve_stat,
 	[FSREQ_FLUSH] =		(fshandler)serve_flush,
 	[FSREQ_WRITE] =		(fshandler)serve_write,
 	[FSREQ_SET_SIZE] =	(fshandler)serve_set_size,
-	[FSREQ_SYNC] =		serve_sync
+	[FSREQ_SYNC] =		serve_sync,
+	[FSREQ_MAP_CHILD] =	(fshandler)serve_map_child,
+	[FSREQ_MAP_IMAGE] =	(fshandler)serve_map_image
 };
 #define NHANDLERS (sizeof(handlers)/sizeof(handlers[0]))
 
@@ -335,6 +454,8 @@ serve(void)
 		pg = NULL;
 		if (req == FSREQ_OPEN) {
 			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
+		} else if (req == FSREQ_MAP) {
+			r = serve_map(whom, (struct Fsreq_map*)fsreq, &pg, &perm);
 		} else if (req < NHANDLERS && handlers[req]) {
 			r = handlers[req](whom, fsreq);
 		} else {
@@ -358,6 +479,7 @@ umain(int argc, char **argv)
 	cprintf("FS can do I/O\n");
 
 	serve_init();
+	image_init();
 	fs_init();
 	serve();
 }
@@ -45,6 +45,17 @@ enum EnvType {
 	ENV_TYPE_NS,		// Network server
 };
 
+// A segment of a program the kernel loaded, which the env gets a page
+// of at a time, on first touch; see load_icode.
+#define ENV_MAXSEGS	8
+
+struct EnvSegment {
+	uintptr_t es_va;		// start of the segment
+	uintptr_t es_fileend;		// end of the part from the binary
+	uintptr_t es_memend;		// end of the segment
+	const uint8_t *es_src;		// kernel VA of the byte for es_va
+};
+
 struct Env {
 	struct Trapframe env_tf;	// Saved registers
 	struct Env *env_link;		// Next free Env
@@ -61,15 +72,66 @@ struct Env {
 	// Exception handling
 	void *env_pgfault_upcall;	// Page fault upcall entry point
 
+	// Env that may map and unmap our pages besides our parent, see
+	// sys_env_set_mapper
+	envid_t env_mapper;
+
+	// Program segments not all loaded yet
+	struct EnvSegment env_segs[ENV_MAXSEGS];
+	int env_nsegs;
+
 	// Lab 4 IPC
 	bool env_ipc_recving;		// Env is blocked receiving
 	void *env_ipc_dstva;		// VA at which to map received page
 	uint32_t env_ipc_value;		// Data value sent to us
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+	void *env_ipc_datava;		// VA at which to map data pages
+	int env_ipc_datamax;		// Most data pages we will take
+	int env_ipc_npages;		// Data pages received
+
+	// Sleep and wake, see sys_env_sleep
+	bool env_sleeping;		// Env is blocked in sys_env_sleep, or in
+					// sys_ipc_recv with a time limit
+	bool env_wake_pending;		// sys_env_wake came while awake
+	uint32_t env_sleep_until;	// time_msec() to give up, or ~0
+
+	// FPU/SSE state
+	void *env_fpu;			// Kernel VA of FXSAVE area, or NULL
 };
 
  // A custom address represents NO page 
 #define SYS_IPC_NOPAGE ((void *)0xFFFFFFFF)
 
+// A run of data pages sent along with an IPC, see sys_ipc_try_send.
+// Enough to cover IPC_MAXDATA bytes at any offset into the first page.
+#define IPC_MAXDATA	(16 * PGSIZE)
+#define IPC_MAXPAGES	(IPC_MAXDATA / PGSIZE + 1)
+
+struct IpcPages {
+	void *ip_va;		// first page, page-aligned
+	int ip_npages;		// <= IPC_MAXPAGES
+	int ip_perm;		// as for the request page
+};
+
+// One page mapping change for sys_page_map_batch, as the system call of
+// the same name would make it: PAGEOP_ALLOC and PAGEOP_UNMAP change
+// po_dstva in po_dstenv; PAGEOP_MAP maps po_srcva of po_srcenv there.
+#define PAGEOP_MAX	64	// most changes in one batch
+
+enum {
+	PAGEOP_ALLOC = 1,
+	PAGEOP_MAP,
+	PAGEOP_UNMAP,
+};
+
+struct PageOp {
+	int po_op;
+	envid_t po_srcenv;
+	void *po_srcva;
+	envid_t po_dstenv;
+	void *po_dstva;
+	int po_perm;		// for PAGEOP_ALLOC and PAGEOP_MAP
+};
+
 #endif // !JOS_INC_ENV_H
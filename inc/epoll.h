@@ -0,0 +1,37 @@
+#ifndef JOS_INC_EPOLL_H
+#define JOS_INC_EPOLL_H
+
+#include <inc/types.h>
+
+// Readiness multiplexing over file descriptors, after Linux's epoll.
+// Readiness is level-triggered.  Sockets, pipes and the console can be
+// watched.
+
+// Events
+#define EPOLLIN		0x001	// read would not block
+#define EPOLLOUT	0x004	// write would not block
+#define EPOLLERR	0x008	// error or peer gone; always reported
+#define EPOLLHUP	0x010	// hung up; always reported
+
+// epoll_ctl operations
+#define EPOLL_CTL_ADD	1
+#define EPOLL_CTL_DEL	2
+#define EPOLL_CTL_MOD	3
+
+typedef union epoll_data {
+	void *ptr;
+	int fd;
+	uint32_t u32;
+} epoll_data_t;
+
+struct epoll_event {
+	uint32_t events;
+	epoll_data_t data;
+};
+
+int	epoll_create(int size);
+int	epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+int	epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+		   int timeout);
+
+#endif // !JOS_INC_EPOLL_H
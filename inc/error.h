@@ -31,6 +31,13 @@ enum {
 	E_NET_RX_DESC_EMPTY,	// rx_desc_table empty
 	E_NET_PUT_TIMEOUT,	// try put desc time out
 	E_NET_READ_TIMEOUT,	// try read desc time out
+	E_NET_RX_NO_BUF,	// rx buffer pool exhausted
+
+	// Sockets
+	E_WOULDBLOCK	,	// Non-blocking operation would block
+	E_INPROGRESS	,	// Non-blocking connect started
+
+	E_TIMEOUT	,	// Timed out
 
 	MAXERROR
 };
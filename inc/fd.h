@@ -21,8 +21,14 @@ struct Dev {
 	int (*dev_close)(struct Fd *fd);
 	int (*dev_stat)(struct Fd *fd, struct Stat *stat);
 	int (*dev_trunc)(struct Fd *fd, off_t length);
+	// Which of events (EPOLL*) are ready on fd.  If none are, arrange
+	// for sys_env_wake of this env when that may have changed, or
+	// return DEV_POLL_AGAIN if the device has no way to.
+	int (*dev_poll)(struct Fd *fd, uint32_t events);
 };
 
+#define DEV_POLL_AGAIN	0x80000000
+
 struct FdFile {
 	int id;
 };
@@ -61,5 +67,6 @@ extern struct Dev devfile;
 extern struct Dev devsock;
 extern struct Dev devcons;
 extern struct Dev devpipe;
+extern struct Dev devepoll;
 
 #endif	// not JOS_INC_FD_H
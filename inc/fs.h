@@ -74,7 +74,16 @@ enum {
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Map returns the number of file bytes in the block at req_offset
+	// and shares its block cache page read-only
+	FSREQ_MAP,
+	// Map child maps block cache pages straight into a child of the
+	// caller and returns how many it mapped
+	FSREQ_MAP_CHILD,
+	// Map image maps a whole program into a child of the caller from
+	// the cache of program images and returns its entry point
+	FSREQ_MAP_IMAGE
 };
 
 union Fsipc {
@@ -112,6 +121,22 @@ union Fsipc {
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_map {
+		int req_fileid;
+		off_t req_offset;
+	} map;
+	struct Fsreq_map_child {
+		int req_fileid;
+		off_t req_offset;	// block-aligned
+		int req_npages;		// <= PAGEOP_MAX
+		int32_t req_child;	// envid_t
+		void *req_va;
+		int req_perm;		// PTE_P|PTE_U, maybe PTE_COW
+	} map_child;
+	struct Fsreq_map_image {
+		int req_fileid;
+		int32_t req_child;	// envid_t
+	} map_image;
 
 	// Ensure Fsipc is one page
 	char _pad[PGSIZE];
@@ -23,6 +23,7 @@
 #include <inc/malloc.h>
 #include <inc/ns.h>
 #include <inc/nete1000.h>
+#include <inc/epoll.h>
 
 #define USED(x)		(void)(x)
 
@@ -59,11 +60,22 @@ int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int	sys_ipc_try_send_pages(envid_t to_env, uint32_t value, void *pg, int perm,
+			       const struct IpcPages *pages);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_recv_pages(void *rcv_pg, void *datava, int datamax,
+			   unsigned int msec);
 unsigned int sys_time_msec(void);
+int	sys_ncpu(void);
+int	sys_env_sleep(unsigned int msec);
+int	sys_env_wake(envid_t envid);
+envid_t	sys_fork(void);
+int	sys_page_map_batch(const struct PageOp *ops, int n);
+int	sys_env_set_mapper(envid_t envid, envid_t mapper);
 int sys_net_try_put_tx_desc(struct tx_desc *td, uint32_t trytime);
 bool sys_net_tx_table_available(void);
-int sys_net_try_read_rx_desc(struct rx_desc *td, uint32_t trytime);
+int sys_net_rx_map(void *va, int perm);
+int sys_net_rx_recv(void);
 bool sys_net_rx_table_available(void);
 bool sys_net_is_rx_desc_done(int i);
 
@@ -83,10 +95,14 @@ sys_exofork(void)
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+void	ipc_send_pages(envid_t to_env, uint32_t value, void *pg, int perm,
+		       const struct IpcPages *pages);
+int32_t ipc_recv_pages(envid_t *from_env_store, void *pg, int *perm_store,
+		       void *datava, int datamax, int *npages_store,
+		       unsigned int msec);
 envid_t	ipc_find_env(enum EnvType type);
 
 // fork.c
-#define	PTE_SHARE	0x400
 envid_t	fork(void);
 envid_t	sfork(void);	// Challenge!
 
@@ -100,12 +116,16 @@ ssize_t	readn(int fd, void *buf, size_t nbytes);
 int	dup(int oldfd, int newfd);
 int	fstat(int fd, struct Stat *statbuf);
 int	stat(const char *path, struct Stat *statbuf);
+int	fcntl(int fd, int cmd, int arg);
 
 // file.c
 int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	file_map_child(int fdnum, off_t offset, int npages, envid_t child,
+		       void *va, int perm);
+int	file_map_image(int fdnum, envid_t child);
 
 // pageref.c
 int	pageref(void *addr);
@@ -117,17 +137,24 @@ int     shutdown(int s, int how);
 int     connect(int s, const struct sockaddr *name, socklen_t namelen);
 int     listen(int s, int backlog);
 int     socket(int domain, int type, int protocol);
+ssize_t sendfile(int s, int fd, off_t offset, size_t count);
 
 // nsipc.c
-int     nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
+int     nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen,
+		     unsigned int flags);
 int     nsipc_bind(int s, struct sockaddr *name, socklen_t namelen);
 int     nsipc_shutdown(int s, int how);
 int     nsipc_close(int s);
-int     nsipc_connect(int s, const struct sockaddr *name, socklen_t namelen);
+int     nsipc_connect(int s, const struct sockaddr *name, socklen_t namelen,
+		      unsigned int flags);
 int     nsipc_listen(int s, int backlog);
 int     nsipc_recv(int s, void *mem, int len, unsigned int flags);
 int     nsipc_send(int s, const void *buf, int size, unsigned int flags);
 int     nsipc_socket(int domain, int type, int protocol);
+int     nsipc_sendfile(int s, int fileid, off_t offset, size_t count);
+int     nsipc_poll(struct Nspollfd *fds, int n);
+int     nsipc_loopdelay(uint32_t msec);
+int     nsipc_stats(int worker, struct Nsret_stats *stats);
 
 // spawn.c
 envid_t	spawn(const char *program, const char **argv);
@@ -156,5 +183,11 @@ void	wait(envid_t env);
 #define	O_TRUNC		0x0200		/* truncate to zero length */
 #define	O_EXCL		0x0400		/* error if already exists */
 #define O_MKDIR		0x0800		/* create directory, not regular file */
+#undef O_NONBLOCK			/* lwIP's own collides with O_MKDIR */
+#define O_NONBLOCK	0x1000		/* sockets: fail with -E_WOULDBLOCK */
+
+/* fcntl commands */
+#define F_GETFL		3		/* get fd_omode */
+#define F_SETFL		4		/* set the O_NONBLOCK bit of fd_omode */
 
 #endif	// !JOS_INC_LIB_H
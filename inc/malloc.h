@@ -1,7 +1,14 @@
 #ifndef JOS_INC_MALLOC_H
 #define JOS_INC_MALLOC_H 1
 
+struct MallocStats {
+	size_t ms_inuse;	// bytes in allocated blocks, each rounded
+				// up to the size it was given
+	size_t ms_mapped;	// bytes of heap pages mapped
+};
+
 void *malloc(size_t size);
 void free(void *addr);
+void malloc_stats(struct MallocStats *ms);
 
 #endif
@@ -178,6 +178,8 @@ extern volatile pde_t uvpd[];     // VA of current page directory
 struct PageInfo {
 	// Next page on the free list.
 	struct PageInfo *pp_link;
+	// Previous one, on the buddy allocator's doubly linked lists.
+	struct PageInfo *pp_prev;
 
 	// pp_ref is the count of pointers (usually in page table entries)
 	// to this page, for pages allocated using page_alloc.
@@ -185,6 +187,11 @@ struct PageInfo {
 	// boot_alloc do not have valid reference count fields.
 
 	uint16_t pp_ref;
+
+	// If pp_flags has PP_BUDDY, the page heads a free block of
+	// 2^pp_order pages in the buddy allocator.
+	uint8_t pp_order;
+	uint8_t pp_flags;
 };
 
 #endif /* !__ASSEMBLER__ */
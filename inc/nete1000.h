@@ -23,6 +23,58 @@ struct tx_desc
 	uint16_t special;
 };
 
+// Byte-wide fields of struct tx_desc, as seen by user space.
+// TXD_DTYP_D goes in cso and TXD_POPTS_* in css when TXD_CMD_DEXT is set,
+// see below.
+#define TXD_CMD_EOP	0x01	// End of Packet
+#define TXD_CMD_IFCS	0x02	// Insert FCS
+#define TXD_CMD_IC	0x04	// Insert Checksum (legacy)
+#define TXD_CMD_RS	0x08	// Report Status
+#define TXD_CMD_DEXT	0x20	// Extended descriptor
+#define TXD_DTYP_D	0x10	// Extended data descriptor
+#define TXD_POPTS_IXSM	0x01	// Insert IP checksum
+#define TXD_POPTS_TXSM	0x02	// Insert TCP/UDP checksum
+#define TXD_TUCMD_TCP	0x01	// Context is for TCP (otherwise UDP)
+#define TXD_TUCMD_IP	0x02	// Context is for IPv4
+#define TXD_TUCMD_TSE	0x04	// TCP segmentation enable
+
+// See 8254x_GBe_SDM.pdf Section 3.3.6 TCP/IP Context Transmit Descriptor
+//
+//  63      48 47    40 39    32 31      16 15     8 7      0
+//  +-------------------------------------------------------+
+//  |  TUCSE   |  TUCSO  |  TUCSS |  IPCSE   |  IPCSO |IPCSS |
+//  +----------+---------+--------+------+---+--------+------+
+//  |   MSS    |  HDRLEN |  STA   | TUCMD| DTYP | PAYLEN     |
+//  +-------------------------------------------------------+
+//
+// It takes up one slot of the tx_desc ring and applies to the data
+// descriptors that follow it.  An extended data descriptor is laid out
+// like struct tx_desc, except that cso holds DTYP (TXD_DTYP_D) and css
+// holds POPTS.
+//
+struct tx_ctx_desc
+{
+	uint8_t ipcss;
+	uint8_t ipcso;
+	uint16_t ipcse;
+	uint8_t tucss;
+	uint8_t tucso;
+	uint16_t tucse;
+	uint16_t paylen;
+	uint8_t dtyp;		// PAYLEN bits 19:16, DTYP in bits 7:4
+	uint8_t tucmd;
+	uint8_t status;
+	uint8_t hdrlen;
+	uint16_t mss;
+};
+
+// A context descriptor carries header offsets instead of a buffer address.
+static inline bool
+tx_desc_is_ctx(const struct tx_desc *td)
+{
+	return (td->cmd & TXD_CMD_DEXT) && !(td->cso & TXD_DTYP_D);
+}
+
 
 // See 8254x_GBe_SDM.pdf Section 3.2.3 Receive Descriptor Format
 //
@@ -44,4 +96,98 @@ struct rx_desc
 	uint16_t special;
 };
 
+// Number of pages in the receive buffer pool.  Must be a power of 2 and
+// larger than the number of rx_descs, so that ns can hold on to some
+// buffers while the NIC still has a full ring.
+#define NRXBUF 512
+
+// Each pool page holds a struct jif_pkt; the NIC DMAs the frame into
+// jp_data and the driver fills in jp_len.  inc/ns.h pulls in lwip, so
+// the offset is spelled out here rather than computed with offsetof.
+#define RXBUF_DATA_OFF	sizeof(int)
+
+// rr_csum[] flags, set when the NIC verified the checksum.
+#define RXBUF_CSUM_IP	0x1	// IPv4 header checksum is good
+#define RXBUF_CSUM_L4	0x2	// TCP/UDP checksum is good
+
+// At most NRXBUF minus the number of rx_descs buffers are outside the NIC
+// at any time, so no queue ever holds more than that.  Power of 2.
+#define RXQ_SIZE 256
+
+// Number of receive queues, one per ns worker.  ns_input steers each
+// packet to one of them, see net/rss.c.
+#define NRXQUEUE 4
+
+// A single-producer, single-consumer queue of rx buffer indices.
+// rq_head and rq_tail only ever increase; slot = counter % RXQ_SIZE.
+struct rx_queue {
+	volatile uint32_t rq_head;	// next slot to consume
+	volatile uint32_t rq_tail;	// next slot to produce
+	volatile uint16_t rq_buf[RXQ_SIZE];
+};
+
+// Receive buffer pool control page.
+//
+// The kernel allocates it, together with NRXBUF packet pages, once at
+// attach time.  sys_net_rx_map() maps the control page followed by the
+// packet pages into the caller, so the driver, ns_input and ns all share
+// the same physical pages and only buffer indices change hands.
+//
+//   rr_ready: filled buffers, one queue per ns worker.  Produced by
+//             ns_input, consumed by the worker.
+//   rr_free:  buffers ns is done with.  Produced by the ns workers,
+//             which serialize on rr_free_lock, and consumed by the
+//             driver when it hands a buffer back to the NIC.
+//   rr_ref:   number of workers a buffer was steered to; the last one
+//             to finish with it returns it to rr_free.
+//   rr_busy:  set while worker w drains rr_ready[w].  Whoever changes it
+//             from 0 to 1 owns the draining: ns_input, which then sends
+//             the worker an NSREQ_INPUT, or the worker itself.
+struct rx_ring {
+	struct rx_queue rr_ready[NRXQUEUE];
+	struct rx_queue rr_free;
+	volatile uint32_t rr_free_lock;
+	volatile uint8_t rr_ref[NRXBUF];
+	volatile uint8_t rr_csum[NRXBUF];	// RXBUF_CSUM_* of each buffer
+	volatile uint32_t rr_npkts;	// packets received
+	volatile uint32_t rr_nstall;	// times rr_free ran dry
+	volatile uint32_t rr_busy[NRXQUEUE];
+};
+
+static inline bool
+rx_queue_empty(struct rx_queue *q)
+{
+	return q->rq_head == q->rq_tail;
+}
+
+// Append v to q.  Only one env may push to a given queue.
+// Returns false if q is full.
+static inline bool
+rx_queue_push(struct rx_queue *q, uint16_t v)
+{
+	if (q->rq_tail - q->rq_head == RXQ_SIZE)
+		return false;
+	q->rq_buf[q->rq_tail % RXQ_SIZE] = v;
+	// Publish the slot before the new tail.
+	__asm __volatile("" : : : "memory");
+	q->rq_tail++;
+	return true;
+}
+
+// Remove the oldest index from q.  Only one env may pop from a given
+// queue.  Returns the index, or -1 if q is empty.
+static inline int
+rx_queue_pop(struct rx_queue *q)
+{
+	int v;
+
+	if (rx_queue_empty(q))
+		return -1;
+	v = q->rq_buf[q->rq_head % RXQ_SIZE];
+	// Read the slot before handing it back to the producer.
+	__asm __volatile("" : : : "memory");
+	q->rq_head++;
+	return v;
+}
+
 #endif
\ No newline at end of file
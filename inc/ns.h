@@ -5,6 +5,7 @@
 
 #include <inc/types.h>
 #include <inc/mmu.h>
+#include <inc/env.h>
 #include <lwip/sockets.h>
 
 struct jif_pkt {
@@ -26,6 +27,14 @@ enum {
 	NSREQ_RECV,
 	NSREQ_SEND,
 	NSREQ_SOCKET,
+	// Sendfile has ns read the file from the file server itself.
+	NSREQ_SENDFILE,
+	// Poll a list of sockets, see Nsreq_poll.
+	NSREQ_POLL,
+	// Set how long looped packets are held back, see Nsreq_loopdelay.
+	NSREQ_LOOPDELAY,
+	// Report a worker's memory pools, see Nsret_stats.
+	NSREQ_STATS,
 
 	// The following two messages pass a page containing a struct jif_pkt
 	NSREQ_INPUT,
@@ -33,14 +42,31 @@ enum {
 	// network server, to the output environment
 	NSREQ_OUTPUT,
 
-	// The following message passes no page
-	NSREQ_TIMER,
+	// The following messages pass no page
+	// NSREQ_SYNC is sent between ns workers when state they share
+	// changes, see net/serv.c
+	NSREQ_SYNC,
 };
 
+// Socket ids handed to clients carry the ENVX of the ns worker that owns
+// the socket in their upper bits, so clients can send requests for that
+// socket straight to its worker.
+#define NSSOCK(envx, s)		(((envx) << 16) | (s))
+#define NSSOCK_ENVX(id)		((unsigned) (id) >> 16)
+#define NSSOCK_LOCAL(id)	((id) & 0xffff)
+
+// Most workers and memory pools NSREQ_STATS reports.
+#define NSSTATS_WORKERS	8
+#define NSSTATS_POOLS	32
+
 union Nsipc {
+	// Accept, connect, recv and send take MSG_DONTWAIT in req_flags:
+	// rather than wait, they fail with -E_WOULDBLOCK, or for connect
+	// -E_INPROGRESS, and a send takes only what fits right away.
 	struct Nsreq_accept {
 		int req_s;
 		socklen_t req_addrlen;
+		unsigned int req_flags;
 	} accept;
 
 	struct Nsret_accept {
@@ -67,6 +93,7 @@ union Nsipc {
 		int req_s;
 		struct sockaddr req_name;
 		socklen_t req_namelen;
+		unsigned int req_flags;
 	} connect;
 
 	struct Nsreq_listen {
@@ -74,10 +101,16 @@ union Nsipc {
 		int req_backlog;
 	} listen;
 
+	// Recv and send carry up to NSIPC_INLINE bytes in the request
+	// page.  Larger buffers are passed as req_npages data pages along
+	// with it (see sys_ipc_try_send), starting req_off bytes into the
+	// first one, so that ns reads or writes them in place.
 	struct Nsreq_recv {
 		int req_s;
 		int req_len;
 		unsigned int req_flags;
+		int req_off;
+		int req_npages;
 	} recv;
 
 	struct Nsret_recv {
@@ -88,9 +121,62 @@ union Nsipc {
 		int req_s;
 		int req_size;
 		unsigned int req_flags;
+		int req_off;
+		int req_npages;
 		char req_buf[0];
 	} send;
 
+	struct Nsreq_sendfile {
+		int req_s;
+		int req_fileid;
+		off_t req_offset;
+		size_t req_count;
+	} sendfile;
+
+	// Fill in the pf_revents (EPOLL*) of each socket.  Sockets that
+	// have none of their pf_events ready are watched: ns does a
+	// sys_env_wake of the caller once one becomes ready.  Returns the
+	// number of sockets with pf_revents.
+	struct Nsreq_poll {
+		int req_n;
+		struct Nspollfd {
+			int pf_s;
+			uint32_t pf_events;
+			uint32_t pf_revents;
+		} req_fds[0];
+	} poll;
+
+	// Hold every packet ns sends to its own address back for
+	// req_msec milliseconds, in all workers, to emulate a long path.
+	struct Nsreq_loopdelay {
+		uint32_t req_msec;
+	} loopdelay;
+
+	// The usage of the heap and of each memory pool of the worker the
+	// request went to, and how to reach the other workers.  ps_max is
+	// the high-water mark of ps_used since ns started.  The rx_ring
+	// counters cover all workers.
+	struct Nsret_stats {
+		uint64_t ret_tsc;	// the worker's read_tsc()
+		uint64_t ret_blocked;	// cycles it spent waiting for work
+		uint64_t ret_tx_bytes;	// bytes its sockets have sent
+		uint64_t ret_tx_cycles;	// cycles it has spent running
+		uint32_t ret_rx_frames;	// frames it fed to lwIP
+		uint32_t ret_rx_pbufs;	// pbufs it allocated for them
+		uint32_t ret_rx_npkts;	// rx_ring rr_npkts
+		uint32_t ret_rx_nstall;	// rx_ring rr_nstall
+		int ret_nworkers;
+		envid_t ret_workers[NSSTATS_WORKERS];
+		int ret_npools;
+		struct Nspoolstat {
+			char ps_name[16];
+			uint32_t ps_avail;
+			uint32_t ps_used;
+			uint32_t ps_max;
+			uint32_t ps_err;
+		} ret_pools[NSSTATS_POOLS];
+	} statsRet;
+
 	struct Nsreq_socket {
 		int req_domain;
 		int req_type;
@@ -103,4 +189,10 @@ union Nsipc {
 	char _pad[PGSIZE];
 };
 
+// Most data recv and send pass in the request page itself.
+#define NSIPC_INLINE	1600
+
+// Most sockets one NSREQ_POLL can carry.
+#define NSPOLL_MAX	((PGSIZE - sizeof(int)) / sizeof(struct Nspollfd))
+
 #endif // !JOS_INC_NS_H
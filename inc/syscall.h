@@ -18,11 +18,18 @@ enum {
 	SYS_ipc_try_send,
 	SYS_ipc_recv,
 	SYS_time_msec,
+	SYS_ncpu,
+	SYS_env_sleep,
+	SYS_env_wake,
+	SYS_fork,
+	SYS_page_map_batch,
+	SYS_env_set_mapper,
 
 	// Network
 	SYS_net_try_put_tx_desc,
 	SYS_net_tx_table_available,
-	SYS_net_try_put_rx_desc,
+	SYS_net_rx_map,
+	SYS_net_rx_recv,
 	SYS_net_rx_table_available,
 	SYS_net_is_rx_desc_done,
 
@@ -23,6 +23,11 @@ struct CpuInfo {
 	volatile unsigned cpu_status;   // The status of the CPU
 	struct Env *cpu_env;            // The currently-running environment.
 	struct Taskstate cpu_ts;        // Used by x86 to find stack for interrupt
+	struct PageInfo *cpu_pages;     // Free pages kept for page_alloc
+	int cpu_npages;                 // Number of them
+	bool cpu_tlb_batch;             // tlb_invalidate defers user flushes
+	bool cpu_tlb_stale;             // and one has been deferred
+	struct Env *cpu_fpu_env;        // Whose FPU/SSE registers are loaded
 };
 
 // Initialized in mpconfig.c
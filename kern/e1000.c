@@ -37,6 +37,12 @@ struct tx_desc tx_desc_table[NTXDESCS];
 __attribute__((__aligned__(16)))
 struct rx_desc rx_desc_table[NRXDESCS];
 
+// Receive buffer pool, see inc/nete1000.h.
+// rx_pool[0] is the struct rx_ring control page,
+// rx_pool[1 + i] is packet buffer i.
+struct PageInfo *rx_pool[1 + NRXBUF];
+// Index of the packet buffer currently owned by each rx_desc.
+uint16_t rx_desc_buf[NRXDESCS];
 
 
 #define debug 0
@@ -247,14 +253,27 @@ e1000_82540em_init(void)
 	*(uint32_t *)rdbal = rx_table;
 	uintptr_t rdbah = E1000_REG_ADDR(e1000, E1000_RDBAH);
 	*(uint32_t *)rdbah = 0;
-	//     3.1 Initialize tx_desc_table
+	static_assert(NRXBUF - NRXDESCS <= RXQ_SIZE);
+	static_assert(sizeof(struct rx_ring) <= PGSIZE);
+
+	//     3.1 Allocate the receive buffer pool. The pages are never freed,
+	//         so hold a reference on each of them.
+	for (i = 0; i < 1 + NRXBUF; i++) {
+		if (! (rx_pool[i] = page_alloc(ALLOC_ZERO)))
+			panic("e1000_82540em_init: out of memory for rx pool");
+		rx_pool[i]->pp_ref++;
+	}
+
+	//     3.2 Initialize rx_desc_table, buffer i goes to rx_desc i and the
+	//         rest of the pool starts out on the free queue.
 	memset(rx_desc_table, 0, sizeof(rx_desc_table));
 	for (i = 0; i < NRXDESCS; i++) {
-		// Allocate memory, phsical address for DMA.
-		// 4 is the offset of &nsipcbuf.pkt.jp_data
-		// TODO: dead code, it shloud be able automatically compute.
-		rx_desc_table[i].addr = page2pa(page_alloc(0)) + 4;
+		rx_desc_buf[i] = i;
+		rx_desc_table[i].addr = page2pa(rx_pool[1 + i]) + RXBUF_DATA_OFF;
 	}
+	struct rx_ring *ring = page2kva(rx_pool[0]);
+	for (i = NRXDESCS; i < NRXBUF; i++)
+		rx_queue_push(&ring->rr_free, i);
 
 	// 4. Set the Receive Descriptor Length (RDLEN) register to
 	//    the size (in bytes) of the descriptor ring.
@@ -304,6 +323,12 @@ e1000_82540em_init(void)
 
 	*(uint32_t *) rctl = rflag;
 
+	// 7. Program the Receive Checksum Control (RXCSUM) register so the
+	//    NIC verifies IPv4 and TCP/UDP checksums, see 8254x_GBe_SDM.pdf
+	//    Section 13.4.28.  Results are passed on through rr_csum.
+	uintptr_t rxcsum = E1000_REG_ADDR(e1000, E1000_RXCSUM);
+	*(uint32_t *) rxcsum = E1000_RXCSUM_IPOFL | E1000_RXCSUM_TUOFL;
+
 }
 
 int
@@ -378,61 +403,86 @@ e1000_82540em_tx_table_available(void)
 }
 
 //
-// Read a rx_desc.
-// The rd->addr will be updates to the new physical address which is the page
-// that already contents some date from network.
+// Translate the checksum status of a completed rx_desc to RXBUF_CSUM_*.
+// Nothing is reported when the NIC says to ignore its checksum results.
+//
+static int
+e1000_82540em_rx_csum(struct rx_desc *rr)
+{
+	int csum = 0;
+
+	if (rr->status & E1000_RXD_STAT_IXSM)
+		return 0;
+	if ((rr->status & E1000_RXD_STAT_IPCS)
+	    && !(rr->errors & E1000_RXD_ERR_IPE))
+		csum |= RXBUF_CSUM_IP;
+	if ((rr->status & (E1000_RXD_STAT_TCPCS | E1000_RXD_STAT_UDPCS))
+	    && !(rr->errors & E1000_RXD_ERR_TCPE))
+		csum |= RXBUF_CSUM_L4;
+	return csum;
+}
+
 //
-//   1. Exchange physical address of rd and current RDT
-//   2. Unset RDT's DD
-//   3. RDT += 1
+// Pages backing the receive buffer pool, for sys_net_rx_map.
+// Index 0 is the struct rx_ring page, index 1 + i is packet buffer i.
+//
+struct PageInfo **
+e1000_82540em_rx_pool(void)
+{
+	return rx_pool;
+}
+
+//
+// Receive a packet.
+// The buffer holding the packet is swapped out of the rx_desc for one
+// taken from the pool's free queue, so nothing is allocated or remapped.
+//
+//   1. Check the DD bit of the rx_desc after RDT
+//   2. Pop a replacement buffer from rr_free
+//   3. Record the length in the filled buffer's jp_len
+//   4. Hand the replacement to the rx_desc, unset DD, RDT += 1
 //
 // RETURNS:
-//   index of the rx_desc, >= 0
+//   index of the pool buffer holding the packet, >= 0
 //   -E_NET_RX_DESC_EMPTY if there is no data in receive queue.
+//   -E_NET_RX_NO_BUF if ns has not returned any buffers yet.
 //
 int
-e1000_82540em_read_rx_desc(struct rx_desc *rd)
+e1000_82540em_rx_recv(void)
 {
-#if debug
-	cprintf("In %s, line %d\n", __FILE__, __LINE__);
-	cprintf("rx_desc_table:\n");
-	int ii;
-	for(ii = 0; ii < 15; ii++) {
-		cprintf("  [%3d]'s status: %d\n",ii, rx_desc_table[ii].status);
-	}
-	cprintf("\n");
-#endif
-
+	struct rx_ring *ring = page2kva(rx_pool[0]);
 	struct rx_desc *rr;
+	int i, buf, next;
 
-	// i is the index of the frist rx_desc with DD bit under RDT. 
-	int i = (*e1000_rdt + 1) & (NRXDESCS - 1);
-	if (rx_desc_table[i].status & E1000_RXD_STAT_SHIFT(E1000_RXD_STAT_DD)) {
-		if (rx_desc_table[i].status & E1000_RXD_STAT_SHIFT(E1000_RXD_STAT_EOP)) {
-
-			goto receive;
-		}
+	// i is the index of the frist rx_desc with DD bit under RDT.
+	i = (*e1000_rdt + 1) & (NRXDESCS - 1);
+	rr = &rx_desc_table[i];
+	if (! (rr->status & E1000_RXD_STAT_SHIFT(E1000_RXD_STAT_DD)))
+		return -E_NET_RX_DESC_EMPTY;
+	if (! (rr->status & E1000_RXD_STAT_SHIFT(E1000_RXD_STAT_EOP)))
 		panic("DO NOT support jumbo frames!");
 
-	} else {
-
-		return -E_NET_RX_DESC_EMPTY;
+	// rr_free is written by user space, do not trust its contents.
+	if ((next = rx_queue_pop(&ring->rr_free)) < 0) {
+		ring->rr_nstall++;
+		return -E_NET_RX_NO_BUF;
 	}
+	if (next >= NRXBUF)
+		return -E_INVAL;
 
-	receive:
-
-	rr = &rx_desc_table[i];
+	buf = rx_desc_buf[i];
+	*(int *) page2kva(rx_pool[1 + buf]) = rr->length;
+	ring->rr_csum[buf] = e1000_82540em_rx_csum(rr);
 
-	// Exchange rx_desc and unset DD
-	uint64_t pa = rd->addr;
-	*rd = *rr;
-	rr->addr = pa;
+	rx_desc_buf[i] = next;
+	rr->addr = page2pa(rx_pool[1 + next]) + RXBUF_DATA_OFF;
 	rr->status = 0;
 
 	// Update RDT
 	*e1000_rdt = i;
 
-	return i;
+	ring->rr_npkts++;
+	return buf;
 }
 
 //
@@ -441,7 +491,7 @@ e1000_82540em_read_rx_desc(struct rx_desc *rd)
 bool
 e1000_82540em_rx_table_available(void)
 {
-	struct rx_desc *rr = &rx_desc_table[*e1000_rdt + 1];
+	struct rx_desc *rr = &rx_desc_table[(*e1000_rdt + 1) & (NRXDESCS - 1)];
 	if (! (rr->status & E1000_RXD_STAT_SHIFT(E1000_RXD_STAT_DD)))
 		return false;    // FULL!
 	return true;
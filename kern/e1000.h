@@ -14,7 +14,8 @@ int e1000_82540em_pci_attach(struct pci_func *pcif);
 uint32_t e1000_82540em_status(void);
 int e1000_82540em_put_tx_desc(struct tx_desc *td);
 bool e1000_82540em_tx_table_available(void);
-int e1000_82540em_read_rx_desc(struct rx_desc *rd);
+struct PageInfo **e1000_82540em_rx_pool(void);
+int e1000_82540em_rx_recv(void);
 bool e1000_82540em_rx_table_available(void);
 bool e1000_82540em_is_rx_desc_done(int i);
 
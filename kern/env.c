@@ -17,10 +17,14 @@
 
 struct Env *envs = NULL;		// All environments
 static struct Env *env_free_list;	// Free environment list
+int env_nsleeping;			// Envs in sys_env_sleep with a deadline
 					// (linked by Env->env_link)
 
 #define ENVGENSHIFT	12		// >= LOGNENV
 
+// Set if the CPU has FXSAVE/FXRSTOR and we switch FPU/SSE state.
+static bool fpu_enabled;
+
 // Global descriptor table.
 //
 // Set up global descriptor table (GDT) with separate segments for
@@ -160,6 +164,90 @@ env_init_percpu(void)
 	// For good measure, clear the local descriptor table (LDT),
 	// since we don't use it.
 	lldt(0);
+
+	// Let user environments use SSE.  Their FPU/SSE state is switched
+	// lazily: CR0_TS makes the first FPU instruction of an env that
+	// does not own this CPU's FPU fault, see env_fpu_restore.
+	uint32_t edx;
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (edx & (1 << 24)) {		// FXSR
+		fpu_enabled = 1;
+		lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+		lcr0((rcr0() & ~CR0_EM) | CR0_MP | CR0_TS);
+	}
+}
+
+//
+// This CPU's FPU/SSE registers belong to thiscpu->cpu_fpu_env, if set,
+// and CR0_TS is clear exactly then.  The owner is the env running on
+// this CPU, and its registers stay loaded across its traps.  When the
+// CPU switches to another env or goes idle, save them back to the owner
+// and set CR0_TS, so that the next env to use the FPU faults.
+//
+void
+env_fpu_release(void)
+{
+	struct CpuInfo *c = thiscpu;
+
+	if (!c->cpu_fpu_env)
+		return;
+	asm volatile("fxsave (%0)" : : "r" (c->cpu_fpu_env->env_fpu) : "memory");
+	c->cpu_fpu_env = NULL;
+	lcr0(rcr0() | CR0_TS);
+}
+
+//
+// Handle a device-not-available fault from curenv e: give e this CPU's
+// FPU, loading its saved registers, or fresh ones if it never used the
+// FPU.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NO_MEM if there is no memory for e's FPU/SSE state.
+//	-E_INVAL if the FPU is not switched at all.
+//
+int
+env_fpu_restore(struct Env *e)
+{
+	struct PageInfo *pp;
+	uint32_t mxcsr = 0x1f80;	// all SIMD exceptions masked
+
+	if (!fpu_enabled)
+		return -E_INVAL;
+	assert(!thiscpu->cpu_fpu_env);
+	if (!e->env_fpu) {
+		if (!(pp = page_alloc(0)))
+			return -E_NO_MEM;
+		pp->pp_ref++;
+		e->env_fpu = page2kva(pp);
+		asm volatile("clts; fninit; ldmxcsr %0" : : "m" (mxcsr));
+	} else
+		asm volatile("clts; fxrstor (%0)" : : "r" (e->env_fpu));
+	thiscpu->cpu_fpu_env = e;
+	return 0;
+}
+
+//
+// Give the child dst of a fork a copy of src's FPU/SSE state.
+// src must be curenv.
+//
+// Returns 0 on success, -E_NO_MEM if out of memory.
+//
+int
+env_fpu_copy(struct Env *dst, struct Env *src)
+{
+	struct PageInfo *pp;
+
+	if (!src->env_fpu)
+		return 0;
+	if (!(pp = page_alloc(0)))
+		return -E_NO_MEM;
+	pp->pp_ref++;
+	dst->env_fpu = page2kva(pp);
+	// src's registers may still be loaded rather than saved
+	if (thiscpu->cpu_fpu_env == src)
+		asm volatile("fxsave (%0)" : : "r" (src->env_fpu) : "memory");
+	memmove(dst->env_fpu, src->env_fpu, 512);
+	return 0;
 }
 
 //
@@ -272,9 +360,16 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Clear the page fault handler until user installs one.
 	e->env_pgfault_upcall = 0;
+	e->env_nsegs = 0;
+	e->env_mapper = 0;
+
+	// The FPU/SSE state is allocated on first use.
+	e->env_fpu = NULL;
 
 	// Also clear the IPC receiving flag.
 	e->env_ipc_recving = 0;
+	e->env_sleeping = 0;
+	e->env_wake_pending = 0;
 
 	// commit the allocation
 	env_free_list = e->env_link;
@@ -284,6 +379,25 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	return 0;
 }
 
+//
+// Make e, blocked in sys_env_sleep, runnable again; its sys_env_sleep
+// returns 0.  If e is blocked in sys_ipc_recv instead, its time is up,
+// and that returns -E_TIMEOUT.
+//
+void
+env_wake(struct Env *e)
+{
+	if (e->env_sleep_until != ~0U)
+		env_nsleeping--;
+	e->env_sleeping = 0;
+	e->env_tf.tf_regs.reg_eax = 0;
+	if (e->env_ipc_recving) {
+		e->env_ipc_recving = 0;
+		e->env_tf.tf_regs.reg_eax = -E_TIMEOUT;
+	}
+	e->env_status = ENV_RUNNABLE;
+}
+
 //
 // Allocate len bytes of physical memory for environment env,
 // and map it at virtual address va in the environment's address space.
@@ -374,6 +488,7 @@ load_icode(struct Env *e, uint8_t *binary)
 		goto bad;
 
 	struct Proghdr *ph, *eph;
+	struct EnvSegment *es;
 
 	// load each program segment (ignores ph flags)
 	ph = (struct Proghdr *) (binary + elf->e_phoff);
@@ -386,6 +501,18 @@ load_icode(struct Env *e, uint8_t *binary)
 		if ((ph->p_memsz) < (ph->p_filesz))
 			goto bad;
 
+		// Most segments are loaded a page at a time as the env
+		// touches them, see env_segment_fault, so that it does not
+		// pay for pages of a big binary it never uses.
+		if (e->env_nsegs < ENV_MAXSEGS) {
+			es = &e->env_segs[e->env_nsegs++];
+			es->es_va = ph->p_va;
+			es->es_fileend = ph->p_va + ph->p_filesz;
+			es->es_memend = ph->p_va + ph->p_memsz;
+			es->es_src = binary + ph->p_offset;
+			continue;
+		}
+
 		region_alloc(e, (void *)ph->p_va, ph->p_memsz);
 		memset((void *)ph->p_va, 0, ph->p_memsz);
 		memcpy((void *)ph->p_va, (void *)(binary + ph->p_offset), ph->p_filesz);
@@ -407,6 +534,51 @@ load_icode(struct Env *e, uint8_t *binary)
 		panic("Malformed elf file at 0x%08x\n", binary);
 }
 
+// Fill in the page at va of e from the segment of its program it is
+// in, if load_icode left that page to be loaded on first touch and it is
+// not mapped yet.  Returns 0 if it filled the page in, -E_INVAL if there
+// was nothing to fill in, or -E_NO_MEM.
+int
+env_segment_fault(struct Env *e, void *va)
+{
+	struct EnvSegment *es;
+	struct PageInfo *pp;
+	uintptr_t pg = ROUNDDOWN((uintptr_t) va, PGSIZE), start, end;
+	int r;
+
+	if (pg >= UTOP || page_lookup(e->env_pgdir, (void *) pg, NULL))
+		return -E_INVAL;
+	for (es = e->env_segs; es < e->env_segs + e->env_nsegs; es++)
+		if (pg < es->es_memend && pg + PGSIZE > es->es_va)
+			break;
+	if (es == e->env_segs + e->env_nsegs)
+		return -E_INVAL;
+
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	start = MAX(pg, es->es_va);
+	end = MIN(pg + PGSIZE, es->es_fileend);
+	if (start < end)
+		memcpy(page2kva(pp) + (start - pg),
+		       es->es_src + (start - es->es_va), end - start);
+	if ((r = page_insert(e->env_pgdir, pp, (void *) pg, PTE_U|PTE_W)) < 0)
+		page_free(pp);
+	return r;
+}
+
+// page_lookup in e's address space, filling the page in first if it is
+// in a segment of e's program not loaded yet.
+struct PageInfo *
+env_page_lookup(struct Env *e, void *va, pte_t **pte_store)
+{
+	struct PageInfo *pp;
+
+	if (!(pp = page_lookup(e->env_pgdir, va, pte_store))
+	    && env_segment_fault(e, va) == 0)
+		pp = page_lookup(e->env_pgdir, va, pte_store);
+	return pp;
+}
+
 //
 // Allocates a new env with env_alloc, loads the named elf
 // binary into it with load_icode, and sets its env_type.
@@ -483,6 +655,21 @@ env_free(struct Env *e)
 	e->env_pgdir = 0;
 	page_decref(pa2page(pa));
 
+	// free the FPU/SSE state, dropping it from this CPU if loaded;
+	// e is not running, or loaded, anywhere else
+	if (thiscpu->cpu_fpu_env == e) {
+		thiscpu->cpu_fpu_env = NULL;
+		lcr0(rcr0() | CR0_TS);
+	}
+	if (e->env_fpu) {
+		page_decref(pa2page(PADDR(e->env_fpu)));
+		e->env_fpu = NULL;
+	}
+
+	if (e->env_sleeping && e->env_sleep_until != ~0U)
+		env_nsleeping--;
+	e->env_sleeping = 0;
+
 	// return the environment to the free list
 	e->env_status = ENV_FREE;
 	e->env_link = env_free_list;
@@ -573,6 +760,11 @@ env_run(struct Env *e)
 	curenv->env_runs++;
 	lcr3((uint32_t) PADDR(curenv->env_pgdir));
 
+	// Another env's FPU/SSE registers are loaded: save them, so that e
+	// faults if it uses the FPU.  If they are e's, leave them be.
+	if (thiscpu->cpu_fpu_env != e)
+		env_fpu_release();
+
 	// Unlock the kernel_lock before leaving kernel mode.
 	unlock_kernel();
 
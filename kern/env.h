@@ -7,6 +7,7 @@
 #include <kern/cpu.h>
 
 extern struct Env *envs;		// All environments
+extern int env_nsleeping;		// Envs sleeping with a deadline
 #define curenv (thiscpu->cpu_env)		// Current environment
 extern struct Segdesc gdt[];
 
@@ -17,8 +18,15 @@ void	env_free(struct Env *e);
 void	env_create(uint8_t *binary, enum EnvType type);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
 
+void	env_fpu_release(void);
+int	env_fpu_restore(struct Env *e);
+int	env_fpu_copy(struct Env *dst, struct Env *src);
+
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
+int	env_segment_fault(struct Env *e, void *va);
+struct PageInfo *env_page_lookup(struct Env *e, void *va, pte_t **pte_store);
 // The following two functions do not return
+void	env_wake(struct Env *e);
 void	env_run(struct Env *e) __attribute__((noreturn));
 void	env_pop_tf(struct Trapframe *tf) __attribute__((noreturn));
 
@@ -129,6 +129,11 @@ mon_show_mappings(int argc, char **argv, struct Trapframe *tf)
 		a = (uintptr_t) strtol(argv[i], NULL, 16);
 		pd = kern_pgdir[a >> 22];
 		cprintf("pd: 0x%08x\n", pd);
+		if (pd & PTE_PS) {
+			cprintf("address %s maps to 0x%08x (4MB page)\n",
+				argv[i], (pd & 0xFFC00000) | (a & 0x003FFFFF));
+			continue;
+		}
 		pt = ((pde_t *)pd)[(a >> 12) & 0x3FF];
 		cprintf("pt: 0x%08x\n", pt);
 
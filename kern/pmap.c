@@ -10,6 +10,7 @@
 #include <kern/kclock.h>
 #include <kern/env.h>
 #include <kern/cpu.h>
+#include <kern/spinlock.h>
 
 // These variables are set by i386_detect_memory()
 size_t npages;			// Amount of physical memory (in pages)
@@ -18,7 +19,9 @@ static size_t npages_basemem;	// Amount of base memory (in pages)
 // These variables are set in mem_init()
 pde_t *kern_pgdir;		// Kernel's initial page directory
 struct PageInfo *pages;		// Physical page state array
-static struct PageInfo *page_free_list;	// Free list of physical pages
+static bool pse;		// CPU has 4MB pages (PSE)
+static bool pge;		// CPU has global pages (PGE)
+static bool sse2;		// CPU has non-temporal stores (SSE2)
 
 
 // --------------------------------------------------------------
@@ -60,6 +63,7 @@ i386_detect_memory(void)
 // --------------------------------------------------------------
 
 static void mem_init_mp(void);
+static void page_init_highmem(void);
 static void boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm);
 static void check_page_free_list(bool only_low_memory);
 static void check_page_alloc(void);
@@ -79,7 +83,7 @@ static void check_page_installed_pgdir(void);
 //
 // If we're out of memory, boot_alloc should panic.
 // This function may ONLY be used during initialization,
-// before the page_free_list list has been set up.
+// before the page allocator has been set up.
 static void *
 boot_alloc(uint32_t n)
 {
@@ -136,6 +140,16 @@ mem_init(void)
 	// Find out how much memory the machine has (npages & npages_basemem).
 	i386_detect_memory();
 
+	// With PSE, boot_map_region maps whole 4MB regions with one PDE and
+	// no page table, which spares the TLB most kernel accesses.  With
+	// PGE, it marks its mappings global, so that they stay in the TLB
+	// when env_run loads another env's page directory.
+	uint32_t edx;
+	cpuid(1, NULL, NULL, NULL, &edx);
+	pse = (edx & (1 << 3)) != 0;
+	pge = (edx & (1 << 13)) != 0;
+	sse2 = (edx & (1 << 26)) != 0;
+
 	// Remove this line when you're ready to test this function.
 	// panic("mem_init: This function is not finished\n");
 
@@ -255,8 +269,10 @@ mem_init(void)
 	//
 	// If the machine reboots at this point, you've probably set up your
 	// kern_pgdir wrong.
+	mem_init_percpu();
 	lcr3(PADDR(kern_pgdir));
 
+	page_init_highmem();
 	check_page_free_list(0);
 
 	// entry.S set the really important flags in cr0 (including enabling
@@ -270,6 +286,17 @@ mem_init(void)
 	check_page_installed_pgdir();
 }
 
+// Set up this CPU to use kern_pgdir: turn on the 4MB and global pages
+// in it.  Must come before loading kern_pgdir into CR3.
+void
+mem_init_percpu(void)
+{
+	if (pse)
+		lcr4(rcr4() | CR4_PSE);
+	if (pge)
+		lcr4(rcr4() | CR4_PGE);
+}
+
 // Modify mappings in kern_pgdir to support SMP
 //   - Map the per-CPU stacks in the region [KSTACKTOP-PTSIZE, KSTACKTOP)
 //
@@ -310,14 +337,175 @@ mem_init_mp(void)
 // --------------------------------------------------------------
 // Tracking of physical pages.
 // The 'pages' array has one 'struct PageInfo' entry per physical page.
-// Pages are reference counted, and free pages are kept on a linked list.
+// Pages are reference counted.  Free pages are kept by a buddy
+// allocator, in blocks of 2^order pages aligned to their size, and
+// each CPU keeps a few free ones of its own in front of it, so that
+// most page_alloc and page_free calls touch no shared state.
 // --------------------------------------------------------------
 
+// Free pages a CPU's cache takes from, or gives back to, the buddy
+// allocator at once, and most it keeps.
+#define PAGE_CACHE_ORDER	4
+#define PAGE_CACHE_BATCH	(1 << PAGE_CACHE_ORDER)
+#define PAGE_CACHE_HIGH		(4 * PAGE_CACHE_BATCH)
+
+// buddy_free[order] lists the free blocks of 2^order pages, by their
+// first page, with the buddy_lock held.
+static struct PageInfo *buddy_free[PAGE_MAXORDER + 1];
+static struct spinlock buddy_lock = {
+#ifdef DEBUG_SPINLOCK
+	.name = "buddy_lock"
+#endif
+};
+
+static void
+buddy_insert(struct PageInfo *pp, int order)
+{
+	pp->pp_order = order;
+	pp->pp_flags |= PP_BUDDY;
+	pp->pp_prev = NULL;
+	pp->pp_link = buddy_free[order];
+	if (pp->pp_link)
+		pp->pp_link->pp_prev = pp;
+	buddy_free[order] = pp;
+}
+
+static void
+buddy_remove(struct PageInfo *pp)
+{
+	if (pp->pp_prev)
+		pp->pp_prev->pp_link = pp->pp_link;
+	else
+		buddy_free[pp->pp_order] = pp->pp_link;
+	if (pp->pp_link)
+		pp->pp_link->pp_prev = pp->pp_prev;
+	pp->pp_flags &= ~PP_BUDDY;
+	pp->pp_link = pp->pp_prev = NULL;
+}
+
+// Take a block of 2^order pages, splitting a bigger one if need be.
+// Returns NULL if there is none.
+static struct PageInfo *
+buddy_alloc(int order)
+{
+	struct PageInfo *pp;
+	int o;
+
+	for (o = order; o <= PAGE_MAXORDER && !buddy_free[o]; o++)
+		/* do nothing */;
+	if (o > PAGE_MAXORDER)
+		return NULL;
+
+	pp = buddy_free[o];
+	buddy_remove(pp);
+	// keep the low half, give back the high one
+	while (o > order) {
+		o--;
+		buddy_insert(pp + (1 << o), o);
+	}
+	return pp;
+}
+
+// Give back the block of 2^order pages at pp, merging it with its buddy,
+// the other half of the block twice its size, for as long as that is
+// free as a whole.
+static void
+buddy_release(struct PageInfo *pp, int order)
+{
+	size_t i = pp - pages, buddy;
+
+	for (; order < PAGE_MAXORDER; order++) {
+		buddy = i ^ (1 << order);
+		if (buddy >= npages || !(pages[buddy].pp_flags & PP_BUDDY)
+		    || pages[buddy].pp_order != order)
+			break;
+		buddy_remove(&pages[buddy]);
+		i &= ~(1 << order);
+	}
+	buddy_insert(&pages[i], order);
+}
+
+// Fill this CPU's cache with a batch of pages, in one block if there is
+// one that size.
+static void
+page_cache_refill(struct CpuInfo *c)
+{
+	struct PageInfo *pp;
+	int i;
+
+	spin_lock(&buddy_lock);
+	if ((pp = buddy_alloc(PAGE_CACHE_ORDER))) {
+		for (i = PAGE_CACHE_BATCH - 1; i >= 0; i--) {
+			pp[i].pp_link = c->cpu_pages;
+			c->cpu_pages = &pp[i];
+		}
+		c->cpu_npages += PAGE_CACHE_BATCH;
+	} else {
+		for (i = 0; i < PAGE_CACHE_BATCH && (pp = buddy_alloc(0)); i++) {
+			pp->pp_link = c->cpu_pages;
+			c->cpu_pages = pp;
+			c->cpu_npages++;
+		}
+	}
+	spin_unlock(&buddy_lock);
+}
+
+// Give n of the pages in this CPU's cache back to the buddy allocator.
+static void
+page_cache_drain(struct CpuInfo *c, int n)
+{
+	struct PageInfo *pp;
+
+	spin_lock(&buddy_lock);
+	while (n-- > 0 && (pp = c->cpu_pages)) {
+		c->cpu_pages = pp->pp_link;
+		c->cpu_npages--;
+		pp->pp_link = NULL;
+		buddy_release(pp, 0);
+	}
+	spin_unlock(&buddy_lock);
+}
+
+// Pages idle CPUs have zeroed ahead of time, for page_alloc(ALLOC_ZERO),
+// up to ZERO_POOL_MAX of them; 0 turns the pool off.
+#define ZERO_POOL_MAX		256
+#define ZERO_POOL_BATCH		32	// most zeroed per sched_halt
+
+static struct PageInfo *zero_pages;
+static int nzero_pages;
+static struct spinlock zero_lock = {
+#ifdef DEBUG_SPINLOCK
+	.name = "zero_lock"
+#endif
+};
+
+// Take a zeroed page from the pool, or NULL if it is empty.
+static struct PageInfo *
+zero_pool_get(void)
+{
+	struct PageInfo *pp;
+
+	if (!zero_pages)
+		return NULL;
+	spin_lock(&zero_lock);
+	if ((pp = zero_pages)) {
+		zero_pages = pp->pp_link;
+		nzero_pages--;
+		pp->pp_link = NULL;
+	}
+	spin_unlock(&zero_lock);
+	return pp;
+}
+
 //
 // Initialize page structure and memory free list.
 // After this is done, NEVER use boot_alloc again.  ONLY use the page
 // allocator functions below to allocate and deallocate physical
-// memory via the page_free_list.
+// memory.
+//
+// Only the free pages that entry_pgdir maps, those below 4MB, are handed
+// to the allocator here, since mem_init writes to the pages it allocates
+// before it loads kern_pgdir; page_init_highmem hands over the rest.
 //
 void
 page_init(void)
@@ -389,8 +577,7 @@ page_init(void)
 			continue;
 		}
 		pages[i].pp_ref = 0;
-		pages[i].pp_link = page_free_list;
-		page_free_list = &pages[i];
+		buddy_release(&pages[i], 0);
 	}
 	// [IOPHYSMEM, EXTPHYSMEM)  ignore
 	// kernel  ignore
@@ -403,10 +590,25 @@ page_init(void)
 		pages[i].pp_link = NULL;
 	}
 
-	for (i = next_index; i < npages; i++) {
+	// up to what entry_pgdir maps
+	for (i = next_index; i < MIN(npages, PGNUM(PTSIZE)); i++) {
+		pages[i].pp_ref = 0;
+		buddy_release(&pages[i], 0);
+	}
+}
+
+//
+// Hand the free pages above 4MB to the allocator, once mem_init has
+// loaded kern_pgdir, which maps them all.
+//
+static void
+page_init_highmem(void)
+{
+	size_t i = MAX(PGNUM(PADDR(boot_alloc(0))), PGNUM(PTSIZE));
+
+	for (; i < npages; i++) {
 		pages[i].pp_ref = 0;
-		pages[i].pp_link = page_free_list;
-		page_free_list = &pages[i];
+		buddy_release(&pages[i], 0);
 	}
 }
 
@@ -419,18 +621,29 @@ page_init(void)
 // Be sure to set the pp_link field of the allocated page to NULL so
 // page_free can check for double-free bugs.
 //
+// Zeroed pages come from the pool idle CPUs fill, when it has any.
+//
 // Returns NULL if out of free memory.
 //
 // Hint: use page2kva and memset
 struct PageInfo *
 page_alloc(int alloc_flags)
 {
-	// Out of memory
-	if (! page_free_list)
-		return NULL;
+	struct CpuInfo *c = thiscpu;
+	struct PageInfo *pp;
 
-	struct PageInfo *ret_p = page_free_list;
-	page_free_list = page_free_list->pp_link;
+	if ((alloc_flags & ALLOC_ZERO) && (pp = zero_pool_get()))
+		return pp;
+
+	if (!c->cpu_pages)
+		page_cache_refill(c);
+	// Out of memory, but for the zeroed pages
+	if (!c->cpu_pages)
+		return zero_pool_get();
+
+	struct PageInfo *ret_p = c->cpu_pages;
+	c->cpu_pages = ret_p->pp_link;
+	c->cpu_npages--;
 
 	ret_p->pp_link = NULL;
 	if (alloc_flags & ALLOC_ZERO) {
@@ -454,9 +667,111 @@ page_free(struct PageInfo *pp)
 	if (pp->pp_link != NULL)
 		panic("Page can't free, has link");
 
-	// Add to page_free_list.
-	pp->pp_link = page_free_list;
-	page_free_list = pp;
+	// Add to this CPU's cache, which gives a batch back to the buddy
+	// allocator when it gets too big.
+	struct CpuInfo *c = thiscpu;
+
+	pp->pp_link = c->cpu_pages;
+	c->cpu_pages = pp;
+	if (++c->cpu_npages > PAGE_CACHE_HIGH)
+		page_cache_drain(c, PAGE_CACHE_BATCH);
+}
+
+//
+// Allocates 2^order physically contiguous pages, aligned to their size,
+// as for DMA or a large page, straight from the buddy allocator.  Like
+// page_alloc, does not increment their reference counts, and fills them
+// all with '\0' if (alloc_flags & ALLOC_ZERO).
+// They can be given back at once with page_free_order, or one by one
+// as their reference counts drop to 0.
+//
+// Returns NULL if there is no such block free.
+//
+struct PageInfo *
+page_alloc_order(int order, int alloc_flags)
+{
+	struct PageInfo *pp;
+
+	if (order < 0 || order > PAGE_MAXORDER)
+		return NULL;
+
+	spin_lock(&buddy_lock);
+	pp = buddy_alloc(order);
+	spin_unlock(&buddy_lock);
+	if (!pp) {
+		// The pages this CPU keeps might complete a block.
+		page_cache_drain(thiscpu, PAGE_CACHE_HIGH);
+		spin_lock(&buddy_lock);
+		pp = buddy_alloc(order);
+		spin_unlock(&buddy_lock);
+	}
+
+	if (pp && (alloc_flags & ALLOC_ZERO))
+		memset(page2kva(pp), 0, PGSIZE << order);
+	return pp;
+}
+
+//
+// Return the 2^order pages page_alloc_order gave at pp, once none of
+// them has any references left.
+//
+void
+page_free_order(struct PageInfo *pp, int order)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++)
+		if (pp[i].pp_ref != 0 || pp[i].pp_link != NULL)
+			panic("page_free_order: page %d in use", i);
+	assert((pp - pages) % (1 << order) == 0);
+
+	spin_lock(&buddy_lock);
+	buddy_release(pp, order);
+	spin_unlock(&buddy_lock);
+}
+
+// Zero a page with non-temporal stores, which do not drag it through,
+// and evict everything else from, the cache.
+static void
+page_zero_nt(void *kva)
+{
+	uint32_t *p, *end = (uint32_t *) kva + PGSIZE / 4;
+
+	if (!sse2) {
+		memset(kva, 0, PGSIZE);
+		return;
+	}
+	for (p = kva; p < end; p += 4)
+		asm volatile("movnti %1, (%0)\n\t"
+			     "movnti %1, 4(%0)\n\t"
+			     "movnti %1, 8(%0)\n\t"
+			     "movnti %1, 12(%0)"
+			     : : "r" (p), "r" (0) : "memory");
+	// order them before the page is handed out
+	asm volatile("sfence" : : : "memory");
+}
+
+//
+// Top up the pool of zeroed pages by a batch.  Called by sched_halt,
+// without the big kernel lock, on a CPU with nothing else to do.
+//
+void
+page_zero_idle(void)
+{
+	struct PageInfo *pp;
+	int i;
+
+	for (i = 0; i < ZERO_POOL_BATCH && nzero_pages < ZERO_POOL_MAX; i++) {
+		if (!(pp = page_alloc(0)))
+			break;
+		page_zero_nt(page2kva(pp));
+
+		spin_lock(&zero_lock);
+		pp->pp_link = zero_pages;
+		zero_pages = pp;
+		nzero_pages++;
+		spin_unlock(&zero_lock);
+	}
 }
 
 //
@@ -497,6 +812,11 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 {
 	pde_t *pde = &pgdir[PDX(va)];
 
+	// A 4MB page has no page table, hence no PTE to return.  Only the
+	// kernel's mappings above UTOP use them.
+	if (*pde & PTE_PS)
+		return NULL;
+
 	if (! (*pde & PTE_P)) {
 		// The relevant page table page might not exist yet.
 
@@ -531,6 +851,12 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 // above UTOP. As such, it should *not* change the pp_ref field on the
 // mapped pages.
 //
+// With PSE, any 4MB of the range that starts 4MB-aligned in both va and
+// pa, and has no page table yet, is mapped with a single 4MB PDE.  With
+// PGE, the mappings are global: every env_pgdir has them, from
+// env_setup_vm, so no switch between them needs to flush them.  Per-env
+// mappings above UTOP, that is UVPT, must not come from here.
+//
 // Hint: the TA solution uses pgdir_walk
 static void
 boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm)
@@ -544,7 +870,18 @@ boot_map_region(pde_t *pgdir, uintptr_t va, size_t size, physaddr_t pa, int perm
 
 	size_t pages_num = size / PGSIZE;
 	pte_t *pte_va;
+
+	if (pge)
+		perm |= PTE_G;
 	do {
+		if (pse && va % PTSIZE == 0 && pa % PTSIZE == 0
+		    && pages_num >= NPTENTRIES && !(pgdir[PDX(va)] & PTE_P)) {
+			pgdir[PDX(va)] = pa | perm | PTE_PS | PTE_P;
+			va += PTSIZE;
+			pa += PTSIZE;
+			pages_num -= NPTENTRIES;
+			continue;
+		}
 		pte_va = pgdir_walk(pgdir, (void *)va, 1);
 		*pte_va = pa | perm | PTE_P;
 		// change to corresponding PDE
@@ -651,6 +988,83 @@ page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
 	return 0;
 }
 
+//
+// Copy the user mappings below 'end' in 'src' into 'dst', for fork.
+// Pages that are writable or copy-on-write become copy-on-write in both,
+// pages with PTE_SHARE stay shared as they are, and the rest are shared
+// read-only.  Builds each page table of 'dst' in one pass, not a
+// page_insert per page; the caller must flush the TLB for 'src'.
+//
+// RETURNS:
+//   0 on success
+//   -E_NO_MEM, if a page table couldn't be allocated
+//
+int
+pgdir_copy_cow(pde_t *dst, pde_t *src, uintptr_t end)
+{
+	struct PageInfo *pt;
+	pte_t *spt, *dpt, pte;
+	uintptr_t va;
+	int i;
+
+	for (va = 0; va < end; va += PTSIZE) {
+		if (!(src[PDX(va)] & PTE_P))
+			continue;
+		if (!(pt = page_alloc(ALLOC_ZERO)))
+			return -E_NO_MEM;
+		pt->pp_ref++;
+		dst[PDX(va)] = page2pa(pt) | (src[PDX(va)] & PTE_SYSCALL);
+
+		spt = KADDR(PTE_ADDR(src[PDX(va)]));
+		dpt = page2kva(pt);
+		for (i = 0; i < NPTENTRIES && va + i * PGSIZE < end; i++) {
+			if (!((pte = spt[i]) & PTE_P))
+				continue;
+			if (!(pte & PTE_SHARE) && (pte & (PTE_W | PTE_COW)))
+				spt[i] = pte = (pte & ~PTE_W) | PTE_COW;
+			dpt[i] = pte;
+			pa2page(PTE_ADDR(pte))->pp_ref++;
+		}
+	}
+	return 0;
+}
+
+//
+// Resolve a write fault at 'va' on a copy-on-write page: map a private,
+// writable copy of it instead, or just make it writable if nothing else
+// maps it any more.
+//
+// RETURNS:
+//   0 on success
+//   -E_INVAL, if there is no copy-on-write page at 'va'
+//   -E_NO_MEM, if there is no memory for the copy
+//
+int
+page_cow(pde_t *pgdir, void *va)
+{
+	struct PageInfo *pp, *copy;
+	pte_t *pte;
+	int perm, r;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if (!(pp = page_lookup(pgdir, va, &pte)) || !(*pte & PTE_COW))
+		return -E_INVAL;
+	perm = (*pte & PTE_SYSCALL & ~PTE_COW) | PTE_W;
+
+	if (pp->pp_ref == 1) {
+		*pte = page2pa(pp) | perm;
+		tlb_invalidate(pgdir, va);
+		return 0;
+	}
+
+	if (!(copy = page_alloc(0)))
+		return -E_NO_MEM;
+	memmove(page2kva(copy), page2kva(pp), PGSIZE);
+	if ((r = page_insert(pgdir, copy, va, perm)) < 0)
+		page_free(copy);
+	return r;
+}
+
 //
 // Return the page mapped at virtual address 'va'.
 // If pte_store is not zero, then we store in it the address
@@ -718,13 +1132,41 @@ page_remove(pde_t *pgdir, void *va)
 //
 // Invalidate a TLB entry, but only if the page tables being
 // edited are the ones currently in use by the processor.
+// Mappings above UTOP are global, in use whatever the page tables, and
+// survive loading CR3, so those are always flushed.
+// Between tlb_batch_begin and tlb_batch_end, the flushes below UTOP are
+// left to one flush of the whole TLB at the end.
 //
 void
 tlb_invalidate(pde_t *pgdir, void *va)
 {
-	// Flush the entry only if we're modifying the current address space.
-	if (!curenv || curenv->env_pgdir == pgdir)
+	struct CpuInfo *c = thiscpu;
+
+	if ((uintptr_t) va >= UTOP)
 		invlpg(va);
+	// Flush the entry only if we're modifying the current address space.
+	else if (!c->cpu_env || c->cpu_env->env_pgdir == pgdir) {
+		if (c->cpu_tlb_batch)
+			c->cpu_tlb_stale = true;
+		else
+			invlpg(va);
+	}
+}
+
+void
+tlb_batch_begin(void)
+{
+	thiscpu->cpu_tlb_batch = true;
+}
+
+void
+tlb_batch_end(void)
+{
+	struct CpuInfo *c = thiscpu;
+
+	if (c->cpu_tlb_stale)
+		lcr3(rcr3());
+	c->cpu_tlb_batch = c->cpu_tlb_stale = false;
 }
 
 //
@@ -804,6 +1246,9 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm)
 	pte_t *p;
 	for (; vi <= ve; vi += PGSIZE) {
 		p = pgdir_walk(env->env_pgdir, (void *)vi, 0);
+		if ((!p || !(*p & PTE_P))
+		    && env_segment_fault(env, (void *)vi) == 0)
+			p = pgdir_walk(env->env_pgdir, (void *)vi, 0);
 
 		// present?
 		if (! (uintptr_t)p)
@@ -873,90 +1318,111 @@ user_mem_phy_addr(struct Env *env, uintptr_t va, physaddr_t *pa_store)
 	return 0;
 }
 
+// --------------------------------------------------------------
+// Checking functions.
+// --------------------------------------------------------------
+
 //
-// Replace the page mapped in va with pt, and exchange pp_ref.
-// Like page_insert but DO NOT automatically increase or decrease pp_ref.
+// Take every free page out of the allocator, as the blocks it kept them
+// in, linked through pp_link; and give them back.
 //
-int
-user_mem_page_replace(uintptr_t va, struct PageInfo *pt)
+static struct PageInfo *
+steal_free_pages(void)
 {
-	user_mem_assert(curenv, (const void *)va, PGSIZE, PTE_U| PTE_P);
-
-	pte_t *ppet;
-	struct PageInfo *po = page_lookup(curenv->env_pgdir, (void *)va, &ppet);
-
-	// Exchange pp_ref
-	int ref = po->pp_ref;
-	po->pp_ref = pt->pp_ref;
-	pt->pp_ref = ref;
+	struct PageInfo *pp, *fl = NULL;
+	int order;
+
+	page_cache_drain(thiscpu, PAGE_CACHE_HIGH);
+	for (order = 0; order <= PAGE_MAXORDER; order++)
+		while ((pp = buddy_free[order])) {
+			buddy_remove(pp);
+			pp->pp_link = fl;
+			fl = pp;
+		}
+	return fl;
+}
 
-	// Update the new PageInfo backend, leave permit unchange.
-	*ppet = page2pa(pt) | PGOFF(*ppet);
-	tlb_invalidate(curenv->env_pgdir, (void*)va);
+static void
+give_back_free_pages(struct PageInfo *fl)
+{
+	struct PageInfo *pp;
 
-	return 0;
+	while ((pp = fl)) {
+		fl = pp->pp_link;
+		pp->pp_link = NULL;
+		buddy_release(pp, pp->pp_order);
+	}
 }
 
-// --------------------------------------------------------------
-// Checking functions.
-// --------------------------------------------------------------
+// Count the free pages, in the buddy allocator, every CPU's cache and
+// the pool of zeroed ones.
+static int
+count_free_pages(void)
+{
+	struct PageInfo *pp;
+	int order, i, nfree = 0;
+
+	for (order = 0; order <= PAGE_MAXORDER; order++)
+		for (pp = buddy_free[order]; pp; pp = pp->pp_link)
+			nfree += 1 << order;
+	for (i = 0; i < NCPU; i++)
+		nfree += cpus[i].cpu_npages;
+	return nfree + nzero_pages;
+}
 
 //
-// Check that the pages on the page_free_list are reasonable.
+// Check that the free pages are reasonable.
 //
 static void
 check_page_free_list(bool only_low_memory)
 {
-	struct PageInfo *pp;
+	struct PageInfo *pp, *p;
 	unsigned pdx_limit = only_low_memory ? 1 : NPDENTRIES;
 	int nfree_basemem = 0, nfree_extmem = 0;
 	char *first_free_page;
+	int order;
 
-	if (!page_free_list)
-		panic("'page_free_list' is a null pointer!");
-
-	if (only_low_memory) {
-		// Move pages with lower addresses first in the free
-		// list, since entry_pgdir does not map all pages.
-		struct PageInfo *pp1, *pp2;
-		struct PageInfo **tp[2] = { &pp1, &pp2 };
-		for (pp = page_free_list; pp; pp = pp->pp_link) {
-			int pagetype = PDX(page2pa(pp)) >= pdx_limit;
-			*tp[pagetype] = pp;
-			tp[pagetype] = &pp->pp_link;
-		}
-		*tp[1] = 0;
-		*tp[0] = pp2;
-		page_free_list = pp1;
-	}
-
-	// if there's a page that shouldn't be on the free list,
-	// try to make sure it eventually causes trouble.
-	for (pp = page_free_list; pp; pp = pp->pp_link)
-		if (PDX(page2pa(pp)) < pdx_limit)
-			memset(page2kva(pp), 0x97, 128);
+	// Only this CPU has run yet; put all its free pages in the buddy
+	// allocator, to check them there.
+	page_cache_drain(thiscpu, PAGE_CACHE_HIGH);
+	if (!count_free_pages())
+		panic("no free pages!");
 
 	first_free_page = (char *) boot_alloc(0);
-	for (pp = page_free_list; pp; pp = pp->pp_link) {
-		// check that we didn't corrupt the free list itself
-		assert(pp >= pages);
-		assert(pp < pages + npages);
-		assert(((char *) pp - (char *) pages) % sizeof(*pp) == 0);
-
-		// check a few pages that shouldn't be on the free list
-		assert(page2pa(pp) != 0);
-		assert(page2pa(pp) != IOPHYSMEM);
-		assert(page2pa(pp) != EXTPHYSMEM - PGSIZE);
-		assert(page2pa(pp) != EXTPHYSMEM);
-		assert(page2pa(pp) < EXTPHYSMEM || (char *) page2kva(pp) >= first_free_page);
-		// (new test for lab 4)
-		assert(page2pa(pp) != MPENTRY_PADDR);
-
-		if (page2pa(pp) < EXTPHYSMEM)
-			++nfree_basemem;
-		else
-			++nfree_extmem;
-	}
+	for (order = 0; order <= PAGE_MAXORDER; order++)
+		for (pp = buddy_free[order]; pp; pp = pp->pp_link) {
+			// check that we didn't corrupt the free lists themselves
+			assert(pp >= pages);
+			assert(pp < pages + npages);
+			assert(((char *) pp - (char *) pages) % sizeof(*pp) == 0);
+			assert((pp->pp_flags & PP_BUDDY) && pp->pp_order == order);
+			assert((pp - pages) % (1 << order) == 0);
+			assert(pp + (1 << order) <= pages + npages);
+			assert(!pp->pp_link || pp->pp_link->pp_prev == pp);
+
+			for (p = pp; p < pp + (1 << order); p++) {
+				// entry_pgdir maps only the low free pages
+				assert(PDX(page2pa(p)) < pdx_limit);
+
+				// if there's a page that shouldn't be free, try
+				// to make sure it eventually causes trouble.
+				memset(page2kva(p), 0x97, 128);
+
+				// check a few pages that shouldn't be free
+				assert(page2pa(p) != 0);
+				assert(page2pa(p) != IOPHYSMEM);
+				assert(page2pa(p) != EXTPHYSMEM - PGSIZE);
+				assert(page2pa(p) != EXTPHYSMEM);
+				assert(page2pa(p) < EXTPHYSMEM || (char *) page2kva(p) >= first_free_page);
+				// (new test for lab 4)
+				assert(page2pa(p) != MPENTRY_PADDR);
+
+				if (page2pa(p) < EXTPHYSMEM)
+					++nfree_basemem;
+				else
+					++nfree_extmem;
+			}
+		}
 
 	assert(nfree_basemem > 0);
 	assert(nfree_extmem > 0);
@@ -969,7 +1435,7 @@ check_page_free_list(bool only_low_memory)
 static void
 check_page_alloc(void)
 {
-	struct PageInfo *pp, *pp0, *pp1, *pp2;
+	struct PageInfo *pp, *pp0, *pp1, *pp2, *run;
 	int nfree;
 	struct PageInfo *fl;
 	char *c;
@@ -979,8 +1445,7 @@ check_page_alloc(void)
 		panic("'pages' is a null pointer!");
 
 	// check number of free pages
-	for (pp = page_free_list, nfree = 0; pp; pp = pp->pp_link)
-		++nfree;
+	nfree = count_free_pages();
 
 	// should be able to allocate three pages
 	pp0 = pp1 = pp2 = 0;
@@ -995,9 +1460,15 @@ check_page_alloc(void)
 	assert(page2pa(pp1) < npages*PGSIZE);
 	assert(page2pa(pp2) < npages*PGSIZE);
 
+	// should be able to allocate a run of four pages, aligned
+	assert((run = page_alloc_order(2, ALLOC_ZERO)));
+	assert((run - pages) % 4 == 0);
+	c = page2kva(run);
+	for (i = 0; i < 4 * PGSIZE; i++)
+		assert(c[i] == 0);
+
 	// temporarily steal the rest of the free pages
-	fl = page_free_list;
-	page_free_list = 0;
+	fl = steal_free_pages();
 
 	// should be no free memory
 	assert(!page_alloc(0));
@@ -1015,6 +1486,16 @@ check_page_alloc(void)
 	assert(pp2 && pp2 != pp1 && pp2 != pp0);
 	assert(!page_alloc(0));
 
+	// a run splits into halves, and they merge again
+	page_free_order(run, 2);
+	assert(page_alloc_order(1, 0) == run);
+	assert(page_alloc_order(1, 0) == run + 2);
+	assert(!page_alloc_order(0, 0));
+	page_free_order(run, 1);
+	page_free_order(run + 2, 1);
+	assert(page_alloc_order(2, 0) == run);
+	assert(!page_alloc_order(0, 0));
+
 	// test flags
 	memset(page2kva(pp0), 1, PGSIZE);
 	page_free(pp0);
@@ -1025,17 +1506,16 @@ check_page_alloc(void)
 		assert(c[i] == 0);
 
 	// give free list back
-	page_free_list = fl;
+	give_back_free_pages(fl);
 
 	// free the pages we took
 	page_free(pp0);
 	page_free(pp1);
 	page_free(pp2);
+	page_free_order(run, 2);
 
 	// number of free pages should be the same
-	for (pp = page_free_list; pp; pp = pp->pp_link)
-		--nfree;
-	assert(nfree == 0);
+	assert(nfree == count_free_pages());
 
 	cprintf("check_page_alloc() succeeded!\n");
 }
@@ -1116,6 +1596,8 @@ check_va2pa(pde_t *pgdir, uintptr_t va)
 	pgdir = &pgdir[PDX(va)];
 	if (!(*pgdir & PTE_P))
 		return ~0;
+	if (*pgdir & PTE_PS)
+		return ROUNDDOWN(*pgdir, PTSIZE) + PTX(va) * PGSIZE;
 	p = (pte_t*) KADDR(PTE_ADDR(*pgdir));
 	if (!(p[PTX(va)] & PTE_P))
 		return ~0;
@@ -1146,8 +1628,7 @@ check_page(void)
 	assert(pp2 && pp2 != pp1 && pp2 != pp0);
 
 	// temporarily steal the rest of the free pages
-	fl = page_free_list;
-	page_free_list = 0;
+	fl = steal_free_pages();
 
 	// should be no free memory
 	assert(!page_alloc(0));
@@ -1267,7 +1748,7 @@ check_page(void)
 	pp0->pp_ref = 0;
 
 	// give free list back
-	page_free_list = fl;
+	give_back_free_pages(fl);
 
 	// free the pages we took
 	page_free(pp0);
@@ -51,24 +51,39 @@ enum {
 	ALLOC_ZERO = 1<<0,
 };
 
+// Largest block of pages, 2^PAGE_MAXORDER of them, page_alloc_order can
+// hand out: 4MB, a large page.
+#define PAGE_MAXORDER	10
+
+// struct PageInfo pp_flags
+#define PP_BUDDY	0x01	// Heads a free block in the buddy allocator
+
 void	mem_init(void);
+void	mem_init_percpu(void);
 
 void	page_init(void);
 struct PageInfo *page_alloc(int alloc_flags);
 void	page_free(struct PageInfo *pp);
+struct PageInfo *page_alloc_order(int order, int alloc_flags);
+void	page_free_order(struct PageInfo *pp, int order);
+void	page_zero_idle(void);
 int	page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm);
 void	page_remove(pde_t *pgdir, void *va);
 struct PageInfo *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct PageInfo *pp);
 
 void	tlb_invalidate(pde_t *pgdir, void *va);
+void	tlb_batch_begin(void);
+void	tlb_batch_end(void);
+
+int	pgdir_copy_cow(pde_t *dst, pde_t *src, uintptr_t end);
+int	page_cow(pde_t *pgdir, void *va);
 
 void *	mmio_map_region(physaddr_t pa, size_t size);
 
 int	user_mem_check(struct Env *env, const void *va, size_t len, int perm);
 void	user_mem_assert(struct Env *env, const void *va, size_t len, int perm);
 int	user_mem_phy_addr(struct Env *env, uintptr_t va, physaddr_t *pa_store);
-int user_mem_page_replace(uintptr_t va, struct PageInfo *pt);
 
 static inline physaddr_t
 page2pa(struct PageInfo *pp)
@@ -4,9 +4,22 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/time.h>
 
 void sched_halt(void);
 
+// Wake envs whose sys_env_sleep deadline has passed.
+static void
+sched_wake_sleepers(void)
+{
+	uint32_t now = time_msec();
+	int i;
+
+	for (i = 0; i < NENV && env_nsleeping; i++)
+		if (envs[i].env_sleeping && envs[i].env_sleep_until <= now)
+			env_wake(&envs[i]);
+}
+
 // Choose a user environment to run and run it.
 void
 sched_yield(void)
@@ -32,6 +45,9 @@ sched_yield(void)
 
 	idle = NULL;
 
+	if (env_nsleeping)
+		sched_wake_sleepers();
+
 	int n = 0;
 	if (curenv) {
 		n = ENVX(ENVX(curenv->env_id));
@@ -75,6 +91,9 @@ sched_halt(void)
 		     envs[i].env_status == ENV_RUNNING ||
 		     envs[i].env_status == ENV_DYING))
 			break;
+		// an env sleeping with a deadline will run again
+		if (envs[i].env_sleeping && envs[i].env_sleep_until != ~0U)
+			break;
 	}
 	if (i == NENV) {
 		cprintf("No runnable environments in the system!\n");
@@ -82,8 +101,10 @@ sched_halt(void)
 			monitor(NULL);
 	}
 
-	// Mark that no environment is running on this CPU
+	// Mark that no environment is running on this CPU, and save the
+	// FPU/SSE registers of the last one, which may run elsewhere next
 	curenv = NULL;
+	env_fpu_release();
 	lcr3(PADDR(kern_pgdir));
 
 	// Mark that this CPU is in the HALT state, so that when
@@ -94,6 +115,9 @@ sched_halt(void)
 	// Release the big kernel lock as if we were "leaving" the kernel
 	unlock_kernel();
 
+	// Zero some pages for page_alloc while there is nothing to run.
+	page_zero_idle();
+
 	// Reset stack pointer, enable interrupts and then halt.
 	asm volatile (
 		"movl $0, %%ebp\n"
@@ -89,6 +89,10 @@ sys_exofork(void)
 		return r;
 
 	memmove(&(e->env_tf), &(curenv->env_tf), sizeof(struct Trapframe));
+	if ((r = env_fpu_copy(e, curenv)) < 0) {
+		env_free(e);
+		return r;
+	}
 	// sub env return 0
 	e->env_tf.tf_regs.reg_eax = 0;
 
@@ -96,6 +100,59 @@ sys_exofork(void)
 	return e->env_id;
 }
 
+// Create a runnable copy of the current environment, all in one system
+// call: the child gets the parent's registers, with sys_fork returning 0
+// in it, its page fault upcall, a fresh user exception stack if the
+// parent has one, and the rest of its address space below USTACKTOP
+// copy-on-write, as pgdir_copy_cow shares it.  Copy-on-write faults
+// are resolved in page_fault_handler.
+//
+// Returns envid of new environment, or < 0 on error.  Errors are:
+//	-E_NO_FREE_ENV if no free environment is available.
+//	-E_NO_MEM on memory exhaustion.
+static envid_t
+sys_fork(void)
+{
+	struct Env *e;
+	struct PageInfo *pp;
+	envid_t envid;
+	int r;
+
+	if ((envid = sys_exofork()) < 0)
+		return envid;
+	if ((r = envid2env(envid, &e, 0)) < 0)
+		return r;
+
+	r = pgdir_copy_cow(e->env_pgdir, curenv->env_pgdir, USTACKTOP);
+	// our writable pages are read-only now, even if that failed
+	lcr3(PADDR(curenv->env_pgdir));
+	if (r < 0)
+		goto bad;
+
+	if (page_lookup(curenv->env_pgdir, (void *) (UXSTACKTOP - PGSIZE), NULL)) {
+		r = -E_NO_MEM;
+		if (!(pp = page_alloc(ALLOC_ZERO)))
+			goto bad;
+		if ((r = page_insert(e->env_pgdir, pp, (void *) (UXSTACKTOP - PGSIZE),
+				     PTE_U|PTE_W|PTE_P)) < 0) {
+			page_free(pp);
+			goto bad;
+		}
+	}
+	e->env_pgfault_upcall = curenv->env_pgfault_upcall;
+	// pages of our program we have not touched yet, the child fills in
+	// for itself
+	memmove(e->env_segs, curenv->env_segs, sizeof(e->env_segs));
+	e->env_nsegs = curenv->env_nsegs;
+
+	e->env_status = ENV_RUNNABLE;
+	return envid;
+
+bad:
+	env_free(e);
+	return r;
+}
+
 // Set envid's env_status to status, which must be ENV_RUNNABLE
 // or ENV_NOT_RUNNABLE.
 //
@@ -184,6 +241,47 @@ sys_env_set_pgfault_upcall(envid_t envid, void *func)
 	return 0;
 }
 
+// Let 'mapper' map and unmap pages in envid's address space, as
+// envid's parent may, until it is set back to 0.  Spawn lets the file
+// server map a program's pages straight into the child this way.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid or a nonzero mapper doesn't
+//		currently exist, or the caller doesn't have permission to
+//		change envid.
+static int
+sys_env_set_mapper(envid_t envid, envid_t mapper)
+{
+	struct Env *e, *m;
+	int r;
+
+	if ((r = envid2env(envid, &e, true)) < 0)
+		return r;
+	if (mapper && (r = envid2env(mapper, &m, false)) < 0)
+		return r;
+	e->env_mapper = mapper;
+	return 0;
+}
+
+// Look up envid as envid2env does with checkperm set, but also let
+// through an env whose mapper the caller is.
+static int
+envid2env_pages(envid_t envid, struct Env **env_store)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, false)) < 0)
+		return r;
+	if (e != curenv && e->env_parent_id != curenv->env_id
+	    && e->env_mapper != curenv->env_id) {
+		*env_store = 0;
+		return -E_BAD_ENV;
+	}
+	*env_store = e;
+	return 0;
+}
+
 // Allocate a page of memory and map it at 'va' with permission
 // 'perm' in the address space of 'envid'.
 // The page's contents are set to 0.
@@ -236,6 +334,40 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 	return 0;
 }
 
+// Map se's page at srcva at dstva in de, as sys_page_map does once it
+// has checked its arguments, but for any two envs.  sys_ipc_try_send
+// maps into an env that is not ours this way.
+static int
+page_map_env(struct Env *se, void *srcva, struct Env *de, void *dstva,
+	     int perm)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+	int r;
+
+	pp = env_page_lookup(se, srcva, &pte);
+
+	if (pte == NULL)
+		return -E_INVAL;
+
+	//   s  W  R
+	// d
+	// W    V  X
+	// R    V  V
+	if (perm & PTE_W) {
+		if (!(*pte & PTE_W))
+			return -E_INVAL;
+	}
+
+	if (pp == NULL)
+		return -E_NO_MEM;
+
+	if ((r = page_insert(de->env_pgdir, pp, dstva, perm)) < 0)
+		return r;
+
+	return 0;
+}
+
 // Map the page of memory at 'srcva' in srcenvid's address space
 // at 'dstva' in dstenvid's address space with permission 'perm'.
 // Perm has the same restrictions as in sys_page_alloc, except
@@ -244,7 +376,8 @@ sys_page_alloc(envid_t envid, void *va, int perm)
 //
 // Return 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if srcenvid and/or dstenvid doesn't currently exist,
-//		or the caller doesn't have permission to change one of them.
+//		or the caller doesn't have permission to change one of them;
+//		an env may also change dstenvid if it is its mapper.
 //	-E_INVAL if srcva >= UTOP or srcva is not page-aligned,
 //		or dstva >= UTOP or dstva is not page-aligned.
 //	-E_INVAL is srcva is not mapped in srcenvid's address space.
@@ -276,35 +409,11 @@ sys_page_map(envid_t srcenvid, void *srcva,
 
 	struct Env *se, *de;
 	int r;
-	if (((r = envid2env(srcenvid, &se, false)) < 0)
-		|| (r = envid2env(dstenvid, &de, false) < 0)) {
-
-		return r; 
-	}
-
-	struct PageInfo *pp;
-	pte_t *pte;
-	pp = page_lookup(se->env_pgdir, srcva, &pte);
-
-	if (pte == NULL)
-		return -E_INVAL;
-
-	//   s  W  R
-	// d
-	// W    V  X
-	// R    V  V
-	if (perm & PTE_W) {
-		if (!(*pte & PTE_W))
-			return -E_INVAL;
-	}
-
-	if (pp == NULL)
-		return -E_NO_MEM;
-
-	if ((r = page_insert(de->env_pgdir, pp, dstva, perm)) < 0)
+	if ((r = envid2env(srcenvid, &se, true)) < 0
+	    || (r = envid2env_pages(dstenvid, &de)) < 0)
 		return r;
 
-	return 0;
+	return page_map_env(se, srcva, de, dstva, perm);
 }
 
 // Unmap the page of memory at 'va' in the address space of 'envid'.
@@ -312,7 +421,8 @@ sys_page_map(envid_t srcenvid, void *srcva,
 //
 // Return 0 on success, < 0 on error.  Errors are:
 //	-E_BAD_ENV if environment envid doesn't currently exist,
-//		or the caller doesn't have permission to change envid.
+//		or the caller doesn't have permission to change envid
+//		and isn't its mapper.
 //	-E_INVAL if va >= UTOP, or va is not page-aligned.
 static int
 sys_page_unmap(envid_t envid, void *va)
@@ -328,13 +438,86 @@ sys_page_unmap(envid_t envid, void *va)
 
 	struct Env *e;
 	int r;
-	if ((r = envid2env(envid, &e, true)) < 0)
+	if ((r = envid2env_pages(envid, &e)) < 0)
 		return r;
 	page_remove(e->env_pgdir, va);
 
 	return 0;
 }
 
+// Make a batch of up to PAGEOP_MAX page mapping changes, each as
+// sys_page_alloc, sys_page_map or sys_page_unmap would, in one system
+// call.  All of them are checked for bad arguments first, and nothing
+// is changed if any is bad; the TLB is flushed once, at the end.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if n < 0 or n > PAGEOP_MAX, or an op is unknown.
+//	Those of the system call an op stands for.  If it is only found
+//	when the op is made, say a source page that is not mapped, or
+//	-E_NO_MEM, the ops before it stay made.
+static int
+sys_page_map_batch(const struct PageOp *uops, int n)
+{
+	struct PageOp ops[PAGEOP_MAX], *op;
+	struct Env *e;
+	int i, r = 0;
+
+	if (n < 0 || n > PAGEOP_MAX)
+		return -E_INVAL;
+	if (n == 0)
+		return 0;
+	user_mem_assert(curenv, uops, n * sizeof(*uops), PTE_U);
+	memmove(ops, uops, n * sizeof(*uops));
+
+	for (i = 0, op = ops; i < n; i++, op++) {
+		if ((uintptr_t) op->po_dstva >= UTOP || PGOFF(op->po_dstva))
+			return -E_INVAL;
+		if (op->po_op != PAGEOP_UNMAP
+		    && ((op->po_perm & (PTE_U | PTE_P)) != (PTE_U | PTE_P)
+			|| (op->po_perm & ~PTE_SYSCALL)))
+			return -E_INVAL;
+		switch (op->po_op) {
+		case PAGEOP_MAP:
+			if ((uintptr_t) op->po_srcva >= UTOP
+			    || PGOFF(op->po_srcva))
+				return -E_INVAL;
+			if ((r = envid2env(op->po_srcenv, &e, true)) < 0
+			    || (r = envid2env_pages(op->po_dstenv, &e)) < 0)
+				return r;
+			break;
+		case PAGEOP_ALLOC:
+			if ((r = envid2env(op->po_dstenv, &e, true)) < 0)
+				return r;
+			break;
+		case PAGEOP_UNMAP:
+			if ((r = envid2env_pages(op->po_dstenv, &e)) < 0)
+				return r;
+			break;
+		default:
+			return -E_INVAL;
+		}
+	}
+
+	tlb_batch_begin();
+	for (i = 0, op = ops; i < n && r == 0; i++, op++)
+		switch (op->po_op) {
+		case PAGEOP_ALLOC:
+			r = sys_page_alloc(op->po_dstenv, op->po_dstva,
+					   op->po_perm);
+			break;
+		case PAGEOP_MAP:
+			r = sys_page_map(op->po_srcenv, op->po_srcva,
+					 op->po_dstenv, op->po_dstva,
+					 op->po_perm);
+			break;
+		case PAGEOP_UNMAP:
+			r = sys_page_unmap(op->po_dstenv, op->po_dstva);
+			break;
+		}
+	tlb_batch_end();
+	return r;
+}
+
 // Try to send 'value' to the target env 'envid'.
 // If srcva < UTOP, then also send page currently mapped at 'srcva',
 // so that receiver gets a duplicate mapping of the same page.
@@ -349,7 +532,16 @@ sys_page_unmap(envid_t envid, void *va)
 //    env_ipc_recving is set to 0 to block future sends;
 //    env_ipc_from is set to the sending envid;
 //    env_ipc_value is set to the 'value' parameter;
-//    env_ipc_perm is set to 'perm' if a page was transferred, 0 otherwise.
+//    env_ipc_perm is set to 'perm' if a page was transferred, 0 otherwise;
+//    env_ipc_npages is set to the number of data pages transferred.
+//
+// If 'pages' is not NULL, it describes a run of up to IPC_MAXPAGES data
+// pages to send as well, each with pages->ip_perm.  They are mapped at
+// the target's env_ipc_datava, but only if it said it would take that
+// many; otherwise they are dropped, like a page the target did not ask
+// for.  This lets one IPC carry a large argument or result buffer
+// without copying it.
+//
 // The target environment is marked runnable again, returning 0
 // from the paused sys_ipc_recv system call.  (Hint: does the
 // sys_ipc_recv function ever actually return?)
@@ -373,14 +565,38 @@ sys_page_unmap(envid_t envid, void *va)
 //		current environment's address space.
 //	-E_NO_MEM if there's not enough memory to map srcva in envid's
 //		address space.
+//	-E_INVAL if a data page fails any of the checks for srcva.
 static int
-sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm,
+		 struct IpcPages *pages)
 {
 	// LAB 4: Your code here.
-	int r;
+	int r, i, npages = 0;
 	struct Env *e;
 	struct PageInfo *pp;
 	pte_t *pte;
+	struct IpcPages pg;
+	struct PageInfo *data[IPC_MAXPAGES];
+
+	// Look up the data pages first, so that nothing is sent unless
+	// all of them can be.
+	if (pages) {
+		user_mem_assert(curenv, pages, sizeof(*pages), PTE_U);
+		pg = *pages;
+		if (pg.ip_npages < 0 || pg.ip_npages > IPC_MAXPAGES
+		    || PGOFF(pg.ip_va) != 0
+		    || (uintptr_t) pg.ip_va + pg.ip_npages * PGSIZE > UTOP
+		    || (pg.ip_perm & (PTE_P | PTE_U)) != (PTE_P | PTE_U)
+		    || (pg.ip_perm & ~PTE_SYSCALL))
+			return -E_INVAL;
+		for (i = 0; i < pg.ip_npages; i++) {
+			data[i] = env_page_lookup(curenv,
+						  pg.ip_va + i * PGSIZE, &pte);
+			if (!data[i] || ((pg.ip_perm & PTE_W) && !(*pte & PTE_W)))
+				return -E_INVAL;
+		}
+		npages = pg.ip_npages;
+	}
 
 	if (srcva == SYS_IPC_NOPAGE) {
 		perm = 0;
@@ -394,7 +610,7 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 		return -E_INVAL;
 	}
 
-	pp = page_lookup(curenv->env_pgdir, srcva, &pte);
+	pp = env_page_lookup(curenv, srcva, &pte);
 	if (pp == NULL)              // srcva is not mapped in the caller's
 	    return -E_INVAL;         // address space.
 
@@ -413,23 +629,43 @@ src_no_page:
 		return -E_IPC_NOT_RECV;  // NOT currently blocked!
 	}
 
+	// Allocate the page tables for the data pages before mapping
+	// anything, so that the page_inserts below cannot fail halfway.
+	if (npages > e->env_ipc_datamax)
+		npages = 0;
+	for (i = 0; i < npages; i++)
+		if (!pgdir_walk(e->env_pgdir,
+				e->env_ipc_datava + i * PGSIZE, 1))
+			return -E_NO_MEM;
+
 	if (e->env_ipc_dstva == SYS_IPC_NOPAGE // target wants NO page,
 		|| srcva == SYS_IPC_NOPAGE)	       // or sender has no page.
 		goto target_no_page;
 
-	r = sys_page_map(curenv->env_id, srcva,
-	                 e->env_id, e->env_ipc_dstva, perm);
+	r = page_map_env(curenv, srcva, e, e->env_ipc_dstva, perm);
 	if (r < 0) {
 		return r;                // An error occer!
 	}
 
 
 target_no_page:
-	// Update target env.
+	for (i = 0; i < npages; i++)
+		if ((r = page_insert(e->env_pgdir, data[i],
+				     e->env_ipc_datava + i * PGSIZE,
+				     pg.ip_perm)) < 0)
+			panic("sys_ipc_try_send: %e", r);
+
+	// Update target env, which may be waiting with a time limit.
+	if (e->env_sleeping) {
+		if (e->env_sleep_until != ~0U)
+			env_nsleeping--;
+		e->env_sleeping = 0;
+	}
 	e->env_ipc_recving = false;
 	e->env_ipc_from = curenv->env_id;
 	e->env_ipc_value = value;
 	e->env_ipc_perm = perm;
+	e->env_ipc_npages = npages;
 
 	// Set the return value in user mode.
 	e->env_tf.tf_regs.reg_eax = 0;
@@ -445,14 +681,31 @@ target_no_page:
 // If 'dstva' is < UTOP, then you are willing to receive a page of data.
 // 'dstva' is the virtual address at which the sent page should be mapped.
 //
+// If 'datamax' is not 0, you are also willing to receive up to 'datamax'
+// data pages, mapped starting at 'datava'.
+//
+// If 'msec' is not ~0, give up after msec milliseconds, rounded up to the
+// next timer tick like sys_env_sleep's deadline.
+//
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
 //	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_INVAL if datamax is not 0 and datava is not page-aligned, or
+//		the datamax pages there do not all lie below UTOP.
+//	-E_TIMEOUT if msec passed with nothing received.
 static int
-sys_ipc_recv(void *dstva)
+sys_ipc_recv(void *dstva, void *datava, int datamax, uint32_t msec)
 {
 	// LAB 4: Your code here.
+	if (datamax < 0 || datamax > IPC_MAXPAGES
+	    || (datamax && (PGOFF(datava) != 0
+			    || (uintptr_t) datava >= UTOP
+			    || (uintptr_t) datava + datamax * PGSIZE > UTOP)))
+		return -E_INVAL;
+	curenv->env_ipc_datava = datava;
+	curenv->env_ipc_datamax = datamax;
+
 	if (dstva == SYS_IPC_NOPAGE)
 		goto no_page;
 
@@ -462,6 +715,14 @@ sys_ipc_recv(void *dstva)
 	}
 
 	no_page:
+	if (msec == 0)
+		return -E_TIMEOUT;
+	if (msec != ~0U) {
+		// env_wake gives up on the receive
+		curenv->env_sleeping = 1;
+		curenv->env_sleep_until = time_msec() + msec;
+		env_nsleeping++;
+	}
 	curenv->env_ipc_dstva = dstva;
 	curenv->env_ipc_recving = true;
 	curenv->env_status = ENV_NOT_RUNNABLE;
@@ -478,6 +739,58 @@ sys_time_msec(void)
 	return time_msec();
 }
 
+// Return the number of CPUs the kernel brought up.
+static int
+sys_ncpu(void)
+{
+	return ncpu;
+}
+
+// Block until another environment calls sys_env_wake on us, or until
+// msec milliseconds have passed, whichever comes first.  msec of ~0
+// means no time limit.  A wakeup that came while we were not asleep is
+// not lost: it makes the next sys_env_sleep return at once.  Callers
+// therefore check their condition, then sleep, and check again.
+//
+// The deadline is only checked on timer ticks, so it is rounded up to
+// the next one.  Returns 0 either way.
+static int
+sys_env_sleep(uint32_t msec)
+{
+	if (curenv->env_wake_pending || msec == 0) {
+		curenv->env_wake_pending = 0;
+		return 0;
+	}
+	curenv->env_sleeping = 1;
+	curenv->env_sleep_until = msec == ~0U ? ~0U : time_msec() + msec;
+	if (curenv->env_sleep_until != ~0U)
+		env_nsleeping++;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Wake environment envid out of sys_env_sleep, or make its next
+// sys_env_sleep return at once if it is not asleep.  Any environment
+// may wake any other; a spurious wakeup only costs the target a check.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+static int
+sys_env_wake(envid_t envid)
+{
+	struct Env *e;
+	int r;
+
+	if ((r = envid2env(envid, &e, false)) < 0)
+		return r;
+	// an env waiting in sys_ipc_recv only wakes for a message
+	if (e->env_sleeping && !e->env_ipc_recving)
+		env_wake(e);
+	else
+		e->env_wake_pending = 1;
+	return 0;
+}
+
 // Try put tx_desc
 //
 // If timeout set 0, it will keep trying till success.
@@ -493,12 +806,15 @@ sys_net_try_put_tx_desc(struct tx_desc *td, uint32_t trytime)
 
 	int r;
 
+	// Context descriptors carry header offsets, not a buffer address.
 	physaddr_t paddr;
-	r = user_mem_phy_addr(curenv, td->addr, &paddr);
-	if (r < 0)
-		return r;
-	else
-		td->addr = paddr;
+	if (! tx_desc_is_ctx(td)) {
+		r = user_mem_phy_addr(curenv, td->addr, &paddr);
+		if (r < 0)
+			return r;
+		else
+			td->addr = paddr;
+	}
 
 	r = -1;
 	int c = trytime;
@@ -530,42 +846,71 @@ sys_net_tx_table_available(void)
 }
 
 //
-// Try read rx_desc
-// If trytime set 0 means no retry.
+// Is the current environment the network server, or an environment it
+// forked, such as ns_input?  Only they may touch the receive pool.
 //
-// RETURNS:
-//   index of the rx_desc, >= 0
-//   -E_NET_RX_DESC_EMPTY
-static int
-sys_net_try_read_rx_desc(struct rx_desc *rd, uint32_t trytime)
+static bool
+net_rx_allowed(void)
 {
-	user_mem_assert(curenv, rd, sizeof(struct tx_desc), PTE_U);
+	struct Env *parent;
 
-	int r;
+	if (curenv->env_type == ENV_TYPE_NS)
+		return 1;
+	return curenv->env_parent_id != 0
+		&& envid2env(curenv->env_parent_id, &parent, 0) == 0
+		&& parent->env_type == ENV_TYPE_NS;
+}
 
-	// Kernel space rx_desc.
-	struct rx_desc kr = *rd;
-	physaddr_t paddr;
-	r = user_mem_phy_addr(curenv, rd->addr, &paddr);
-	if (r < 0)
-		return r;
-	else
-		kr.addr = paddr;
+//
+// Map the receive buffer pool into the current environment.
+// The struct rx_ring page goes at va, packet buffer i at va + (1 + i)*PGSIZE.
+// perm has the same restrictions as in sys_page_alloc; passing PTE_SHARE
+// lets ns hand the mapping down to the envs it forks.
+//
+// Return 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if the current environment is not ns or forked by ns.
+//	-E_INVAL if va is not page-aligned, or the pool does not fit below UTOP.
+//	-E_INVAL if perm is inappropriate.
+//	-E_NO_MEM if there's no memory to allocate any necessary page tables.
+//		Nothing is mapped then.
+static int
+sys_net_rx_map(void *va, int perm)
+{
+	struct PageInfo **pool = e1000_82540em_rx_pool();
+	int i, r;
 
-	retry:
-	r = e1000_82540em_read_rx_desc(&kr);
-	if (r < 0) {
-		if (trytime == 0) {
+	if (!net_rx_allowed())
+		return -E_BAD_ENV;
+	if (perm != (perm | PTE_U | PTE_P) || (perm & ~PTE_SYSCALL))
+		return -E_INVAL;
+	if (PGOFF(va) != 0 || (uintptr_t)va >= UTOP
+	    || (uintptr_t)va + (1 + NRXBUF) * PGSIZE > UTOP)
+		return -E_INVAL;
+
+	for (i = 0; i < 1 + NRXBUF; i++)
+		if ((r = page_insert(curenv->env_pgdir, pool[i],
+		                     va + i * PGSIZE, perm)) < 0) {
+			while (--i >= 0)
+				page_remove(curenv->env_pgdir, va + i * PGSIZE);
 			return r;
 		}
-		trytime -= 1;
-		goto retry;
-	}
+	return 0;
+}
 
-	user_mem_page_replace(rd->addr, pa2page(kr.addr));
-	kr.addr = rd->addr;
-	*rd = kr;
-	return r;
+//
+// Receive a packet into the buffer pool, see e1000_82540em_rx_recv.
+//
+// RETURNS:
+//   index of the pool buffer holding the packet, >= 0
+//   -E_NET_RX_DESC_EMPTY
+//   -E_NET_RX_NO_BUF
+//   -E_BAD_ENV if the current environment is not ns or forked by ns
+static int
+sys_net_rx_recv(void)
+{
+	if (!net_rx_allowed())
+		return -E_BAD_ENV;
+	return e1000_82540em_rx_recv();
 }
 
 //
@@ -652,17 +997,43 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 
 		case SYS_ipc_try_send:
 			r = (uint32_t)sys_ipc_try_send(
-			        (envid_t)a1, (uint32_t)a2, (void *)a3, (int)a4);
+			        (envid_t)a1, (uint32_t)a2, (void *)a3, (int)a4,
+			        (struct IpcPages *)a5);
 			break;
 
 		case SYS_ipc_recv:
-			r = (uint32_t)sys_ipc_recv((void *)a1);
+			r = (uint32_t)sys_ipc_recv((void *)a1, (void *)a2, (int)a3,
+						   a4);
 			break;
 
 		case SYS_time_msec:
 			r = (uint32_t)sys_time_msec();
 			break;
 
+		case SYS_ncpu:
+			r = sys_ncpu();
+			break;
+
+		case SYS_env_sleep:
+			r = sys_env_sleep(a1);
+			break;
+
+		case SYS_env_wake:
+			r = sys_env_wake((envid_t)a1);
+			break;
+
+		case SYS_fork:
+			r = sys_fork();
+			break;
+
+		case SYS_page_map_batch:
+			r = sys_page_map_batch((const struct PageOp *)a1, (int)a2);
+			break;
+
+		case SYS_env_set_mapper:
+			r = sys_env_set_mapper((envid_t)a1, (envid_t)a2);
+			break;
+
 		case SYS_net_try_put_tx_desc:
 			r = (uint32_t) sys_net_try_put_tx_desc((struct tx_desc *)a1, a2);
 			break;
@@ -671,8 +1042,12 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 			r = sys_net_tx_table_available();
 			break;
 
-		case SYS_net_try_put_rx_desc:
-			r = sys_net_try_read_rx_desc((struct rx_desc *)a1, a2);
+		case SYS_net_rx_map:
+			r = sys_net_rx_map((void *)a1, (int)a2);
+			break;
+
+		case SYS_net_rx_recv:
+			r = sys_net_rx_recv();
 			break;
 
 		case SYS_net_rx_table_available:
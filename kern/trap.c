@@ -210,6 +210,11 @@ trap_dispatch(struct Trapframe *tf)
 			page_fault_handler(tf);
 			return;
 
+		case T_DEVICE:  // first FPU/SSE instruction since the env got this CPU
+			if ((tf->tf_cs & 3) == 3 && env_fpu_restore(curenv) == 0)
+				return;
+			break;
+
 		case T_SYSCALL:
 			(tf->tf_regs).reg_eax =	syscall(
 				(tf->tf_regs).reg_eax,
@@ -354,6 +359,16 @@ page_fault_handler(struct Trapframe *tf)
 	// We've already handled kernel-mode exceptions, so if we get here,
 	// the page fault happened in user mode.
 
+	// Copy-on-write pages, as sys_fork leaves them, are resolved here
+	// without bothering the environment, and so are pages of its
+	// program that load_icode left to load on first touch.
+	if ((tf->tf_err & FEC_WR) && fault_va < UTOP
+	    && page_cow(curenv->env_pgdir, (void *) fault_va) == 0)
+		return;
+	if (!(tf->tf_err & FEC_PR)
+	    && env_segment_fault(curenv, (void *) fault_va) == 0)
+		return;
+
 	// Call the environment's page fault upcall, if one exists.  Set up a
 	// page fault stack frame on the user exception stack (below
 	// UXSTACKTOP), then branch to curenv->env_pgfault_upcall.
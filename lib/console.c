@@ -38,6 +38,7 @@ static ssize_t devcons_read(struct Fd*, void*, size_t);
 static ssize_t devcons_write(struct Fd*, const void*, size_t);
 static int devcons_close(struct Fd*);
 static int devcons_stat(struct Fd*, struct Stat*);
+static int devcons_poll(struct Fd*, uint32_t);
 
 struct Dev devcons =
 {
@@ -46,9 +47,13 @@ struct Dev devcons =
 	.dev_read =	devcons_read,
 	.dev_write =	devcons_write,
 	.dev_close =	devcons_close,
-	.dev_stat =	devcons_stat
+	.dev_stat =	devcons_stat,
+	.dev_poll =	devcons_poll
 };
 
+// A character devcons_poll read ahead, for devcons_read to return next.
+static int cons_pending;
+
 int
 iscons(int fdnum)
 {
@@ -83,8 +88,11 @@ devcons_read(struct Fd *fd, void *vbuf, size_t n)
 	if (n == 0)
 		return 0;
 
-	while ((c = sys_cgetc()) == 0)
-		sys_yield();
+	if ((c = cons_pending) != 0)
+		cons_pending = 0;
+	else
+		while ((c = sys_cgetc()) == 0)
+			sys_yield();
 	if (c < 0)
 		return c;
 	if (c == 0x04)	// ctl-d is eof
@@ -126,3 +134,16 @@ devcons_stat(struct Fd *fd, struct Stat *stat)
 	return 0;
 }
 
+// The console can always be written.  Nothing tells us when a key is
+// pressed, so look for one now and have epoll_wait come back soon.
+static int
+devcons_poll(struct Fd *fd, uint32_t events)
+{
+	int revents = events & EPOLLOUT;
+
+	if ((events & EPOLLIN) && !cons_pending)
+		cons_pending = sys_cgetc();
+	if ((events & EPOLLIN) && cons_pending)
+		revents |= EPOLLIN;
+	return revents ? revents : DEV_POLL_AGAIN;
+}
@@ -0,0 +1,208 @@
+// Readiness multiplexing, after Linux's epoll.
+//
+// An epoll instance is a file descriptor whose data page holds the
+// interest list.  epoll_wait asks each watched device whether its file
+// descriptors are ready -- with one NSREQ_POLL per ns worker for all the
+// sockets -- and if none are, sleeps in sys_env_sleep.  Asking leaves a
+// wakeup behind with the device, so the sleep ends as soon as any of
+// them may have become ready.
+
+#include <inc/lib.h>
+
+#define debug 0
+
+static int devepoll_close(struct Fd *fd);
+static int devepoll_stat(struct Fd *fd, struct Stat *stat);
+
+struct Dev devepoll =
+{
+	.dev_id =	'e',
+	.dev_name =	"epoll",
+	.dev_close =	devepoll_close,
+	.dev_stat =	devepoll_stat,
+};
+
+struct epoll_item {
+	int ei_fd;
+	struct epoll_event ei_event;
+};
+
+#define EPOLL_MAX	((PGSIZE - sizeof(int)) / sizeof(struct epoll_item))
+
+struct Epoll {
+	int ep_n;
+	struct epoll_item ep_items[EPOLL_MAX];
+};
+
+// Sockets being polled by epoll_wait, and their index in ep_items.
+static struct Nspollfd ep_socks[EPOLL_MAX];
+static int ep_sockitem[EPOLL_MAX];
+
+static struct Epoll *
+fd2epoll(int epfd)
+{
+	struct Fd *fd;
+
+	if (fd_lookup(epfd, &fd) < 0 || fd->fd_dev_id != devepoll.dev_id)
+		return NULL;
+	return (struct Epoll *) fd2data(fd);
+}
+
+int
+epoll_create(int size)
+{
+	struct Fd *fd;
+	int r;
+
+	if (size <= 0)
+		return -E_INVAL;
+	if ((r = fd_alloc(&fd)) < 0
+	    || (r = sys_page_alloc(0, fd, PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0)
+		return r;
+	if ((r = sys_page_alloc(0, fd2data(fd), PTE_P|PTE_W|PTE_U|PTE_SHARE)) < 0) {
+		sys_page_unmap(0, fd);
+		return r;
+	}
+	fd->fd_dev_id = devepoll.dev_id;
+	fd->fd_omode = O_RDWR;
+	return fd2num(fd);
+}
+
+int
+epoll_ctl(int epfd, int op, int fdnum, struct epoll_event *event)
+{
+	struct Epoll *ep;
+	struct Fd *fd;
+	struct Dev *dev;
+	int i, r;
+
+	if (!(ep = fd2epoll(epfd)))
+		return -E_INVAL;
+	if ((r = fd_lookup(fdnum, &fd)) < 0
+	    || (r = dev_lookup(fd->fd_dev_id, &dev)) < 0)
+		return r;
+	if (!dev->dev_poll && dev != &devsock)
+		return -E_NOT_SUPP;
+
+	for (i = 0; i < ep->ep_n; i++)
+		if (ep->ep_items[i].ei_fd == fdnum)
+			break;
+
+	switch (op) {
+	case EPOLL_CTL_ADD:
+		if (i < ep->ep_n)
+			return -E_FILE_EXISTS;
+		if (ep->ep_n == EPOLL_MAX)
+			return -E_NO_MEM;
+		ep->ep_items[ep->ep_n].ei_fd = fdnum;
+		ep->ep_items[ep->ep_n].ei_event = *event;
+		ep->ep_n++;
+		return 0;
+	case EPOLL_CTL_MOD:
+		if (i == ep->ep_n)
+			return -E_NOT_FOUND;
+		ep->ep_items[i].ei_event = *event;
+		return 0;
+	case EPOLL_CTL_DEL:
+		if (i == ep->ep_n)
+			return -E_NOT_FOUND;
+		ep->ep_items[i] = ep->ep_items[--ep->ep_n];
+		return 0;
+	default:
+		return -E_INVAL;
+	}
+}
+
+// Store the ready events of item i in events[n], if any.
+static int
+epoll_report(struct Epoll *ep, int i, uint32_t revents,
+	     struct epoll_event *events, int n)
+{
+	revents &= ep->ep_items[i].ei_event.events | EPOLLERR | EPOLLHUP;
+	if (!revents)
+		return n;
+	events[n].events = revents;
+	events[n].data = ep->ep_items[i].ei_event.data;
+	return n + 1;
+}
+
+// Wait up to timeout milliseconds (forever if < 0) for any of epfd's
+// file descriptors to become ready, and store up to maxevents of them in
+// events.  Returns how many were stored, 0 on timeout.  File descriptors
+// that were closed drop out of the interest list.
+int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	struct Epoll *ep;
+	struct epoll_item *ei;
+	struct Fd *fd;
+	struct Dev *dev;
+	uint32_t deadline, now, sleep;
+	int i, r, n, nsock, again;
+
+	if (!(ep = fd2epoll(epfd)) || maxevents <= 0)
+		return -E_INVAL;
+	deadline = timeout < 0 ? ~0U : sys_time_msec() + timeout;
+
+	while (1) {
+		n = nsock = again = 0;
+		for (i = 0; i < ep->ep_n && n < maxevents; i++) {
+			ei = &ep->ep_items[i];
+			if (fd_lookup(ei->ei_fd, &fd) < 0
+			    || dev_lookup(fd->fd_dev_id, &dev) < 0) {
+				ep->ep_items[i--] = ep->ep_items[--ep->ep_n];
+				continue;
+			}
+			if (dev == &devsock) {
+				ep_socks[nsock].pf_s = fd->fd_sock.sockid;
+				ep_socks[nsock].pf_events = ei->ei_event.events;
+				ep_socks[nsock].pf_revents = 0;
+				ep_sockitem[nsock++] = i;
+				continue;
+			}
+			r = dev->dev_poll(fd, ei->ei_event.events);
+			if (r & DEV_POLL_AGAIN)
+				again = 1;
+			else
+				n = epoll_report(ep, i, r, events, n);
+		}
+		if (nsock > 0 && n < maxevents) {
+			if ((r = nsipc_poll(ep_socks, nsock)) < 0)
+				return r;
+			for (i = 0; i < nsock && n < maxevents; i++)
+				n = epoll_report(ep, ep_sockitem[i],
+						 ep_socks[i].pf_revents, events, n);
+		}
+		if (n > 0 || timeout == 0)
+			return n;
+
+		now = sys_time_msec();
+		if (now >= deadline)
+			return 0;
+		sleep = deadline == ~0U ? ~0U : deadline - now;
+		// devices that cannot wake us get looked at every tick
+		if (again)
+			sleep = MIN(sleep, 10);
+		if (debug)
+			cprintf("[%08x] epoll_wait sleeps %u ms\n",
+				thisenv->env_id, sleep);
+		sys_env_sleep(sleep);
+	}
+}
+
+static int
+devepoll_close(struct Fd *fd)
+{
+	(void) sys_page_unmap(0, fd);
+	return sys_page_unmap(0, fd2data(fd));
+}
+
+static int
+devepoll_stat(struct Fd *fd, struct Stat *stat)
+{
+	strcpy(stat->st_name, "<epoll>");
+	stat->st_size = ((struct Epoll *) fd2data(fd))->ep_n;
+	stat->st_isdir = 0;
+	stat->st_dev = &devepoll;
+	return 0;
+}
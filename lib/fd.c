@@ -3,7 +3,7 @@
 #define debug		0
 
 // Maximum number of file descriptors a program may hold open concurrently
-#define MAXFD		32
+#define MAXFD		256
 // Bottom of file descriptor area
 #define FDTABLE		0xD0000000
 // Bottom of file data area.  We reserve one data page for each FD,
@@ -129,6 +129,7 @@ static struct Dev *devtab[] =
 	&devsock,
 	&devpipe,
 	&devcons,
+	&devepoll,
 	0
 };
 
@@ -307,6 +308,30 @@ fstat(int fdnum, struct Stat *stat)
 	return (*dev->dev_stat)(fd, stat);
 }
 
+// Get or set the mode of file descriptor fdnum.  Only O_NONBLOCK can be
+// changed, and only on sockets.  Since the Fd page is shared, the mode
+// is shared with every dup and forked copy of fdnum, as on Unix.
+int
+fcntl(int fdnum, int cmd, int arg)
+{
+	int r;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	switch (cmd) {
+	case F_GETFL:
+		return fd->fd_omode;
+	case F_SETFL:
+		if ((arg & O_NONBLOCK) && fd->fd_dev_id != devsock.dev_id)
+			return -E_NOT_SUPP;
+		fd->fd_omode = (fd->fd_omode & ~O_NONBLOCK) | (arg & O_NONBLOCK);
+		return 0;
+	default:
+		return -E_INVAL;
+	}
+}
+
 int
 stat(const char *path, struct Stat *stat)
 {
@@ -189,6 +189,58 @@ devfile_trunc(struct Fd *fd, off_t newsize)
 }
 
 
+// Map npages pages of the file open on fdnum, from the page-aligned
+// offset on, into our child env 'child' at va, straight from the file
+// server's block cache: read-only, and copy-on-write if perm has
+// PTE_COW.  The file server keeps the pages, so every env that maps the
+// same part of a file shares them.
+//
+// Returns the number of pages mapped, fewer than npages at the end of
+// the file, or < 0 on error.
+int
+file_map_child(int fdnum, off_t offset, int npages, envid_t child,
+	       void *va, int perm)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+
+	fsipcbuf.map_child.req_fileid = fd->fd_file.id;
+	fsipcbuf.map_child.req_offset = offset;
+	fsipcbuf.map_child.req_npages = npages;
+	fsipcbuf.map_child.req_child = child;
+	fsipcbuf.map_child.req_va = va;
+	fsipcbuf.map_child.req_perm = perm;
+	return fsipc(FSREQ_MAP_CHILD, NULL);
+}
+
+// Map the whole program open on fdnum into our child env 'child', which
+// must have nothing mapped yet, from the file server's cache of program
+// images: text read-only and shared with every other env running the
+// program, data and bss copy-on-write.
+//
+// Returns the program's entry point, -E_NO_MEM if the program is too
+// big for the cache, or < 0 on other errors.
+int
+file_map_image(int fdnum, envid_t child)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+
+	fsipcbuf.map_image.req_fileid = fd->fd_file.id;
+	fsipcbuf.map_image.req_child = child;
+	return fsipc(FSREQ_MAP_IMAGE, NULL);
+}
+
 // Synchronize disk with buffer cache
 int
 sync(void)
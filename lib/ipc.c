@@ -21,12 +21,23 @@
 //   a perfectly valid place to map a page.)
 int32_t
 ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
+{
+	return ipc_recv_pages(from_env_store, pg, perm_store, NULL, 0, NULL, ~0U);
+}
+
+// Like ipc_recv, but also accept up to 'datamax' data pages, mapped
+// starting at 'datava'.  If 'npages_store' is nonnull, store the number
+// of data pages received in *npages_store.  Unless 'msec' is ~0, give up
+// after msec milliseconds and return -E_TIMEOUT.
+int32_t
+ipc_recv_pages(envid_t *from_env_store, void *pg, int *perm_store,
+	       void *datava, int datamax, int *npages_store, unsigned int msec)
 {
 	// LAB 4: Your code here.
 	if (pg == NULL)
 		pg = SYS_IPC_NOPAGE;
 
-	int r = sys_ipc_recv(pg);
+	int r = sys_ipc_recv_pages(pg, datava, datamax, msec);
 	if (r < 0){
 		if (from_env_store != NULL) {
 			*from_env_store = 0;
@@ -36,6 +47,9 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 			*perm_store = 0;
 		}
 
+		if (npages_store != NULL)
+			*npages_store = 0;
+
 		return r;
 	}
 
@@ -43,6 +57,8 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 		*from_env_store = thisenv->env_ipc_from;
 	if (perm_store != NULL)
 		*perm_store = thisenv->env_ipc_perm;
+	if (npages_store != NULL)
+		*npages_store = thisenv->env_ipc_npages;
 	return thisenv->env_ipc_value;
 }
 
@@ -56,6 +72,15 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 //   as meaning "no page".  (Zero is not the right value.)
 void
 ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
+{
+	ipc_send_pages(to_env, val, pg, perm, NULL);
+}
+
+// Like ipc_send, but also send the data pages described by 'pages',
+// if it is nonnull.
+void
+ipc_send_pages(envid_t to_env, uint32_t val, void *pg, int perm,
+	       const struct IpcPages *pages)
 {
 	// LAB 4: Your code here.
 	if (pg == NULL)
@@ -63,7 +88,7 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 
 	int r = 1;
 	while (r) {
-		r = sys_ipc_try_send(to_env, val, pg, perm);
+		r = sys_ipc_try_send_pages(to_env, val, pg, perm, pages);
 
 		if (r < 0 && r != -E_IPC_NOT_RECV)
 			panic("ipc_send, %e!",r);
@@ -1,140 +1,276 @@
-
 #include <inc/lib.h>
 
 /*
- * Simple malloc/free.
+ * Size-class slab malloc/free.
+ *
+ * Requests of up to SLAB_MAXSIZE bytes come from slabs: pages cut into
+ * objects of one of the sizes in slab_sizes, after a header at the
+ * start of the page.  Each size class keeps a list of its slabs that
+ * have free objects, and each slab a list of its free objects, so a
+ * freed object goes to the next malloc of its size.  A slab that falls
+ * empty goes back to the kernel, unless it is the only one its class
+ * has room in.
+ *
+ * Bigger requests get pages of their own, header first, which free
+ * gives straight back to the kernel.
  *
- * Uses the address space to do most of the hard work.
- * The address space from mbegin to mend is scanned
- * in order.  Pages are allocated, used to fill successive
- * malloc requests, and then left alone.  Free decrements
- * a ref count maintained in the page; the page is freed
- * when the ref count hits zero.
+ * The address space from mbegin to mend is handed out a page at a time
+ * from a bitmap, lowest free pages first, so it is reused as well.
+ * Every block starts in the page holding its header, so free finds the
+ * header by rounding down.
  *
- * If we need to allocate a large amount (more than a page)
- * we can't put a ref count at the end of each page,
- * so we mark the pte entry with the bit PTE_CONTINUED.
+ * There is no locking: lwIP's threads are cooperative and never switch
+ * inside malloc, and forked envs each have their own copy of the heap.
  */
 enum
 {
 	MAXMALLOC = 1024*1024	/* max size of one allocated chunk */
 };
 
-#define PTE_CONTINUED 0x200
+#define HEAPSTART	0x08000000
+#define HEAPEND		0x10000000
+#define NHEAPPAGES	((HEAPEND - HEAPSTART) / PGSIZE)
 
-static uint8_t *mbegin = (uint8_t*) 0x08000000;
-static uint8_t *mend   = (uint8_t*) 0x10000000;
-static uint8_t *mptr;
+static uint8_t *mbegin = (uint8_t*) HEAPSTART;
+static uint8_t *mend   = (uint8_t*) HEAPEND;
 
+static uint32_t heap_used[NHEAPPAGES / 32];	/* bit per page in use */
+static uint32_t heap_hint;	/* every page below this is in use */
+
+struct Slab {
+	uint16_t s_class;	/* index into slab_sizes, or SLAB_LARGE */
+	uint16_t s_nfree;	/* objects on s_free */
+	uint32_t s_npages;	/* pages, for SLAB_LARGE */
+	void *s_free;		/* free objects, linked by their first word */
+	struct Slab *s_next;	/* the class's slabs with free objects */
+	struct Slab *s_prev;
+};
+
+#define SLAB_LARGE	0xffff
+#define SLAB_HDRSIZE	32
+#define SLAB_MAXSIZE	1008
+
+/*
+ * Each size leaves little of a page over after the header.
+ */
+static const uint16_t slab_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 336, 448, 672, SLAB_MAXSIZE
+};
+#define NSLABCLASS	(sizeof(slab_sizes) / sizeof(slab_sizes[0]))
+#define SLAB_NOBJ(c)	((PGSIZE - SLAB_HDRSIZE) / slab_sizes[c])
+
+static struct Slab *slab_partial[NSLABCLASS];
+
+static size_t nbytes_inuse;	/* for malloc_stats */
+static size_t npages_mapped;
+
+/*
+ * map or unmap npages pages from va on, PAGEOP_MAX to a system call.
+ */
 static int
-isfree(void *v, size_t n)
+map_pages(uint8_t *va, int npages, int op)
 {
-	uintptr_t va, end_va = (uintptr_t) v + n;
+	struct PageOp ops[PAGEOP_MAX];
+	int i, j, r;
 
-	for (va = (uintptr_t) v; va < end_va; va += PGSIZE)
-		if (va >= (uintptr_t) mend
-		    || ((uvpd[PDX(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P)))
-			return 0;
-	return 1;
+	for (i = 0; i < npages; i += j) {
+		for (j = 0; j < PAGEOP_MAX && i + j < npages; j++) {
+			ops[j].po_op = op;
+			ops[j].po_dstenv = 0;
+			ops[j].po_dstva = va + (i + j) * PGSIZE;
+			ops[j].po_perm = PTE_P|PTE_U|PTE_W;
+		}
+		if ((r = sys_page_map_batch(ops, j)) < 0)
+			return r;
+	}
+	return 0;
 }
 
-void*
-malloc(size_t n)
+/*
+ * find npages free pages of address space in a row, lowest first.
+ */
+static uint8_t *
+heap_alloc(uint32_t npages)
 {
-	int i, cont;
-	int nwrap;
-	uint32_t *ref;
-	void *v;
+	uint32_t i, start = 0, run = 0, first = NHEAPPAGES;
 
-	if (mptr == 0)
-		mptr = mbegin;
+	for (i = heap_hint; i < NHEAPPAGES; i++) {
+		if (i % 32 == 0 && heap_used[i / 32] == ~0U) {
+			i += 31;
+			run = 0;
+			continue;
+		}
+		if (heap_used[i / 32] & (1U << (i % 32))) {
+			run = 0;
+			continue;
+		}
+		if (first == NHEAPPAGES)
+			first = i;
+		if (run++ == 0)
+			start = i;
+		if (run == npages) {
+			for (i = start; i < start + npages; i++)
+				heap_used[i / 32] |= 1U << (i % 32);
+			heap_hint = first == start ? start + npages : first;
+			return mbegin + start * PGSIZE;
+		}
+	}
+	return 0;	/* out of address space */
+}
 
-	n = ROUNDUP(n, 4);
+static void
+heap_release(uint8_t *va, uint32_t npages)
+{
+	uint32_t i, pg = (va - mbegin) / PGSIZE;
 
-	if (n >= MAXMALLOC)
+	for (i = pg; i < pg + npages; i++)
+		heap_used[i / 32] &= ~(1U << (i % 32));
+	if (pg < heap_hint)
+		heap_hint = pg;
+}
+
+static void
+slab_link(struct Slab *s)
+{
+	s->s_prev = 0;
+	s->s_next = slab_partial[s->s_class];
+	if (s->s_next)
+		s->s_next->s_prev = s;
+	slab_partial[s->s_class] = s;
+}
+
+static void
+slab_unlink(struct Slab *s)
+{
+	if (s->s_prev)
+		s->s_prev->s_next = s->s_next;
+	else
+		slab_partial[s->s_class] = s->s_next;
+	if (s->s_next)
+		s->s_next->s_prev = s->s_prev;
+}
+
+static struct Slab *
+slab_new(int c)
+{
+	struct Slab *s;
+	uint8_t *pg;
+	int i;
+
+	static_assert(sizeof(struct Slab) <= SLAB_HDRSIZE);
+
+	if (!(pg = heap_alloc(1)))
 		return 0;
+	if (sys_page_alloc(0, pg, PTE_P|PTE_U|PTE_W) < 0) {
+		heap_release(pg, 1);
+		return 0;	/* out of physical memory */
+	}
+	npages_mapped++;
 
-	if ((uintptr_t) mptr % PGSIZE){
-		/*
-		 * we're in the middle of a partially
-		 * allocated page - can we add this chunk?
-		 * the +4 below is for the ref count.
-		 */
-		ref = (uint32_t*) (ROUNDUP(mptr, PGSIZE) - 4);
-		if ((uintptr_t) mptr / PGSIZE == (uintptr_t) (mptr + n - 1 + 4) / PGSIZE) {
-			(*ref)++;
-			v = mptr;
-			mptr += n;
-			return v;
-		}
-		/*
-		 * stop working on this page and move on.
-		 */
-		free(mptr);	/* drop reference to this page */
-		mptr = ROUNDDOWN(mptr + PGSIZE, PGSIZE);
+	s = (struct Slab*) pg;
+	s->s_class = c;
+	s->s_npages = 1;
+	s->s_free = 0;
+	for (i = SLAB_NOBJ(c) - 1; i >= 0; i--) {
+		void **o = (void**) (pg + SLAB_HDRSIZE + i * slab_sizes[c]);
+
+		*o = s->s_free;
+		s->s_free = o;
 	}
+	s->s_nfree = SLAB_NOBJ(c);
+	slab_link(s);
+	return s;
+}
 
-	/*
-	 * now we need to find some address space for this chunk.
-	 * if it's less than a page we leave it open for allocation.
-	 * runs of more than a page can't have ref counts so we
-	 * flag the PTE entries instead.
-	 */
-	nwrap = 0;
-	while (1) {
-		if (isfree(mptr, n + 4))
-			break;
-		mptr += PGSIZE;
-		if (mptr == mend) {
-			mptr = mbegin;
-			if (++nwrap == 2)
-				return 0;	/* out of address space */
-		}
+void*
+malloc(size_t n)
+{
+	struct Slab *s;
+	uint32_t npages;
+	uint8_t *pg;
+	void *v;
+	int c;
+
+	if (n >= MAXMALLOC)
+		return 0;
+
+	if (n <= SLAB_MAXSIZE) {
+		for (c = 0; slab_sizes[c] < n; c++)
+			/* do nothing */;
+		if (!(s = slab_partial[c]) && !(s = slab_new(c)))
+			return 0;
+		v = s->s_free;
+		s->s_free = *(void**) v;
+		if (--s->s_nfree == 0)
+			slab_unlink(s);
+		nbytes_inuse += slab_sizes[c];
+		return v;
 	}
 
 	/*
-	 * allocate at mptr - the +4 makes sure we allocate a ref count.
+	 * pages of its own, the header in the first.
 	 */
-	for (i = 0; i < n + 4; i += PGSIZE){
-		cont = (i + PGSIZE < n + 4) ? PTE_CONTINUED : 0;
-		if (sys_page_alloc(0, mptr + i, PTE_P|PTE_U|PTE_W|cont) < 0){
-			for (; i >= 0; i -= PGSIZE)
-				sys_page_unmap(0, mptr + i);
-			return 0;	/* out of physical memory */
-		}
+	npages = ROUNDUP(n + SLAB_HDRSIZE, PGSIZE) / PGSIZE;
+	if (!(pg = heap_alloc(npages)))
+		return 0;
+	if (map_pages(pg, npages, PAGEOP_ALLOC) < 0) {
+		map_pages(pg, npages, PAGEOP_UNMAP);
+		heap_release(pg, npages);
+		return 0;	/* out of physical memory */
 	}
-
-	ref = (uint32_t*) (mptr + i - 4);
-	*ref = 2;	/* reference for mptr, reference for returned block */
-	v = mptr;
-	mptr += n;
-	return v;
+	s = (struct Slab*) pg;
+	s->s_class = SLAB_LARGE;
+	s->s_npages = npages;
+	npages_mapped += npages;
+	nbytes_inuse += npages * PGSIZE - SLAB_HDRSIZE;
+	return pg + SLAB_HDRSIZE;
 }
 
 void
 free(void *v)
 {
-	uint8_t *c;
-	uint32_t *ref;
+	struct Slab *s;
+	uint32_t npages;
+	int c;
 
 	if (v == 0)
 		return;
 	assert(mbegin <= (uint8_t*) v && (uint8_t*) v < mend);
 
-	c = ROUNDDOWN(v, PGSIZE);
-
-	while (uvpt[PGNUM(c)] & PTE_CONTINUED) {
-		sys_page_unmap(0, c);
-		c += PGSIZE;
-		assert(mbegin <= c && c < mend);
+	s = ROUNDDOWN(v, PGSIZE);
+	if (s->s_class == SLAB_LARGE) {
+		assert((uint8_t*) v == (uint8_t*) s + SLAB_HDRSIZE);
+		npages = s->s_npages;
+		npages_mapped -= npages;
+		nbytes_inuse -= npages * PGSIZE - SLAB_HDRSIZE;
+		map_pages((uint8_t*) s, npages, PAGEOP_UNMAP);
+		heap_release((uint8_t*) s, npages);
+		return;
 	}
 
+	c = s->s_class;
+	assert(c < NSLABCLASS && s->s_nfree < SLAB_NOBJ(c));
+	*(void**) v = s->s_free;
+	s->s_free = v;
+	nbytes_inuse -= slab_sizes[c];
+	if (s->s_nfree++ == 0)
+		slab_link(s);	/* was full */
+
 	/*
-	 * c is just a piece of this page, so dec the ref count
-	 * and maybe free the page.
+	 * give an empty slab back, unless the class would have
+	 * none with room left.
 	 */
-	ref = (uint32_t*) (c + PGSIZE - 4);
-	if (--(*ref) == 0)
-		sys_page_unmap(0, c);
+	if (s->s_nfree == SLAB_NOBJ(c) && (slab_partial[c] != s || s->s_next)) {
+		slab_unlink(s);
+		sys_page_unmap(0, s);
+		heap_release((uint8_t*) s, 1);
+		npages_mapped--;
+	}
 }
 
+void
+malloc_stats(struct MallocStats *ms)
+{
+	ms->ms_inuse = nbytes_inuse;
+	ms->ms_mapped = npages_mapped * PGSIZE;
+}
@@ -8,35 +8,90 @@
 #define REQVA		0x0ffff000
 union Nsipc nsipcbuf __attribute__((aligned(PGSIZE)));
 
+// The network server environment, which creates new sockets.
+static envid_t
+ns_env(void)
+{
+	static envid_t nsenv;
+	if (nsenv == 0)
+		nsenv = ipc_find_env(ENV_TYPE_NS);
+	return nsenv;
+}
+
+// The ns worker environment that owns socket s, see NSSOCK in inc/ns.h.
+static envid_t
+nssock_env(int s)
+{
+	if (s < 0 || NSSOCK_ENVX(s) >= NENV)
+		return ns_env();
+	return envs[NSSOCK_ENVX(s)].env_id;
+}
+
 // Send an IP request to the network server, and wait for a reply.
 // The request body should be in nsipcbuf, and parts of the response
 // may be written back to nsipcbuf.
+// to: the ns environment to send the request to.
 // type: request code, passed as the simple integer IPC value.
 // Returns 0 if successful, < 0 on failure.
 static int
-nsipc(unsigned type)
+nsipc(envid_t to, unsigned type)
 {
-	static envid_t nsenv;
-	if (nsenv == 0)
-		nsenv = ipc_find_env(ENV_TYPE_NS);
-
 	static_assert(sizeof(nsipcbuf) == PGSIZE);
 
 	if (debug)
-		cprintf("[%08x] nsipc %d\n", thisenv->env_id, type);
+		cprintf("[%08x] nsipc %d to %08x\n", thisenv->env_id, type, to);
 
-	ipc_send(nsenv, type, &nsipcbuf, PTE_P|PTE_W|PTE_U);
+	ipc_send(to, type, &nsipcbuf, PTE_P|PTE_W|PTE_U);
+	return ipc_recv(NULL, NULL, NULL);
+}
+
+// Like nsipc, but also pass ns the pages holding the len bytes at buf,
+// writable if ns is to fill them in.  Returns the offset of buf in the
+// first page in *off and the number of pages in *npages.
+static int
+nsipc_pages(envid_t to, unsigned type, const void *buf, size_t len,
+	    bool writable, int *off, int *npages)
+{
+	struct IpcPages pages;
+	uintptr_t va;
+
+	assert(len > 0 && len <= IPC_MAXDATA);
+	pages.ip_va = ROUNDDOWN((void *) buf, PGSIZE);
+	pages.ip_npages = (ROUNDUP((uintptr_t) buf + len, PGSIZE)
+			   - (uintptr_t) pages.ip_va) / PGSIZE;
+	pages.ip_perm = PTE_P|PTE_U|(writable ? PTE_W : 0);
+	*off = PGOFF(buf);
+	*npages = pages.ip_npages;
+
+	// The kernel only passes pages that are mapped with at least the
+	// permissions asked for, so fault them in first, and break
+	// copy-on-write sharing of the ones ns is to write.
+	for (va = (uintptr_t) pages.ip_va; va < (uintptr_t) buf + len; va += PGSIZE) {
+		volatile char *p = (volatile char *) va;
+		if (writable)
+			*p = *p;
+		else
+			(void) *p;
+	}
+
+	if (debug)
+		cprintf("[%08x] nsipc %d to %08x with %d pages\n",
+			thisenv->env_id, type, to, *npages);
+
+	ipc_send_pages(to, type, &nsipcbuf, PTE_P|PTE_W|PTE_U, &pages);
 	return ipc_recv(NULL, NULL, NULL);
 }
 
 int
-nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen)
+nsipc_accept(int s, struct sockaddr *addr, socklen_t *addrlen,
+	     unsigned int flags)
 {
 	int r;
 
 	nsipcbuf.accept.req_s = s;
-	nsipcbuf.accept.req_addrlen = *addrlen;
-	if ((r = nsipc(NSREQ_ACCEPT)) >= 0) {
+	nsipcbuf.accept.req_addrlen = addrlen ? *addrlen : 0;
+	nsipcbuf.accept.req_flags = flags;
+	if ((r = nsipc(nssock_env(s), NSREQ_ACCEPT)) >= 0 && addr && addrlen) {
 		struct Nsret_accept *ret = &nsipcbuf.acceptRet;
 		memmove(addr, &ret->ret_addr, ret->ret_addrlen);
 		*addrlen = ret->ret_addrlen;
@@ -50,7 +105,7 @@ nsipc_bind(int s, struct sockaddr *name, socklen_t namelen)
 	nsipcbuf.bind.req_s = s;
 	memmove(&nsipcbuf.bind.req_name, name, namelen);
 	nsipcbuf.bind.req_namelen = namelen;
-	return nsipc(NSREQ_BIND);
+	return nsipc(nssock_env(s), NSREQ_BIND);
 }
 
 int
@@ -58,23 +113,25 @@ nsipc_shutdown(int s, int how)
 {
 	nsipcbuf.shutdown.req_s = s;
 	nsipcbuf.shutdown.req_how = how;
-	return nsipc(NSREQ_SHUTDOWN);
+	return nsipc(nssock_env(s), NSREQ_SHUTDOWN);
 }
 
 int
 nsipc_close(int s)
 {
 	nsipcbuf.close.req_s = s;
-	return nsipc(NSREQ_CLOSE);
+	return nsipc(nssock_env(s), NSREQ_CLOSE);
 }
 
 int
-nsipc_connect(int s, const struct sockaddr *name, socklen_t namelen)
+nsipc_connect(int s, const struct sockaddr *name, socklen_t namelen,
+	      unsigned int flags)
 {
 	nsipcbuf.connect.req_s = s;
 	memmove(&nsipcbuf.connect.req_name, name, namelen);
 	nsipcbuf.connect.req_namelen = namelen;
-	return nsipc(NSREQ_CONNECT);
+	nsipcbuf.connect.req_flags = flags;
+	return nsipc(nssock_env(s), NSREQ_CONNECT);
 }
 
 int
@@ -82,7 +139,7 @@ nsipc_listen(int s, int backlog)
 {
 	nsipcbuf.listen.req_s = s;
 	nsipcbuf.listen.req_backlog = backlog;
-	return nsipc(NSREQ_LISTEN);
+	return nsipc(nssock_env(s), NSREQ_LISTEN);
 }
 
 int
@@ -91,26 +148,69 @@ nsipc_recv(int s, void *mem, int len, unsigned int flags)
 	int r;
 
 	nsipcbuf.recv.req_s = s;
-	nsipcbuf.recv.req_len = len;
 	nsipcbuf.recv.req_flags = flags;
 
-	if ((r = nsipc(NSREQ_RECV)) >= 0) {
-		assert(r < 1600 && r <= len);
+	// ns writes large reads straight into mem
+	if (len > NSIPC_INLINE) {
+		len = MIN(len, IPC_MAXDATA);
+		nsipcbuf.recv.req_len = len;
+		return nsipc_pages(nssock_env(s), NSREQ_RECV, mem, len, 1,
+				   &nsipcbuf.recv.req_off,
+				   &nsipcbuf.recv.req_npages);
+	}
+
+	nsipcbuf.recv.req_len = len;
+	nsipcbuf.recv.req_npages = 0;
+	if ((r = nsipc(nssock_env(s), NSREQ_RECV)) >= 0) {
+		assert(r <= len);
 		memmove(mem, nsipcbuf.recvRet.ret_buf, r);
 	}
 
 	return r;
 }
 
+// Large sends go to ns as pages, IPC_MAXDATA bytes at a time.  ns may
+// take only part of each, as much as fits in the socket's send buffer,
+// so keep going until all of buf is sent -- unless MSG_DONTWAIT says to
+// return what was sent so far.
 int
 nsipc_send(int s, const void *buf, int size, unsigned int flags)
 {
-	nsipcbuf.send.req_s = s;
-	assert(size < 1600);
-	memmove(&nsipcbuf.send.req_buf, buf, size);
-	nsipcbuf.send.req_size = size;
-	nsipcbuf.send.req_flags = flags;
-	return nsipc(NSREQ_SEND);
+	int r, n, tot;
+
+	if (size <= NSIPC_INLINE) {
+		nsipcbuf.send.req_s = s;
+		memmove(&nsipcbuf.send.req_buf, buf, size);
+		nsipcbuf.send.req_size = size;
+		nsipcbuf.send.req_flags = flags;
+		nsipcbuf.send.req_npages = 0;
+		return nsipc(nssock_env(s), NSREQ_SEND);
+	}
+
+	for (tot = 0; tot < size; tot += r) {
+		n = MIN(size - tot, IPC_MAXDATA);
+		nsipcbuf.send.req_s = s;
+		nsipcbuf.send.req_size = n;
+		nsipcbuf.send.req_flags = flags;
+		r = nsipc_pages(nssock_env(s), NSREQ_SEND, (char *) buf + tot, n, 0,
+				&nsipcbuf.send.req_off,
+				&nsipcbuf.send.req_npages);
+		if (r <= 0)
+			return tot ? tot : r;
+		if (r < n && (flags & MSG_DONTWAIT))
+			return tot + r;
+	}
+	return tot;
+}
+
+int
+nsipc_sendfile(int s, int fileid, off_t offset, size_t count)
+{
+	nsipcbuf.sendfile.req_s = s;
+	nsipcbuf.sendfile.req_fileid = fileid;
+	nsipcbuf.sendfile.req_offset = offset;
+	nsipcbuf.sendfile.req_count = count;
+	return nsipc(nssock_env(s), NSREQ_SENDFILE);
 }
 
 int
@@ -119,5 +219,67 @@ nsipc_socket(int domain, int type, int protocol)
 	nsipcbuf.socket.req_domain = domain;
 	nsipcbuf.socket.req_type = type;
 	nsipcbuf.socket.req_protocol = protocol;
-	return nsipc(NSREQ_SOCKET);
+	return nsipc(ns_env(), NSREQ_SOCKET);
+}
+
+// Have ns hold every packet it sends to itself back for msec
+// milliseconds.
+int
+nsipc_loopdelay(uint32_t msec)
+{
+	nsipcbuf.loopdelay.req_msec = msec;
+	return nsipc(ns_env(), NSREQ_LOOPDELAY);
+}
+
+// Fetch the memory pool usage of ns worker number worker.  Returns
+// -E_INVAL if there is no such worker.
+int
+nsipc_stats(int worker, struct Nsret_stats *stats)
+{
+	static envid_t workers[NSSTATS_WORKERS];
+	static int nworkers;
+	int r;
+
+	if (worker != 0 && nworkers == 0) {
+		if ((r = nsipc(ns_env(), NSREQ_STATS)) < 0)
+			return r;
+		nworkers = nsipcbuf.statsRet.ret_nworkers;
+		memmove(workers, nsipcbuf.statsRet.ret_workers, sizeof(workers));
+	}
+	if (worker < 0 || (worker > 0 && worker >= nworkers))
+		return -E_INVAL;
+	if ((r = nsipc(worker ? workers[worker] : ns_env(), NSREQ_STATS)) < 0)
+		return r;
+	*stats = nsipcbuf.statsRet;
+	return 0;
+}
+
+// Poll the n sockets in fds, with one NSREQ_POLL to each ns worker that
+// owns any of them.  Returns the number of sockets with pf_revents set.
+int
+nsipc_poll(struct Nspollfd *fds, int n)
+{
+	envid_t to;
+	int i, j, m, r, nready = 0;
+	bool sent[n];
+
+	memset(sent, 0, sizeof(sent));
+	for (i = 0; i < n; i++) {
+		if (sent[i])
+			continue;
+		to = nssock_env(fds[i].pf_s);
+		for (j = i, m = 0; j < n && m < NSPOLL_MAX; j++)
+			if (!sent[j] && nssock_env(fds[j].pf_s) == to)
+				nsipcbuf.poll.req_fds[m++] = fds[j];
+		nsipcbuf.poll.req_n = m;
+		if ((r = nsipc(to, NSREQ_POLL)) < 0)
+			return r;
+		nready += r;
+		for (j = i, m = 0; j < n && m < nsipcbuf.poll.req_n; j++)
+			if (!sent[j] && nssock_env(fds[j].pf_s) == to) {
+				fds[j].pf_revents = nsipcbuf.poll.req_fds[m++].pf_revents;
+				sent[j] = 1;
+			}
+	}
+	return nready;
 }
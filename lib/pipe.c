@@ -6,6 +6,7 @@ static ssize_t devpipe_read(struct Fd *fd, void *buf, size_t n);
 static ssize_t devpipe_write(struct Fd *fd, const void *buf, size_t n);
 static int devpipe_stat(struct Fd *fd, struct Stat *stat);
 static int devpipe_close(struct Fd *fd);
+static int devpipe_poll(struct Fd *fd, uint32_t events);
 
 struct Dev devpipe =
 {
@@ -15,6 +16,7 @@ struct Dev devpipe =
 	.dev_write =	devpipe_write,
 	.dev_close =	devpipe_close,
 	.dev_stat =	devpipe_stat,
+	.dev_poll =	devpipe_poll,
 };
 
 #define PIPEBUFSIZ 32		// small to provoke races
@@ -22,9 +24,23 @@ struct Dev devpipe =
 struct Pipe {
 	off_t p_rpos;		// read position
 	off_t p_wpos;		// write position
+	envid_t p_rwaiter;	// env to wake when there is data, see devpipe_poll
+	envid_t p_wwaiter;	// env to wake when there is room
 	uint8_t p_buf[PIPEBUFSIZ];	// data buffer
 };
 
+// Wake the env, if any, waiting in devpipe_poll for *waiter.
+static void
+pipewake(volatile envid_t *waiter)
+{
+	envid_t e = *waiter;
+
+	if (e) {
+		*waiter = 0;
+		sys_env_wake(e);
+	}
+}
+
 int
 pipe(int pfd[2])
 {
@@ -118,8 +134,10 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 		while (p->p_rpos == p->p_wpos) {
 			// pipe is empty
 			// if we got any data, return it
-			if (i > 0)
+			if (i > 0) {
+				pipewake(&p->p_wwaiter);
 				return i;
+			}
 			// if all the writers are gone, note eof
 			if (_pipeisclosed(fd, p))
 				return 0;
@@ -133,6 +151,7 @@ devpipe_read(struct Fd *fd, void *vbuf, size_t n)
 		buf[i] = p->p_buf[p->p_rpos % PIPEBUFSIZ];
 		p->p_rpos++;
 	}
+	pipewake(&p->p_wwaiter);
 	return i;
 }
 
@@ -157,6 +176,8 @@ devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 			// note eof
 			if (_pipeisclosed(fd, p))
 				return 0;
+			// let a reader in devpipe_poll see what we wrote
+			pipewake(&p->p_rwaiter);
 			// yield and see what happens
 			if (debug)
 				cprintf("devpipe_write yield\n");
@@ -168,9 +189,37 @@ devpipe_write(struct Fd *fd, const void *vbuf, size_t n)
 		p->p_wpos++;
 	}
 
+	pipewake(&p->p_rwaiter);
 	return i;
 }
 
+// Readiness is plain arithmetic on the shared positions.  To be woken,
+// we leave our envid in the pipe for the other end's next read, write
+// or close, then look again in case it came in between.
+static int
+devpipe_poll(struct Fd *fd, uint32_t events)
+{
+	struct Pipe *p = (struct Pipe*) fd2data(fd);
+	int revents = 0, pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		if (_pipeisclosed(fd, p))
+			return EPOLLHUP | (events & (EPOLLIN|EPOLLOUT));
+		if ((events & EPOLLIN) && p->p_rpos != p->p_wpos)
+			revents |= EPOLLIN;
+		if ((events & EPOLLOUT)
+		    && p->p_wpos < p->p_rpos + sizeof(p->p_buf))
+			revents |= EPOLLOUT;
+		if (revents || pass)
+			return revents;
+		if (events & EPOLLIN)
+			p->p_rwaiter = thisenv->env_id;
+		if (events & EPOLLOUT)
+			p->p_wwaiter = thisenv->env_id;
+	}
+	return revents;
+}
+
 static int
 devpipe_stat(struct Fd *fd, struct Stat *stat)
 {
@@ -185,7 +234,17 @@ devpipe_stat(struct Fd *fd, struct Stat *stat)
 static int
 devpipe_close(struct Fd *fd)
 {
+	struct Pipe *p = (struct Pipe*) fd2data(fd);
+	envid_t rwaiter = p->p_rwaiter, wwaiter = p->p_wwaiter;
+	int r;
+
 	(void) sys_page_unmap(0, fd);
-	return sys_page_unmap(0, fd2data(fd));
+	r = sys_page_unmap(0, fd2data(fd));
+	// the other end may now see the pipe closed
+	if (rwaiter)
+		sys_env_wake(rwaiter);
+	if (wwaiter)
+		sys_env_wake(wwaiter);
+	return r;
 }
 
@@ -39,6 +39,10 @@ static const char * const error_string[MAXERROR] =
 	[E_NET_RX_DESC_EMPTY]	= "net rx_desc_table empty",
 	[E_NET_PUT_TIMEOUT]	= "net put desc timeout",
 	[E_NET_READ_TIMEOUT]	= "net read desc time out",
+	[E_NET_RX_NO_BUF]	= "net rx buffer pool exhausted",
+	[E_WOULDBLOCK]		= "operation would block",
+	[E_INPROGRESS]		= "operation in progress",
+	[E_TIMEOUT]		= "timed out",
 
 };
 
@@ -29,6 +29,17 @@ fd2sockid(int fd)
 	return sfd->fd_sock.sockid;
 }
 
+// MSG_DONTWAIT if socket fd is in non-blocking mode, see fcntl.
+static unsigned int
+fd2sockflags(int fd)
+{
+	struct Fd *sfd;
+
+	if (fd_lookup(fd, &sfd) < 0 || !(sfd->fd_omode & O_NONBLOCK))
+		return 0;
+	return MSG_DONTWAIT;
+}
+
 static int
 alloc_sockfd(int sockid)
 {
@@ -53,7 +64,7 @@ accept(int s, struct sockaddr *addr, socklen_t *addrlen)
 	int r;
 	if ((r = fd2sockid(s)) < 0)
 		return r;
-	if ((r = nsipc_accept(r, addr, addrlen)) < 0)
+	if ((r = nsipc_accept(r, addr, addrlen, fd2sockflags(s))) < 0)
 		return r;
 	return alloc_sockfd(r);
 }
@@ -91,7 +102,7 @@ connect(int s, const struct sockaddr *name, socklen_t namelen)
 	int r;
 	if ((r = fd2sockid(s)) < 0)
 		return r;
-	return nsipc_connect(r, name, namelen);
+	return nsipc_connect(r, name, namelen, fd2sockflags(s));
 }
 
 int
@@ -106,13 +117,15 @@ listen(int s, int backlog)
 static ssize_t
 devsock_read(struct Fd *fd, void *buf, size_t n)
 {
-	return nsipc_recv(fd->fd_sock.sockid, buf, n, 0);
+	return nsipc_recv(fd->fd_sock.sockid, buf, n,
+			  (fd->fd_omode & O_NONBLOCK) ? MSG_DONTWAIT : 0);
 }
 
 static ssize_t
 devsock_write(struct Fd *fd, const void *buf, size_t n)
 {
-	return nsipc_send(fd->fd_sock.sockid, buf, n, 0);
+	return nsipc_send(fd->fd_sock.sockid, buf, n,
+			  (fd->fd_omode & O_NONBLOCK) ? MSG_DONTWAIT : 0);
 }
 
 static int
@@ -130,3 +143,25 @@ socket(int domain, int type, int protocol)
 		return r;
 	return alloc_sockfd(r);
 }
+
+// Send count bytes of file fd, starting at offset, on socket s.
+// The network server maps the file's blocks from the file server's
+// cache itself, so the data never passes through this environment.
+// Does not change fd's seek position.  Returns the number of bytes
+// sent, which is short only at the end of the file, or < 0 on error.
+ssize_t
+sendfile(int s, int fd, off_t offset, size_t count)
+{
+	struct Fd *ffd;
+	int r;
+
+	if ((r = fd2sockid(s)) < 0)
+		return r;
+	if ((r = fd_lookup(fd, &ffd)) < 0)
+		return r;
+	if (ffd->fd_dev_id != devfile.dev_id)
+		return -E_NOT_SUPP;
+	if ((ffd->fd_omode & O_ACCMODE) == O_WRONLY)
+		return -E_INVAL;
+	return nsipc_sendfile(r, ffd->fd_file.id, offset, count);
+}
@@ -7,6 +7,7 @@
 
 // Helper functions for spawn.
 static int init_stack(envid_t child, const char **argv, uintptr_t *init_esp);
+static int load_segments(envid_t child, int fd, uintptr_t *entry);
 static int map_segment(envid_t child, uintptr_t va, size_t memsz,
 		       int fd, size_t filesz, off_t fileoffset, int perm);
 static int copy_shared_pages(envid_t child);
@@ -19,14 +20,10 @@ static int copy_shared_pages(envid_t child);
 int
 spawn(const char *prog, const char **argv)
 {
-	unsigned char elf_buf[512];
 	struct Trapframe child_tf;
 	envid_t child;
 
-	int fd, i, r;
-	struct Elf *elf;
-	struct Proghdr *ph;
-	int perm;
+	int fd, r;
 
 	// This code follows this procedure:
 	//
@@ -89,41 +86,34 @@ spawn(const char *prog, const char **argv)
 		return r;
 	fd = r;
 
-	// Read elf header
-	elf = (struct Elf*) elf_buf;
-	if (readn(fd, elf_buf, sizeof(elf_buf)) != sizeof(elf_buf)
-	    || elf->e_magic != ELF_MAGIC) {
-		close(fd);
-		cprintf("elf magic %08x want %08x\n", elf->e_magic, ELF_MAGIC);
-		return -E_NOT_EXEC;
-	}
-
 	// Create new child environment
-	if ((r = sys_exofork()) < 0)
+	if ((r = sys_exofork()) < 0) {
+		close(fd);
 		return r;
+	}
 	child = r;
 
 	// Set up trap frame, including initial stack.
 	child_tf = envs[ENVX(child)].env_tf;
-	child_tf.tf_eip = elf->e_entry;
 
 	if ((r = init_stack(child, argv, &child_tf.tf_esp)) < 0)
-		return r;
+		goto error;
 
-	// Set up program segments as defined in ELF header.
-	ph = (struct Proghdr*) (elf_buf + elf->e_phoff);
-	for (i = 0; i < elf->e_phnum; i++, ph++) {
-		if (ph->p_type != ELF_PROG_LOAD)
-			continue;
-		perm = PTE_P | PTE_U;
-		if (ph->p_flags & ELF_PROG_FLAG_WRITE)
-			perm |= PTE_W;
-		if ((r = map_segment(child, ph->p_va, ph->p_memsz,
-				     fd, ph->p_filesz, ph->p_offset, perm)) < 0)
-			goto error;
-	}
+	// Map the program from the file server's cache of program images,
+	// which loads it the first time; if it is too big for the cache,
+	// set up its segments ourselves.  Either way the file server maps
+	// pages into the child, so let it until the child runs.
+	if ((r = sys_env_set_mapper(child, ipc_find_env(ENV_TYPE_FS))) < 0)
+		goto error;
+	if ((r = file_map_image(fd, child)) >= 0)
+		child_tf.tf_eip = r;
+	else if (r != -E_NO_MEM
+		 || (r = load_segments(child, fd, &child_tf.tf_eip)) < 0)
+		goto error;
 	close(fd);
 	fd = -1;
+	if ((r = sys_env_set_mapper(child, 0)) < 0)
+		panic("sys_env_set_mapper: %e", r);
 
 	// Copy shared library state.
 	if ((r = copy_shared_pages(child)) < 0)
@@ -175,6 +165,53 @@ spawnl(const char *prog, const char *arg0, ...)
 }
 
 
+// Set up program segments as defined in the ELF header of the program
+// open on fd, and set *entry to its entry point.
+static int
+load_segments(envid_t child, int fd, uintptr_t *entry)
+{
+	unsigned char elf_buf[512];
+	struct Elf *elf;
+	struct Proghdr *ph;
+	int i, r, perm;
+
+	// Read elf header
+	elf = (struct Elf*) elf_buf;
+	if (seek(fd, 0) < 0
+	    || readn(fd, elf_buf, sizeof(elf_buf)) != sizeof(elf_buf)
+	    || elf->e_magic != ELF_MAGIC) {
+		cprintf("elf magic %08x want %08x\n", elf->e_magic, ELF_MAGIC);
+		return -E_NOT_EXEC;
+	}
+	*entry = elf->e_entry;
+
+	ph = (struct Proghdr*) (elf_buf + elf->e_phoff);
+	for (i = 0; i < elf->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD)
+			continue;
+		perm = PTE_P | PTE_U;
+		if (ph->p_flags & ELF_PROG_FLAG_WRITE)
+			perm |= PTE_W;
+		if ((r = map_segment(child, ph->p_va, ph->p_memsz,
+				     fd, ph->p_filesz, ph->p_offset, perm)) < 0)
+			return r;
+	}
+	return 0;
+}
+
+// Add a change to a batch for sys_page_map_batch.
+static void
+page_op(struct PageOp *op, int what, envid_t srcenv, void *srcva,
+	envid_t dstenv, void *dstva, int perm)
+{
+	op->po_op = what;
+	op->po_srcenv = srcenv;
+	op->po_srcva = srcva;
+	op->po_dstenv = dstenv;
+	op->po_dstva = dstva;
+	op->po_perm = perm;
+}
+
 // Set up the initial stack page for the new child process with envid 'child'
 // using the arguments array pointed to by 'argv',
 // which is a null-terminated array of pointers to null-terminated strings.
@@ -247,9 +284,11 @@ init_stack(envid_t child, const char **argv, uintptr_t *init_esp)
 
 	// After completing the stack, map it into the child's address space
 	// and unmap it from ours!
-	if ((r = sys_page_map(0, UTEMP, child, (void*) (USTACKTOP - PGSIZE), PTE_P | PTE_U | PTE_W)) < 0)
-		goto error;
-	if ((r = sys_page_unmap(0, UTEMP)) < 0)
+	struct PageOp ops[2];
+	page_op(&ops[0], PAGEOP_MAP, 0, UTEMP, child,
+		(void*) (USTACKTOP - PGSIZE), PTE_P | PTE_U | PTE_W);
+	page_op(&ops[1], PAGEOP_UNMAP, 0, 0, 0, UTEMP, 0);
+	if ((r = sys_page_map_batch(ops, 2)) < 0)
 		goto error;
 
 	return 0;
@@ -259,12 +298,28 @@ error:
 	return r;
 }
 
+// Whether the page at offset i into a segment can be the file's block
+// itself: it must be a whole block, unless the segment has no bss,
+// which has to read as zeros, after the file's bytes.
+static bool
+page_is_block(size_t i, size_t memsz, size_t filesz, off_t fileoffset)
+{
+	return PGOFF(fileoffset) == 0 && i < filesz
+		&& (i + PGSIZE <= filesz || memsz <= filesz);
+}
+
+// Map a segment in batches of pages.  Pages that are whole blocks of the
+// file are mapped by the file server straight from its block cache, so
+// every env running the program shares them; copy-on-write if the
+// segment is writable.  Blank pages are allocated PAGEOP_MAX at a time.
+// The rest -- the page holding the start of the bss -- are read into
+// pages at UTEMP and moved to the child.
 static int
 map_segment(envid_t child, uintptr_t va, size_t memsz,
 	int fd, size_t filesz, off_t fileoffset, int perm)
 {
-	int i, r;
-	void *blk;
+	struct PageOp ops[PAGEOP_MAX];
+	int i, j, n, r;
 
 	//cprintf("map_segment %x+%x\n", va, memsz);
 
@@ -275,22 +330,50 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
 		fileoffset -= i;
 	}
 
-	for (i = 0; i < memsz; i += PGSIZE) {
-		if (i >= filesz) {
-			// allocate a blank page
-			if ((r = sys_page_alloc(child, (void*) (va + i), perm)) < 0)
+	for (i = 0; i < memsz; i += n * PGSIZE) {
+		if (page_is_block(i, memsz, filesz, fileoffset)) {
+			// straight from the block cache
+			for (n = 1; n < PAGEOP_MAX
+			     && page_is_block(i + n * PGSIZE, memsz, filesz,
+					      fileoffset); n++)
+				/* do nothing */;
+			if ((r = file_map_child(fd, fileoffset + i, n, child,
+						(void*) (va + i),
+						(perm & PTE_W) ? PTE_P|PTE_U|PTE_COW
+							       : PTE_P|PTE_U)) < 0)
+				return r;
+			if (r == 0)
+				return -E_NOT_EXEC;
+			n = r;
+		} else if (i >= filesz) {
+			// allocate blank pages
+			n = MIN(ROUNDUP(memsz - i, PGSIZE) / PGSIZE, PAGEOP_MAX);
+			for (j = 0; j < n; j++)
+				page_op(&ops[j], PAGEOP_ALLOC, 0, 0, child,
+					(void*) (va + i + j * PGSIZE), perm);
+			if ((r = sys_page_map_batch(ops, n)) < 0)
 				return r;
 		} else {
 			// from file
-			if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
+			n = MIN(ROUNDUP(filesz - i, PGSIZE) / PGSIZE,
+				PAGEOP_MAX / 2);
+			for (j = 0; j < n; j++)
+				page_op(&ops[j], PAGEOP_ALLOC, 0, 0, 0,
+					UTEMP + j * PGSIZE, PTE_P|PTE_U|PTE_W);
+			if ((r = sys_page_map_batch(ops, n)) < 0)
 				return r;
 			if ((r = seek(fd, fileoffset + i)) < 0)
 				return r;
-			if ((r = readn(fd, UTEMP, MIN(PGSIZE, filesz-i))) < 0)
+			if ((r = readn(fd, UTEMP, MIN(n * PGSIZE, filesz-i))) < 0)
 				return r;
-			if ((r = sys_page_map(0, UTEMP, child, (void*) (va + i), perm)) < 0)
-				panic("spawn: sys_page_map data: %e", r);
-			sys_page_unmap(0, UTEMP);
+			for (j = 0; j < n; j++) {
+				page_op(&ops[2 * j], PAGEOP_MAP, 0, UTEMP + j * PGSIZE,
+					child, (void*) (va + i + j * PGSIZE), perm);
+				page_op(&ops[2 * j + 1], PAGEOP_UNMAP, 0, 0, 0,
+					UTEMP + j * PGSIZE, 0);
+			}
+			if ((r = sys_page_map_batch(ops, 2 * n)) < 0)
+				panic("spawn: sys_page_map_batch data: %e", r);
 		}
 	}
 	return 0;
@@ -301,11 +384,14 @@ static int
 copy_shared_pages(envid_t child)
 {
 	// LAB 5: Your code here.
-	int r;
+	struct PageOp ops[PAGEOP_MAX];
+	int r, n = 0;
 	uintptr_t va; 
 	for (va = 0; va < USTACKTOP; va += PGSIZE) {
-		if (! uvpd[PDX(va)] & PTE_P)
+		if (! (uvpd[PDX(va)] & PTE_P)) {
+			va += PTSIZE - PGSIZE;
 			continue;
+		}
 
 		if (! (uvpt[PGNUM(va)] & PTE_P))
 			continue;
@@ -313,12 +399,14 @@ copy_shared_pages(envid_t child)
 		if (! (uvpt[PGNUM(va)] & PTE_SHARE))
 			continue;
 
-		r = sys_page_map(0, (void *)va,
-		                 child, (void *)va,
-		                 uvpt[PGNUM(va)] & PTE_SYSCALL);
-		if (r < 0)
-			return r;
+		page_op(&ops[n++], PAGEOP_MAP, 0, (void *)va,
+			child, (void *)va, uvpt[PGNUM(va)] & PTE_SYSCALL);
+		if (n == PAGEOP_MAX) {
+			if ((r = sys_page_map_batch(ops, n)) < 0)
+				return r;
+			n = 0;
+		}
 	}
-	return 0;
+	return sys_page_map_batch(ops, n);
 }
 
@@ -111,10 +111,25 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, 0);
 }
 
+int
+sys_ipc_try_send_pages(envid_t envid, uint32_t value, void *srcva, int perm,
+		       const struct IpcPages *pages)
+{
+	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm,
+		       (uint32_t) pages);
+}
+
 int
 sys_ipc_recv(void *dstva)
 {
-	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
+	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, ~0U, 0);
+}
+
+int
+sys_ipc_recv_pages(void *dstva, void *datava, int datamax, unsigned int msec)
+{
+	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, (uint32_t)datava,
+		       datamax, msec, 0);
 }
 
 unsigned int
@@ -123,6 +138,42 @@ sys_time_msec(void)
 	return (unsigned int) syscall(SYS_time_msec, 0, 0, 0, 0, 0, 0);
 }
 
+int
+sys_ncpu(void)
+{
+	return syscall(SYS_ncpu, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_env_sleep(unsigned int msec)
+{
+	return syscall(SYS_env_sleep, 1, msec, 0, 0, 0, 0);
+}
+
+int
+sys_env_wake(envid_t envid)
+{
+	return syscall(SYS_env_wake, 0, envid, 0, 0, 0, 0);
+}
+
+envid_t
+sys_fork(void)
+{
+	return syscall(SYS_fork, 0, 0, 0, 0, 0, 0);
+}
+
+int
+sys_page_map_batch(const struct PageOp *ops, int n)
+{
+	return syscall(SYS_page_map_batch, 1, (uint32_t) ops, n, 0, 0, 0);
+}
+
+int
+sys_env_set_mapper(envid_t envid, envid_t mapper)
+{
+	return syscall(SYS_env_set_mapper, 1, envid, mapper, 0, 0, 0);
+}
+
 int
 sys_net_try_put_tx_desc(struct tx_desc *td, uint32_t trytime)
 {
@@ -136,9 +187,15 @@ sys_net_tx_table_available(void)
 }
 
 int
-sys_net_try_read_rx_desc(struct rx_desc *rd, uint32_t trytime)
+sys_net_rx_map(void *va, int perm)
+{
+	return syscall(SYS_net_rx_map, 1, (uint32_t)va, perm, 0, 0, 0);
+}
+
+int
+sys_net_rx_recv(void)
 {
-	return syscall(SYS_net_try_put_rx_desc, 0, (uint32_t)rd, trytime, 0, 0, 0);
+	return syscall(SYS_net_rx_recv, 0, 0, 0, 0, 0, 0);
 }
 
 bool
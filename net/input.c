@@ -1,16 +1,41 @@
 #include "ns.h"
 
 #include <inc/lib.h>
+#include <inc/x86.h>
 
 # define debug 0
 #if debug
 static void hexdump(const char *prefix, const void *data, int len);
 #endif
 
-extern union Nsipc nsipcbuf;
+// Queue rx buffer buf for worker w, and wake the worker up if its queue
+// was empty.  Workers drain everything queued before going back to sleep.
+static void
+deliver(envid_t *workers, int w, int buf)
+{
+	struct rx_queue *q = &RXRING->rr_ready[w];
+	int r;
+
+	if (! rx_queue_push(q, buf))
+		panic("input, rr_ready[%d] overflow", w);
+	// Wake the worker only if it is not draining the queue already.
+	// The xchg also keeps the push from passing the read of the flag.
+	if (xchg(&RXRING->rr_busy[w], 1))
+		return;
+
+	again:
+	r = sys_ipc_try_send(workers[w], NSREQ_INPUT, SYS_IPC_NOPAGE, 0);
+	if (r < 0) {
+		if (r == -E_IPC_NOT_RECV) {
+			sys_yield();
+			goto again;
+		}
+		panic("input, %e", r);
+	}
+}
 
 void
-input(envid_t ns_envid)
+input(envid_t *workers, int nworkers)
 {
 	binaryname = "ns_input";
 
@@ -20,43 +45,32 @@ input(envid_t ns_envid)
 	// Hint: When you IPC a page to the network server, it will be
 	// reading from it for a while, so don't immediately receive
 	// another packet in to the same physical page.
-	int r;
+	//
+	// The packet buffers live in the shared pool at RXRING, so a packet
+	// only costs a buffer index pushed onto a worker's rr_ready queue.
+	// rss_steer picks the worker.  ARP goes to all of them, so that each
+	// keeps its ARP table up to date; only worker 0 replies.
+	int r, w;
 	while(1) {
 
-		// Alloc a new page at nsipcbuf
-		r = sys_page_alloc(0, &nsipcbuf, PTE_U| PTE_W| PTE_P);
-		if (r < 0) {
-			panic("input, %e", r);
-		}
-
-		// Cook up a new rx_desc
-		struct rx_desc rd = {0, 0, 0, 0, 0, 0};
-		rd.addr = (uintptr_t)&nsipcbuf.pkt.jp_data;
-
-		retry:
-		r = sys_net_try_read_rx_desc(&rd, 2);
-		if (r == -E_NET_RX_DESC_EMPTY) {
+		r = sys_net_rx_recv();
+		if (r == -E_NET_RX_DESC_EMPTY || r == -E_NET_RX_NO_BUF) {
 			sys_yield();
-			goto retry;
+			continue;
 		}
-		nsipcbuf.pkt.jp_len = rd.length;
+		if (r < 0)
+			panic("input, %e", r);
 #if debug
-		cprintf("rd.addr: %08x\n", rd.addr);
-		cprintf("&nsipcbuf.pkt.jp_data: %08x\n", &nsipcbuf.pkt.jp_data);
-		cprintf("nsipcbuf.pkt.jp_len: %d\n", nsipcbuf.pkt.jp_len);
-		hexdump("debug:", (void *)&nsipcbuf.pkt.jp_data, rd.length);
-		cprintf("In %s, line %d\n", __FILE__, __LINE__);
+		cprintf("rx buf %d, jp_len: %d\n", r, RXBUF(r)->jp_len);
+		hexdump("debug:", RXBUF(r)->jp_data, RXBUF(r)->jp_len);
 #endif
-		again:
-		r = sys_ipc_try_send(ns_envid, NSREQ_INPUT, &nsipcbuf,
-		                     PTE_P| PTE_W| PTE_U);
-		if (r < 0) {
-			if (r == -E_IPC_NOT_RECV) {
-				sys_yield();
-				goto again;
-			}
-			panic("input, %e", r);
-		}
+		w = rss_steer(RXBUF(r), nworkers);
+		RXRING->rr_ref[r] = (w < 0 ? nworkers : 1);
+		if (w >= 0)
+			deliver(workers, w, r);
+		else
+			for (w = 0; w < nworkers; w++)
+				deliver(workers, w, r);
 	}
 }
 
@@ -0,0 +1,14 @@
+#include "ns.h"
+
+// Delay injection for ns's loopback, see LWIP_NETIF_LOOPBACK_DELAY.
+//
+// netif_loop_output stamps each looped packet with the delay that
+// NSREQ_LOOPDELAY last set, so that connections to our own address see
+// the round trip time of a long path, e.g. for user/tcprtt.  The delay
+// lives in NSSHARED, so every worker applies the same one.
+
+uint32_t
+jos_loopback_delay(void)
+{
+	return NSSHARED->ns_loopdelay;
+}
@@ -330,7 +330,9 @@ setup_tcp(struct netconn *conn)
   tcp_arg(pcb, conn);
   tcp_recv(pcb, recv_tcp);
   tcp_sent(pcb, sent_tcp);
-  tcp_poll(pcb, poll_tcp, 4);
+  /* poll_tcp is only set while a write or close is pending, so that the
+     TCP timers can leave idle connections alone */
+  tcp_poll(pcb, NULL, 4);
   tcp_err(pcb, err_tcp);
 }
 
@@ -960,7 +962,7 @@ do_writemore(struct netconn *conn)
   } else {
     len = conn->write_msg->msg.w.len - conn->write_offset;
   }
-  available = tcp_sndbuf(conn->pcb.tcp);
+  available = (u16_t)LWIP_MIN(tcp_sndbuf(conn->pcb.tcp), 0xffff);
   if (available < len) {
     /* don't try to write more than sendbuf */
     len = available;
@@ -1002,6 +1004,9 @@ do_writemore(struct netconn *conn)
     write_finished = 1;
   }
 
+  /* keep polling until everything is written */
+  tcp_poll(conn->pcb.tcp, write_finished ? NULL : poll_tcp, 4);
+
   if (write_finished) {
     /* everything was written: set back connection state
        and back to application task */
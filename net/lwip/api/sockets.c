@@ -117,6 +117,9 @@ static struct lwip_socket sockets[NUM_SOCKETS];
 /** The global list of tasks waiting for select */
 static struct lwip_select_cb *select_cb_list;
 
+/** Called after every socket event, see lwip_recv_ready */
+void (*lwip_socket_event)(int s);
+
 /** Semaphore protecting the sockets array */
 static sys_sem_t socksem;
 /** Semaphore protecting select_cb_list */
@@ -463,7 +466,8 @@ lwip_recvfrom(int s, void *mem, int len, unsigned int flags,
 {
   struct lwip_socket *sock;
   struct netbuf      *buf;
-  u16_t               buflen, copylen, off = 0;
+  u16_t               buflen, copylen;
+  int                 off = 0;   /* JOS: len may be 64k, see nsipc_recv */
   struct ip_addr     *addr;
   u16_t               port;
   u8_t                done = 0;
@@ -1049,6 +1053,9 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
   }
   sys_sem_signal(selectsem);
 
+  if (lwip_socket_event)
+    lwip_socket_event(s);
+
   /* Now decide if anyone is waiting for this socket */
   /* NOTE: This code is written this way to protect the select link list
      but to avoid a deadlock situation by releasing socksem before
@@ -1080,6 +1087,53 @@ event_callback(struct netconn *conn, enum netconn_evt evt, u16_t len)
   }
 }
 
+/**
+ * JOS: Would lwip_recv or lwip_accept on socket s return right away?
+ * They do if data or a connection is waiting, or if they would fail.
+ */
+int
+lwip_recv_ready(int s)
+{
+  struct lwip_socket *sock = get_socket(s);
+
+  return !sock || sock->lastdata || sock->rcvevent
+    || sock->conn->err != ERR_OK;
+}
+
+/**
+ * JOS: Would lwip_send of size bytes on socket s return right away?
+ * A TCP send waits until all the data is queued, so there must be room
+ * in both the send buffer and the segment queue.
+ */
+int
+lwip_send_ready(int s, int size)
+{
+  return size <= lwip_send_room(s);
+}
+
+/**
+ * JOS: The most bytes lwip_send on socket s could take right away,
+ * see lwip_send_ready.  Sockets that do not wait at all have no limit.
+ */
+int
+lwip_send_room(int s)
+{
+  struct lwip_socket *sock = get_socket(s);
+  struct tcp_pcb *pcb;
+  int segs;
+
+  if (!sock || sock->conn->err != ERR_OK
+      || sock->conn->type != NETCONN_TCP)
+    return 0x7fffffff;
+  pcb = sock->conn->pcb.tcp;
+  if (!pcb)
+    return 0x7fffffff;
+  segs = TCP_SND_QUEUELEN - 2 - pcb->snd_queuelen;
+  if (segs < 0)
+    return 0;
+  return LWIP_MIN(tcp_sndbuf(pcb), (segs + 1) * TCP_MSS - 1);
+}
+
 /**
  * Unimplemented: Close one end of a full-duplex connection.
  * Currently, the full connection is closed.
@@ -1740,6 +1794,12 @@ lwip_setsockopt_internal(void *arg)
       } else {
         sock->conn->pcb.ip->so_options &= ~optname;
       }
+#if LWIP_TCP
+      if (optname == SO_KEEPALIVE && sock->conn->type == NETCONN_TCP) {
+        /* the keepalive timer is due earlier now */
+        TCP_TIMER_TOUCH(sock->conn->pcb.tcp);
+      }
+#endif /* LWIP_TCP */
       LWIP_DEBUGF(SOCKETS_DEBUG, ("lwip_setsockopt(%d, SOL_SOCKET, optname=0x%x, ..) -> %s\n",
                   s, optname, (*(int*)optval?"on":"off")));
       break;
@@ -1842,6 +1902,8 @@ lwip_setsockopt_internal(void *arg)
 #endif /* LWIP_TCP_KEEPALIVE */
 
     }  /* switch (optname) */
+    /* the keepalive timer may be due earlier now */
+    TCP_TIMER_TOUCH(sock->conn->pcb.tcp);
     break;
 #endif /* LWIP_TCP*/
 #if LWIP_UDP && LWIP_UDPLITE
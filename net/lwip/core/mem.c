@@ -286,13 +286,13 @@ mem_init(void)
 }
 
 /**
- * Put a struct mem back on the heap
+ * Put a struct mem back on the heap, see mem_free
  *
  * @param rmem is the data portion of a struct mem as returned by a previous
  *             call to mem_malloc()
  */
-void
-mem_free(void *rmem)
+static void
+mem_heap_free(void *rmem)
 {
   struct mem *mem;
   LWIP_MEM_FREE_DECL_PROTECT();
@@ -468,7 +468,7 @@ mem_realloc(void *rmem, mem_size_t newsize)
 }
 
 /**
- * Adam's mem_malloc() plus solution for bug #17922
+ * Adam's mem_malloc() plus solution for bug #17922, see mem_malloc
  * Allocate a block of memory with a minimum of 'size' bytes.
  *
  * @param size is the minimum size of the requested block in bytes.
@@ -476,8 +476,8 @@ mem_realloc(void *rmem, mem_size_t newsize)
  *
  * Note that the returned value will always be aligned (as defined by MEM_ALIGNMENT).
  */
-void *
-mem_malloc(mem_size_t size)
+static void *
+mem_heap_malloc(mem_size_t size)
 {
   mem_size_t ptr, ptr2;
   struct mem *mem, *mem2;
@@ -604,6 +604,131 @@ mem_malloc(mem_size_t size)
   return NULL;
 }
 
+#if MEM_MAGAZINE
+/** The size classes, each with a magazine of freed blocks that are at
+ *  least that big. The first ones take ACKs and headers, the last ones
+ *  full-sized segments and frames. */
+static const mem_size_t mem_mag_sizes[] = { 128, 256, 512, 1024, 1664, 2048 };
+#define MEM_MAG_CLASSES (sizeof(mem_mag_sizes) / sizeof(mem_mag_sizes[0]))
+
+struct mem_mag {
+  u16_t n;
+  void *blocks[MEM_MAGAZINE];
+};
+static struct mem_mag mem_mags[MEM_MAG_CLASSES];
+
+/**
+ * Give the blocks in the magazine of class c back to the heap until only
+ * keep of them are left.
+ */
+static void
+mem_mag_drain(u8_t c, u16_t keep)
+{
+  struct mem_mag *mag = &mem_mags[c];
+
+  while (mag->n > keep) {
+    mem_heap_free(mag->blocks[--mag->n]);
+  }
+}
+
+/**
+ * Allocate a block of memory with a minimum of 'size' bytes: from the
+ * magazine of its size class if there is one and it has a block, else
+ * from the heap, filling half the magazine while at it.
+ *
+ * @param size is the minimum size of the requested block in bytes.
+ * @return pointer to allocated memory or NULL if no free memory was found.
+ */
+void *
+mem_malloc(mem_size_t size)
+{
+  struct mem_mag *mag;
+  void *rmem;
+  u8_t c;
+
+  if (size == 0) {
+    return NULL;
+  }
+  for (c = 0; c < MEM_MAG_CLASSES && size > mem_mag_sizes[c]; c++);
+  if (c < MEM_MAG_CLASSES) {
+    mag = &mem_mags[c];
+    if (mag->n == 0) {
+      while (mag->n < MEM_MAGAZINE / 2 &&
+             (rmem = mem_heap_malloc(mem_mag_sizes[c])) != NULL) {
+        mag->blocks[mag->n++] = rmem;
+      }
+    }
+    if (mag->n > 0) {
+      return mag->blocks[--mag->n];
+    }
+    size = mem_mag_sizes[c];
+  } else if ((rmem = mem_heap_malloc(size)) != NULL) {
+    return rmem;
+  }
+
+  /* the heap is out of room: take back what the magazines hold */
+  for (c = 0; c < MEM_MAG_CLASSES; c++) {
+    mem_mag_drain(c, 0);
+  }
+  return mem_heap_malloc(size);
+}
+
+/**
+ * Free a block from mem_malloc: into the magazine of its size class if
+ * the heap gave it out for that class, else back to the heap. A full
+ * magazine gives half its blocks back to the heap first.
+ *
+ * @param rmem is the data portion of a struct mem as returned by a previous
+ *             call to mem_malloc()
+ */
+void
+mem_free(void *rmem)
+{
+  struct mem *mem;
+  mem_size_t size;
+  struct mem_mag *mag;
+  u8_t c;
+
+  if ((u8_t *)rmem < (u8_t *)ram || (u8_t *)rmem >= (u8_t *)ram_end) {
+    /* NULL, or illegal: mem_heap_free deals with it */
+    mem_heap_free(rmem);
+    return;
+  }
+
+  /* blocks mem_realloc has shrunk no longer fit their class */
+  mem = (struct mem *)((u8_t *)rmem - SIZEOF_STRUCT_MEM);
+  size = mem->next - ((u8_t *)mem - ram) - SIZEOF_STRUCT_MEM;
+  for (c = 0; c < MEM_MAG_CLASSES && size > mem_mag_sizes[c]; c++);
+  if (c == MEM_MAG_CLASSES || size != mem_mag_sizes[c]) {
+    /* mem_heap_malloc leaves no room for a split at the end of a block */
+    if (c == 0 ||
+        size >= mem_mag_sizes[c - 1] + SIZEOF_STRUCT_MEM + MIN_SIZE_ALIGNED) {
+      mem_heap_free(rmem);
+      return;
+    }
+    c--;
+  }
+
+  mag = &mem_mags[c];
+  if (mag->n == MEM_MAGAZINE) {
+    mem_mag_drain(c, MEM_MAGAZINE / 2);
+  }
+  mag->blocks[mag->n++] = rmem;
+}
+#else /* MEM_MAGAZINE */
+void *
+mem_malloc(mem_size_t size)
+{
+  return mem_heap_malloc(size);
+}
+
+void
+mem_free(void *rmem)
+{
+  mem_heap_free(rmem);
+}
+#endif /* MEM_MAGAZINE */
+
 #endif /* MEM_USE_POOLS */
 /**
  * Contiguously allocates enough space for count objects that are size bytes
@@ -115,6 +115,11 @@ netif_add(struct netif *netif, struct ip_addr *ipaddr, struct ip_addr *netmask,
 #if ENABLE_LOOPBACK
   netif->loop_first = NULL;
   netif->loop_last = NULL;
+#if LWIP_NETIF_LOOPBACK_DELAY
+  netif->loop_due_head = 0;
+  netif->loop_due_count = 0;
+  netif->loop_timer = 0;
+#endif /* LWIP_NETIF_LOOPBACK_DELAY */
 #endif /* ENABLE_LOOPBACK */
 
   /* remember netif specific state information data */
@@ -513,6 +518,20 @@ void netif_set_link_callback(struct netif *netif, void (* link_callback)(struct
 #endif /* LWIP_NETIF_LINK_CALLBACK */
 
 #if ENABLE_LOOPBACK
+#if LWIP_NETIF_LOOPBACK_DELAY
+/**
+ * sys_timeout handler: deliver the looped packets that have come due.
+ */
+static void
+netif_loop_timer(void *arg)
+{
+  struct netif *netif = arg;
+
+  netif->loop_timer = 0;
+  netif_poll(netif);
+}
+#endif /* LWIP_NETIF_LOOPBACK_DELAY */
+
 /**
  * Send an IP packet to be received on the same netif (loopif-like).
  * The pbuf is simply copied and handed back to netif->input.
@@ -540,6 +559,13 @@ netif_loop_output(struct netif *netif, struct pbuf *p,
   SYS_ARCH_DECL_PROTECT(lev);
   LWIP_UNUSED_ARG(ipaddr);
 
+#if LWIP_NETIF_LOOPBACK_DELAY
+  /* no room to remember when another packet is due: drop it */
+  if (netif->loop_due_count == LWIP_LOOPBACK_DELAY_RING) {
+    return ERR_MEM;
+  }
+#endif /* LWIP_NETIF_LOOPBACK_DELAY */
+
   /* Allocate a new pbuf */
   r = pbuf_alloc(PBUF_LINK, p->tot_len, PBUF_RAM);
   if (r == NULL) {
@@ -563,6 +589,9 @@ netif_loop_output(struct netif *netif, struct pbuf *p,
     r = NULL;
     return err;
   }
+  /* JOS: checksums are left to the NIC, but looped packets never
+     reach it and cannot be corrupted on the way */
+  r->flags |= PBUF_FLAG_IPCSUM_OK | PBUF_FLAG_L4CSUM_OK;
 
   /* Put the packet on a linked list which gets emptied through calling
      netif_poll(). */
@@ -579,11 +608,16 @@ netif_loop_output(struct netif *netif, struct pbuf *p,
     netif->loop_first = r;
     netif->loop_last = last;
   }
+#if LWIP_NETIF_LOOPBACK_DELAY
+  netif->loop_due[(netif->loop_due_head + netif->loop_due_count++) %
+                  LWIP_LOOPBACK_DELAY_RING] =
+    LWIP_LOOPBACK_NOW() + LWIP_LOOPBACK_DELAY();
+#endif /* LWIP_NETIF_LOOPBACK_DELAY */
   SYS_ARCH_UNPROTECT(lev);
 
 #if LWIP_NETIF_LOOPBACK_MULTITHREADING
   /* For multithreading environment, schedule a call to netif_poll */
-  tcpip_callback(netif_poll, netif);
+  tcpip_callback((void (*)(void *))netif_poll, netif);
 #endif /* LWIP_NETIF_LOOPBACK_MULTITHREADING */
 
   return ERR_OK;
@@ -599,12 +633,31 @@ void
 netif_poll(struct netif *netif)
 {
   struct pbuf *in;
+#if LWIP_NETIF_LOOPBACK_DELAY
+  s32_t wait;
+#endif /* LWIP_NETIF_LOOPBACK_DELAY */
   SYS_ARCH_DECL_PROTECT(lev);
 
   do {
     /* Get a packet from the list. With SYS_LIGHTWEIGHT_PROT=1, this is protected */
     SYS_ARCH_PROTECT(lev);
     in = netif->loop_first;
+#if LWIP_NETIF_LOOPBACK_DELAY
+    /* leave the packet be until it is due, and come back then */
+    if (in != NULL) {
+      wait = (s32_t)(netif->loop_due[netif->loop_due_head] - LWIP_LOOPBACK_NOW());
+      if (wait > 0) {
+        SYS_ARCH_UNPROTECT(lev);
+        if (!netif->loop_timer) {
+          netif->loop_timer = 1;
+          sys_timeout((u32_t)wait, netif_loop_timer, netif);
+        }
+        return;
+      }
+      netif->loop_due_head = (netif->loop_due_head + 1) % LWIP_LOOPBACK_DELAY_RING;
+      netif->loop_due_count--;
+    }
+#endif /* LWIP_NETIF_LOOPBACK_DELAY */
     if(in != NULL) {
       struct pbuf *in_end = in;
 #if LWIP_LOOPBACK_MAX_PBUFS
@@ -73,6 +73,13 @@ struct tcp_pcb *tcp_tw_pcbs;
 
 struct tcp_pcb *tcp_tmp_pcb;
 
+#if TCP_PCB_HASH
+/** Active and TIME-WAIT PCBs, by remote address and ports */
+struct tcp_pcb *tcp_conn_hash[TCP_PCB_HASH];
+/** Listening PCBs, by local port */
+struct tcp_pcb_listen *tcp_listen_hash[TCP_PCB_HASH];
+#endif /* TCP_PCB_HASH */
+
 static u8_t tcp_timer;
 static u16_t tcp_new_port(void);
 
@@ -377,6 +384,7 @@ tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog)
   lpcb->backlog = (backlog ? backlog : 1);
 #endif /* TCP_LISTEN_BACKLOG */
   TCP_REG(&tcp_listen_pcbs.listen_pcbs, lpcb);
+  TCP_HASH_ADD(lpcb);
   return (struct tcp_pcb *)lpcb;
 }
 
@@ -391,9 +399,10 @@ tcp_listen_with_backlog(struct tcp_pcb *pcb, u8_t backlog)
 void
 tcp_recved(struct tcp_pcb *pcb, u16_t len)
 {
-  if ((u32_t)pcb->rcv_wnd + len > TCP_WND) {
-    pcb->rcv_wnd = TCP_WND;
-    pcb->rcv_ann_wnd = TCP_WND;
+  TCP_TIMER_TOUCH(pcb);
+  if ((u32_t)pcb->rcv_wnd + len > TCP_WND_MAX(pcb)) {
+    pcb->rcv_wnd = TCP_WND_MAX(pcb);
+    pcb->rcv_ann_wnd = TCP_WND_MAX(pcb);
   } else {
     pcb->rcv_wnd += len;
     if (pcb->rcv_wnd >= pcb->mss) {
@@ -415,7 +424,7 @@ tcp_recved(struct tcp_pcb *pcb, u16_t len)
      */
     tcp_ack(pcb);
   } 
-  else if (pcb->flags & TF_ACK_DELAY && pcb->rcv_wnd >= TCP_WND/2) {
+  else if (pcb->flags & TF_ACK_DELAY && pcb->rcv_wnd >= TCP_WND_MAX(pcb)/2) {
     /* If we can send a window update such that there is a full
      * segment available in the window, do so now.  This is sort of
      * nagle-like in its goals, and tries to hit a compromise between
@@ -427,7 +436,7 @@ tcp_recved(struct tcp_pcb *pcb, u16_t len)
   }
 
   LWIP_DEBUGF(TCP_DEBUG, ("tcp_recved: recveived %"U16_F" bytes, wnd %"U16_F" (%"U16_F").\n",
-         len, pcb->rcv_wnd, TCP_WND - pcb->rcv_wnd));
+         len, pcb->rcv_wnd, TCP_WND_MAX(pcb) - pcb->rcv_wnd));
 }
 
 /**
@@ -485,7 +494,8 @@ err_t
 tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
       err_t (* connected)(void *arg, struct tcp_pcb *tpcb, err_t err))
 {
-  u32_t optdata;
+  u32_t optdata[3];
+  u8_t optlen;
   err_t ret;
   u32_t iss;
 
@@ -500,6 +510,11 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
   pcb->remote_port = port;
   if (pcb->local_port == 0) {
     pcb->local_port = tcp_new_port();
+#ifdef TCP_LOCAL_PORT_OK
+    while (!TCP_LOCAL_PORT_OK(pcb, pcb->local_port)) {
+      pcb->local_port = tcp_new_port();
+    }
+#endif /* TCP_LOCAL_PORT_OK */
   }
   iss = tcp_next_iss();
   pcb->rcv_nxt = 0;
@@ -523,250 +538,563 @@ tcp_connect(struct tcp_pcb *pcb, struct ip_addr *ipaddr, u16_t port,
 #endif /* LWIP_CALLBACK_API */
   TCP_RMV(&tcp_bound_pcbs, pcb);
   TCP_REG(&tcp_active_pcbs, pcb);
+  TCP_HASH_ADD(pcb);
 
   snmp_inc_tcpactiveopens();
   
-  /* Build an MSS option */
-  optdata = TCP_BUILD_MSS_OPTION();
+  /* Build the MSS option, and offer window scaling and SACK */
+  optlen = tcp_syn_options(pcb, optdata);
 
-  ret = tcp_enqueue(pcb, NULL, 0, TCP_SYN, 0, (u8_t *)&optdata, 4);
+  ret = tcp_enqueue(pcb, NULL, 0, TCP_SYN, 0, (u8_t *)optdata, optlen);
   if (ret == ERR_OK) { 
     tcp_output(pcb);
   }
   return ret;
 } 
 
+#define TCP_TMR_KEEP    0 /* the PCB stays */
+#define TCP_TMR_POLL    1 /* the PCB stays and its application is polled */
+#define TCP_TMR_REMOVE  2 /* the PCB is removed */
+#define TCP_TMR_RESET   3 /* the PCB is removed and the connection reset */
+
 /**
- * Called every 500 ms and implements the retransmission timer and the timer that
- * removes PCBs that have been in TIME-WAIT for enough time. It also increments
- * various timers such as the inactivity timer in each PCB.
+ * Runs one slow timer tick for an active PCB: the retransmission and
+ * persist timers, keepalives and the timeouts of the closing states.
  *
- * Automatically called from tcp_tmr().
+ * @param pcb the active tcp_pcb
+ * @return what tcp_slowtmr_done() is to do with the PCB, a TCP_TMR_ value
  */
-void
-tcp_slowtmr(void)
+static u8_t
+tcp_slowtmr_active(struct tcp_pcb *pcb)
 {
-  struct tcp_pcb *pcb, *pcb2, *prev;
-  u16_t eff_wnd;
-  u8_t pcb_remove;      /* flag if a PCB should be removed */
-  err_t err;
-
-  err = ERR_OK;
-
-  ++tcp_ticks;
-
-  /* Steps through all of the active PCBs. */
-  prev = NULL;
-  pcb = tcp_active_pcbs;
-  if (pcb == NULL) {
-    LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: no active pcbs\n"));
+  tcpwnd_size_t eff_wnd;
+  u8_t pcb_remove = 0;  /* flag if the PCB should be removed */
+  u8_t pcb_reset = 0;   /* flag if the connection should be reset too */
+
+  LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: processing active pcb\n"));
+  LWIP_ASSERT("tcp_slowtmr: active pcb->state != CLOSED\n", pcb->state != CLOSED);
+  LWIP_ASSERT("tcp_slowtmr: active pcb->state != LISTEN\n", pcb->state != LISTEN);
+  LWIP_ASSERT("tcp_slowtmr: active pcb->state != TIME-WAIT\n", pcb->state != TIME_WAIT);
+
+  if (pcb->state == SYN_SENT && pcb->nrtx == TCP_SYNMAXRTX) {
+    ++pcb_remove;
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max SYN retries reached\n"));
   }
-  while (pcb != NULL) {
-    LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: processing active pcb\n"));
-    LWIP_ASSERT("tcp_slowtmr: active pcb->state != CLOSED\n", pcb->state != CLOSED);
-    LWIP_ASSERT("tcp_slowtmr: active pcb->state != LISTEN\n", pcb->state != LISTEN);
-    LWIP_ASSERT("tcp_slowtmr: active pcb->state != TIME-WAIT\n", pcb->state != TIME_WAIT);
+  else if (pcb->nrtx == TCP_MAXRTX) {
+    ++pcb_remove;
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max DATA retries reached\n"));
+  } else {
+    if (pcb->persist_backoff > 0) {
+      /* If snd_wnd is zero, use persist timer to send 1 byte probes
+       * instead of using the standard retransmission mechanism. */
+      pcb->persist_cnt++;
+      if (pcb->persist_cnt >= tcp_persist_backoff[pcb->persist_backoff-1]) {
+        pcb->persist_cnt = 0;
+        if (pcb->persist_backoff < sizeof(tcp_persist_backoff)) {
+          pcb->persist_backoff++;
+        }
+        tcp_zero_window_probe(pcb);
+      }
+    } else {
+      /* Increase the retransmission timer if it is running */
+      if(pcb->rtime >= 0)
+        ++pcb->rtime;
+
+      if (pcb->unacked != NULL && pcb->rtime >= pcb->rto) {
+        /* Time for a retransmission. */
+        LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_slowtmr: rtime %"S16_F
+                                    " pcb->rto %"S16_F"\n",
+                                    pcb->rtime, pcb->rto));
+
+        /* Double retransmission time-out unless we are trying to
+         * connect to somebody (i.e., we are in SYN_SENT). */
+        if (pcb->state != SYN_SENT) {
+          pcb->rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[pcb->nrtx];
+        }
 
-    pcb_remove = 0;
+        /* Reset the retransmission timer. */
+        pcb->rtime = 0;
 
-    if (pcb->state == SYN_SENT && pcb->nrtx == TCP_SYNMAXRTX) {
-      ++pcb_remove;
-      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max SYN retries reached\n"));
-    }
-    else if (pcb->nrtx == TCP_MAXRTX) {
-      ++pcb_remove;
-      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max DATA retries reached\n"));
-    } else {
-      if (pcb->persist_backoff > 0) {
-        /* If snd_wnd is zero, use persist timer to send 1 byte probes
-         * instead of using the standard retransmission mechanism. */
-        pcb->persist_cnt++;
-        if (pcb->persist_cnt >= tcp_persist_backoff[pcb->persist_backoff-1]) {
-          pcb->persist_cnt = 0;
-          if (pcb->persist_backoff < sizeof(tcp_persist_backoff)) {
-            pcb->persist_backoff++;
-          }
-          tcp_zero_window_probe(pcb);
+        /* Reduce congestion window and ssthresh. */
+        eff_wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
+        pcb->ssthresh = eff_wnd >> 1;
+        if (pcb->ssthresh < pcb->mss) {
+          pcb->ssthresh = pcb->mss * 2;
         }
-      } else {
-        /* Increase the retransmission timer if it is running */
-        if(pcb->rtime >= 0)
-          ++pcb->rtime;
-
-        if (pcb->unacked != NULL && pcb->rtime >= pcb->rto) {
-          /* Time for a retransmission. */
-          LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_slowtmr: rtime %"S16_F
-                                      " pcb->rto %"S16_F"\n",
-                                      pcb->rtime, pcb->rto));
-
-          /* Double retransmission time-out unless we are trying to
-           * connect to somebody (i.e., we are in SYN_SENT). */
-          if (pcb->state != SYN_SENT) {
-            pcb->rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[pcb->nrtx];
-          }
-
-          /* Reset the retransmission timer. */
-          pcb->rtime = 0;
-
-          /* Reduce congestion window and ssthresh. */
-          eff_wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
-          pcb->ssthresh = eff_wnd >> 1;
-          if (pcb->ssthresh < pcb->mss) {
-            pcb->ssthresh = pcb->mss * 2;
-          }
-          pcb->cwnd = pcb->mss;
-          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"U16_F
-                                       " ssthresh %"U16_F"\n",
-                                       pcb->cwnd, pcb->ssthresh));
+        pcb->cwnd = pcb->mss;
+        LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"U16_F
+                                     " ssthresh %"U16_F"\n",
+                                     pcb->cwnd, pcb->ssthresh));
  
-          /* The following needs to be called AFTER cwnd is set to one
-             mss - STJ */
-          tcp_rexmit_rto(pcb);
-        }
+        /* The following needs to be called AFTER cwnd is set to one
+           mss - STJ */
+        tcp_rexmit_rto(pcb);
       }
     }
-    /* Check if this PCB has stayed too long in FIN-WAIT-2 */
-    if (pcb->state == FIN_WAIT_2) {
-      if ((u32_t)(tcp_ticks - pcb->tmr) >
-          TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in FIN-WAIT-2\n"));
-      }
+  }
+  /* Check if this PCB has stayed too long in FIN-WAIT-2 */
+  if (pcb->state == FIN_WAIT_2) {
+    if ((u32_t)(tcp_ticks - pcb->tmr) >
+        TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
+      ++pcb_remove;
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in FIN-WAIT-2\n"));
     }
+  }
 
-    /* Check if KEEPALIVE should be sent */
-    if((pcb->so_options & SOF_KEEPALIVE) && 
-       ((pcb->state == ESTABLISHED) || 
-        (pcb->state == CLOSE_WAIT))) {
+  /* Check if KEEPALIVE should be sent */
+  if((pcb->so_options & SOF_KEEPALIVE) && 
+     ((pcb->state == ESTABLISHED) || 
+      (pcb->state == CLOSE_WAIT))) {
 #if LWIP_TCP_KEEPALIVE
-      if((u32_t)(tcp_ticks - pcb->tmr) > 
-         (pcb->keep_idle + (pcb->keep_cnt*pcb->keep_intvl))
-         / TCP_SLOW_INTERVAL)
+    if((u32_t)(tcp_ticks - pcb->tmr) > 
+       (pcb->keep_idle + (pcb->keep_cnt*pcb->keep_intvl))
+       / TCP_SLOW_INTERVAL)
 #else      
-      if((u32_t)(tcp_ticks - pcb->tmr) > 
-         (pcb->keep_idle + TCP_MAXIDLE) / TCP_SLOW_INTERVAL)
+    if((u32_t)(tcp_ticks - pcb->tmr) > 
+       (pcb->keep_idle + TCP_MAXIDLE) / TCP_SLOW_INTERVAL)
 #endif /* LWIP_TCP_KEEPALIVE */
-      {
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: KEEPALIVE timeout. Aborting connection to %"U16_F".%"U16_F".%"U16_F".%"U16_F".\n",
-                                ip4_addr1(&pcb->remote_ip), ip4_addr2(&pcb->remote_ip),
-                                ip4_addr3(&pcb->remote_ip), ip4_addr4(&pcb->remote_ip)));
-        
-        tcp_abort(pcb);
-      }
+    {
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: KEEPALIVE timeout. Aborting connection to %"U16_F".%"U16_F".%"U16_F".%"U16_F".\n",
+                              ip4_addr1(&pcb->remote_ip), ip4_addr2(&pcb->remote_ip),
+                              ip4_addr3(&pcb->remote_ip), ip4_addr4(&pcb->remote_ip)));
+      
+      ++pcb_remove;
+      ++pcb_reset;
+    }
 #if LWIP_TCP_KEEPALIVE
-      else if((u32_t)(tcp_ticks - pcb->tmr) > 
-              (pcb->keep_idle + pcb->keep_cnt_sent * pcb->keep_intvl)
-              / TCP_SLOW_INTERVAL)
+    else if((u32_t)(tcp_ticks - pcb->tmr) > 
+            (pcb->keep_idle + pcb->keep_cnt_sent * pcb->keep_intvl)
+            / TCP_SLOW_INTERVAL)
 #else
-      else if((u32_t)(tcp_ticks - pcb->tmr) > 
-              (pcb->keep_idle + pcb->keep_cnt_sent * TCP_KEEPINTVL_DEFAULT) 
-              / TCP_SLOW_INTERVAL)
+    else if((u32_t)(tcp_ticks - pcb->tmr) > 
+            (pcb->keep_idle + pcb->keep_cnt_sent * TCP_KEEPINTVL_DEFAULT) 
+            / TCP_SLOW_INTERVAL)
 #endif /* LWIP_TCP_KEEPALIVE */
-      {
-        tcp_keepalive(pcb);
-        pcb->keep_cnt_sent++;
-      }
+    {
+      tcp_keepalive(pcb);
+      pcb->keep_cnt_sent++;
     }
+  }
 
-    /* If this PCB has queued out of sequence data, but has been
-       inactive for too long, will drop the data (it will eventually
-       be retransmitted). */
+  /* If this PCB has queued out of sequence data, but has been
+     inactive for too long, will drop the data (it will eventually
+     be retransmitted). */
 #if TCP_QUEUE_OOSEQ    
-    if (pcb->ooseq != NULL &&
-        (u32_t)tcp_ticks - pcb->tmr >= pcb->rto * TCP_OOSEQ_TIMEOUT) {
-      tcp_segs_free(pcb->ooseq);
-      pcb->ooseq = NULL;
-      LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: dropping OOSEQ queued data\n"));
-    }
+  if (pcb->ooseq != NULL &&
+      (u32_t)tcp_ticks - pcb->tmr >= pcb->rto * TCP_OOSEQ_TIMEOUT) {
+    tcp_segs_free(pcb->ooseq);
+    pcb->ooseq = NULL;
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: dropping OOSEQ queued data\n"));
+  }
 #endif /* TCP_QUEUE_OOSEQ */
 
-    /* Check if this PCB has stayed too long in SYN-RCVD */
-    if (pcb->state == SYN_RCVD) {
-      if ((u32_t)(tcp_ticks - pcb->tmr) >
-          TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in SYN-RCVD\n"));
-      }
+  /* Check if this PCB has stayed too long in SYN-RCVD */
+  if (pcb->state == SYN_RCVD) {
+    if ((u32_t)(tcp_ticks - pcb->tmr) >
+        TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL) {
+      ++pcb_remove;
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in SYN-RCVD\n"));
     }
+  }
 
-    /* Check if this PCB has stayed too long in LAST-ACK */
-    if (pcb->state == LAST_ACK) {
-      if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in LAST-ACK\n"));
-      }
+  /* Check if this PCB has stayed too long in LAST-ACK */
+  if (pcb->state == LAST_ACK) {
+    if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+      ++pcb_remove;
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in LAST-ACK\n"));
     }
+  }
 
-    /* If the PCB should be removed, do it. */
-    if (pcb_remove) {
-      tcp_pcb_purge(pcb);      
-      /* Remove PCB from tcp_active_pcbs list. */
-      if (prev != NULL) {
-        LWIP_ASSERT("tcp_slowtmr: middle tcp != tcp_active_pcbs", pcb != tcp_active_pcbs);
-        prev->next = pcb->next;
-      } else {
-        /* This PCB was the first. */
-        LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_active_pcbs", tcp_active_pcbs == pcb);
-        tcp_active_pcbs = pcb->next;
-      }
+  if (pcb_remove) {
+    return pcb_reset ? TCP_TMR_RESET : TCP_TMR_REMOVE;
+  }
 
-      TCP_EVENT_ERR(pcb->errf, pcb->callback_arg, ERR_ABRT);
+  /* We check if we should poll the connection. */
+  ++pcb->polltmr;
+  if (pcb->polltmr >= pcb->pollinterval) {
+    pcb->polltmr = 0;
+    return TCP_TMR_POLL;
+  }
+  return TCP_TMR_KEEP;
+}
 
-      pcb2 = pcb->next;
-      memp_free(MEMP_TCP_PCB, pcb);
-      pcb = pcb2;
+/**
+ * Runs one slow timer tick for a TIME-WAIT PCB.
+ *
+ * @param pcb the tcp_pcb in TIME-WAIT
+ * @return what tcp_slowtmr_done() is to do with the PCB, a TCP_TMR_ value
+ */
+static u8_t
+tcp_slowtmr_tw(struct tcp_pcb *pcb)
+{
+  LWIP_ASSERT("tcp_slowtmr: TIME-WAIT pcb->state == TIME-WAIT", pcb->state == TIME_WAIT);
+
+  /* Check if this PCB has stayed long enough in TIME-WAIT */
+  if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+    return TCP_TMR_REMOVE;
+  }
+  return TCP_TMR_KEEP;
+}
+
+#if TCP_TIMER_WHEEL
+static void tcp_timer_sched(struct tcp_pcb *pcb);
+static void tcp_timer_rmv(struct tcp_pcb *pcb);
+#endif /* TCP_TIMER_WHEEL */
+
+/**
+ * Does what tcp_slowtmr_active() or tcp_slowtmr_tw() decided for a PCB:
+ * removes it, or polls its application.
+ *
+ * @param pcb the active or TIME-WAIT tcp_pcb
+ * @param what a TCP_TMR_ value
+ */
+static void
+tcp_slowtmr_done(struct tcp_pcb *pcb, u8_t what)
+{
+  err_t err = ERR_OK;
+
+  if (what == TCP_TMR_REMOVE || what == TCP_TMR_RESET) {
+    tcp_pcb_purge(pcb);
+    if (pcb->state == TIME_WAIT) {
+      TCP_RMV(&tcp_tw_pcbs, pcb);
     } else {
+      TCP_RMV(&tcp_active_pcbs, pcb);
+    }
+    TCP_HASH_RMV(pcb);
+#if TCP_TIMER_WHEEL
+    tcp_timer_rmv(pcb);
+#endif /* TCP_TIMER_WHEEL */
+
+    if (what == TCP_TMR_RESET) {
+      LWIP_DEBUGF(TCP_RST_DEBUG, ("tcp_slowtmr: sending RST\n"));
+      tcp_rst(pcb->snd_nxt, pcb->rcv_nxt, &pcb->local_ip, &pcb->remote_ip,
+              pcb->local_port, pcb->remote_port);
+    }
+    if (pcb->state != TIME_WAIT) {
+      TCP_EVENT_ERR(pcb->errf, pcb->callback_arg, ERR_ABRT);
+    }
+    memp_free(MEMP_TCP_PCB, pcb);
+    return;
+  }
 
-      /* We check if we should poll the connection. */
-      ++pcb->polltmr;
-      if (pcb->polltmr >= pcb->pollinterval) {
-        pcb->polltmr = 0;
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: polling application\n"));
-        TCP_EVENT_POLL(pcb, err);
-        if (err == ERR_OK) {
-          tcp_output(pcb);
-        }
-      }
-      
-      prev = pcb;
-      pcb = pcb->next;
+#if TCP_TIMER_WHEEL
+  /* File the PCB before polling, which may free it. */
+  tcp_timer_sched(pcb);
+#endif /* TCP_TIMER_WHEEL */
+  if (what == TCP_TMR_POLL) {
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: polling application\n"));
+    TCP_EVENT_POLL(pcb, err);
+    if (err == ERR_OK) {
+      tcp_output(pcb);
     }
   }
+}
 
-  
-  /* Steps through all of the TIME-WAIT PCBs. */
-  prev = NULL;    
-  pcb = tcp_tw_pcbs;
-  while (pcb != NULL) {
-    LWIP_ASSERT("tcp_slowtmr: TIME-WAIT pcb->state == TIME-WAIT", pcb->state == TIME_WAIT);
-    pcb_remove = 0;
+/**
+ * Runs one fast timer tick for an active PCB: hands data previously
+ * "refused" by upper layer (application) to it again and sends a delayed
+ * ACK.
+ *
+ * @param pcb the active tcp_pcb
+ */
+static void
+tcp_fasttmr_pcb(struct tcp_pcb *pcb)
+{
+  /* If there is data which was previously "refused" by upper layer */
+  if (pcb->refused_data != NULL) {
+    /* Notify again application with data previously received. */
+    err_t err;
+    LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_fasttmr: notify kept packet\n"));
+    TCP_EVENT_RECV(pcb, pcb->refused_data, ERR_OK, err);
+    if (err == ERR_OK) {
+      pcb->refused_data = NULL;
+    }
+  }
 
-    /* Check if this PCB has stayed long enough in TIME-WAIT */
-    if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
-      ++pcb_remove;
+  /* send delayed ACKs */
+  if (pcb->flags & TF_ACK_DELAY) {
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_fasttmr: delayed ACK\n"));
+    tcp_ack_now(pcb);
+    pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
+  }
+}
+
+#if TCP_TIMER_WHEEL
+/*
+ * The timing wheel. Level 0 has a slot for each of the next
+ * TCP_WHEEL_SLOTS slow timer ticks, and each level above has a slot for
+ * each TCP_WHEEL_SLOTS slots of the level below. Once tcp_ticks reaches
+ * the ticks of a slot above level 0, its PCBs are filed again lower down.
+ * So an idle connection costs nothing until its keepalive or closing
+ * timeout, while one that is sending or receiving is looked at every tick.
+ */
+#define TCP_WHEEL_BITS   6
+#define TCP_WHEEL_SLOTS  (1 << TCP_WHEEL_BITS)
+#define TCP_WHEEL_MASK   (TCP_WHEEL_SLOTS - 1)
+#define TCP_WHEEL_LEVELS 3
+/* How far ahead of tcp_ticks a PCB can be filed. A PCB with later timers
+   is looked at then, to no effect but filing it again. */
+#define TCP_WHEEL_SPAN   ((1UL << (TCP_WHEEL_BITS * TCP_WHEEL_LEVELS)) - 1)
+
+static struct tcp_pcb *tcp_wheel[TCP_WHEEL_LEVELS][TCP_WHEEL_SLOTS];
+
+/**
+ * Files a PCB in the wheel, under the tick pcb->wheel_due.
+ */
+static void
+tcp_timer_link(struct tcp_pcb *pcb)
+{
+  struct tcp_pcb **slot;
+  u32_t delta = pcb->wheel_due - tcp_ticks;
+  int level;
+
+  for (level = 0; level < TCP_WHEEL_LEVELS - 1; level++) {
+    if (delta < (1UL << (TCP_WHEEL_BITS * (level + 1)))) {
+      break;
     }
-    
+  }
+  slot = &tcp_wheel[level][(pcb->wheel_due >> (TCP_WHEEL_BITS * level)) & TCP_WHEEL_MASK];
+  pcb->wheel_next = *slot;
+  if (*slot != NULL) {
+    (*slot)->wheel_pprev = &pcb->wheel_next;
+  }
+  pcb->wheel_pprev = slot;
+  *slot = pcb;
+}
 
+/**
+ * Takes a PCB out of the wheel, if it is in it.
+ */
+static void
+tcp_timer_rmv(struct tcp_pcb *pcb)
+{
+  if (pcb->wheel_pprev != NULL) {
+    *pcb->wheel_pprev = pcb->wheel_next;
+    if (pcb->wheel_next != NULL) {
+      pcb->wheel_next->wheel_pprev = pcb->wheel_pprev;
+    }
+    pcb->wheel_next = NULL;
+    pcb->wheel_pprev = NULL;
+  }
+}
 
-    /* If the PCB should be removed, do it. */
-    if (pcb_remove) {
-      tcp_pcb_purge(pcb);      
-      /* Remove PCB from tcp_tw_pcbs list. */
-      if (prev != NULL) {
-        LWIP_ASSERT("tcp_slowtmr: middle tcp != tcp_tw_pcbs", pcb != tcp_tw_pcbs);
-        prev->next = pcb->next;
-      } else {
-        /* This PCB was the first. */
-        LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_tw_pcbs", tcp_tw_pcbs == pcb);
-        tcp_tw_pcbs = pcb->next;
-      }
-      pcb2 = pcb->next;
-      memp_free(MEMP_TCP_PCB, pcb);
-      pcb = pcb2;
+/**
+ * Counts the slow timer ticks after pcb->wheel_last, up to and including
+ * 'upto', in the timers that tcp_slowtmr_active() counts up. The PCB was
+ * not looked at for those ticks, which tcp_timer_delta() makes sure left
+ * nothing else to do.
+ */
+static void
+tcp_timer_advance(struct tcp_pcb *pcb, u32_t upto)
+{
+  u32_t n = upto - pcb->wheel_last;
+
+  if ((s32_t)n <= 0) {
+    return;
+  }
+  pcb->wheel_last = upto;
+  if (pcb->state == TIME_WAIT) {
+    return;
+  }
+  if (pcb->persist_backoff > 0) {
+    pcb->persist_cnt += n;
+  } else if (pcb->rtime >= 0) {
+    pcb->rtime = (s16_t)LWIP_MIN(pcb->rtime + n, 0x7fff);
+  }
+  pcb->polltmr = (u8_t)LWIP_MIN(pcb->polltmr + n, pcb->pollinterval);
+}
+
+/**
+ * Lowers *delta to the ticks from now until tick 'due', or to 1 if that
+ * has passed.
+ */
+static void
+tcp_timer_upto(u32_t *delta, u32_t due)
+{
+  s32_t d = (s32_t)(due - tcp_ticks);
+
+  if (d < 1) {
+    d = 1;
+  }
+  if ((u32_t)d < *delta) {
+    *delta = d;
+  }
+}
+
+/**
+ * Works out in how many ticks the timers have to look at a PCB again:
+ * the first tick at which tcp_slowtmr_active() or tcp_slowtmr_tw() would
+ * do more than count, or tcp_fasttmr anything at all. At most
+ * TCP_WHEEL_SPAN.
+ *
+ * @param pcb the active or TIME-WAIT tcp_pcb, just looked at
+ * @return the ticks until the PCB is due
+ */
+static u32_t
+tcp_timer_delta(struct tcp_pcb *pcb)
+{
+  u32_t delta = TCP_WHEEL_SPAN;
+
+  if (pcb->state == TIME_WAIT) {
+    tcp_timer_upto(&delta, pcb->tmr + 2 * TCP_MSL / TCP_SLOW_INTERVAL + 1);
+    return delta;
+  }
+
+  /* work for tcp_fasttmr, or a PCB out of retries */
+  if (pcb->refused_data != NULL || (pcb->flags & TF_ACK_DELAY) ||
+      (pcb->state == SYN_SENT && pcb->nrtx == TCP_SYNMAXRTX) ||
+      pcb->nrtx == TCP_MAXRTX) {
+    return 1;
+  }
+
+  if (pcb->persist_backoff > 0) {
+    tcp_timer_upto(&delta, tcp_ticks +
+                   tcp_persist_backoff[pcb->persist_backoff-1] - pcb->persist_cnt);
+  } else if (pcb->rtime >= 0 && pcb->unacked != NULL) {
+    tcp_timer_upto(&delta, tcp_ticks + pcb->rto - pcb->rtime);
+  }
+
+  if (pcb->state == FIN_WAIT_2) {
+    tcp_timer_upto(&delta, pcb->tmr + TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL + 1);
+  }
+  if (pcb->state == SYN_RCVD) {
+    tcp_timer_upto(&delta, pcb->tmr + TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL + 1);
+  }
+  if (pcb->state == LAST_ACK) {
+    tcp_timer_upto(&delta, pcb->tmr + 2 * TCP_MSL / TCP_SLOW_INTERVAL + 1);
+  }
+
+  if((pcb->so_options & SOF_KEEPALIVE) &&
+     ((pcb->state == ESTABLISHED) ||
+      (pcb->state == CLOSE_WAIT))) {
+#if LWIP_TCP_KEEPALIVE
+    tcp_timer_upto(&delta, pcb->tmr + 1 +
+                   (pcb->keep_idle + (pcb->keep_cnt*pcb->keep_intvl))
+                   / TCP_SLOW_INTERVAL);
+    tcp_timer_upto(&delta, pcb->tmr + 1 +
+                   (pcb->keep_idle + pcb->keep_cnt_sent * pcb->keep_intvl)
+                   / TCP_SLOW_INTERVAL);
+#else
+    tcp_timer_upto(&delta, pcb->tmr + 1 +
+                   (pcb->keep_idle + TCP_MAXIDLE) / TCP_SLOW_INTERVAL);
+    tcp_timer_upto(&delta, pcb->tmr + 1 +
+                   (pcb->keep_idle + pcb->keep_cnt_sent * TCP_KEEPINTVL_DEFAULT)
+                   / TCP_SLOW_INTERVAL);
+#endif /* LWIP_TCP_KEEPALIVE */
+  }
+
+#if TCP_QUEUE_OOSEQ
+  if (pcb->ooseq != NULL) {
+    tcp_timer_upto(&delta, pcb->tmr + pcb->rto * TCP_OOSEQ_TIMEOUT);
+  }
+#endif /* TCP_QUEUE_OOSEQ */
+
+  /* Polling does nothing but for an application that asked for it, or
+     to send what is queued. */
+#if LWIP_CALLBACK_API
+  if (pcb->poll != NULL || pcb->unsent != NULL)
+#endif /* LWIP_CALLBACK_API */
+  {
+    tcp_timer_upto(&delta, tcp_ticks + pcb->pollinterval - pcb->polltmr);
+  }
+  return delta;
+}
+
+/**
+ * Files a PCB the timers just looked at under the tick it is next due.
+ */
+static void
+tcp_timer_sched(struct tcp_pcb *pcb)
+{
+  tcp_timer_rmv(pcb);
+  pcb->wheel_due = tcp_ticks + tcp_timer_delta(pcb);
+  tcp_timer_link(pcb);
+}
+
+/**
+ * Has the timers look at an active or TIME-WAIT PCB on the next slow
+ * timer tick, and tcp_fasttmr before that. Called for anything that may
+ * bring its timers forward: a segment in or out, new data to send, and
+ * changes to how it is polled or kept alive.
+ *
+ * @param pcb the tcp_pcb
+ */
+void
+tcp_timer_touch(struct tcp_pcb *pcb)
+{
+  if (pcb->state == CLOSED || pcb->state == LISTEN) {
+    return;
+  }
+  tcp_timer_advance(pcb, tcp_ticks);
+  if (pcb->wheel_pprev != NULL) {
+    if (pcb->wheel_due == tcp_ticks + 1) {
+      return;
+    }
+    tcp_timer_rmv(pcb);
+  }
+  pcb->wheel_due = tcp_ticks + 1;
+  tcp_timer_link(pcb);
+}
+
+/**
+ * Files the PCBs in the slot of 'level' that tcp_ticks has reached again,
+ * on the levels below.
+ */
+static void
+tcp_timer_cascade(int level)
+{
+  struct tcp_pcb **slot, *pcb, *next;
+
+  slot = &tcp_wheel[level][(tcp_ticks >> (TCP_WHEEL_BITS * level)) & TCP_WHEEL_MASK];
+  pcb = *slot;
+  *slot = NULL;
+  for (; pcb != NULL; pcb = next) {
+    next = pcb->wheel_next;
+    tcp_timer_link(pcb);
+  }
+}
+
+/**
+ * Called every 500 ms and implements the retransmission timer and the timer that
+ * removes PCBs that have been in TIME-WAIT for enough time. It also increments
+ * various timers such as the inactivity timer in each PCB.
+ *
+ * Only the PCBs that the timing wheel has due are looked at.
+ *
+ * Automatically called from tcp_tmr().
+ */
+void
+tcp_slowtmr(void)
+{
+  struct tcp_pcb *pcb, *due;
+  u8_t what;
+
+  ++tcp_ticks;
+
+  if ((tcp_ticks & TCP_WHEEL_MASK) == 0) {
+    if (((tcp_ticks >> TCP_WHEEL_BITS) & TCP_WHEEL_MASK) == 0) {
+      tcp_timer_cascade(2);
+    }
+    tcp_timer_cascade(1);
+  }
+
+  /* Take the slot off the wheel. Timers and callbacks of one PCB may
+     remove another, which then leaves 'due' as it would the slot. */
+  due = tcp_wheel[0][tcp_ticks & TCP_WHEEL_MASK];
+  tcp_wheel[0][tcp_ticks & TCP_WHEEL_MASK] = NULL;
+  if (due != NULL) {
+    due->wheel_pprev = &due;
+  }
+  while ((pcb = due) != NULL) {
+    tcp_timer_rmv(pcb);
+    tcp_timer_advance(pcb, tcp_ticks - 1);
+    pcb->wheel_last = tcp_ticks;
+    if (pcb->state == TIME_WAIT) {
+      what = tcp_slowtmr_tw(pcb);
     } else {
-      prev = pcb;
-      pcb = pcb->next;
+      what = tcp_slowtmr_active(pcb);
     }
+    tcp_slowtmr_done(pcb, what);
   }
 }
 
@@ -774,34 +1102,75 @@ tcp_slowtmr(void)
  * Is called every TCP_FAST_INTERVAL (250 ms) and process data previously
  * "refused" by upper layer (application) and sends delayed ACKs.
  *
+ * PCBs with either are due on the next slow timer tick, see
+ * tcp_timer_delta(), so only those are looked at.
+ *
  * Automatically called from tcp_tmr().
  */
 void
 tcp_fasttmr(void)
 {
-  struct tcp_pcb *pcb;
+  struct tcp_pcb *pcb, *next;
 
-  for(pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
-    /* If there is data which was previously "refused" by upper layer */
-    if (pcb->refused_data != NULL) {
-      /* Notify again application with data previously received. */
-      err_t err;
-      LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_fasttmr: notify kept packet\n"));
-      TCP_EVENT_RECV(pcb, pcb->refused_data, ERR_OK, err);
-      if (err == ERR_OK) {
-        pcb->refused_data = NULL;
-      }
+  pcb = tcp_wheel[0][(tcp_ticks + 1) & TCP_WHEEL_MASK];
+  for(; pcb != NULL; pcb = next) {
+    next = pcb->wheel_next;
+    if (pcb->state != TIME_WAIT) {
+      tcp_fasttmr_pcb(pcb);
     }
+  }
+}
 
-    /* send delayed ACKs */  
-    if (pcb->flags & TF_ACK_DELAY) {
-      LWIP_DEBUGF(TCP_DEBUG, ("tcp_fasttmr: delayed ACK\n"));
-      tcp_ack_now(pcb);
-      pcb->flags &= ~(TF_ACK_DELAY | TF_ACK_NOW);
-    }
+#else /* TCP_TIMER_WHEEL */
+
+/**
+ * Called every 500 ms and implements the retransmission timer and the timer that
+ * removes PCBs that have been in TIME-WAIT for enough time. It also increments
+ * various timers such as the inactivity timer in each PCB.
+ *
+ * Automatically called from tcp_tmr().
+ */
+void
+tcp_slowtmr(void)
+{
+  struct tcp_pcb *pcb, *pcb2;
+
+  ++tcp_ticks;
+
+  /* Steps through all of the active PCBs. */
+  pcb = tcp_active_pcbs;
+  if (pcb == NULL) {
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: no active pcbs\n"));
+  }
+  for(; pcb != NULL; pcb = pcb2) {
+    pcb2 = pcb->next;
+    tcp_slowtmr_done(pcb, tcp_slowtmr_active(pcb));
+  }
+
+  /* Steps through all of the TIME-WAIT PCBs. */
+  for(pcb = tcp_tw_pcbs; pcb != NULL; pcb = pcb2) {
+    pcb2 = pcb->next;
+    tcp_slowtmr_done(pcb, tcp_slowtmr_tw(pcb));
   }
 }
 
+/**
+ * Is called every TCP_FAST_INTERVAL (250 ms) and process data previously
+ * "refused" by upper layer (application) and sends delayed ACKs.
+ *
+ * Automatically called from tcp_tmr().
+ */
+void
+tcp_fasttmr(void)
+{
+  struct tcp_pcb *pcb;
+
+  for(pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
+    tcp_fasttmr_pcb(pcb);
+  }
+}
+#endif /* TCP_TIMER_WHEEL */
+
 /**
  * Deallocates a list of TCP segments (tcp_seg structures).
  *
@@ -1009,6 +1378,9 @@ tcp_alloc(u8_t prio)
     pcb->tmr = tcp_ticks;
 
     pcb->polltmr = 0;
+#if TCP_TIMER_WHEEL
+    pcb->wheel_last = tcp_ticks;
+#endif /* TCP_TIMER_WHEEL */
 
 #if LWIP_CALLBACK_API
     pcb->recv = tcp_recv_null;
@@ -1133,6 +1505,7 @@ tcp_poll(struct tcp_pcb *pcb,
   pcb->poll = poll;
 #endif /* LWIP_CALLBACK_API */  
   pcb->pollinterval = interval;
+  TCP_TIMER_TOUCH(pcb);
 }
 
 /**
@@ -1189,6 +1562,7 @@ void
 tcp_pcb_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb)
 {
   TCP_RMV(pcblist, pcb);
+  TCP_HASH_RMV(pcb);
 
   tcp_pcb_purge(pcb);
   
@@ -1201,6 +1575,9 @@ tcp_pcb_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb)
   }
 
   if (pcb->state != LISTEN) {
+#if TCP_TIMER_WHEEL
+    tcp_timer_rmv(pcb);
+#endif /* TCP_TIMER_WHEEL */
     LWIP_ASSERT("unsent segments leaking", pcb->unsent == NULL);
     LWIP_ASSERT("unacked segments leaking", pcb->unacked == NULL);
 #if TCP_QUEUE_OOSEQ
@@ -1213,6 +1590,117 @@ tcp_pcb_remove(struct tcp_pcb **pcblist, struct tcp_pcb *pcb)
   LWIP_ASSERT("tcp_pcb_remove: tcp_pcbs_sane()", tcp_pcbs_sane());
 }
 
+#if TCP_PCB_HASH
+/**
+ * Hashes a connection's remote address and ports into a tcp_conn_hash
+ * bucket.
+ */
+static u32_t
+tcp_conn_hashfn(struct ip_addr *remote_ip, u16_t remote_port, u16_t local_port)
+{
+  u32_t h;
+
+  h = remote_ip->addr ^ (((u32_t)remote_port << 16) | local_port);
+  h ^= h >> 16;
+  h *= 0x45d9f3b;
+  h ^= h >> 16;
+  return h & (TCP_PCB_HASH - 1);
+}
+
+/**
+ * Returns the hash bucket a PCB belongs in: tcp_listen_hash for a
+ * listening PCB, else tcp_conn_hash. The local address is not hashed,
+ * so that netif_set_ipaddr() can change it.
+ */
+static struct tcp_pcb **
+tcp_pcb_bucket(struct tcp_pcb *pcb)
+{
+  if (pcb->state == LISTEN) {
+    return (struct tcp_pcb **)&tcp_listen_hash[pcb->local_port & (TCP_PCB_HASH - 1)];
+  }
+  return &tcp_conn_hash[tcp_conn_hashfn(&pcb->remote_ip, pcb->remote_port, pcb->local_port)];
+}
+
+/**
+ * Enters a PCB that was just put on the active or listen list into its
+ * hash table. Its ports and remote address must not change until
+ * tcp_pcb_hash_rmv().
+ *
+ * @param pcb the tcp_pcb (or tcp_pcb_listen) to enter
+ */
+void
+tcp_pcb_hash_add(struct tcp_pcb *pcb)
+{
+  struct tcp_pcb **bucket = tcp_pcb_bucket(pcb);
+
+  pcb->hash_next = *bucket;
+  *bucket = pcb;
+}
+
+/**
+ * Takes a PCB out of its hash table, if it is in it.
+ *
+ * @param pcb the tcp_pcb (or tcp_pcb_listen) to take out
+ */
+void
+tcp_pcb_hash_rmv(struct tcp_pcb *pcb)
+{
+  struct tcp_pcb **pp;
+
+  for (pp = tcp_pcb_bucket(pcb); *pp != NULL; pp = &(*pp)->hash_next) {
+    if (*pp == pcb) {
+      *pp = pcb->hash_next;
+      break;
+    }
+  }
+  pcb->hash_next = NULL;
+}
+
+/**
+ * Finds the active or TIME-WAIT PCB of a connection.
+ *
+ * @return the tcp_pcb, or NULL if there is no such connection
+ */
+struct tcp_pcb *
+tcp_conn_lookup(struct ip_addr *remote_ip, u16_t remote_port,
+                struct ip_addr *local_ip, u16_t local_port)
+{
+  struct tcp_pcb *pcb;
+
+  pcb = tcp_conn_hash[tcp_conn_hashfn(remote_ip, remote_port, local_port)];
+  for(; pcb != NULL; pcb = pcb->hash_next) {
+    if (pcb->remote_port == remote_port &&
+       pcb->local_port == local_port &&
+       ip_addr_cmp(&(pcb->remote_ip), remote_ip) &&
+       ip_addr_cmp(&(pcb->local_ip), local_ip)) {
+      return pcb;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Finds a PCB listening on local_ip (or on any address) and local_port.
+ *
+ * @return the tcp_pcb_listen, or NULL if nobody is listening there
+ */
+struct tcp_pcb_listen *
+tcp_listen_lookup(struct ip_addr *local_ip, u16_t local_port)
+{
+  struct tcp_pcb_listen *lpcb;
+
+  lpcb = tcp_listen_hash[local_port & (TCP_PCB_HASH - 1)];
+  for(; lpcb != NULL; lpcb = lpcb->hash_next) {
+    if ((ip_addr_isany(&(lpcb->local_ip)) ||
+      ip_addr_cmp(&(lpcb->local_ip), local_ip)) &&
+      lpcb->local_port == local_port) {
+      return lpcb;
+    }
+  }
+  return NULL;
+}
+#endif /* TCP_PCB_HASH */
+
 /**
  * Calculates a new initial sequence number for new connections.
  *
@@ -76,6 +76,9 @@ struct tcp_pcb *tcp_input_pcb;
 static err_t tcp_process(struct tcp_pcb *pcb);
 static u8_t tcp_receive(struct tcp_pcb *pcb);
 static void tcp_parseopt(struct tcp_pcb *pcb);
+#if LWIP_TCP_SACK
+static void tcp_parse_sack(struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK */
 
 static err_t tcp_listen_input(struct tcp_pcb_listen *pcb);
 static err_t tcp_timewait_input(struct tcp_pcb *pcb);
@@ -92,7 +95,10 @@ static err_t tcp_timewait_input(struct tcp_pcb *pcb);
 void
 tcp_input(struct pbuf *p, struct netif *inp)
 {
-  struct tcp_pcb *pcb, *prev;
+  struct tcp_pcb *pcb;
+#if !TCP_PCB_HASH
+  struct tcp_pcb *prev;
+#endif /* !TCP_PCB_HASH */
   struct tcp_pcb_listen *lpcb;
   u8_t hdrlen;
   err_t err;
@@ -131,8 +137,9 @@ tcp_input(struct pbuf *p, struct netif *inp)
   }
 
 #if CHECKSUM_CHECK_TCP
-  /* Verify TCP checksum. */
-  if (inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
+  /* Verify TCP checksum, unless the netif already did. */
+  if (!(p->flags & PBUF_FLAG_L4CSUM_OK) &&
+      inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
       (struct ip_addr *)&(iphdr->dest),
       IP_PROTO_TCP, p->tot_len) != 0) {
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packet discarded due to failing checksum 0x%04"X16_F"\n",
@@ -172,6 +179,26 @@ tcp_input(struct pbuf *p, struct netif *inp)
   flags = TCPH_FLAGS(tcphdr) & TCP_FLAGS;
   tcplen = p->tot_len + ((flags & TCP_FIN || flags & TCP_SYN)? 1: 0);
 
+#if TCP_PCB_HASH
+  /* Demultiplex an incoming segment: look up its connection, active or
+     in TIME-WAIT, and failing that a PCB LISTENing on its port. */
+  pcb = tcp_conn_lookup(&(iphdr->src), tcphdr->src, &(iphdr->dest), tcphdr->dest);
+  if (pcb != NULL && pcb->state == TIME_WAIT) {
+    LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packed for TIME_WAITing connection.\n"));
+    tcp_timewait_input(pcb);
+    pbuf_free(p);
+    return;
+  }
+  if (pcb == NULL) {
+    lpcb = tcp_listen_lookup(&(iphdr->dest), tcphdr->dest);
+    if (lpcb != NULL) {
+      LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packed for LISTENing connection.\n"));
+      tcp_listen_input(lpcb);
+      pbuf_free(p);
+      return;
+    }
+  }
+#else /* TCP_PCB_HASH */
   /* Demultiplex an incoming segment. First, we check if it is destined
      for an active connection. */
   prev = NULL;
@@ -191,9 +218,8 @@ tcp_input(struct pbuf *p, struct netif *inp)
          arrivals). */
       LWIP_ASSERT("tcp_input: pcb->next != pcb (before cache)", pcb->next != pcb);
       if (prev != NULL) {
-        prev->next = pcb->next;
-        pcb->next = tcp_active_pcbs;
-        tcp_active_pcbs = pcb;
+        TCP_RMV(&tcp_active_pcbs, pcb);
+        TCP_REG(&tcp_active_pcbs, pcb);
       }
       LWIP_ASSERT("tcp_input: pcb->next != pcb (after cache)", pcb->next != pcb);
       break;
@@ -231,11 +257,9 @@ tcp_input(struct pbuf *p, struct netif *inp)
            lookups will be faster (we exploit locality in TCP segment
            arrivals). */
         if (prev != NULL) {
-          ((struct tcp_pcb_listen *)prev)->next = lpcb->next;
-                /* our successor is the remainder of the listening list */
-          lpcb->next = tcp_listen_pcbs.listen_pcbs;
-                /* put this listening pcb at the head of the listening list */
-          tcp_listen_pcbs.listen_pcbs = lpcb;
+          /* put this listening pcb at the head of the listening list */
+          TCP_RMV(&tcp_listen_pcbs.listen_pcbs, lpcb);
+          TCP_REG(&tcp_listen_pcbs.listen_pcbs, lpcb);
         }
       
         LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packed for LISTENing connection.\n"));
@@ -246,6 +270,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
       prev = (struct tcp_pcb *)lpcb;
     }
   }
+#endif /* TCP_PCB_HASH */
 
 #if TCP_INPUT_DEBUG
   LWIP_DEBUGF(TCP_INPUT_DEBUG, ("+-+-+-+-+-+-+-+-+-+-+-+-+-+- tcp_input: flags "));
@@ -289,6 +314,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
       }
     }
 
+    TCP_TIMER_TOUCH(pcb);
     tcp_input_pcb = pcb;
     err = tcp_process(pcb);
     tcp_input_pcb = NULL;
@@ -314,7 +340,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
            called when new send buffer space is available, we call it
            now. */
         if (pcb->acked > 0) {
-          TCP_EVENT_SENT(pcb, pcb->acked, err);
+          TCP_EVENT_SENT(pcb, TCPWND16(pcb->acked), err);
         }
       
         if (recv_data != NULL) {
@@ -393,7 +419,8 @@ static err_t
 tcp_listen_input(struct tcp_pcb_listen *pcb)
 {
   struct tcp_pcb *npcb;
-  u32_t optdata;
+  u32_t optdata[3];
+  u8_t optlen;
 
   /* In the LISTEN state, we check for incoming SYN segments,
      creates a new PCB, and responds with a SYN|ACK. */
@@ -442,19 +469,27 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
     /* Register the new PCB so that we can begin receiving segments
        for it. */
     TCP_REG(&tcp_active_pcbs, npcb);
+    TCP_HASH_ADD(npcb);
+    TCP_TIMER_TOUCH(npcb);
 
     /* Parse any options in the SYN. */
     tcp_parseopt(npcb);
+#if LWIP_WND_SCALE
+    /* Without scaling, the peer cannot be told about more than 64K. */
+    if (!(npcb->flags & TF_WND_SCALE)) {
+      npcb->rcv_wnd = npcb->rcv_ann_wnd = TCPWND16(TCP_WND);
+    }
+#endif /* LWIP_WND_SCALE */
 #if TCP_CALCULATE_EFF_SEND_MSS
     npcb->mss = tcp_eff_send_mss(npcb->mss, &(npcb->remote_ip));
 #endif /* TCP_CALCULATE_EFF_SEND_MSS */
 
     snmp_inc_tcppassiveopens();
 
-    /* Build an MSS option. */
-    optdata = TCP_BUILD_MSS_OPTION();
-    /* Send a SYN|ACK together with the MSS option. */
-    tcp_enqueue(npcb, NULL, 0, TCP_SYN | TCP_ACK, 0, (u8_t *)&optdata, 4);
+    /* Build the MSS option, and answer the options the peer offered. */
+    optlen = tcp_syn_options(npcb, optdata);
+    /* Send a SYN|ACK together with the options. */
+    tcp_enqueue(npcb, NULL, 0, TCP_SYN | TCP_ACK, 0, (u8_t *)optdata, optlen);
     return tcp_output(npcb);
   }
   return ERR_OK;
@@ -553,6 +588,11 @@ tcp_process(struct tcp_pcb *pcb)
       /* Parse any options in the SYNACK before using pcb->mss since that
        * can be changed by the received options! */
       tcp_parseopt(pcb);
+#if LWIP_WND_SCALE
+      if (!(pcb->flags & TF_WND_SCALE)) {
+        pcb->rcv_wnd = pcb->rcv_ann_wnd = TCPWND16(TCP_WND);
+      }
+#endif /* LWIP_WND_SCALE */
 #if TCP_CALCULATE_EFF_SEND_MSS
       pcb->mss = tcp_eff_send_mss(pcb->mss, &(pcb->remote_ip));
 #endif /* TCP_CALCULATE_EFF_SEND_MSS */
@@ -596,7 +636,7 @@ tcp_process(struct tcp_pcb *pcb)
        !(flags & TCP_RST)) {
       /* expected ACK number? */
       if (TCP_SEQ_BETWEEN(ackno, pcb->lastack+1, pcb->snd_nxt)) {
-        u16_t old_cwnd;
+        tcpwnd_size_t old_cwnd;
         pcb->state = ESTABLISHED;
         LWIP_DEBUGF(TCP_DEBUG, ("TCP connection established %"U16_F" -> %"U16_F".\n", inseg.tcphdr->src, inseg.tcphdr->dest));
 #if LWIP_CALLBACK_API
@@ -721,15 +761,21 @@ tcp_receive(struct tcp_pcb *pcb)
   u32_t right_wnd_edge;
   u16_t new_tot_len;
   u8_t accepted_inseq = 0;
+  tcpwnd_size_t wnd;
+#if LWIP_TCP_SACK
+  u8_t partial = 0;
+#endif /* LWIP_TCP_SACK */
 
   if (flags & TCP_ACK) {
     right_wnd_edge = pcb->snd_wnd + pcb->snd_wl1;
+    /* The window in a SYN is never scaled. */
+    wnd = (flags & TCP_SYN) ? tcphdr->wnd : SND_WND_SCALE(pcb, tcphdr->wnd);
 
     /* Update window. */
     if (TCP_SEQ_LT(pcb->snd_wl1, seqno) ||
        (pcb->snd_wl1 == seqno && TCP_SEQ_LT(pcb->snd_wl2, ackno)) ||
-       (pcb->snd_wl2 == ackno && tcphdr->wnd > pcb->snd_wnd)) {
-      pcb->snd_wnd = tcphdr->wnd;
+       (pcb->snd_wl2 == ackno && wnd > pcb->snd_wnd)) {
+      pcb->snd_wnd = wnd;
       pcb->snd_wl1 = seqno;
       pcb->snd_wl2 = ackno;
       if (pcb->snd_wnd > 0 && pcb->persist_backoff > 0) {
@@ -738,13 +784,19 @@ tcp_receive(struct tcp_pcb *pcb)
       LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: window update %"U16_F"\n", pcb->snd_wnd));
 #if TCP_WND_DEBUG
     } else {
-      if (pcb->snd_wnd != tcphdr->wnd) {
+      if (pcb->snd_wnd != wnd) {
         LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_receive: no window update lastack %"U32_F" snd_max %"U32_F" ackno %"U32_F" wl1 %"U32_F" seqno %"U32_F" wl2 %"U32_F"\n",
                                pcb->lastack, pcb->snd_max, ackno, pcb->snd_wl1, seqno, pcb->snd_wl2));
       }
 #endif /* TCP_WND_DEBUG */
     }
 
+#if LWIP_TCP_SACK
+    if (pcb->flags & TF_SACK) {
+      tcp_parse_sack(pcb);
+    }
+#endif /* LWIP_TCP_SACK */
+
     if (pcb->lastack == ackno) {
       pcb->acked = 0;
 
@@ -756,6 +808,14 @@ tcp_receive(struct tcp_pcb *pcb)
             LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_receive: dupacks %"U16_F" (%"U32_F"), fast retransmit %"U32_F"\n",
                                        (u16_t)pcb->dupacks, pcb->lastack,
                                        ntohl(pcb->unacked->tcphdr->seqno)));
+#if LWIP_TCP_SACK
+            /* Recovery lasts until everything sent so far is acked. */
+            pcb->recover = pcb->snd_max;
+            for (next = pcb->unacked; next != NULL; next = next->next) {
+              next->sack_flags &= ~TF_SEG_REXMIT;
+            }
+            pcb->unacked->sack_flags |= TF_SEG_REXMIT;
+#endif /* LWIP_TCP_SACK */
             tcp_rexmit(pcb);
             /* Set ssthresh to max (FlightSize / 2, 2*SMSS) */
             /*pcb->ssthresh = LWIP_MAX((pcb->snd_max -
@@ -778,9 +838,16 @@ tcp_receive(struct tcp_pcb *pcb)
           } else {
             /* Inflate the congestion window, but not if it means that
                the value overflows. */
-            if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+            if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
               pcb->cwnd += pcb->mss;
             }
+#if LWIP_TCP_SACK
+            /* Each duplicate ACK means a segment left the network:
+               send the next hole the SACK blocks reveal in its place. */
+            if (pcb->flags & TF_SACK) {
+              tcp_rexmit_sack(pcb);
+            }
+#endif /* LWIP_TCP_SACK */
           }
         }
       } else {
@@ -794,8 +861,17 @@ tcp_receive(struct tcp_pcb *pcb)
          in fast retransmit. Also reset the congestion window to the
          slow start threshold. */
       if (pcb->flags & TF_INFR) {
-        pcb->flags &= ~TF_INFR;
-        pcb->cwnd = pcb->ssthresh;
+#if LWIP_TCP_SACK
+        /* A partial ACK: the peer is still missing data sent before
+           recovery began, so stay in recovery (RFC 6675). */
+        if ((pcb->flags & TF_SACK) && TCP_SEQ_LT(ackno, pcb->recover)) {
+          partial = 1;
+        } else
+#endif /* LWIP_TCP_SACK */
+        {
+          pcb->flags &= ~TF_INFR;
+          pcb->cwnd = pcb->ssthresh;
+        }
       }
 
       /* Reset the number of retransmissions. */
@@ -804,8 +880,9 @@ tcp_receive(struct tcp_pcb *pcb)
       /* Reset the retransmission time-out. */
       pcb->rto = (pcb->sa >> 3) + pcb->sv;
 
-      /* Update the send buffer space. Diff between the two can never exceed 64K? */
-      pcb->acked = (u16_t)(ackno - pcb->lastack);
+      /* Update the send buffer space. Diff between the two can never exceed 64K
+         unless windows are scaled. */
+      pcb->acked = (tcpwnd_size_t)(ackno - pcb->lastack);
 
       pcb->snd_buf += pcb->acked;
 
@@ -815,14 +892,14 @@ tcp_receive(struct tcp_pcb *pcb)
 
       /* Update the congestion control variables (cwnd and
          ssthresh). */
-      if (pcb->state >= ESTABLISHED) {
+      if (pcb->state >= ESTABLISHED && !(pcb->flags & TF_INFR)) {
         if (pcb->cwnd < pcb->ssthresh) {
-          if ((u16_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
+          if ((tcpwnd_size_t)(pcb->cwnd + pcb->mss) > pcb->cwnd) {
             pcb->cwnd += pcb->mss;
           }
           LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"U16_F"\n", pcb->cwnd));
         } else {
-          u16_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
+          tcpwnd_size_t new_cwnd = (pcb->cwnd + pcb->mss * pcb->mss / pcb->cwnd);
           if (new_cwnd > pcb->cwnd) {
             pcb->cwnd = new_cwnd;
           }
@@ -869,6 +946,12 @@ tcp_receive(struct tcp_pcb *pcb)
         pcb->rtime = 0;
 
       pcb->polltmr = 0;
+#if LWIP_TCP_SACK
+      /* After a partial ACK the new first unacked segment is a hole. */
+      if (partial) {
+        tcp_rexmit_sack(pcb);
+      }
+#endif /* LWIP_TCP_SACK */
     } else {
       /* Fix bug bug #21582: out of sequence ACK, didn't really ack anything */
       pcb->acked = 0;
@@ -1300,8 +1383,8 @@ tcp_receive(struct tcp_pcb *pcb)
  * Parses the options contained in the incoming segment. (Code taken
  * from uIP with only small changes.)
  *
- * Called from tcp_listen_input() and tcp_process().
- * Currently, only the MSS option is supported!
+ * Called from tcp_listen_input() and tcp_process() on SYN segments.
+ * Supports the MSS, window scale and SACK-permitted options.
  *
  * @param pcb the tcp_pcb for which a segment arrived
  */
@@ -1330,9 +1413,23 @@ tcp_parseopt(struct tcp_pcb *pcb)
         mss = (opts[c + 2] << 8) | opts[c + 3];
         /* Limit the mss to the configured TCP_MSS and prevent division by zero */
         pcb->mss = ((mss > TCP_MSS) || (mss == 0)) ? TCP_MSS : mss;
-
-        /* And we are done processing options. */
-        break;
+        c += 0x04;
+#if LWIP_WND_SCALE
+      } else if (opt == 0x03 &&
+        opts[c + 1] == 0x03) {
+        /* A window scale option: RFC 7323 caps the shift at 14. */
+        pcb->snd_scale = LWIP_MIN(opts[c + 2], 14);
+        pcb->rcv_scale = TCP_RCV_SCALE;
+        pcb->flags |= TF_WND_SCALE;
+        c += 0x03;
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK
+      } else if (opt == 0x04 &&
+        opts[c + 1] == 0x02) {
+        /* SACK permitted. */
+        pcb->flags |= TF_SACK;
+        c += 0x02;
+#endif /* LWIP_TCP_SACK */
       } else {
         if (opts[c + 1] == 0) {
           /* If the length field is zero, the options are malformed
@@ -1347,4 +1444,50 @@ tcp_parseopt(struct tcp_pcb *pcb)
   }
 }
 
+#if LWIP_TCP_SACK
+/**
+ * Marks the unacked segments that the SACK blocks of the incoming ACK
+ * cover, so that tcp_rexmit_sack() can tell the holes from them.
+ *
+ * @param pcb the tcp_pcb for which an ACK arrived
+ */
+static void
+tcp_parse_sack(struct tcp_pcb *pcb)
+{
+  u8_t c, i, len, *opts;
+  u32_t left, right, segno;
+  struct tcp_seg *seg;
+
+  opts = (u8_t *)tcphdr + TCP_HLEN;
+  for(c = 0; c < (TCPH_HDRLEN(tcphdr) - 5) << 2 ;) {
+    if (opts[c] == 0x00) {
+      break;
+    } else if (opts[c] == 0x01) {
+      ++c;
+      continue;
+    }
+    len = opts[c + 1];
+    if (len < 2 || c + len > (TCPH_HDRLEN(tcphdr) - 5) << 2) {
+      break;
+    }
+    if (opts[c] == 0x05) {
+      for (i = 2; i + 8 <= len; i += 8) {
+        left = ((u32_t)opts[c + i] << 24) | ((u32_t)opts[c + i + 1] << 16) |
+          ((u32_t)opts[c + i + 2] << 8) | opts[c + i + 3];
+        right = ((u32_t)opts[c + i + 4] << 24) | ((u32_t)opts[c + i + 5] << 16) |
+          ((u32_t)opts[c + i + 6] << 8) | opts[c + i + 7];
+        for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+          segno = ntohl(seg->tcphdr->seqno);
+          if (TCP_SEQ_GEQ(segno, left) &&
+              TCP_SEQ_LEQ(segno + TCP_TCPLEN(seg), right)) {
+            seg->sack_flags |= TF_SEG_SACKED;
+          }
+        }
+      }
+    }
+    c += len;
+  }
+}
+#endif /* LWIP_TCP_SACK */
+
 #endif /* LWIP_TCP */
@@ -58,6 +58,9 @@
 
 /* Forward declarations.*/
 static void tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb);
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+static u8_t tcp_sack_options(struct tcp_pcb *pcb, u32_t *opts);
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
 
 /**
  * Called by tcp_close() to send a segment including flags but not data.
@@ -144,6 +147,7 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
       ((len == 0) || (optlen == 0)), return ERR_ARG;);
   LWIP_ERROR("tcp_enqueue: arg == NULL || optdata == NULL (programmer violates API)",
       ((arg == NULL) || (optdata == NULL)), return ERR_ARG;);
+  TCP_TIMER_TOUCH(pcb);
   /* fail on too much data */
   if (len > pcb->snd_buf) {
     LWIP_DEBUGF(TCP_OUTPUT_DEBUG | 3, ("tcp_enqueue: too much data (len=%"U16_F" > snd_buf=%"U16_F")\n", len, pcb->snd_buf));
@@ -195,6 +199,9 @@ tcp_enqueue(struct tcp_pcb *pcb, void *arg, u16_t len,
     }
     seg->next = NULL;
     seg->p = NULL;
+#if LWIP_TCP_SACK
+    seg->sack_flags = 0;
+#endif /* LWIP_TCP_SACK */
 
     /* first segment of to-be-queued data? */
     if (queue == NULL) {
@@ -414,10 +421,14 @@ tcp_output(struct tcp_pcb *pcb)
   struct tcp_hdr *tcphdr;
   struct tcp_seg *seg, *useg;
   u32_t wnd;
+  u32_t opts[9];
+  u8_t optlen = 0;
 #if TCP_CWND_DEBUG
   s16_t i = 0;
 #endif /* TCP_CWND_DEBUG */
 
+  TCP_TIMER_TOUCH(pcb);
+
   /* First, check if we are invoked by the TCP input processing
      code. If so, we do not output anything. Instead, we rely on the
      input processing code to call us when input processing is done
@@ -445,7 +456,13 @@ tcp_output(struct tcp_pcb *pcb)
   if (pcb->flags & TF_ACK_NOW &&
      (seg == NULL ||
       ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len > wnd)) {
-    p = pbuf_alloc(PBUF_IP, TCP_HLEN, PBUF_RAM);
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+    /* tell the peer which out-of-sequence data we hold */
+    if (pcb->flags & TF_SACK) {
+      optlen = tcp_sack_options(pcb, opts);
+    }
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
+    p = pbuf_alloc(PBUF_IP, TCP_HLEN + optlen, PBUF_RAM);
     if (p == NULL) {
       LWIP_DEBUGF(TCP_OUTPUT_DEBUG, ("tcp_output: (ACK) could not allocate pbuf\n"));
       return ERR_BUF;
@@ -460,9 +477,12 @@ tcp_output(struct tcp_pcb *pcb)
     tcphdr->seqno = htonl(pcb->snd_nxt);
     tcphdr->ackno = htonl(pcb->rcv_nxt);
     TCPH_FLAGS_SET(tcphdr, TCP_ACK);
-    tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+    tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
     tcphdr->urgp = 0;
-    TCPH_HDRLEN_SET(tcphdr, 5);
+    TCPH_HDRLEN_SET(tcphdr, 5 + optlen / 4);
+    if (optlen > 0) {
+      MEMCPY((u8_t *)tcphdr + TCP_HLEN, opts, optlen);
+    }
 
     tcphdr->chksum = 0;
 #if CHECKSUM_GEN_TCP
@@ -606,8 +626,13 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb)
    wnd fields remain. */
   seg->tcphdr->ackno = htonl(pcb->rcv_nxt);
 
-  /* advertise our receive window size in this TCP segment */
-  seg->tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  /* advertise our receive window size in this TCP segment; the
+     window in a SYN is never scaled */
+  if (TCPH_FLAGS(seg->tcphdr) & TCP_SYN) {
+    seg->tcphdr->wnd = htons(TCPWND16(pcb->rcv_ann_wnd));
+  } else {
+    seg->tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
+  }
 
   /* If we don't have a local IP address, we get one by
      calling ip_route(). */
@@ -707,7 +732,7 @@ tcp_rst(u32_t seqno, u32_t ackno,
   tcphdr->seqno = htonl(seqno);
   tcphdr->ackno = htonl(ackno);
   TCPH_FLAGS_SET(tcphdr, TCP_RST | TCP_ACK);
-  tcphdr->wnd = htons(TCP_WND);
+  tcphdr->wnd = htons(TCPWND16(TCP_WND));
   tcphdr->urgp = 0;
   TCPH_HDRLEN_SET(tcphdr, 5);
 
@@ -794,6 +819,123 @@ tcp_rexmit(struct tcp_pcb *pcb)
   tcp_output(pcb);
 }
 
+#if LWIP_TCP_SACK
+/**
+ * Resend the first hole in the unacked queue, in place: the first
+ * segment that is neither SACKed nor resent already in this recovery,
+ * and that is either first in the queue (the cumulative ACK stops there)
+ * or has SACKed data above it.
+ *
+ * Called by tcp_receive() for each duplicate or partial ACK during
+ * fast recovery.
+ *
+ * @param pcb the tcp_pcb for which to retransmit a hole
+ * @return 1 if a segment was resent, 0 if there was no hole to fill
+ */
+u8_t
+tcp_rexmit_sack(struct tcp_pcb *pcb)
+{
+  struct tcp_seg *seg, *last;
+
+  /* holes past the last SACKed segment are not known to be lost */
+  last = NULL;
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if (seg->sack_flags & TF_SEG_SACKED) {
+      last = seg;
+    }
+  }
+  for (seg = pcb->unacked; seg != NULL; seg = seg->next) {
+    if (seg != pcb->unacked && last == NULL) {
+      return 0;
+    }
+    if (!(seg->sack_flags & (TF_SEG_SACKED | TF_SEG_REXMIT))) {
+      break;
+    }
+    if (seg == last) {
+      return 0;
+    }
+  }
+  if (seg == NULL) {
+    return 0;
+  }
+
+  LWIP_DEBUGF(TCP_FR_DEBUG, ("tcp_rexmit_sack: %"U32_F"\n",
+                             ntohl(seg->tcphdr->seqno)));
+  seg->sack_flags |= TF_SEG_REXMIT;
+  snmp_inc_tcpretranssegs();
+  tcp_output_segment(seg, pcb);
+  /* Don't time the retransmission, nor anything sent before it. */
+  pcb->rttest = 0;
+  return 1;
+}
+#endif /* LWIP_TCP_SACK */
+
+/**
+ * Build the options of a SYN or SYN|ACK: the MSS, and window scaling
+ * and SACK if we offer them (SYN) or the peer offered them (SYN|ACK).
+ *
+ * @param pcb the tcp_pcb that sends the SYN
+ * @param opts room for 3 words of options
+ * @return the length of the options in bytes
+ */
+u8_t
+tcp_syn_options(struct tcp_pcb *pcb, u32_t *opts)
+{
+  u8_t n = 0;
+
+  opts[n++] = TCP_BUILD_MSS_OPTION();
+#if LWIP_WND_SCALE
+  if (pcb->state == SYN_SENT || (pcb->flags & TF_WND_SCALE)) {
+    /* NOP, window scale, length 3, shift */
+    opts[n++] = htonl(0x01030300 | TCP_RCV_SCALE);
+  }
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK
+  if (pcb->state == SYN_SENT || (pcb->flags & TF_SACK)) {
+    /* NOP, NOP, SACK permitted, length 2 */
+    opts[n++] = htonl(0x01010402);
+  }
+#endif /* LWIP_TCP_SACK */
+  LWIP_UNUSED_ARG(pcb);
+  return n * 4;
+}
+
+#if LWIP_TCP_SACK && TCP_QUEUE_OOSEQ
+/**
+ * Build a SACK option that reports up to 4 blocks of the out-of-sequence
+ * queue, merging adjacent segments.
+ *
+ * @param pcb the tcp_pcb that sends the ACK
+ * @param opts room for 9 words of options
+ * @return the length of the option in bytes, 0 if there is nothing to report
+ */
+static u8_t
+tcp_sack_options(struct tcp_pcb *pcb, u32_t *opts)
+{
+  struct tcp_seg *seg;
+  u32_t left, right;
+  u8_t n = 0;
+
+  for (seg = pcb->ooseq; seg != NULL && n < 4; ) {
+    left = seg->tcphdr->seqno;
+    right = left + TCP_TCPLEN(seg);
+    for (seg = seg->next; seg != NULL && seg->tcphdr->seqno == right;
+         seg = seg->next) {
+      right += TCP_TCPLEN(seg);
+    }
+    opts[1 + 2 * n] = htonl(left);
+    opts[2 + 2 * n] = htonl(right);
+    n++;
+  }
+  if (n == 0) {
+    return 0;
+  }
+  /* NOP, NOP, SACK, length */
+  opts[0] = htonl(0x01010500 | (2 + 8 * n));
+  return 4 + 8 * n;
+}
+#endif /* LWIP_TCP_SACK && TCP_QUEUE_OOSEQ */
+
 /**
  * Send keepalive packets to keep a connection active although
  * no data is sent over it.
@@ -831,7 +973,7 @@ tcp_keepalive(struct tcp_pcb *pcb)
   tcphdr->seqno = htonl(pcb->snd_nxt - 1);
   tcphdr->ackno = htonl(pcb->rcv_nxt);
   TCPH_FLAGS_SET(tcphdr, 0);
-  tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
   tcphdr->urgp = 0;
   TCPH_HDRLEN_SET(tcphdr, 5);
 
@@ -914,7 +1056,7 @@ tcp_zero_window_probe(struct tcp_pcb *pcb)
   tcphdr->seqno = seg->tcphdr->seqno;
   tcphdr->ackno = htonl(pcb->rcv_nxt);
   TCPH_FLAGS_SET(tcphdr, 0);
-  tcphdr->wnd = htons(pcb->rcv_ann_wnd);
+  tcphdr->wnd = htons(TCPWND16(RCV_WND_SCALE(pcb, pcb->rcv_ann_wnd)));
   tcphdr->urgp = 0;
   TCPH_HDRLEN_SET(tcphdr, 5);
 
@@ -246,7 +246,7 @@ udp_input(struct pbuf *p, struct netif *inp)
 #endif /* LWIP_UDPLITE */
     {
 #if CHECKSUM_CHECK_UDP
-      if (udphdr->chksum != 0) {
+      if (udphdr->chksum != 0 && !(p->flags & PBUF_FLAG_L4CSUM_OK)) {
         if (inet_chksum_pseudo(p, (struct ip_addr *)&(iphdr->src),
                                (struct ip_addr *)&(iphdr->dest),
                                IP_PROTO_UDP, p->tot_len) != 0) {
@@ -512,6 +512,14 @@ udp_sendto_if(struct udp_pcb *pcb, struct pbuf *p,
       /* chksum zero must become 0xffff, as zero means 'no checksum' */
       if (udphdr->chksum == 0x0000) udphdr->chksum = 0xffff;
     }
+#elif IP_FRAG
+    /* the hardware checksums each frame on its own, so a datagram that
+       ip_output_if will fragment still needs its checksum computed here */
+    if ((pcb->flags & UDP_FLAGS_NOCHKSUM) == 0 &&
+        netif->mtu && q->tot_len + IP_HLEN > netif->mtu) {
+      udphdr->chksum = inet_chksum_pseudo(q, src_ip, dst_ip, IP_PROTO_UDP, q->tot_len);
+      if (udphdr->chksum == 0x0000) udphdr->chksum = 0xffff;
+    }
 #endif /* CHECKSUM_CHECK_UDP */
     LWIP_DEBUGF(UDP_DEBUG, ("udp_send: UDP checksum 0x%04"X16_F"\n", udphdr->chksum));
     LWIP_DEBUGF(UDP_DEBUG, ("udp_send: ip_output_if (,,,,IP_PROTO_UDP,)\n"));
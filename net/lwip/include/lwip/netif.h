@@ -174,6 +174,14 @@ struct netif {
 #if LWIP_LOOPBACK_MAX_PBUFS
   u16_t loop_cnt_current;
 #endif /* LWIP_LOOPBACK_MAX_PBUFS */
+#if LWIP_NETIF_LOOPBACK_DELAY
+  /* When each queued packet is due, in queue order. */
+  u32_t loop_due[LWIP_LOOPBACK_DELAY_RING];
+  u16_t loop_due_head;
+  u16_t loop_due_count;
+  /* A sys_timeout is pending for the first packet. */
+  u8_t loop_timer;
+#endif /* LWIP_NETIF_LOOPBACK_DELAY */
 #endif /* ENABLE_LOOPBACK */
 };
 
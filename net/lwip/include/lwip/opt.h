@@ -155,6 +155,17 @@
 #define MEMP_USE_CUSTOM_POOLS           0
 #endif
 
+/**
+ * MEM_MAGAZINE: Keep up to this many freed heap blocks of each of a few
+ * packet-sized classes in a magazine in front of the heap, so that
+ * PBUF_RAM pbufs are mostly allocated and freed without searching the
+ * heap or taking mem_sem. Only for cooperative threads, as in one
+ * process: the magazines themselves are not protected. 0 disables them.
+ */
+#ifndef MEM_MAGAZINE
+#define MEM_MAGAZINE                    0
+#endif
+
 /**
  * Set this to 1 if you want to free PBUF_RAM pbufs (or call mem_free()) from
  * interrupt context (or another context that doesn't allow waiting for a
@@ -664,6 +675,49 @@
 #define TCP_WND                         2048
 #endif 
 
+/**
+ * LWIP_WND_SCALE==1: Support RFC 7323 window scaling, so that windows can
+ * be larger than 0xffff. TCP_RCV_SCALE is the shift announced for our
+ * receive window: TCP_WND must fit in (0xffff << TCP_RCV_SCALE).
+ */
+#ifndef LWIP_WND_SCALE
+#define LWIP_WND_SCALE                  0
+#endif
+
+#ifndef TCP_RCV_SCALE
+#define TCP_RCV_SCALE                   0
+#endif
+
+/**
+ * LWIP_TCP_SACK==1: Support RFC 2018 selective acknowledgments. Pure ACKs
+ * carry SACK blocks for out-of-sequence data, and fast recovery resends
+ * the holes that the peer's SACK blocks reveal, one per duplicate ACK.
+ */
+#ifndef LWIP_TCP_SACK
+#define LWIP_TCP_SACK                   0
+#endif
+
+/**
+ * TCP_PCB_HASH: Number of buckets (a power of 2) in the hash tables that
+ * tcp_input looks up connections in: active and TIME-WAIT pcbs by remote
+ * address and both ports, listening pcbs by local port. 0 leaves tcp_input
+ * searching the pcb lists.
+ */
+#ifndef TCP_PCB_HASH
+#define TCP_PCB_HASH                    0
+#endif
+
+/**
+ * TCP_TIMER_WHEEL==1: Keep active and TIME-WAIT PCBs in a hierarchical
+ * timing wheel, filed under the next slow timer tick at which one of their
+ * timers can expire, so that tcp_slowtmr() and tcp_fasttmr() only look at
+ * those. PCBs that send or receive are looked at on every tick. With 0,
+ * both timers go through every PCB.
+ */
+#ifndef TCP_TIMER_WHEEL
+#define TCP_TIMER_WHEEL                 0
+#endif
+
 /**
  * TCP_MAXRTX: Maximum number of retransmissions of data segments.
  */
@@ -852,6 +906,21 @@
 #define LWIP_LOOPBACK_MAX_PBUFS         0
 #endif
 
+/**
+ * LWIP_NETIF_LOOPBACK_DELAY==1: Hold looped packets back for
+ * LWIP_LOOPBACK_DELAY() milliseconds, as measured by LWIP_LOOPBACK_NOW(),
+ * to emulate a long path. At most LWIP_LOOPBACK_DELAY_RING packets can
+ * be on the way; more are dropped. Requires
+ * LWIP_NETIF_LOOPBACK_MULTITHREADING, and a sys_timeout.
+ */
+#ifndef LWIP_NETIF_LOOPBACK_DELAY
+#define LWIP_NETIF_LOOPBACK_DELAY       0
+#endif
+
+#ifndef LWIP_LOOPBACK_DELAY_RING
+#define LWIP_LOOPBACK_DELAY_RING        2048
+#endif
+
 /**
  * LWIP_NETIF_LOOPBACK_MULTITHREADING: Indicates whether threading is enabled in
  * the system, as netifs must change how they behave depending on this setting
@@ -60,6 +60,10 @@ typedef enum {
 
 /** indicates this packet's data should be immediately passed to the application */
 #define PBUF_FLAG_PUSH 0x01U
+/** the netif already verified the IP header checksum of this packet */
+#define PBUF_FLAG_IPCSUM_OK 0x02U
+/** the netif already verified the TCP/UDP checksum of this packet */
+#define PBUF_FLAG_L4CSUM_OK 0x04U
 
 struct pbuf {
   /** next pbuf in singly linked pbuf chain */
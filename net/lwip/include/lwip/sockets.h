@@ -322,6 +322,14 @@ int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptse
                 struct timeval *timeout);
 int lwip_ioctl(int s, long cmd, void *argp);
 
+/* JOS: let the network server dispatch requests without blocking.
+ * lwip_socket_event is called whenever a socket may have become ready,
+ * and the _ready functions tell whether a call would complete at once. */
+extern void (*lwip_socket_event)(int s);
+int lwip_recv_ready(int s);
+int lwip_send_ready(int s, int size);
+int lwip_send_room(int s);
+
 #if LWIP_COMPAT_SOCKETS
 #define accept(a,b,c)         lwip_accept(a,b,c)
 #define bind(a,b,c)           lwip_bind(a,b,c)
@@ -138,6 +138,23 @@ void             tcp_rexmit_rto  (struct tcp_pcb *pcb);
 #define tcp_output_nagle(tpcb) (tcp_do_output_nagle(tpcb) ? tcp_output(tpcb) : ERR_OK)
 
 
+/* Windows are kept in 32 bits when they may be scaled. The window
+ * field of a SYN is never scaled, see RFC 7323. */
+#if LWIP_WND_SCALE
+typedef u32_t tcpwnd_size_t;
+#define TCPWND16(x)             ((u16_t)LWIP_MIN((x), 0xffff))
+#define RCV_WND_SCALE(pcb, wnd) ((wnd) >> (pcb)->rcv_scale)
+#define SND_WND_SCALE(pcb, wnd) ((tcpwnd_size_t)(wnd) << (pcb)->snd_scale)
+#define TCP_WND_MAX(pcb)        ((tcpwnd_size_t)(((pcb)->flags & TF_WND_SCALE) ? \
+                                 TCP_WND : TCPWND16(TCP_WND)))
+#else /* LWIP_WND_SCALE */
+typedef u16_t tcpwnd_size_t;
+#define TCPWND16(x)             (x)
+#define RCV_WND_SCALE(pcb, wnd) (wnd)
+#define SND_WND_SCALE(pcb, wnd) (wnd)
+#define TCP_WND_MAX(pcb)        TCP_WND
+#endif /* LWIP_WND_SCALE */
+
 /** This returns a TCP header option for MSS in an u32_t */
 #define TCP_BUILD_MSS_OPTION()  htonl(((u32_t)2 << 24) | \
                                 ((u32_t)4 << 16) | \
@@ -263,6 +280,8 @@ enum tcp_state {
  */
 #define TCP_PCB_COMMON(type) \
   type *next; /* for the linked list */ \
+  type **pprev; /* the pointer to us in the linked list */ \
+  type *hash_next; /* for the TCP_PCB_HASH bucket */ \
   enum tcp_state state; /* TCP state */ \
   u8_t prio; \
   void *callback_arg; \
@@ -283,6 +302,8 @@ struct tcp_pcb {
 #define TF_ACK_DELAY   (u8_t)0x01U   /* Delayed ACK. */
 #define TF_ACK_NOW     (u8_t)0x02U   /* Immediate ACK. */
 #define TF_INFR        (u8_t)0x04U   /* In fast recovery. */
+#define TF_WND_SCALE   (u8_t)0x08U   /* Window scaling was negotiated. */
+#define TF_SACK        (u8_t)0x10U   /* SACK was negotiated. */
 #define TF_FIN         (u8_t)0x20U   /* Connection was closed locally (FIN segment enqueued). */
 #define TF_NODELAY     (u8_t)0x40U   /* Disable Nagle algorithm */
 #define TF_NAGLEMEMERR (u8_t)0x80U /* nagle enabled, memerr, try to output to prevent delayed ACK to happen */
@@ -291,8 +312,8 @@ struct tcp_pcb {
      as we have to do some math with them */
   /* receiver variables */
   u32_t rcv_nxt;   /* next seqno expected */
-  u16_t rcv_wnd;   /* receiver window */
-  u16_t rcv_ann_wnd; /* announced receive window */
+  tcpwnd_size_t rcv_wnd;   /* receiver window */
+  tcpwnd_size_t rcv_ann_wnd; /* announced receive window */
 
   /* Timers */
   u32_t tmr;
@@ -314,22 +335,29 @@ struct tcp_pcb {
   /* fast retransmit/recovery */
   u32_t lastack; /* Highest acknowledged seqno. */
   u8_t dupacks;
+#if LWIP_TCP_SACK
+  u32_t recover; /* snd_max when fast recovery began */
+#endif /* LWIP_TCP_SACK */
   
   /* congestion avoidance/control variables */
-  u16_t cwnd;  
-  u16_t ssthresh;
+  tcpwnd_size_t cwnd;  
+  tcpwnd_size_t ssthresh;
 
   /* sender variables */
   u32_t snd_nxt,   /* next seqno to be sent */
     snd_max;       /* Highest seqno sent. */
-  u16_t snd_wnd;   /* sender window */
+  tcpwnd_size_t snd_wnd;   /* sender window */
+#if LWIP_WND_SCALE
+  u8_t snd_scale;  /* shift of the windows the peer announces */
+  u8_t rcv_scale;  /* shift of the windows we announce */
+#endif /* LWIP_WND_SCALE */
   u32_t snd_wl1, snd_wl2, /* Sequence and acknowledgement numbers of last
                              window update. */
     snd_lbb;       /* Sequence number of next byte to be buffered. */
 
-  u16_t acked;
+  tcpwnd_size_t acked;
   
-  u16_t snd_buf;   /* Available buffer space for sending (in bytes). */
+  tcpwnd_size_t snd_buf;   /* Available buffer space for sending (in bytes). */
 #define TCP_SNDQUEUELEN_OVERFLOW (0xffff-3)
   u16_t snd_queuelen; /* Available buffer space for sending (in tcp_segs). */
   
@@ -412,6 +440,13 @@ struct tcp_pcb {
 
   /* KEEPALIVE counter */
   u8_t keep_cnt_sent;
+
+#if TCP_TIMER_WHEEL
+  /* Timing wheel slot, see tcp_timer_touch() */
+  struct tcp_pcb *wheel_next, **wheel_pprev;
+  u32_t wheel_due;  /* tcp_ticks at which tcp_slowtmr looks at us next */
+  u32_t wheel_last; /* last tick counted in rtime, polltmr and persist_cnt */
+#endif /* TCP_TIMER_WHEEL */
 };
 
 struct tcp_pcb_listen {  
@@ -495,6 +530,11 @@ struct tcp_seg {
   void *dataptr;           /* pointer to the TCP data in the pbuf */
   u16_t len;               /* the TCP length of this segment */
   struct tcp_hdr *tcphdr;  /* the TCP header */
+#if LWIP_TCP_SACK
+  u8_t sack_flags;
+#define TF_SEG_SACKED  (u8_t)0x01U /* The peer has SACKed this segment. */
+#define TF_SEG_REXMIT  (u8_t)0x02U /* Resent in the current fast recovery. */
+#endif /* LWIP_TCP_SACK */
 };
 
 /* Internal functions and global variables: */
@@ -523,6 +563,10 @@ err_t tcp_enqueue(struct tcp_pcb *pcb, void *dataptr, u16_t len,
                 u8_t *optdata, u8_t optlen);
 
 void tcp_rexmit_seg(struct tcp_pcb *pcb, struct tcp_seg *seg);
+#if LWIP_TCP_SACK
+u8_t tcp_rexmit_sack(struct tcp_pcb *pcb);
+#endif /* LWIP_TCP_SACK */
+u8_t tcp_syn_options(struct tcp_pcb *pcb, u32_t *opts);
 
 void tcp_rst(u32_t seqno, u32_t ackno,
        struct ip_addr *local_ip, struct ip_addr *remote_ip,
@@ -573,15 +617,44 @@ extern struct tcp_pcb *tcp_tw_pcbs;      /* List of all TCP PCBs in TIME-WAIT. *
 
 extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
 
+#if TCP_PCB_HASH
+/* Hash tables over the lists, see tcp_pcb_hash_add(). */
+extern struct tcp_pcb *tcp_conn_hash[TCP_PCB_HASH];
+extern struct tcp_pcb_listen *tcp_listen_hash[TCP_PCB_HASH];
+
+void tcp_pcb_hash_add(struct tcp_pcb *pcb);
+void tcp_pcb_hash_rmv(struct tcp_pcb *pcb);
+struct tcp_pcb *tcp_conn_lookup(struct ip_addr *remote_ip, u16_t remote_port,
+                                struct ip_addr *local_ip, u16_t local_port);
+struct tcp_pcb_listen *tcp_listen_lookup(struct ip_addr *local_ip, u16_t local_port);
+#define TCP_HASH_ADD(npcb) tcp_pcb_hash_add((struct tcp_pcb *)(npcb))
+#define TCP_HASH_RMV(npcb) tcp_pcb_hash_rmv((struct tcp_pcb *)(npcb))
+#else /* TCP_PCB_HASH */
+#define TCP_HASH_ADD(npcb)
+#define TCP_HASH_RMV(npcb)
+#endif /* TCP_PCB_HASH */
+
+#if TCP_TIMER_WHEEL
+void tcp_timer_touch(struct tcp_pcb *pcb);
+#define TCP_TIMER_TOUCH(pcb) tcp_timer_touch(pcb)
+#else /* TCP_TIMER_WHEEL */
+#define TCP_TIMER_TOUCH(pcb)
+#endif /* TCP_TIMER_WHEEL */
+
 /* Axioms about the above lists:   
    1) Every TCP PCB that is not CLOSED is in one of the lists.
    2) A PCB is only in one of the lists.
    3) All PCBs in the tcp_listen_pcbs list is in LISTEN state.
    4) All PCBs in the tcp_tw_pcbs list is in TIME-WAIT state.
+   5) With TCP_PCB_HASH, every PCB in tcp_active_pcbs or tcp_tw_pcbs is in
+      tcp_conn_hash, and every PCB in tcp_listen_pcbs in tcp_listen_hash.
+      Moving between the active and TIME-WAIT lists leaves it where it is.
 */
 
 /* Define two macros, TCP_REG and TCP_RMV that registers a TCP PCB
-   with a PCB list or removes a PCB from a list, respectively. */
+   with a PCB list or removes a PCB from a list, respectively. Each PCB
+   knows the pointer to it in its list, so TCP_RMV does not search the
+   list, and removing a PCB that is on no list does nothing. */
 #if 0
 #define TCP_REG(pcbs, npcb) do {\
                             LWIP_DEBUGF(TCP_DEBUG, ("TCP_REG %p local port %d\n", npcb, npcb->local_port)); \
@@ -593,22 +666,25 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
                             LWIP_ASSERT("TCP_REG: pcb->state != CLOSED", npcb->state != CLOSED); \
                             npcb->next = *pcbs; \
                             LWIP_ASSERT("TCP_REG: npcb->next != npcb", npcb->next != npcb); \
+                            if(npcb->next != NULL) { \
+                               npcb->next->pprev = &npcb->next; \
+                            } \
+                            npcb->pprev = (pcbs); \
                             *(pcbs) = npcb; \
                             LWIP_ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
               tcp_timer_needed(); \
                             } while(0)
 #define TCP_RMV(pcbs, npcb) do { \
-                            LWIP_ASSERT("TCP_RMV: pcbs != NULL", *pcbs != NULL); \
                             LWIP_DEBUGF(TCP_DEBUG, ("TCP_RMV: removing %p from %p\n", npcb, *pcbs)); \
-                            if(*pcbs == npcb) { \
-                               *pcbs = (*pcbs)->next; \
-                            } else for(tcp_tmp_pcb = *pcbs; tcp_tmp_pcb != NULL; tcp_tmp_pcb = tcp_tmp_pcb->next) { \
-                               if(tcp_tmp_pcb->next != NULL && tcp_tmp_pcb->next == npcb) { \
-                                  tcp_tmp_pcb->next = npcb->next; \
-                                  break; \
+                            if(npcb->pprev != NULL) { \
+                               LWIP_ASSERT("TCP_RMV: pcbs != NULL", *pcbs != NULL); \
+                               *npcb->pprev = npcb->next; \
+                               if(npcb->next != NULL) { \
+                                  npcb->next->pprev = npcb->pprev; \
                                } \
                             } \
                             npcb->next = NULL; \
+                            npcb->pprev = NULL; \
                             LWIP_ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
                             LWIP_DEBUGF(TCP_DEBUG, ("TCP_RMV: removed %p from %p\n", npcb, *pcbs)); \
                             } while(0)
@@ -616,19 +692,22 @@ extern struct tcp_pcb *tcp_tmp_pcb;      /* Only used for temporary storage. */
 #else /* LWIP_DEBUG */
 #define TCP_REG(pcbs, npcb) do { \
                             npcb->next = *pcbs; \
+                            if(npcb->next != NULL) { \
+                               npcb->next->pprev = &npcb->next; \
+                            } \
+                            npcb->pprev = (pcbs); \
                             *(pcbs) = npcb; \
               tcp_timer_needed(); \
                             } while(0)
 #define TCP_RMV(pcbs, npcb) do { \
-                            if(*(pcbs) == npcb) { \
-                               (*(pcbs)) = (*pcbs)->next; \
-                            } else for(tcp_tmp_pcb = *pcbs; tcp_tmp_pcb != NULL; tcp_tmp_pcb = tcp_tmp_pcb->next) { \
-                               if(tcp_tmp_pcb->next != NULL && tcp_tmp_pcb->next == npcb) { \
-                                  tcp_tmp_pcb->next = npcb->next; \
-                                  break; \
+                            if(npcb->pprev != NULL) { \
+                               *npcb->pprev = npcb->next; \
+                               if(npcb->next != NULL) { \
+                                  npcb->next->pprev = npcb->pprev; \
                                } \
                             } \
                             npcb->next = NULL; \
+                            npcb->pprev = NULL; \
                             } while(0)
 #endif /* LWIP_DEBUG */
 
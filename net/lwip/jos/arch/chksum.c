@@ -0,0 +1,96 @@
+#include <inc/x86.h>
+
+#include <arch/chksum.h>
+
+// The Internet checksum does not care about byte order (RFC 1071): sum
+// the data as little-endian 16-bit words and the folded result is the
+// network-order sum with its bytes swapped, which is just the host-order
+// value lwIP wants.  So neither version below swaps anything, and
+// neither cares whether dataptr is aligned.
+
+static uint16_t
+fold(uint32_t sum)
+{
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	return sum;
+}
+
+// Sum the words of the len < 16 bytes at p into sum.
+static uint32_t
+add_tail(uint32_t sum, const uint8_t *p, int len)
+{
+	for (; len > 1; p += 2, len -= 2)
+		sum += p[0] | (p[1] << 8);
+	if (len > 0)
+		sum += p[0];
+	return sum;
+}
+
+uint16_t
+jos_chksum_scalar(void *dataptr, uint16_t len)
+{
+	const uint8_t *p = dataptr;
+	uint32_t sum = 0;
+	int n = len;
+
+	// len < 64KB, so 32 bits cannot overflow
+	for (; n >= 16; p += 16, n -= 16)
+		sum += (p[0] | (p[1] << 8)) + (p[2] | (p[3] << 8))
+			+ (p[4] | (p[5] << 8)) + (p[6] | (p[7] << 8))
+			+ (p[8] | (p[9] << 8)) + (p[10] | (p[11] << 8))
+			+ (p[12] | (p[13] << 8)) + (p[14] | (p[15] << 8));
+	return fold(add_tail(sum, p, n));
+}
+
+// Sum 16 bytes per iteration: widen the eight words to 32 bits and add
+// them into two vectors of four sums.  Each lane gains less than 2^17
+// per iteration and there are at most 4096 iterations, so the lanes
+// cannot overflow.
+__attribute__((target("sse2"))) uint16_t
+jos_chksum_sse2(void *dataptr, uint16_t len)
+{
+	const uint8_t *p = dataptr;
+	uint32_t sum = 0;
+	int n = len / 16;
+
+	if (n > 0) {
+		asm volatile("pxor %%xmm0, %%xmm0\n"
+			     "\tpxor %%xmm1, %%xmm1\n"
+			     "\tpxor %%xmm4, %%xmm4\n"
+			     "1:\tmovdqu (%1), %%xmm2\n"
+			     "\tmovdqa %%xmm2, %%xmm3\n"
+			     "\tpunpcklwd %%xmm4, %%xmm2\n"
+			     "\tpunpckhwd %%xmm4, %%xmm3\n"
+			     "\tpaddd %%xmm2, %%xmm0\n"
+			     "\tpaddd %%xmm3, %%xmm1\n"
+			     "\taddl $16, %1\n"
+			     "\tdecl %2\n"
+			     "\tjnz 1b\n"
+			     "\tpaddd %%xmm1, %%xmm0\n"
+			     "\tpshufd $0x4e, %%xmm0, %%xmm1\n"
+			     "\tpaddd %%xmm1, %%xmm0\n"
+			     "\tpshufd $0xb1, %%xmm0, %%xmm1\n"
+			     "\tpaddd %%xmm1, %%xmm0\n"
+			     "\tmovd %%xmm0, %0\n"
+			     : "=r" (sum), "+r" (p), "+r" (n)
+			     :
+			     : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",
+			       "cc", "memory");
+	}
+	return fold(add_tail(sum, p, len % 16));
+}
+
+static uint16_t (*chksum_fn)(void *, uint16_t);
+
+uint16_t
+jos_chksum(void *dataptr, uint16_t len)
+{
+	uint32_t edx;
+
+	if (!chksum_fn) {
+		cpuid(1, NULL, NULL, NULL, &edx);
+		chksum_fn = (edx & (1 << 26)) ? jos_chksum_sse2 : jos_chksum_scalar;
+	}
+	return chksum_fn(dataptr, len);
+}
@@ -0,0 +1,13 @@
+#ifndef LWIP_ARCH_CHKSUM_H
+#define LWIP_ARCH_CHKSUM_H
+
+#include <inc/types.h>
+
+// Internet checksum of len bytes at dataptr, in host order and not
+// inverted, as lwIP's LWIP_CHKSUM expects.  jos_chksum picks the
+// fastest of the others the CPU supports.
+uint16_t jos_chksum(void *dataptr, uint16_t len);
+uint16_t jos_chksum_scalar(void *dataptr, uint16_t len);
+uint16_t jos_chksum_sse2(void *dataptr, uint16_t len);
+
+#endif
@@ -154,6 +154,9 @@ const char *sys_errlist[] = {
   [ENSRCNAMELOOP] = "ENSRCNAMELOOP" /* Domain name is too long */
 };
 
+/* errno to make lwIP happy */
+int errno;
+
 void
 perror(const char *s) {
 	int err = errno;
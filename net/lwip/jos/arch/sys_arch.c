@@ -9,8 +9,13 @@
 
 #define debug 0
 
-#define NSEM		256
-#define NMBOX		128
+// TCP_LOCAL_PORT_OK and ETHARP_REPLY_OK hooks, see lwipopts.h
+int (*jos_tcp_port_ok)(struct tcp_pcb *pcb, uint16_t port);
+int jos_arp_quiet;
+
+// Every netconn takes a semaphore and a mailbox or two.
+#define NSEM		2048
+#define NMBOX		2048
 #define MBOXSLOTS	32
 
 struct sys_sem_entry {
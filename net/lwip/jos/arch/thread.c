@@ -10,6 +10,108 @@ static struct thread_context *cur_tc;
 static struct thread_queue thread_queue;
 static struct thread_queue kill_queue;
 
+// Sleeping threads.  thread_wait takes a thread off the run queue and
+// files it under its wait address in a hash table, and under its
+// deadline in a min-heap, so neither thread_wakeup nor the scheduler has
+// to look at threads that are not about to run.
+#define WAIT_HASH 256
+static struct thread_context *wait_hash[WAIT_HASH];
+static struct thread_context *deadlines[thread_max];
+static int ndeadlines;
+static int nthreads;
+
+// Called when no thread can run, see thread_set_idle.
+static void (*idle_fn)(void);
+
+static struct thread_context **
+wait_bucket(volatile uint32_t *addr) {
+    return &wait_hash[((uintptr_t) addr >> 2) % WAIT_HASH];
+}
+
+static void
+heap_swap(int i, int j) {
+    struct thread_context *tc = deadlines[i];
+    deadlines[i] = deadlines[j];
+    deadlines[j] = tc;
+    deadlines[i]->tc_heap_idx = i;
+    deadlines[j]->tc_heap_idx = j;
+}
+
+static void
+heap_up(int i) {
+    while (i > 0 && deadlines[(i - 1) / 2]->tc_deadline > deadlines[i]->tc_deadline) {
+	heap_swap(i, (i - 1) / 2);
+	i = (i - 1) / 2;
+    }
+}
+
+static void
+heap_down(int i) {
+    for (;;) {
+	int m = i, l = 2 * i + 1, r = 2 * i + 2;
+	if (l < ndeadlines && deadlines[l]->tc_deadline < deadlines[m]->tc_deadline)
+	    m = l;
+	if (r < ndeadlines && deadlines[r]->tc_deadline < deadlines[m]->tc_deadline)
+	    m = r;
+	if (m == i)
+	    return;
+	heap_swap(i, m);
+	i = m;
+    }
+}
+
+static void
+heap_remove(struct thread_context *tc) {
+    int i = tc->tc_heap_idx;
+
+    tc->tc_heap_idx = -1;
+    if (i != --ndeadlines) {
+	deadlines[i] = deadlines[ndeadlines];
+	deadlines[i]->tc_heap_idx = i;
+	heap_up(i);
+	heap_down(deadlines[i]->tc_heap_idx);
+    }
+}
+
+// Put sleeping thread tc back on the run queue.
+static void
+thread_ready(struct thread_context *tc) {
+    struct thread_context **pp;
+
+    if (tc->tc_wait_addr) {
+	for (pp = wait_bucket(tc->tc_wait_addr); *pp != tc; pp = &(*pp)->tc_wait_link)
+	    ;
+	*pp = tc->tc_wait_link;
+    }
+    if (tc->tc_heap_idx >= 0)
+	heap_remove(tc);
+    tc->tc_sleeping = 0;
+    threadq_push(&thread_queue, tc);
+}
+
+// Wake every thread whose deadline has passed.
+static void
+thread_expire(void) {
+    uint32_t now;
+
+    if (!ndeadlines)
+	return;
+    now = sys_time_msec();
+    while (ndeadlines && deadlines[0]->tc_deadline <= now)
+	thread_ready(deadlines[0]);
+}
+
+// Wait until some thread can run: let the idle function block the env
+// in the kernel, or at least give up the CPU.
+static void
+thread_idle(void) {
+    if (idle_fn)
+	idle_fn();
+    else
+	sys_yield();
+    thread_expire();
+}
+
 void
 thread_init(void) {
     threadq_init(&thread_queue);
@@ -21,50 +123,81 @@ thread_id(void) {
     return cur_tc->tc_tid;
 }
 
+void
+thread_set_idle(void (*fn)(void)) {
+    idle_fn = fn;
+}
+
+// The earliest deadline of a sleeping thread, in sys_time_msec() terms,
+// or ~0 if none has one: how long the idle function may block.
+uint32_t
+thread_deadline(void) {
+    return ndeadlines ? deadlines[0]->tc_deadline : ~0U;
+}
+
 void
 thread_wakeup(volatile uint32_t *addr) {
-    struct thread_context *tc = thread_queue.tq_first;
-    while (tc) {
-	if (tc->tc_wait_addr == addr)
+    struct thread_context *tc, *next;
+
+    for (tc = *wait_bucket(addr); tc; tc = next) {
+	next = tc->tc_wait_link;
+	if (tc->tc_wait_addr == addr) {
 	    tc->tc_wakeup = 1;
-	tc = tc->tc_queue_link;
+	    thread_ready(tc);
+	}
     }
 }
 
+// Sleep until *addr != val, thread_wakeup(addr), or sys_time_msec()
+// reaches msec, whichever comes first.  msec of ~0 means no deadline.
+// Whoever changes *addr must call thread_wakeup(addr).
 void
 thread_wait(volatile uint32_t *addr, uint32_t val, uint32_t msec) {
-    uint32_t s = sys_time_msec();
-    uint32_t p = s;
+    struct thread_context **pp, *next;
+
+    if (addr && *addr != val)
+	return;
+    if (msec != ~0U && msec <= sys_time_msec())
+	return;
 
     cur_tc->tc_wait_addr = addr;
     cur_tc->tc_wakeup = 0;
+    cur_tc->tc_sleeping = 1;
+    if (addr) {
+	pp = wait_bucket(addr);
+	cur_tc->tc_wait_link = *pp;
+	*pp = cur_tc;
+    }
+    if (msec != ~0U) {
+	cur_tc->tc_deadline = msec;
+	cur_tc->tc_heap_idx = ndeadlines;
+	deadlines[ndeadlines++] = cur_tc;
+	heap_up(cur_tc->tc_heap_idx);
+    }
 
-    while (p < msec) {
-	if (p < s)
-	    break;
-	if (addr && *addr != val)
-	    break;
-	if (cur_tc->tc_wakeup)
-	    break;
-
-	thread_yield();
-	p = sys_time_msec();
+    while (!(next = threadq_pop(&thread_queue)))
+	thread_idle();
+    if (next != cur_tc) {
+	if (jos_setjmp(&cur_tc->tc_jb) == 0) {
+	    cur_tc = next;
+	    jos_longjmp(&cur_tc->tc_jb, 1);
+	}
     }
 
     cur_tc->tc_wait_addr = 0;
     cur_tc->tc_wakeup = 0;
 }
 
+// Returns the number of threads ready to run besides the current one.
 int
 thread_wakeups_pending(void)
 {
-    struct thread_context *tc = thread_queue.tq_first;
+    struct thread_context *tc;
     int n = 0;
-    while (tc) {
-	if (tc->tc_wakeup)
-	    ++n;
-	tc = tc->tc_queue_link;
-    }
+
+    thread_expire();
+    for (tc = thread_queue.tq_first; tc; tc = tc->tc_queue_link)
+	++n;
     return n;
 }
 
@@ -101,11 +234,15 @@ thread_entry(void) {
 int
 thread_create(thread_id_t *tid, const char *name, 
 		void (*entry)(uint32_t), uint32_t arg) {
+    if (nthreads == thread_max)
+	return -E_NO_MEM;
+
     struct thread_context *tc = malloc(sizeof(struct thread_context));
     if (!tc)
 	return -E_NO_MEM;
 
     memset(tc, 0, sizeof(struct thread_context));
+    tc->tc_heap_idx = -1;
     
     thread_set_name(tc, name);
     tc->tc_tid = alloc_tid();
@@ -128,6 +265,7 @@ thread_create(thread_id_t *tid, const char *name,
     tc->tc_arg = arg;
 
     threadq_push(&thread_queue, tc);
+    nthreads++;
 
     if (tid)
 	*tid = tc->tc_tid;
@@ -143,6 +281,7 @@ thread_clean(struct thread_context *tc) {
 	tc->tc_onhalt[i](tc->tc_tid);
     free(tc->tc_stack_bottom);
     free(tc);
+    nthreads--;
 }
 
 void
@@ -153,14 +292,26 @@ thread_halt() {
 
     threadq_push(&kill_queue, cur_tc);
     cur_tc = NULL;
-    thread_yield();
-    // WHAT IF THERE ARE NO MORE THREADS? HOW DO WE STOP?
-    // when yield has no thread to run, it will return here!
-    exit();
+
+    // Wait for a thread to run on; with none left at all, we are done.
+    struct thread_context *next_tc;
+    while (!(next_tc = threadq_pop(&thread_queue))) {
+	if (nthreads == 1)
+	    exit();
+	thread_idle();
+    }
+    cur_tc = next_tc;
+    jos_longjmp(&cur_tc->tc_jb, 1);
 }
 
 void
 thread_yield(void) {
+    // A thread on its way to sleep (the idle function runs on its
+    // stack) cannot be put back on the run queue.
+    if (cur_tc && cur_tc->tc_sleeping)
+	return;
+
+    thread_expire();
     struct thread_context *next_tc = threadq_pop(&thread_queue);
 
     if (!next_tc)
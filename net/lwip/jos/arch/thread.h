@@ -15,5 +15,7 @@ int thread_create(thread_id_t *tid, const char *name,
 		void (*entry)(uint32_t), uint32_t arg);
 void thread_yield(void);
 void thread_halt(void);
+void thread_set_idle(void (*fn)(void));
+uint32_t thread_deadline(void);
 
 #endif
@@ -7,6 +7,8 @@
 #define THREAD_NUM_ONHALT 4
 enum { name_size = 32 };
 enum { stack_size = PGSIZE };
+// Most threads that can exist at once, bounding the deadline heap
+enum { thread_max = 2048 };
 
 struct thread_context;
 
@@ -25,6 +27,10 @@ struct thread_context {
     struct jos_jmp_buf	tc_jb;
     volatile uint32_t	*tc_wait_addr;
     volatile char	tc_wakeup;
+    char		tc_sleeping;	// in thread_wait, off the run queue
+    uint32_t		tc_deadline;	// thread_wait's msec
+    int			tc_heap_idx;	// index in the deadline heap, or -1
+    struct thread_context *tc_wait_link; // next in tc_wait_addr's bucket
     void		(*tc_onhalt[THREAD_NUM_ONHALT])(thread_id_t);
     int			tc_nonhalt;
     struct thread_context *tc_queue_link;
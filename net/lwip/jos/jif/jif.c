@@ -46,6 +46,8 @@
 
 #define PKTMAP		0x10000000
 
+u32_t jif_rx_frames, jif_rx_pbufs;
+
 struct jif {
     struct eth_addr *ethaddr;
     envid_t envid;
@@ -118,7 +120,7 @@ low_level_output(struct netif *netif, struct pbuf *p)
  *
  */
 static struct pbuf *
-low_level_input(void *va)
+low_level_input(void *va, int csum)
 {
     struct jif_pkt *pkt = (struct jif_pkt *)va;
     s16_t len = pkt->jp_len;
@@ -126,6 +128,14 @@ low_level_input(void *va)
     struct pbuf *p = pbuf_alloc(PBUF_RAW, len, PBUF_POOL);
     if (p == 0)
 	return 0;
+    jif_rx_frames++;
+    jif_rx_pbufs += pbuf_clen(p);
+
+    /* pass on what the NIC already verified */
+    if (csum & RXBUF_CSUM_IP)
+	p->flags |= PBUF_FLAG_IPCSUM_OK;
+    if (csum & RXBUF_CSUM_L4)
+	p->flags |= PBUF_FLAG_L4CSUM_OK;
 
     /* We iterate over the pbuf chain until we have read the entire
      * packet into the pbuf. */
@@ -168,12 +178,12 @@ jif_output(struct netif *netif, struct pbuf *p,
  * This function should be called when a packet is ready to be read
  * from the interface. It uses the function low_level_input() that
  * should handle the actual reception of bytes from the network
- * interface.
+ * interface. csum holds the RXBUF_CSUM_* checks the NIC already did.
  *
  */
 
 void
-jif_input(struct netif *netif, void *va)
+jif_input(struct netif *netif, void *va, int csum)
 {
     struct jif *jif;
     struct eth_hdr *ethhdr;
@@ -182,7 +192,7 @@ jif_input(struct netif *netif, void *va)
     jif = netif->state;
   
     /* move received packet into a new pbuf */
-    p = low_level_input(va);
+    p = low_level_input(va, csum);
 
     /* no packet could be read, silently ignore this */
     if (p == NULL) return;
@@ -1,4 +1,7 @@
 #include <lwip/netif.h>
 
-void	jif_input(struct netif *netif, void *va);
+/* Frames jif_input has taken, and the pbufs it allocated for them */
+extern u32_t jif_rx_frames, jif_rx_pbufs;
+
+void	jif_input(struct netif *netif, void *va, int csum);
 err_t	jif_init(struct netif *netif);
@@ -10,8 +10,20 @@ void *memcpy(void *dst, const void *src, size_t n);
 
 //#define NO_SYS 1
 
-#define LWIP_STATS		0
+// Only the pool and heap counters, whose high-water marks size
+// PBUF_POOL_SIZE and friends; see NSREQ_STATS and user/nsstat.
+#define LWIP_STATS		1
 #define LWIP_STATS_DISPLAY	0
+#define LINK_STATS		0
+#define ETHARP_STATS		0
+#define IP_STATS		0
+#define IPFRAG_STATS		0
+#define ICMP_STATS		0
+#define UDP_STATS		0
+#define TCP_STATS		0
+#define SYS_STATS		0
+#define MEM_STATS		1
+#define MEMP_STATS		1
 #define LWIP_DHCP		1
 #define LWIP_COMPAT_SOCKETS	0
 //#define SYS_LIGHTWEIGHT_PROT	1
@@ -22,28 +34,102 @@ void *memcpy(void *dst, const void *src, size_t n);
 
 #define MEM_ALIGNMENT		4
 
+// PBUF_RAM pbufs come and go in a few sizes: keep freed ones in
+// magazines in front of the heap, see net/lwip/core/mem.c
+#define MEM_MAGAZINE		64
+
 #define MEMP_NUM_PBUF		64
 #define MEMP_NUM_UDP_PCB	8
-#define MEMP_NUM_TCP_PCB	32
+#define MEMP_NUM_TCP_PCB	1024
 #define MEMP_NUM_TCP_PCB_LISTEN	16
-#define MEMP_NUM_TCP_SEG	TCP_SND_QUEUELEN// at least as big as TCP_SND_QUEUELEN
-#define MEMP_NUM_NETBUF		128
-#define MEMP_NUM_NETCONN	32
-#define MEMP_NUM_SYS_TIMEOUT    6
 
-#define PER_TCP_PCB_BUFFER	(16 * 4096)
-#define MEM_SIZE		(PER_TCP_PCB_BUFFER*MEMP_NUM_TCP_SEG + 4096*MEMP_NUM_TCP_SEG)
+// tcp_input finds a segment's connection by hashing instead of searching
+// every connection and TIME-WAIT pcb, see net/testdemux
+#define TCP_PCB_HASH		1024
+
+// The TCP timers only look at connections whose timers are due, instead
+// of all of them every tick, see user/idleconn
+#define TCP_TIMER_WHEEL		1
+#define MEMP_NUM_NETBUF		128
+#define MEMP_NUM_NETCONN	1024
+#define MEMP_NUM_SYS_TIMEOUT    7
 
-#define PBUF_POOL_SIZE		512
 #define PBUF_POOL_BUFSIZE	2000
 
+// Whatever is left to checksum in software goes through SSE2 if the CPU
+// has it, see arch/chksum.c
+uint16_t jos_chksum(void *dataptr, uint16_t len);
+#define LWIP_CHKSUM		jos_chksum
+
+// The e1000 inserts IP and TCP/UDP checksums on transmit, see net/output.c.
+// UDP datagrams that get fragmented are still summed in software.
+#define CHECKSUM_GEN_IP		0
+#define CHECKSUM_GEN_UDP	0
+#define CHECKSUM_GEN_TCP	0
+
+// Accept threads wait with a timeout so they notice when the listening
+// socket is shut down, see net/serv.c
+#define LWIP_SO_RCVTIMEO	1
+
+// With several ns workers, tcp_connect must pick a local port whose
+// replies are steered back to the calling worker.  ns installs the check,
+// see net/serv.c; other programs linking lwIP take any port.
+struct tcp_pcb;
+extern int (*jos_tcp_port_ok)(struct tcp_pcb *pcb, uint16_t port);
+#define TCP_LOCAL_PORT_OK(pcb, port)					\
+	(!jos_tcp_port_ok || jos_tcp_port_ok(pcb, port))
+
+// ARP requests reach every ns worker, so that each learns the sender's
+// address, but only worker 0 answers them; the others set jos_arp_quiet.
+extern int jos_arp_quiet;
+#define ETHARP_REPLY_OK(netif)	(!jos_arp_quiet)
+
+// Connections to our own address stay inside ns, e.g. user/echoload
+#define LWIP_NETIF_LOOPBACK	1
+
+// Looped packets can be held back to emulate a long path, see
+// nsipc_loopdelay and user/tcprtt.
+unsigned int sys_time_msec(void);
+uint32_t jos_loopback_delay(void);
+#define LWIP_NETIF_LOOPBACK_DELAY	1
+#define LWIP_LOOPBACK_DELAY()	jos_loopback_delay()
+#define LWIP_LOOPBACK_NOW()	sys_time_msec()
+
+// Window scaling and SACK are negotiated per connection, so peers that
+// do not know them just get a 64K window and go-back-N recovery.
+#define LWIP_WND_SCALE		1
+#define LWIP_TCP_SACK		1
+
 #define TCP_MSS			1460
+
+// TCP tuning profiles, picked at build time with make NET_PROFILE=...
+// The pools are static arrays sized from these, so they cannot change
+// at run time.
+#if defined(LWIP_PROFILE_BULK)
+// Bulk transfer over long fat pipes: a 256K receive window (which needs
+// a window scale of 3) and enough send buffer and segments to keep
+// 128 segments in flight per connection.
+#define TCP_WND			(256 * 1024)
+#define TCP_RCV_SCALE		3
+#define TCP_SND_BUF		(128 * TCP_MSS)
+#define TCP_SND_QUEUELEN	(2 * TCP_SND_BUF/TCP_MSS)
+#define MEMP_NUM_TCP_SEG	1024
+#define PBUF_POOL_SIZE		1024
+#define MEM_SIZE		(8 << 20)
+#else
+// Many small connections, e.g. httpd.
 #define TCP_WND			24000
+#define TCP_RCV_SCALE		0
 #define TCP_SND_BUF		(16 * TCP_MSS)
 // lwip prints a warning if TCP_SND_QUEUELEN < (2 * TCP_SND_BUF/TCP_MSS), 
 // but 16 is faster.. 
 #define TCP_SND_QUEUELEN	(2 * TCP_SND_BUF/TCP_MSS)
 //#define TCP_SND_QUEUELEN	16
+#define MEMP_NUM_TCP_SEG	TCP_SND_QUEUELEN// at least as big as TCP_SND_QUEUELEN
+#define PBUF_POOL_SIZE		512
+#define PER_TCP_PCB_BUFFER	(16 * 4096)
+#define MEM_SIZE		(PER_TCP_PCB_BUFFER*MEMP_NUM_TCP_SEG + 4096*MEMP_NUM_TCP_SEG)
+#endif
 
 // Print error messages when we run out of memory
 #define LWIP_DEBUG	1
@@ -696,7 +696,11 @@ etharp_arp_input(struct netif *netif, struct eth_addr *ethaddr, struct pbuf *p)
 
     LWIP_DEBUGF (ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_arp_input: incoming ARP request\n"));
     /* ARP request for our address? */
+#ifdef ETHARP_REPLY_OK
+    if (for_us && ETHARP_REPLY_OK(netif)) {
+#else /* ETHARP_REPLY_OK */
     if (for_us) {
+#endif /* ETHARP_REPLY_OK */
 
       LWIP_DEBUGF(ETHARP_DEBUG | LWIP_DBG_TRACE, ("etharp_arp_input: replying to ARP request for our IP address\n"));
       /* Re-use pbuf to send ARP reply.
@@ -8,14 +8,79 @@
 #define TIMER_INTERVAL 250
 
 // Virtual address at which to receive page mappings containing client requests.
-#define QUEUE_SIZE	20
-#define REQVA		(0x0ffff000 - QUEUE_SIZE * PGSIZE)
+// Requests parked on a socket keep their page, so there is one per
+// possible socket.  They sit just below DATAVA, clear of the malloc heap
+// (lib/malloc.c) and the other ns regions below.
+#define QUEUE_SIZE	1024
+#define REQVA		(DATAVA - QUEUE_SIZE * PGSIZE)
 
-/* timer.c */
-void timer(envid_t ns_envid, uint32_t initial_to);
+// Virtual address at which the data pages of large recv and send
+// requests are mapped, IPC_MAXPAGES for each request buffer.
+#define DATAVA		0x20000000
+
+// Virtual address of the shared receive buffer pool, see inc/nete1000.h.
+// ns maps it with PTE_SHARE before forking, so ns_input sees it too.
+#define RXRING		((struct rx_ring *) 0x10400000)
+#define RXBUF(i)	((struct jif_pkt *) ((uintptr_t) RXRING + (1 + (i)) * PGSIZE))
+
+// ns runs one worker per CPU, up to NSWORKER_MAX.  Each worker is a full
+// lwIP instance with the same address; ns_input steers TCP flows between
+// them by RSS hash, see rss.c.  Worker 0 is the ENV_TYPE_NS env itself;
+// it owns every socket created by NSREQ_SOCKET and shares its listening
+// sockets with the other workers through the page at NSSHARED.
+#define NSWORKER_MAX	NRXQUEUE
+#define NSSHARED	((struct ns_shared *) 0x10300000)
+
+// Maximum number of listening sockets shared between workers, and of
+// connections accepted on their behalf but not yet handed out.
+#define NSLISTEN	8
+#define NSPENDING	16
+
+enum {
+	NSL_FREE = 0,
+	NSL_LISTEN,
+	NSL_CLOSED,
+};
+
+struct ns_accepted {
+	int na_s;			// socket id, see NSSOCK in inc/ns.h
+	struct sockaddr na_addr;
+	socklen_t na_addrlen;
+};
+
+// A listening socket on worker 0 and its replicas on the other workers.
+// Every worker runs an accept thread on its copy that queues new
+// connections in nl_pending, where NSREQ_ACCEPT on worker 0 picks them up.
+struct ns_listen {
+	int nl_state;			// NSL_*
+	uint32_t nl_id;			// bumped every time the slot is reused
+	int nl_s;			// the socket on worker 0
+	struct sockaddr nl_name;	// its bound address
+	int nl_backlog;
+	int nl_nthreads;		// running accept threads
+	volatile uint32_t nl_head;
+	volatile uint32_t nl_tail;
+	struct ns_accepted nl_pending[NSPENDING];
+};
+
+struct ns_shared {
+	volatile uint32_t ns_lock;	// protects everything below
+	volatile uint32_t ns_gen;	// bumped on every ns_listen change
+	int ns_nworkers;
+	envid_t ns_workers[NSWORKER_MAX];
+	envid_t ns_input;
+	struct ns_listen ns_listen[NSLISTEN];
+	volatile uint32_t ns_loopdelay;	// msec looped packets are held
+};
+
+/* rss.c */
+extern int ns_worker;
+extern int ns_nworkers;
+uint32_t rss_hash(uint32_t saddr, uint32_t daddr, uint16_t sport, uint16_t dport);
+int rss_steer(struct jif_pkt *pkt, int nworkers);
 
 /* input.c */
-void input(envid_t ns_envid);
+void input(envid_t *workers, int nworkers);
 
 /* output.c */
 void output(envid_t ns_envid);
@@ -9,6 +9,90 @@ static void hexdump(const char *prefix, const void *data, int len);
 
 extern union Nsipc nsipcbuf;
 
+// Offsets into an Ethernet frame carrying IPv4.
+#define ETH_HLEN	14
+#define IP_PROTO_TCP	6
+#define IP_PROTO_UDP	17
+
+// The checksum context last loaded into the NIC.
+static struct tx_ctx_desc cur_ctx;
+static bool cur_ctx_valid;
+
+// Fold a 32-bit ones-complement sum of big-endian 16-bit words.
+static uint16_t
+csum_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return sum;
+}
+
+//
+// Set up checksum offload for the frame in pkt.
+// lwIP leaves IP, TCP and UDP checksums zero (see CHECKSUM_GEN_* in
+// lwipopts.h).  The NIC fills in the IP header checksum, and the TCP/UDP
+// checksum over the segment; it does not know about the pseudo header,
+// so its sum is seeded into the checksum field here.
+//
+// RETURNS:
+//   the POPTS for the data descriptor, 0 if nothing is offloaded.
+//   *ctx is filled in with the matching context.
+//
+static int
+tx_csum_prepare(struct jif_pkt *pkt, struct tx_ctx_desc *ctx)
+{
+	uint8_t *ip = (uint8_t *) pkt->jp_data + ETH_HLEN;
+	int ihl, len, proto, off;
+	uint8_t *l4;
+	uint32_t sum;
+
+	if (pkt->jp_len < ETH_HLEN + 20
+	    || pkt->jp_data[12] != 0x08 || pkt->jp_data[13] != 0x00
+	    || (ip[0] >> 4) != 4)
+		return 0;
+	ihl = (ip[0] & 0xf) * 4;
+	len = (ip[2] << 8) | ip[3];
+	proto = ip[9];
+	if (ihl < 20 || ETH_HLEN + len > pkt->jp_len)
+		return 0;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->ipcss = ETH_HLEN;
+	ctx->ipcso = ETH_HLEN + 10;
+	ctx->ipcse = ETH_HLEN + ihl - 1;
+	ctx->tucmd = TXD_TUCMD_IP;
+
+	// The NIC sees one fragment at a time, so lwIP computes the UDP
+	// checksum of datagrams it fragments itself (see udp_sendto_if).
+	// TCP is never fragmented by lwIP.
+	if ((ip[6] & 0x3f) || ip[7])
+		return TXD_POPTS_IXSM;
+	if (proto == IP_PROTO_TCP)
+		off = 16;
+	else if (proto == IP_PROTO_UDP)
+		off = 6;
+	else
+		return TXD_POPTS_IXSM;
+	if (len - ihl < off + 2)
+		return TXD_POPTS_IXSM;
+
+	// Pseudo header: source, destination, protocol, TCP/UDP length.
+	sum = ((ip[12] << 8) | ip[13]) + ((ip[14] << 8) | ip[15])
+	    + ((ip[16] << 8) | ip[17]) + ((ip[18] << 8) | ip[19])
+	    + proto + (len - ihl);
+	sum = csum_fold(sum);
+	l4 = ip + ihl;
+	l4[off] = sum >> 8;
+	l4[off + 1] = sum & 0xff;
+
+	ctx->tucss = ETH_HLEN + ihl;
+	ctx->tucso = ETH_HLEN + ihl + off;
+	ctx->tucse = ETH_HLEN + len - 1;
+	if (proto == IP_PROTO_TCP)
+		ctx->tucmd |= TXD_TUCMD_TCP;
+	return TXD_POPTS_IXSM | TXD_POPTS_TXSM;
+}
+
 void
 output(envid_t ns_envid)
 {
@@ -18,7 +102,8 @@ output(envid_t ns_envid)
 	// 	- read a packet from the network server
 	//	- send the packet to the device driver
 	struct tx_desc td;
-	int r;
+	struct tx_ctx_desc ctx;
+	int r, popts;
 	while(1) {
 
 		if (! sys_net_tx_table_available())
@@ -27,22 +112,39 @@ output(envid_t ns_envid)
 		r = sys_ipc_recv(&nsipcbuf);
 		if (r < 0)
 			continue;
-		if ((thisenv->env_ipc_from != ns_envid) ||
+		// Packets come from ns or from one of the ns workers it forked.
+		envid_t from = thisenv->env_ipc_from;
+		if ((from != ns_envid
+		     && envs[ENVX(from)].env_parent_id != ns_envid) ||
 		    (thisenv->env_ipc_value != NSREQ_OUTPUT)) {
 			continue;
 		}
 
-		memset(&td, 0, sizeof(td));
+		// Only load a new checksum context when the header layout
+		// changes; it stays in effect for the data descriptors after it.
+		popts = tx_csum_prepare(&nsipcbuf.pkt, &ctx);
+		if (popts && (! cur_ctx_valid
+		              || memcmp(&ctx, &cur_ctx, sizeof(ctx)) != 0)) {
+			ctx.tucmd |= TXD_CMD_DEXT;
+			r = sys_net_try_put_tx_desc((struct tx_desc *) &ctx, 0);
+			ctx.tucmd &= ~TXD_CMD_DEXT;
+			cur_ctx = ctx;
+			cur_ctx_valid = (r >= 0);
+		}
 
-		if (thisenv->env_ipc_value == NSREQ_OUTPUT) {
-			td.addr = (uint32_t)nsipcbuf.pkt.jp_data;
-			td.length = nsipcbuf.pkt.jp_len;
-			td.cmd = 9;
+		memset(&td, 0, sizeof(td));
+		td.addr = (uint32_t)nsipcbuf.pkt.jp_data;
+		td.length = nsipcbuf.pkt.jp_len;
+		td.cmd = TXD_CMD_EOP | TXD_CMD_RS;
+		if (popts && cur_ctx_valid) {
+			td.cmd |= TXD_CMD_DEXT;
+			td.cso = TXD_DTYP_D;
+			td.css = popts;
+		}
 #if debug
-			hexdump("debug output:", (void *)&nsipcbuf.pkt.jp_data, td.length);
+		hexdump("debug output:", (void *)&nsipcbuf.pkt.jp_data, td.length);
 #endif
-			r = sys_net_try_put_tx_desc(&td, 0);
-		}
+		r = sys_net_try_put_tx_desc(&td, 0);
 	}
 }
 
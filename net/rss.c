@@ -0,0 +1,90 @@
+#include "ns.h"
+
+// Receive-side scaling.
+//
+// The 82540EM has a single receive queue and no RSS, so ns_input does in
+// software what a multi-queue NIC does in hardware: hash each TCP/IPv4
+// flow with the Toeplitz function over (saddr, daddr, sport, dport) and
+// deliver it to the receive queue of one ns worker.  The hash and key are
+// the ones Microsoft's RSS specification uses, so the result matches
+// what an 82574 would report.
+
+// This worker's index, and the number of workers.
+int ns_worker;
+int ns_nworkers = 1;
+
+static const uint8_t rss_key[40] = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+	0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+	0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+	0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+	0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+//
+// Toeplitz hash of a TCP/IPv4 flow.  Addresses and ports are in network
+// byte order, as they appear in the packet.
+//
+uint32_t
+rss_hash(uint32_t saddr, uint32_t daddr, uint16_t sport, uint16_t dport)
+{
+	uint8_t in[12];
+	uint32_t hash = 0, v;
+	int i, b;
+
+	memcpy(in, &saddr, 4);
+	memcpy(in + 4, &daddr, 4);
+	memcpy(in + 8, &sport, 2);
+	memcpy(in + 10, &dport, 2);
+
+	v = (rss_key[0] << 24) | (rss_key[1] << 16)
+	    | (rss_key[2] << 8) | rss_key[3];
+	for (i = 0; i < sizeof(in); i++)
+		for (b = 0; b < 8; b++) {
+			if (in[i] & (0x80 >> b))
+				hash ^= v;
+			v <<= 1;
+			if (rss_key[i + 4] & (0x80 >> b))
+				v |= 1;
+		}
+	return hash;
+}
+
+//
+// Pick the worker that should process the frame in pkt.
+//
+// RETURNS:
+//   the worker index, [0, nworkers)
+//   -1 if every worker needs to see the frame (ARP, which only
+//      worker 0 answers)
+//
+int
+rss_steer(struct jif_pkt *pkt, int nworkers)
+{
+	uint8_t *f = (uint8_t *) pkt->jp_data;
+	uint8_t *ip, *tcp;
+	uint32_t saddr, daddr;
+	uint16_t sport, dport;
+	int ihl;
+
+	if (nworkers <= 1 || pkt->jp_len < 14)
+		return 0;
+	if (f[12] == 0x08 && f[13] == 0x06)
+		return -1;
+	if (f[12] != 0x08 || f[13] != 0x00 || pkt->jp_len < 14 + 20)
+		return 0;
+
+	// Everything but unfragmented TCP belongs to worker 0, which owns
+	// all UDP sockets.
+	ip = f + 14;
+	ihl = (ip[0] & 0xf) * 4;
+	if (ip[9] != 6 || (ip[6] & 0x3f) || ip[7]
+	    || pkt->jp_len < 14 + ihl + 4)
+		return 0;
+	tcp = ip + ihl;
+	memcpy(&saddr, ip + 12, 4);
+	memcpy(&daddr, ip + 16, 4);
+	memcpy(&sport, tcp, 2);
+	memcpy(&dport, tcp + 2, 2);
+	return rss_hash(saddr, daddr, sport, dport) % nworkers;
+}
@@ -26,9 +26,6 @@
 
 #include "ns.h"
 
-/* errno to make lwIP happy */
-int errno;
-
 struct netif nif;
 
 #define debug 0
@@ -42,40 +39,94 @@ struct timer_thread {
 static struct timer_thread t_arp;
 static struct timer_thread t_tcpf;
 static struct timer_thread t_tcps;
+static struct timer_thread t_tick;
 
-static envid_t timer_envid;
 static envid_t input_envid;
 static envid_t output_envid;
 
+// Transmit cost accounting, for NSREQ_STATS: payload bytes handed to
+// lwip_send and the cycles ns spent running (outside ipc_recv) since it
+// started.  Cycles per byte sent is the ratio of the differences between
+// two samples.
+static uint64_t tx_bytes;
+static uint64_t tx_cycles;
+
+// Cycles spent blocked in ns_recv, for NSREQ_STATS.
+static uint64_t blocked_cycles;
+
 static bool buse[QUEUE_SIZE];
+static uint8_t buf_npages[QUEUE_SIZE];	// data pages mapped at buf_data
+static int buf_next;
 static int next_i(int i) { return (i+1) % QUEUE_SIZE; }
-static int prev_i(int i) { return (i ? i-1 : QUEUE_SIZE-1); }
 
+// Returns a free request buffer, or NULL if all are in use.
 static void *
 get_buffer(void) {
-	void *va;
+	int i, n;
 
-	int i;
-	for (i = 0; i < QUEUE_SIZE; i++)
+	for (i = buf_next, n = 0; n < QUEUE_SIZE; i = next_i(i), n++)
 		if (!buse[i]) break;
+	if (n == QUEUE_SIZE)
+		return NULL;
 
-	if (i == QUEUE_SIZE) {
-		panic("NS: buffer overflow");
-		return 0;
-	}
-
-	va = (void *)(REQVA + i * PGSIZE);
 	buse[i] = 1;
+	buf_next = next_i(i);
+	return (void *)(REQVA + i * PGSIZE);
+}
+
+static int
+buf_index(void *va) {
+	return ((uint32_t)va - REQVA) / PGSIZE;
+}
 
-	return va;
+// Where the data pages that came with request buffer va are mapped.
+static void *
+buf_data(void *va) {
+	return (void *)(DATAVA + buf_index(va) * IPC_MAXPAGES * PGSIZE);
 }
 
 static void
 put_buffer(void *va) {
-	int i = ((uint32_t)va - REQVA) / PGSIZE;
+	int i = buf_index(va), j;
+
+	for (j = 0; j < buf_npages[i]; j++)
+		sys_page_unmap(0, buf_data(va) + j * PGSIZE);
+	buf_npages[i] = 0;
 	buse[i] = 0;
 }
 
+// Receive the next message into a free request buffer, returned in *va
+// (NULL if there was none), along with any data pages.  Gives up with
+// -E_TIMEOUT, and no buffer, when the next thread's deadline comes, so
+// that lwIP's timers need nothing to wake ns up.
+static int32_t
+ns_recv(envid_t *whom, void **va, int *perm)
+{
+	int npages = 0;
+	int32_t r;
+	uint32_t deadline, now, msec = ~0U;
+	uint64_t start;
+
+	if ((deadline = thread_deadline()) != ~0U) {
+		now = sys_time_msec();
+		msec = deadline > now ? deadline - now : 0;
+	}
+
+	*perm = 0;
+	start = read_tsc();
+	*va = get_buffer();
+	r = ipc_recv_pages(whom, *va, perm, *va ? buf_data(*va) : NULL,
+			   *va ? IPC_MAXPAGES : 0, &npages, msec);
+	blocked_cycles += read_tsc() - start;
+	if (*va)
+		buf_npages[buf_index(*va)] = npages;
+	if (r == -E_TIMEOUT && *va) {
+		put_buffer(*va);
+		*va = NULL;
+	}
+	return r;
+}
+
 static void
 lwip_init(struct netif *nif, void *if_state,
 	  uint32_t init_addr, uint32_t init_mask, uint32_t init_gw)
@@ -122,6 +173,8 @@ start_timer(struct timer_thread *t, void (*func)(void), const char *name, int ms
 		panic("cannot create timer thread: %s", e2s(r));
 }
 
+static void ns_tick(void);
+
 static void
 tcpip_init_done(void *arg)
 {
@@ -147,6 +200,13 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 	start_timer(&t_arp, &etharp_tmr, "arp timer", ARP_TMR_INTERVAL);
 	start_timer(&t_tcpf, &tcp_fasttmr, "tcp f timer", TCP_FAST_INTERVAL);
 	start_timer(&t_tcps, &tcp_slowtmr, "tcp s timer", TCP_SLOW_INTERVAL);
+	start_timer(&t_tick, &ns_tick, "ns tick", TIMER_INTERVAL);
+
+	lwip_core_unlock();
+
+	// Only worker 0 speaks for ns.
+	if (ns_worker != 0)
+		return;
 
 	struct in_addr ia = {ipaddr};
 	cprintf("ns: %02x:%02x:%02x:%02x:%02x:%02x"
@@ -155,47 +215,632 @@ serve_init(uint32_t ipaddr, uint32_t netmask, uint32_t gw)
 		nif.hwaddr[3], nif.hwaddr[4], nif.hwaddr[5],
 		inet_ntoa(ia));
 
-	lwip_core_unlock();
+	cprintf("NS: TCP/IP initialized, %d worker(s).\n", ns_nworkers);
+}
+
+static void
+tx_account(int n) {
+	tx_bytes += n;
+}
+
+// Spin lock for data shared between ns envs.
+static void
+ns_lock(volatile uint32_t *lock)
+{
+	while (xchg(lock, 1) != 0)
+		sys_yield();
+}
+
+static void
+ns_unlock(volatile uint32_t *lock)
+{
+	xchg(lock, 0);
+}
+
+// Poke another worker.  This is best effort: workers also look at the
+// shared state on every timer tick, so a busy target just sees the
+// change a little later.
+static void
+ns_notify(envid_t to)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		if (sys_ipc_try_send(to, NSREQ_SYNC, SYS_IPC_NOPAGE, 0)
+		    != -E_IPC_NOT_RECV)
+			return;
+		sys_yield();
+	}
+}
+
+//
+// Shared listening sockets.
+//
+// A listening socket lives on worker 0, but the RSS hash spreads new
+// connections over all workers.  So every worker keeps its own copy of
+// each listening socket in NSSHARED->ns_listen, bound to the same
+// address, and runs an accept thread on it that queues what it accepts
+// in nl_pending.  NSREQ_ACCEPT on worker 0 hands out queued connections,
+// whichever worker they live on; later requests for them go straight to
+// that worker, see NSSOCK.
+//
+
+// This worker's copy of each shared listening socket, -1 if none,
+// and the nl_id it was opened for.
+static int listen_s[NSLISTEN];
+static uint32_t listen_id[NSLISTEN];
+// NSSHARED->ns_gen as of the last listen_sync.
+static uint32_t listen_gen;
+
+static void parked_event(int s);
+
+// Queue an accepted connection on l.
+// Returns 1 on success, 0 if l is full, -1 if l is no longer listening.
+static int
+listen_push(struct ns_listen *l, uint32_t id, struct ns_accepted *a)
+{
+	int r = 1;
 
-	cprintf("NS: TCP/IP initialized.\n");
+	ns_lock(&NSSHARED->ns_lock);
+	if (l->nl_id != id || l->nl_state != NSL_LISTEN)
+		r = -1;
+	else if (l->nl_tail - l->nl_head == NSPENDING)
+		r = 0;
+	else
+		l->nl_pending[l->nl_tail++ % NSPENDING] = *a;
+	ns_unlock(&NSSHARED->ns_lock);
+	return r;
+}
+
+// Take the oldest queued connection off l.  Returns 0 if l is empty.
+static int
+listen_pop(struct ns_listen *l, struct ns_accepted *a)
+{
+	int r = 0;
+
+	ns_lock(&NSSHARED->ns_lock);
+	if (l->nl_head != l->nl_tail) {
+		*a = l->nl_pending[l->nl_head++ % NSPENDING];
+		r = 1;
+	}
+	ns_unlock(&NSSHARED->ns_lock);
+	return r;
+}
+
+//
+// Accept connections on this worker's copy of shared listening socket i
+// and queue them for NSREQ_ACCEPT on worker 0.  Once the socket is shut
+// down, close it along with any of our connections still queued, and
+// free the slot if we are the last one out.
+//
+static void
+accept_thread(uint32_t i)
+{
+	struct ns_listen *l = &NSSHARED->ns_listen[i];
+	uint32_t id = listen_id[i], head;
+	int s = listen_s[i], envx = ENVX(thisenv->env_id);
+	int r, j, n, ndrop = 0, tmo = TIMER_INTERVAL;
+	int drop[NSPENDING + 1];
+	struct ns_accepted a;
+
+	// Wake up now and then to notice the socket being shut down.
+	lwip_setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+
+	while (l->nl_id == id && l->nl_state == NSL_LISTEN) {
+		a.na_addrlen = sizeof(a.na_addr);
+		if ((r = lwip_accept(s, &a.na_addr, &a.na_addrlen)) < 0)
+			continue;
+		a.na_s = NSSOCK(envx, r);
+
+		while ((n = listen_push(l, id, &a)) == 0) {
+			head = l->nl_head;
+			thread_wait(&l->nl_head, head,
+				    sys_time_msec() + TIMER_INTERVAL);
+		}
+		if (n < 0) {
+			drop[ndrop++] = r;
+			break;
+		}
+		if (ns_worker == 0) {
+			thread_wakeup(&l->nl_tail);
+			parked_event(listen_s[i]);
+		} else
+			ns_notify(NSSHARED->ns_workers[0]);
+	}
+
+	ns_lock(&NSSHARED->ns_lock);
+	if (l->nl_id == id) {
+		n = 0;
+		for (j = l->nl_head; j != l->nl_tail; j++) {
+			a = l->nl_pending[j % NSPENDING];
+			if (NSSOCK_ENVX(a.na_s) == envx)
+				drop[ndrop++] = NSSOCK_LOCAL(a.na_s);
+			else
+				l->nl_pending[(l->nl_head + n++) % NSPENDING] = a;
+		}
+		l->nl_tail = l->nl_head + n;
+		if (--l->nl_nthreads == 0)
+			l->nl_state = NSL_FREE;
+	}
+	ns_unlock(&NSSHARED->ns_lock);
+
+	for (j = 0; j < ndrop; j++)
+		lwip_close(drop[j]);
+	lwip_close(s);
+	listen_s[i] = -1;
+}
+
+// Returns the shared listening slot of socket s on worker 0, or -1.
+static int
+listen_find(int s)
+{
+	int i;
+
+	if (ns_worker != 0 || ns_nworkers == 1)
+		return -1;
+	for (i = 0; i < NSLISTEN; i++)
+		if (listen_s[i] == s
+		    && NSSHARED->ns_listen[i].nl_state == NSL_LISTEN)
+			return i;
+	return -1;
 }
 
+//
+// Share the listening socket s on worker 0 with the other workers.
+// Waits a little for them to open their copies, so that the first
+// connections steered to them are not refused.
+//
 static void
-process_timer(envid_t envid) {
-	uint32_t start, now, to;
+listen_share(int s, int backlog)
+{
+	struct ns_shared *sh = NSSHARED;
+	struct ns_listen *l;
+	struct sockaddr name;
+	socklen_t namelen = sizeof(name);
+	uint32_t deadline;
+	int i;
 
-	if (envid != timer_envid) {
-		cprintf("NS: received timer interrupt from envid %x not timer env\n", envid);
+	if (ns_worker != 0 || ns_nworkers == 1 || listen_find(s) >= 0)
+		return;
+	if (lwip_getsockname(s, &name, &namelen) < 0)
+		return;
+
+	ns_lock(&sh->ns_lock);
+	for (i = 0; i < NSLISTEN; i++)
+		if (sh->ns_listen[i].nl_state == NSL_FREE)
+			break;
+	if (i == NSLISTEN) {
+		ns_unlock(&sh->ns_lock);
+		cprintf("NS: out of shared listen slots, "
+			"socket %d stays on worker 0\n", s);
 		return;
 	}
+	l = &sh->ns_listen[i];
+	l->nl_state = NSL_LISTEN;
+	l->nl_id++;
+	l->nl_s = s;
+	l->nl_name = name;
+	l->nl_backlog = backlog;
+	l->nl_nthreads = 1;
+	l->nl_head = l->nl_tail = 0;
+	sh->ns_gen++;
+	ns_unlock(&sh->ns_lock);
 
-	start = sys_time_msec();
-	thread_yield();
-	now = sys_time_msec();
+	listen_s[i] = s;
+	listen_id[i] = l->nl_id;
+	thread_create(0, "accept", accept_thread, i);
 
-	to = TIMER_INTERVAL - (now - start);
-	ipc_send(envid, to, 0, 0);
+	for (i = 1; i < ns_nworkers; i++)
+		ns_notify(sh->ns_workers[i]);
+	deadline = sys_time_msec() + 4 * TIMER_INTERVAL;
+	while (l->nl_nthreads < ns_nworkers && sys_time_msec() < deadline)
+		thread_wait(0, 0, sys_time_msec() + 10);
 }
 
-struct st_args {
-	int32_t reqno;
-	uint32_t whom;
-	union Nsipc *req;
-};
+//
+// Hand out a connection accepted on shared listening slot i, waiting
+// for one unless nonblock.
+//
+// RETURNS:
+//   the NSSOCK id of the connection, >= 0
+//   -E_INVAL if the socket was closed meanwhile
+//   -E_WOULDBLOCK if nonblock and there is no connection yet
+//
+static int
+listen_accept(int i, struct sockaddr *addr, socklen_t *addrlen, bool nonblock)
+{
+	struct ns_listen *l = &NSSHARED->ns_listen[i];
+	uint32_t id = l->nl_id, tail;
+	struct ns_accepted a;
 
+	while (! listen_pop(l, &a)) {
+		if (l->nl_id != id || l->nl_state != NSL_LISTEN)
+			return -E_INVAL;
+		if (nonblock)
+			return -E_WOULDBLOCK;
+		tail = l->nl_tail;
+		thread_wait(&l->nl_tail, tail, sys_time_msec() + TIMER_INTERVAL);
+	}
+	if (*addrlen > a.na_addrlen)
+		*addrlen = a.na_addrlen;
+	memmove(addr, &a.na_addr, *addrlen);
+	return a.na_s;
+}
+
+// Shut down shared listening slot i and wait for our accept thread to
+// close the socket.
+static int
+listen_close(int i)
+{
+	struct ns_shared *sh = NSSHARED;
+	int k;
+
+	ns_lock(&sh->ns_lock);
+	sh->ns_listen[i].nl_state = NSL_CLOSED;
+	sh->ns_gen++;
+	ns_unlock(&sh->ns_lock);
+
+	for (k = 1; k < ns_nworkers; k++)
+		ns_notify(sh->ns_workers[k]);
+	thread_wakeup(&sh->ns_listen[i].nl_tail);
+	while (listen_s[i] >= 0)
+		thread_wait(0, 0, sys_time_msec() + 10);
+	return 0;
+}
+
+//
+// Open this worker's copies of listening sockets shared since we last
+// looked.  Copies of sockets that were closed go away by themselves,
+// see accept_thread.
+//
 static void
-serve_thread(uint32_t a) {
-	struct st_args *args = (struct st_args *)a;
-	union Nsipc *req = args->req;
+listen_sync(void)
+{
+	struct ns_shared *sh = NSSHARED;
+	struct ns_listen *l;
+	struct sockaddr name;
+	uint32_t gen = sh->ns_gen, id;
+	int i, s, backlog;
+
+	if (ns_worker == 0 || gen == listen_gen)
+		return;
+	listen_gen = gen;
+
+	for (i = 0; i < NSLISTEN; i++) {
+		l = &sh->ns_listen[i];
+		ns_lock(&sh->ns_lock);
+		if (l->nl_state != NSL_LISTEN || listen_s[i] >= 0
+		    || listen_id[i] == l->nl_id) {
+			ns_unlock(&sh->ns_lock);
+			continue;
+		}
+		id = l->nl_id;
+		name = l->nl_name;
+		backlog = l->nl_backlog;
+		l->nl_nthreads++;
+		ns_unlock(&sh->ns_lock);
+
+		listen_id[i] = id;
+		if ((s = lwip_socket(AF_INET, SOCK_STREAM, 0)) < 0
+		    || lwip_bind(s, &name, sizeof(name)) < 0
+		    || lwip_listen(s, backlog) < 0) {
+			cprintf("NS: worker %d cannot listen on slot %d\n",
+				ns_worker, i);
+			if (s >= 0)
+				lwip_close(s);
+			ns_lock(&sh->ns_lock);
+			if (l->nl_id == id && --l->nl_nthreads == 0)
+				l->nl_state = NSL_FREE;
+			ns_unlock(&sh->ns_lock);
+			continue;
+		}
+		listen_s[i] = s;
+		thread_create(0, "accept", accept_thread, i);
+	}
+}
+
+// Let NSREQ_ACCEPT threads and epoll watchers look for connections
+// queued by other workers.
+static void
+listen_wakeup(void)
+{
+	int i;
+
+	for (i = 0; i < NSLISTEN; i++) {
+		thread_wakeup(&NSSHARED->ns_listen[i].nl_tail);
+		if (ns_worker == 0 && listen_s[i] >= 0)
+			parked_event(listen_s[i]);
+	}
+}
+
+// Requests name sockets by the NSSOCK id we handed out.  Check that the
+// socket belongs to this worker and turn the id into the lwIP one.
+static bool
+nssock_own(union Nsipc *req)
+{
+	int s = req->accept.req_s;
+
+	if (s < 0 || NSSOCK_ENVX(s) != ENVX(thisenv->env_id))
+		return 0;
+	// Every request that names a socket starts with req_s.
+	req->accept.req_s = NSSOCK_LOCAL(s);
+	return 1;
+}
+
+//
+// Requests to the file server, for sendfile.
+//
+// Its replies arrive through the ipc_recv in serve like any request, so
+// only one may be outstanding at a time; fs_map hands the reply over.
+//
+static envid_t fs_envid;
+static volatile uint32_t fs_busy, fs_done;
+static int fs_ret;
+static void *fs_page;
+
+// Map the block of fileid holding byte offset at a request buffer.
+// Returns the number of file bytes in the block and the buffer in *pg,
+// which the caller must put_buffer, or <= 0 and no buffer.
+static int
+fs_map(int fileid, off_t offset, void **pg)
+{
+	union Fsipc *fsreq;
 	int r;
 
-	switch (args->reqno) {
+	while (fs_busy)
+		thread_wait(&fs_busy, 1, sys_time_msec() + TIMER_INTERVAL);
+	fs_busy = 1;
+
+	if (!fs_envid)
+		fs_envid = ipc_find_env(ENV_TYPE_FS);
+	if (!(fsreq = get_buffer())) {
+		r = -E_NO_MEM;
+		goto out;
+	}
+	if ((r = sys_page_alloc(0, fsreq, PTE_P|PTE_U|PTE_W)) < 0) {
+		put_buffer(fsreq);
+		goto out;
+	}
+	fsreq->map.req_fileid = fileid;
+	fsreq->map.req_offset = offset;
+	fs_done = 0;
+	ipc_send(fs_envid, FSREQ_MAP, fsreq, PTE_P|PTE_U|PTE_W);
+	sys_page_unmap(0, fsreq);
+	put_buffer(fsreq);
+
+	while (!fs_done)
+		thread_wait(&fs_done, 0, sys_time_msec() + TIMER_INTERVAL);
+	r = fs_ret;
+	*pg = fs_page;
+	if (r <= 0 && fs_page)
+		put_buffer(fs_page);
+out:
+	fs_busy = 0;
+	thread_wakeup(&fs_busy);
+	return r;
+}
+
+// Send req_count bytes of a file straight from the file server's block
+// cache.  lwip_write copies them into TCP segments, so each block is
+// unmapped again as soon as it is queued.
+static int
+serve_sendfile(struct Nsreq_sendfile *req)
+{
+	off_t offset = req->req_offset;
+	size_t left = req->req_count;
+	int r = 0, n, sent = 0;
+	void *pg;
+
+	if (offset < 0)
+		return -E_INVAL;
+	while (left > 0) {
+		if ((r = fs_map(req->req_fileid, offset, &pg)) <= 0)
+			break;
+		n = MIN((size_t) r - offset % PGSIZE, left);
+		r = lwip_write(req->req_s, (char *) pg + offset % PGSIZE, n);
+		put_buffer(pg);
+		if (r <= 0)
+			break;
+		tx_account(r);
+		sent += r;
+		offset += r;
+		left -= r;
+	}
+	return sent > 0 ? sent : r;
+}
+
+// Sockets with a non-blocking connect under way, see connect_thread.
+static bool connecting[MEMP_NUM_NETCONN];
+
+// Did the client ask request reqno not to wait?
+static bool
+req_nonblock(int32_t reqno, union Nsipc *req)
+{
+	switch (reqno) {
+	case NSREQ_ACCEPT:
+		return req->accept.req_flags & MSG_DONTWAIT;
+	case NSREQ_CONNECT:
+		return req->connect.req_flags & MSG_DONTWAIT;
+	case NSREQ_RECV:
+		return req->recv.req_flags & MSG_DONTWAIT;
+	case NSREQ_SEND:
+		return req->send.req_flags & MSG_DONTWAIT;
+	default:
+		return 0;
+	}
+}
+
+//
+// Socket readiness for epoll.
+//
+// NSREQ_POLL leaves a one-shot watch on every socket that was not ready,
+// and the next lwIP event that makes it ready wakes the env out of
+// sys_env_sleep, see parked_run.  A socket has up to NWATCH watchers at
+// a time, so that pre-forked servers can share a listening socket.
+//
+#define NWATCH 8
+
+static struct {
+	envid_t w_env;
+	uint32_t w_events;
+} watch[MEMP_NUM_NETCONN][NWATCH];
+static uint8_t nwatch[MEMP_NUM_NETCONN];
+
+// Which of events are ready on socket s.
+static uint32_t
+sock_ready(int s, uint32_t events)
+{
+	struct ns_listen *l;
+	uint32_t revents = 0;
+	int i;
+
+	if (connecting[s])
+		return 0;
+	// connections on shared listening sockets queue up in NSSHARED
+	if ((i = listen_find(s)) >= 0) {
+		l = &NSSHARED->ns_listen[i];
+		if (l->nl_head != l->nl_tail)
+			revents |= EPOLLIN;
+		return revents & events;
+	}
+	if ((events & EPOLLIN) && lwip_recv_ready(s))
+		revents |= EPOLLIN;
+	if ((events & EPOLLOUT) && lwip_send_ready(s, NSIPC_INLINE))
+		revents |= EPOLLOUT;
+	return revents;
+}
+
+// Have whom woken when any of events becomes ready on socket s.
+static int
+watch_add(int s, envid_t whom, uint32_t events)
+{
+	int i;
+
+	for (i = 0; i < nwatch[s]; i++)
+		if (watch[s][i].w_env == whom)
+			break;
+	if (i == NWATCH)
+		return -E_NO_MEM;
+	if (i == nwatch[s])
+		nwatch[s]++;
+	watch[s][i].w_env = whom;
+	watch[s][i].w_events = events;
+	return 0;
+}
+
+// Wake the envs watching socket s that s has become ready for.
+static void
+watch_check(int s)
+{
+	int i;
+
+	for (i = 0; i < nwatch[s]; i++)
+		if (sock_ready(s, watch[s][i].w_events)) {
+			sys_env_wake(watch[s][i].w_env);
+			watch[s][i--] = watch[s][--nwatch[s]];
+		}
+}
+
+static int
+serve_poll(envid_t whom, struct Nsreq_poll *req)
+{
+	struct Nspollfd *pf;
+	int i, s, n = 0, envx = ENVX(thisenv->env_id);
+
+	if (req->req_n < 0 || req->req_n > NSPOLL_MAX)
+		return -E_INVAL;
+	for (i = 0; i < req->req_n; i++) {
+		pf = &req->req_fds[i];
+		s = NSSOCK_LOCAL(pf->pf_s);
+		if (pf->pf_s < 0 || NSSOCK_ENVX(pf->pf_s) != envx
+		    || s >= MEMP_NUM_NETCONN) {
+			pf->pf_revents = EPOLLERR;
+			n++;
+			continue;
+		}
+		if ((pf->pf_revents = sock_ready(s, pf->pf_events))) {
+			n++;
+			continue;
+		}
+		// with no room to watch, let the env look again
+		if (watch_add(s, whom, pf->pf_events) < 0) {
+			pf->pf_revents = pf->pf_events;
+			n++;
+		}
+	}
+	return n;
+}
+
+// Names of lwIP's memory pools, as in memp.c.
+static const char *pool_names[MEMP_MAX] = {
+#define LWIP_MEMPOOL(name,num,size,desc) desc,
+#include <lwip/memp_std.h>
+};
+
+// Report this worker's heap and pool usage.
+static void
+serve_stats(struct Nsret_stats *ret)
+{
+	struct stats_mem *sm;
+	int i;
+
+	static_assert(NSWORKER_MAX <= NSSTATS_WORKERS);
+	static_assert(MEMP_MAX + 1 <= NSSTATS_POOLS);
+
+	ret->ret_tsc = read_tsc();
+	ret->ret_blocked = blocked_cycles;
+	ret->ret_tx_bytes = tx_bytes;
+	ret->ret_tx_cycles = tx_cycles;
+	ret->ret_rx_frames = jif_rx_frames;
+	ret->ret_rx_pbufs = jif_rx_pbufs;
+	ret->ret_rx_npkts = RXRING->rr_npkts;
+	ret->ret_rx_nstall = RXRING->rr_nstall;
+	ret->ret_nworkers = NSSHARED->ns_nworkers;
+	for (i = 0; i < NSSHARED->ns_nworkers; i++)
+		ret->ret_workers[i] = NSSHARED->ns_workers[i];
+	ret->ret_npools = MEMP_MAX + 1;
+	for (i = 0; i <= MEMP_MAX; i++) {
+		sm = i == 0 ? &lwip_stats.mem : &lwip_stats.memp[i - 1];
+		strncpy(ret->ret_pools[i].ps_name,
+			i == 0 ? "HEAP" : pool_names[i - 1],
+			sizeof(ret->ret_pools[i].ps_name) - 1);
+		ret->ret_pools[i].ps_name[sizeof(ret->ret_pools[i].ps_name) - 1] = 0;
+		ret->ret_pools[i].ps_avail = sm->avail;
+		ret->ret_pools[i].ps_used = sm->used;
+		ret->ret_pools[i].ps_max = sm->max;
+		ret->ret_pools[i].ps_err = sm->err;
+	}
+}
+
+// The len bytes at offset off into the npages data pages that came
+// with req, or NULL if they did not all come.
+static void *
+req_data(union Nsipc *req, int off, int len, int npages)
+{
+	if (npages != buf_npages[buf_index(req)] || off < 0 || off >= PGSIZE
+	    || len < 0 || off + len > npages * PGSIZE)
+		return NULL;
+	return buf_data(req) + off;
+}
+
+// Carry out request reqno from whom, with its arguments in req.
+static int
+serve_req(int32_t reqno, envid_t whom, union Nsipc *req)
+{
+	int r, i, envx = ENVX(thisenv->env_id);
+	void *data;
+
+	switch (reqno) {
 	case NSREQ_ACCEPT:
 	{
 		struct Nsret_accept ret;
 		ret.ret_addrlen = req->accept.req_addrlen;
-		r = lwip_accept(req->accept.req_s, &ret.ret_addr,
-				&ret.ret_addrlen);
+		if ((i = listen_find(req->accept.req_s)) >= 0)
+			r = listen_accept(i, &ret.ret_addr, &ret.ret_addrlen,
+					  req_nonblock(reqno, req));
+		else if ((r = lwip_accept(req->accept.req_s, &ret.ret_addr,
+					  &ret.ret_addrlen)) >= 0)
+			r = NSSOCK(envx, r);
 		memmove(req, &ret, sizeof ret);
 		break;
 	}
@@ -207,7 +852,10 @@ serve_thread(uint32_t a) {
 		r = lwip_shutdown(req->shutdown.req_s, req->shutdown.req_how);
 		break;
 	case NSREQ_CLOSE:
-		r = lwip_close(req->close.req_s);
+		if ((i = listen_find(req->close.req_s)) >= 0)
+			r = listen_close(i);
+		else
+			r = lwip_close(req->close.req_s);
 		break;
 	case NSREQ_CONNECT:
 		r = lwip_connect(req->connect.req_s, &req->connect.req_name,
@@ -215,91 +863,566 @@ serve_thread(uint32_t a) {
 		break;
 	case NSREQ_LISTEN:
 		r = lwip_listen(req->listen.req_s, req->listen.req_backlog);
+		if (r == 0)
+			listen_share(req->listen.req_s, req->listen.req_backlog);
 		break;
 	case NSREQ_RECV:
+		if (req->recv.req_npages) {
+			if (!(data = req_data(req, req->recv.req_off,
+					      req->recv.req_len,
+					      req->recv.req_npages))) {
+				r = -E_INVAL;
+				break;
+			}
+			r = lwip_recv(req->recv.req_s, data,
+				      req->recv.req_len, req->recv.req_flags);
+			break;
+		}
 		// Note that we read the request fields before we
 		// overwrite it with the response data.
 		r = lwip_recv(req->recv.req_s, req->recvRet.ret_buf,
 			      req->recv.req_len, req->recv.req_flags);
 		break;
 	case NSREQ_SEND:
-		r = lwip_send(req->send.req_s, &req->send.req_buf,
-			      req->send.req_size, req->send.req_flags);
+		if (req->send.req_npages) {
+			if (!(data = req_data(req, req->send.req_off,
+					      req->send.req_size,
+					      req->send.req_npages))) {
+				r = -E_INVAL;
+				break;
+			}
+			// Only take what fits, so as not to wait for the
+			// peer; the client sends the rest in another request.
+			r = lwip_send(req->send.req_s, data,
+				      MIN(req->send.req_size,
+					  lwip_send_room(req->send.req_s)),
+				      req->send.req_flags);
+		} else if (req->send.req_flags & MSG_DONTWAIT)
+			r = lwip_send(req->send.req_s, &req->send.req_buf,
+				      MIN(req->send.req_size,
+					  lwip_send_room(req->send.req_s)),
+				      req->send.req_flags);
+		else
+			r = lwip_send(req->send.req_s, &req->send.req_buf,
+				      req->send.req_size, req->send.req_flags);
+		if (r > 0)
+			tx_account(r);
+		break;
+	case NSREQ_SENDFILE:
+		r = serve_sendfile(&req->sendfile);
+		break;
+	case NSREQ_POLL:
+		r = serve_poll(whom, &req->poll);
+		break;
+	case NSREQ_LOOPDELAY:
+		NSSHARED->ns_loopdelay = req->loopdelay.req_msec;
+		r = 0;
+		break;
+	case NSREQ_STATS:
+		serve_stats(&req->statsRet);
+		r = 0;
 		break;
 	case NSREQ_SOCKET:
 		r = lwip_socket(req->socket.req_domain, req->socket.req_type,
 				req->socket.req_protocol);
-		break;
-	case NSREQ_INPUT:
-		jif_input(&nif, (void *)&req->pkt);
-		r = 0;
+		if (r >= 0)
+			r = NSSOCK(envx, r);
 		break;
 	default:
-		cprintf("Invalid request code %d from %08x\n", args->whom, args->req);
+		cprintf("Invalid request code %d from %08x\n", whom, req);
 		r = -E_INVAL;
 		break;
 	}
 
+	return r;
+}
+
+// Send whom the result r of request reqno and free its request page.
+static void
+serve_reply(int32_t reqno, envid_t whom, union Nsipc *req, int r)
+{
 	if (r == -1) {
 		char buf[100];
-		snprintf(buf, sizeof buf, "ns req type %d", args->reqno);
+		snprintf(buf, sizeof buf, "ns req type %d", reqno);
 		perror(buf);
 	}
 
-	if (args->reqno != NSREQ_INPUT)
-		ipc_send(args->whom, r, 0, 0);
+	ipc_send(whom, r, 0, 0);
+
+	put_buffer(req);
+	sys_page_unmap(0, (void*) req);
+}
+
+struct st_args {
+	int32_t reqno;
+	uint32_t whom;
+	union Nsipc *req;
+};
+
+static void
+serve_thread(uint32_t a) {
+	struct st_args *args = (struct st_args *)a;
+
+	serve_reply(args->reqno, args->whom, args->req,
+		    serve_req(args->reqno, args->whom, args->req));
+	free(args);
+}
+
+struct ct_args {
+	int s;
+	struct sockaddr name;
+	socklen_t namelen;
+};
+
+// Carry out a non-blocking connect, whose client has already been told
+// -E_INPROGRESS.  Recv and send on the socket wait until it is done;
+// then the socket becomes ready one way or the other.
+static void
+connect_thread(uint32_t a) {
+	struct ct_args *args = (struct ct_args *)a;
 
-	put_buffer(args->req);
-	sys_page_unmap(0, (void*) args->req);
+	lwip_connect(args->s, &args->name, args->namelen);
+	connecting[args->s] = 0;
+	parked_event(args->s);
 	free(args);
 }
 
+// Does request reqno wait for something other than data or connections
+// arriving on its socket?  Those get a thread of their own.
+static bool
+serve_blocks(int32_t reqno, union Nsipc *req)
+{
+	switch (reqno) {
+	case NSREQ_CONNECT:
+	case NSREQ_SENDFILE:
+		return 1;
+	case NSREQ_ACCEPT:
+		return listen_find(req->accept.req_s) >= 0
+			&& !req_nonblock(reqno, req);
+	case NSREQ_CLOSE:
+		return listen_find(req->accept.req_s) >= 0;
+	case NSREQ_LISTEN:
+		return ns_worker == 0 && ns_nworkers > 1;
+	default:
+		return 0;
+	}
+}
+
+// Would request reqno complete without waiting?
+static bool
+serve_ready(int32_t reqno, union Nsipc *req)
+{
+	int s = req->accept.req_s;
+
+	switch (reqno) {
+	case NSREQ_ACCEPT:
+	case NSREQ_RECV:
+		return !connecting[s] && lwip_recv_ready(s);
+	case NSREQ_SEND:
+		if (connecting[s])
+			return 0;
+		// a non-blocking send takes whatever fits
+		if (req->send.req_flags & MSG_DONTWAIT)
+			return lwip_send_room(s) > 0;
+		// a large send need only find room for part of its data
+		if (req->send.req_npages)
+			return lwip_send_ready(req->send.req_s,
+					       MIN(req->send.req_size, TCP_SND_BUF / 2));
+		return lwip_send_ready(req->send.req_s, req->send.req_size);
+	default:
+		return 1;
+	}
+}
+
+//
+// Parked requests.
+//
+// A recv, send or accept that would block waits in a per-socket FIFO
+// until lwIP reports an event on the socket (lwip_socket_event), and is
+// then retried from serve's loop.  Every parked request holds a request
+// buffer, so the table is indexed like the buffers.
+//
+struct parked {
+	int32_t p_reqno;
+	envid_t p_whom;
+	union Nsipc *p_req;
+	struct parked *p_next;
+};
+
+static struct parked parked[QUEUE_SIZE];
+static struct parked *parked_head[MEMP_NUM_NETCONN];
+static bool parked_ev[MEMP_NUM_NETCONN];
+static bool parked_events;
+
+static void
+parked_event(int s)
+{
+	if (s >= 0 && s < MEMP_NUM_NETCONN
+	    && (parked_head[s] || nwatch[s])) {
+		parked_ev[s] = 1;
+		parked_events = 1;
+	}
+}
+
+// Is a request of type reqno already waiting on socket s?
+static bool
+parked_on(int s, int32_t reqno)
+{
+	struct parked *p;
+
+	for (p = parked_head[s]; p; p = p->p_next)
+		if (p->p_reqno == reqno)
+			return 1;
+	return 0;
+}
+
+static void
+park(int s, int32_t reqno, envid_t whom, union Nsipc *req)
+{
+	struct parked *p = &parked[buf_index(req)], **pp;
+
+	p->p_reqno = reqno;
+	p->p_whom = whom;
+	p->p_req = req;
+	p->p_next = NULL;
+	for (pp = &parked_head[s]; *pp; pp = &(*pp)->p_next)
+		;
+	*pp = p;
+}
+
+// Complete whatever requests parked on socket s can complete now,
+// keeping requests of the same type in order.
+static void
+parked_retry(int s)
+{
+	struct parked *p, **pp = &parked_head[s];
+	uint32_t blocked = 0;
+
+	while ((p = *pp)) {
+		if ((blocked & (1 << p->p_reqno))
+		    || !serve_ready(p->p_reqno, p->p_req)) {
+			blocked |= 1 << p->p_reqno;
+			pp = &p->p_next;
+			continue;
+		}
+		*pp = p->p_next;
+		serve_reply(p->p_reqno, p->p_whom, p->p_req,
+			    serve_req(p->p_reqno, p->p_whom, p->p_req));
+		// lwIP ran meanwhile, so start over
+		pp = &parked_head[s];
+		blocked = 0;
+	}
+}
+
+// Retry every socket that had an event since the last call.
+static void
+parked_run(void)
+{
+	int s;
+
+	while (parked_events) {
+		parked_events = 0;
+		for (s = 0; s < MEMP_NUM_NETCONN; s++)
+			if (parked_ev[s]) {
+				parked_ev[s] = 0;
+				parked_retry(s);
+				watch_check(s);
+			}
+	}
+}
+
+// Retry everything, in case an event went missing.
+static void
+parked_poll(void)
+{
+	int s;
+
+	for (s = 0; s < MEMP_NUM_NETCONN; s++)
+		parked_event(s);
+}
+
+// Every TIMER_INTERVAL: look for connections other workers queued, and
+// retry parked requests in case their events went missing.
+static void
+ns_tick(void)
+{
+	listen_wakeup();
+	parked_poll();
+}
+
+//
+// Handle request reqno from whom.  Most requests complete right here,
+// in serve's own thread; requests that have to wait for their socket
+// are parked, and the few that wait for anything else get a thread.
+//
+static void
+dispatch(int32_t reqno, envid_t whom, union Nsipc *req)
+{
+	int s;
+
+	if (reqno != NSREQ_SOCKET && reqno != NSREQ_POLL
+	    && reqno != NSREQ_LOOPDELAY && reqno != NSREQ_STATS
+	    && ! nssock_own(req)) {
+		cprintf("NS: request %d from %08x for socket %08x of another worker\n",
+			reqno, whom, req->accept.req_s);
+		reqno = 0;
+	}
+
+	if (reqno == NSREQ_CONNECT && req_nonblock(reqno, req)
+	    && (s = req->connect.req_s) < MEMP_NUM_NETCONN) {
+		struct ct_args *args = malloc(sizeof(struct ct_args));
+		if (!args || connecting[s]) {
+			free(args);
+			serve_reply(reqno, whom, req,
+				    args ? -E_INPROGRESS : -E_NO_MEM);
+			return;
+		}
+		args->s = s;
+		args->name = req->connect.req_name;
+		args->namelen = req->connect.req_namelen;
+		connecting[s] = 1;
+		serve_reply(reqno, whom, req, -E_INPROGRESS);
+		thread_create(0, "connect_thread", connect_thread, (uint32_t)args);
+		return;
+	}
+
+	if (serve_blocks(reqno, req)) {
+		struct st_args *args = malloc(sizeof(struct st_args));
+		if (!args) {
+			serve_reply(reqno, whom, req, -E_NO_MEM);
+			return;
+		}
+		args->reqno = reqno;
+		args->whom = whom;
+		args->req = req;
+		thread_create(0, "serve_thread", serve_thread, (uint32_t)args);
+		thread_yield(); // let the thread created run
+		return;
+	}
+
+	s = (reqno == NSREQ_SOCKET || reqno == NSREQ_POLL
+	     || reqno == NSREQ_LOOPDELAY || reqno == NSREQ_STATS || reqno == 0)
+		? -1 : req->accept.req_s;
+	if (s >= 0 && s < MEMP_NUM_NETCONN
+	    && (parked_on(s, reqno) || !serve_ready(reqno, req))) {
+		if (req_nonblock(reqno, req))
+			serve_reply(reqno, whom, req, -E_WOULDBLOCK);
+		else
+			park(s, reqno, whom, req);
+		return;
+	}
+
+	serve_reply(reqno, whom, req, serve_req(reqno, whom, req));
+
+	// Fail whatever was still waiting on a closed socket before its
+	// number is reused.
+	if (reqno == NSREQ_CLOSE && s >= 0 && s < MEMP_NUM_NETCONN) {
+		parked_retry(s);
+		nwatch[s] = 0;
+	}
+}
+
+// Done with rx buffer i.  ARP frames go to every worker, so the buffer
+// only goes back to the driver once the last of them is done.
+static void
+rx_release(int i)
+{
+	ns_lock(&RXRING->rr_free_lock);
+	if (--RXRING->rr_ref[i] == 0)
+		rx_queue_push(&RXRING->rr_free, i);
+	ns_unlock(&RXRING->rr_free_lock);
+}
+
+// Feed every packet ns_input has queued for this worker to lwIP and
+// hand the buffers back.  jif_input copies the frame into a pbuf, so the
+// buffer is free again as soon as it returns.
+static void
+input_thread(uint32_t arg) {
+	struct rx_queue *q = &RXRING->rr_ready[ns_worker];
+	volatile uint32_t *busy = &RXRING->rr_busy[ns_worker];
+	int i;
+
+	while (1) {
+		while ((i = rx_queue_pop(q)) >= 0) {
+			if (i >= NRXBUF)
+				panic("NS: bad rx buffer index %d", i);
+			jif_input(&nif, RXBUF(i), RXRING->rr_csum[i]);
+			rx_release(i);
+		}
+		// Stop draining, then look once more: ns_input may have
+		// pushed a frame after our last pop but seen us still busy.
+		// If it has since set rr_busy again, its NSREQ_INPUT starts
+		// the next input_thread.
+		xchg(busy, 0);
+		if (rx_queue_empty(q) || xchg(busy, 1))
+			return;
+	}
+}
+
+// Client requests received by ns_idle, in arrival order.
+#define NPENDING 64
+static struct {
+	int32_t reqno;
+	envid_t whom;
+	void *va;
+} pending[NPENDING];
+static uint32_t pending_head, pending_tail;
+
+static bool
+pending_full(void)
+{
+	return pending_tail - pending_head == NPENDING;
+}
+
+static int
+pending_push(int32_t reqno, envid_t whom, void *va)
+{
+	if (pending_full())
+		return 0;
+	pending[pending_tail % NPENDING].reqno = reqno;
+	pending[pending_tail % NPENDING].whom = whom;
+	pending[pending_tail % NPENDING].va = va;
+	pending_tail++;
+	return 1;
+}
+
+static int
+pending_pop(int32_t *reqno, uint32_t *whom, void **va)
+{
+	if (pending_head == pending_tail)
+		return 0;
+	*reqno = pending[pending_head % NPENDING].reqno;
+	*whom = pending[pending_head % NPENDING].whom;
+	*va = pending[pending_head % NPENDING].va;
+	pending_head++;
+	return 1;
+}
+
+// Handle message reqno from whom, with page va if perm says one came.
+// Requests from clients are only dispatched if can_dispatch; otherwise
+// they are queued for serve's loop and 0 is returned if there was no
+// room for them.
+static int
+serve_msg(int32_t reqno, envid_t whom, void *va, int perm, bool can_dispatch)
+{
+	if (debug) {
+		cprintf("ns req %d from %08x\n", reqno, whom);
+	}
+
+	// replies from the file server are for fs_map
+	if (fs_busy && whom == fs_envid) {
+		fs_ret = reqno;
+		fs_page = (va && (perm & PTE_P)) ? va : NULL;
+		if (fs_ret > 0 && !fs_page)
+			fs_ret = -E_NO_MEM;
+		if (va && !fs_page)
+			put_buffer(va);
+		fs_done = 1;
+		thread_wakeup(&fs_done);
+		return 1;
+	}
+
+	// first take care of requests that do not contain an argument page
+	if (reqno == NSREQ_SYNC) {
+		listen_wakeup();
+		if (va)
+			put_buffer(va);
+		return 1;
+	}
+
+	// ns_input only tells us rr_ready needs draining, having set
+	// rr_busy for us; one thread drains the whole queue, see
+	// input_thread.
+	if (reqno == NSREQ_INPUT) {
+		if (whom != NSSHARED->ns_input)
+			cprintf("NS: input request from %08x not input env\n", whom);
+		else {
+			thread_create(0, "input", input_thread, 0);
+			thread_yield();
+		}
+		if (va)
+			put_buffer(va);
+		return 1;
+	}
+
+	// Out of request buffers: the page was not taken, so the
+	// client's arguments are lost; tell it to try again.
+	if (!va) {
+		ipc_send(whom, -E_NO_MEM, 0, 0);
+		return 1;
+	}
+
+	// All remaining requests must contain an argument page
+	if (!(perm & PTE_P)) {
+		cprintf("Invalid request from %08x: no argument page\n", whom);
+		put_buffer(va);
+		return 1; // just leave it hanging...
+	}
+
+	if (!can_dispatch)
+		return pending_push(reqno, whom, va);
+	dispatch(reqno, whom, va);
+	return 1;
+}
+
+// Run by the thread library when every thread is asleep: block in
+// ipc_recv until a message arrives or a thread's deadline comes, rather
+// than spin.  Input and fs replies are what wake lwIP's threads, so they
+// are handled at once; client requests wait in the pending ring for
+// serve's loop, since the thread that would run them is the one asleep.
+static void
+ns_idle(void)
+{
+	int32_t reqno;
+	envid_t whom;
+	int perm;
+	void *va;
+
+	if (pending_full()) {
+		sys_yield();
+		return;
+	}
+	reqno = ns_recv(&whom, &va, &perm);
+	if (reqno != -E_TIMEOUT)
+		serve_msg(reqno, whom, va, perm, 0);
+}
+
 void
 serve(void) {
 	int32_t reqno;
 	uint32_t whom;
 	int i, perm;
 	void *va;
+	uint64_t busy = read_tsc();
+
+	lwip_socket_event = parked_event;
+	thread_set_idle(ns_idle);
 
 	while (1) {
 		// ipc_recv will block the entire process, so we flush
 		// all pending work from other threads.  We limit the
 		// number of yields in case there's a rogue thread.
-		for (i = 0; thread_wakeups_pending() && i < 32; ++i)
+		for (i = 0; (thread_wakeups_pending() || parked_events)
+			    && i < 32; ++i) {
+			parked_run();
 			thread_yield();
-
-		perm = 0;
-		va = get_buffer();
-		reqno = ipc_recv((int32_t *) &whom, (void *) va, &perm);
-		if (debug) {
-			cprintf("ns req %d from %08x\n", reqno, whom);
 		}
+		parked_run();
+		listen_sync();
 
-		// first take care of requests that do not contain an argument page
-		if (reqno == NSREQ_TIMER) {
-			process_timer(whom);
-			put_buffer(va);
+		// requests that came in while we were asleep
+		if (pending_pop(&reqno, &whom, &va)) {
+			dispatch(reqno, whom, va);
 			continue;
 		}
 
-		// All remaining requests must contain an argument page
-		if (!(perm & PTE_P)) {
-			cprintf("Invalid request from %08x: no argument page\n", whom);
-			continue; // just leave it hanging...
-		}
-
-		// Since some lwIP socket calls will block, create a thread and
-		// process the rest of the request in the thread.
-		struct st_args *args = malloc(sizeof(struct st_args));
-		if (!args)
-			panic("could not allocate thread args structure");
-
-		args->reqno = reqno;
-		args->whom = whom;
-		args->req = va;
-
-		thread_create(0, "serve_thread", serve_thread, (uint32_t)args);
-		thread_yield(); // let the thread created run
+		tx_cycles += read_tsc() - busy;
+		reqno = ns_recv((envid_t *) &whom, &va, &perm);
+		busy = read_tsc();
+		// a timer is due: run it, at the top of the loop
+		if (reqno == -E_TIMEOUT)
+			continue;
+		serve_msg(reqno, whom, va, perm, 1);
 	}
 }
 
@@ -311,31 +1434,45 @@ tmain(uint32_t arg) {
 	serve();
 }
 
+//
+// TCP_LOCAL_PORT_OK hook for tcp_connect, see lwipopts.h.
+// Only use local ports whose replies ns_input steers back to this worker.
+//
+static int
+rss_tcp_port_ok(struct tcp_pcb *pcb, uint16_t port)
+{
+	uint32_t local;
+
+	if (ns_nworkers <= 1)
+		return 1;
+	local = pcb->local_ip.addr;
+	if (ip_addr_isany(&pcb->local_ip) && netif_default)
+		local = netif_default->ip_addr.addr;
+	// Replies travel from the remote end to us.
+	return rss_hash(pcb->remote_ip.addr, local, htons(pcb->remote_port),
+			htons(port)) % ns_nworkers == ns_worker;
+}
+
 void
 umain(int argc, char **argv)
 {
 	envid_t ns_envid = sys_getenvid();
+	struct ns_shared *sh = NSSHARED;
+	int i, r;
 
 	binaryname = "ns";
 
-	// fork off the timer thread which will send us periodic messages
-	timer_envid = fork();
-	if (timer_envid < 0)
-		panic("error forking");
-	else if (timer_envid == 0) {
-		timer(ns_envid, TIMER_INTERVAL);
-		return;
-	}
-
-	// fork off the input thread which will poll the NIC driver for input
-	// packets
-	input_envid = fork();
-	if (input_envid < 0)
-		panic("error forking");
-	else if (input_envid == 0) {
-		input(ns_envid);
-		return;
-	}
+	// map the receive buffer pool and the page shared between workers
+	// before forking, so that every env we fork shares them with us
+	if ((r = sys_net_rx_map(RXRING, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_net_rx_map: %e", r);
+	if ((r = sys_page_alloc(0, sh, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+	ns_nworkers = MIN(sys_ncpu(), NSWORKER_MAX);
+	sh->ns_nworkers = ns_nworkers;
+	sh->ns_workers[0] = ns_envid;
+	for (i = 0; i < NSLISTEN; i++)
+		listen_s[i] = -1;
 
 	// fork off the output thread that will send the packets to the NIC
 	// driver
@@ -347,6 +1484,35 @@ umain(int argc, char **argv)
 		return;
 	}
 
+	// fork off the other workers, each with its own lwIP
+	for (i = 1; i < ns_nworkers; i++) {
+		if ((r = fork()) < 0)
+			panic("error forking");
+		else if (r == 0) {
+			ns_worker = i;
+			binaryname = "ns_worker";
+			// only worker 0 answers ARP requests
+			jos_arp_quiet = 1;
+			break;
+		}
+		sh->ns_workers[i] = r;
+	}
+
+	// fork off the input thread which will poll the NIC driver for input
+	// packets and steer them to the workers
+	if (ns_worker == 0) {
+		input_envid = fork();
+		if (input_envid < 0)
+			panic("error forking");
+		else if (input_envid == 0) {
+			input(sh->ns_workers, ns_nworkers);
+			return;
+		}
+		sh->ns_input = input_envid;
+	}
+
+	jos_tcp_port_ok = rss_tcp_port_ok;
+
 	// lwIP requires a user threading library; start the library and jump
 	// into a thread to continue initialization.
 	thread_init();
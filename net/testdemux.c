@@ -0,0 +1,153 @@
+#include "ns.h"
+
+#include <inc/x86.h>
+#include <lwip/tcp.h>
+#include <lwip/inet.h>
+
+// Demultiplexing microbenchmark: what it costs tcp_input to find the pcb
+// of an incoming segment with 10, 1,000 and 10,000 connections, half of
+// them in TIME-WAIT the way httpd's close-per-request leaves them, by
+// searching the pcb lists as lwIP used to and by the TCP_PCB_HASH tables.
+// Segments go to random connections, and SYNs to the one listener.
+
+#define LOCALIP		"10.0.2.15"
+#define PORT		80
+#define MAXPCB		10000
+#define LOOKUPS		20000
+
+static struct tcp_pcb pcbs[MAXPCB];
+static struct tcp_pcb_listen lpcb;
+
+// The addresses of the segments to look up, as tcp_input sees them.
+static struct {
+	struct ip_addr src;
+	u16_t sport;
+} segs[LOOKUPS];
+
+static struct ip_addr localip;
+
+// Make n connections to PORT, from remote addresses and ports in order.
+static void
+setup(int n)
+{
+	struct tcp_pcb *pcb;
+	int i;
+
+	tcp_active_pcbs = tcp_tw_pcbs = NULL;
+	memset(tcp_conn_hash, 0, sizeof(tcp_conn_hash));
+	memset(tcp_listen_hash, 0, sizeof(tcp_listen_hash));
+
+	for (i = 0; i < n; i++) {
+		pcb = &pcbs[i];
+		memset(pcb, 0, sizeof(*pcb));
+		pcb->local_ip = localip;
+		pcb->local_port = PORT;
+		pcb->remote_ip.addr = htonl(0x0a000200 + 2 + i / 1000);
+		pcb->remote_port = 1024 + i % 1000;
+		if (i % 2) {
+			pcb->state = TIME_WAIT;
+			pcb->next = tcp_tw_pcbs;
+			tcp_tw_pcbs = pcb;
+		} else {
+			pcb->state = ESTABLISHED;
+			pcb->next = tcp_active_pcbs;
+			tcp_active_pcbs = pcb;
+		}
+		tcp_pcb_hash_add(pcb);
+	}
+
+	memset(&lpcb, 0, sizeof(lpcb));
+	lpcb.state = LISTEN;
+	lpcb.local_port = PORT;
+	tcp_listen_pcbs.listen_pcbs = &lpcb;
+	tcp_pcb_hash_add((struct tcp_pcb *) &lpcb);
+}
+
+// Pick the segments: random connections, and a SYN from a new one for
+// every syn of them.
+static void
+pick(int n, int syn)
+{
+	uint32_t seed = 6828;
+	int i, c;
+
+	for (i = 0; i < LOOKUPS; i++) {
+		seed = seed * 1103515245 + 12345;
+		c = (seed >> 8) % n;
+		if (syn && i % syn == 0)
+			c = MAXPCB + i;
+		segs[i].src.addr = htonl(0x0a000200 + 2 + c / 1000);
+		segs[i].sport = 1024 + c % 1000;
+	}
+}
+
+// The pcb lookup in tcp_input before TCP_PCB_HASH.
+static void *
+list_demux(struct ip_addr *src, u16_t sport)
+{
+	struct tcp_pcb *pcb;
+	struct tcp_pcb_listen *l;
+
+	for (pcb = tcp_active_pcbs; pcb; pcb = pcb->next)
+		if (pcb->remote_port == sport && pcb->local_port == PORT
+		    && ip_addr_cmp(&pcb->remote_ip, src)
+		    && ip_addr_cmp(&pcb->local_ip, &localip))
+			return pcb;
+	for (pcb = tcp_tw_pcbs; pcb; pcb = pcb->next)
+		if (pcb->remote_port == sport && pcb->local_port == PORT
+		    && ip_addr_cmp(&pcb->remote_ip, src)
+		    && ip_addr_cmp(&pcb->local_ip, &localip))
+			return pcb;
+	for (l = tcp_listen_pcbs.listen_pcbs; l; l = l->next)
+		if ((ip_addr_isany(&l->local_ip)
+		     || ip_addr_cmp(&l->local_ip, &localip))
+		    && l->local_port == PORT)
+			return l;
+	return NULL;
+}
+
+// And with it.
+static void *
+hash_demux(struct ip_addr *src, u16_t sport)
+{
+	struct tcp_pcb *pcb;
+
+	if ((pcb = tcp_conn_lookup(src, sport, &localip, PORT)))
+		return pcb;
+	return tcp_listen_lookup(&localip, PORT);
+}
+
+static uint64_t
+bench(void *(*demux)(struct ip_addr *, u16_t))
+{
+	uint64_t t0;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < LOOKUPS; i++)
+		if (!demux(&segs[i].src, segs[i].sport))
+			panic("testdemux: segment %d not demultiplexed", i);
+	return (read_tsc() - t0) / LOOKUPS;
+}
+
+void
+umain(int argc, char **argv)
+{
+	static const int npcbs[] = { 10, 1000, MAXPCB };
+	int i;
+
+	binaryname = "testdemux";
+	localip.addr = inet_addr(LOCALIP);
+
+	for (i = 0; i < sizeof(npcbs) / sizeof(npcbs[0]); i++) {
+		setup(npcbs[i]);
+		pick(npcbs[i], 0);
+		cprintf("%5d pcbs, data: %7llu cycles per segment listed, "
+			"%4llu hashed\n", npcbs[i], bench(list_demux),
+			bench(hash_demux));
+		pick(npcbs[i], 10);
+		cprintf("%5d pcbs, 10%% SYN: %7llu cycles per segment listed, "
+			"%4llu hashed\n", npcbs[i], bench(list_demux),
+			bench(hash_demux));
+	}
+}
@@ -1,4 +1,5 @@
 #include "ns.h"
+#include <inc/x86.h>
 #include <netif/etharp.h>
 
 static envid_t output_envid;
@@ -72,6 +73,9 @@ umain(int argc, char **argv)
 
 	binaryname = "testinput";
 
+	if ((r = sys_net_rx_map(RXRING, PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_net_rx_map: %e", r);
+
 	output_envid = fork();
 	if (output_envid < 0)
 		panic("error forking");
@@ -84,7 +88,7 @@ umain(int argc, char **argv)
 	if (input_envid < 0)
 		panic("error forking");
 	else if (input_envid == 0) {
-		input(ns_envid);
+		input(&ns_envid, 1);
 		return;
 	}
 
@@ -95,7 +99,7 @@ umain(int argc, char **argv)
 		envid_t whom;
 		int perm;
 
-		int32_t req = ipc_recv((int32_t *)&whom, pkt, &perm);
+		int32_t req = ipc_recv((int32_t *)&whom, 0, &perm);
 		if (req < 0)
 			panic("ipc_recv: %e", req);
 		if (whom != input_envid)
@@ -103,8 +107,17 @@ umain(int argc, char **argv)
 		if (req != NSREQ_INPUT)
 			panic("Unexpected IPC %d", req);
 
-		hexdump("input: ", pkt->jp_data, pkt->jp_len);
-		cprintf("\n");
+		// Drain the queue the way ns's input_thread does, so that
+		// ns_input wakes us again for the next packet.
+		do {
+			while ((i = rx_queue_pop(&RXRING->rr_ready[0])) >= 0) {
+				hexdump("input: ", RXBUF(i)->jp_data, RXBUF(i)->jp_len);
+				cprintf("\n");
+				rx_queue_push(&RXRING->rr_free, i);
+			}
+			xchg(&RXRING->rr_busy[0], 0);
+		} while (!rx_queue_empty(&RXRING->rr_ready[0])
+			 && !xchg(&RXRING->rr_busy[0], 1));
 
 		// Only indicate that we're waiting for packets once
 		// we've received the ARP reply
@@ -0,0 +1,96 @@
+#include "ns.h"
+
+#include <inc/x86.h>
+#include <lwip/mem.h>
+#include <lwip/memp.h>
+#include <lwip/pbuf.h>
+#include <lwip/stats.h>
+#include <lwip/sys.h>
+
+// Allocation microbenchmark for the lwIP memory ns allocates packets
+// from: the PBUF_POOL pool, PBUF_RAM pbufs, which go through the heap
+// magazines (MEM_MAGAZINE), and heap blocks too big for any magazine,
+// which search the heap.  The heap is fragmented first, the way a busy
+// ns leaves it.
+
+#define NLIVE		512		// blocks held to fragment the heap
+#define BATCH		32		// allocations in flight at once
+#define ROUNDS		2000
+
+static void *live[NLIVE];
+
+static void
+fragment(void)
+{
+	uint32_t seed = 6828;
+	int i;
+
+	for (i = 0; i < NLIVE; i++) {
+		seed = seed * 1103515245 + 12345;
+		if (!(live[i] = mem_malloc(64 + (seed >> 16) % 3000)))
+			panic("testpool: heap too small to fragment");
+	}
+	for (i = 0; i < NLIVE; i += 2) {
+		mem_free(live[i]);
+		live[i] = NULL;
+	}
+}
+
+static void
+bench_pbuf(const char *name, pbuf_type type, u16_t len)
+{
+	struct pbuf *p[BATCH];
+	uint64_t t0, t;
+	int i, j;
+
+	t0 = read_tsc();
+	for (j = 0; j < ROUNDS; j++) {
+		for (i = 0; i < BATCH; i++)
+			if (!(p[i] = pbuf_alloc(PBUF_RAW, len, type)))
+				panic("testpool: %s: out of memory", name);
+		for (i = 0; i < BATCH; i++)
+			pbuf_free(p[i]);
+	}
+	t = (read_tsc() - t0) / ((uint64_t) ROUNDS * BATCH);
+	cprintf("%-28s %5llu cycles per alloc+free\n", name, t);
+}
+
+static void
+bench_heap(const char *name, mem_size_t len)
+{
+	void *m[BATCH];
+	uint64_t t0, t;
+	int i, j;
+
+	t0 = read_tsc();
+	for (j = 0; j < ROUNDS; j++) {
+		for (i = 0; i < BATCH; i++)
+			if (!(m[i] = mem_malloc(len)))
+				panic("testpool: %s: out of memory", name);
+		for (i = 0; i < BATCH; i++)
+			mem_free(m[i]);
+	}
+	t = (read_tsc() - t0) / ((uint64_t) ROUNDS * BATCH);
+	cprintf("%-28s %5llu cycles per alloc+free\n", name, t);
+}
+
+void
+umain(int argc, char **argv)
+{
+	binaryname = "testpool";
+
+	sys_init();
+	mem_init();
+	memp_init();
+	fragment();
+
+	bench_pbuf("PBUF_POOL 1514 (memp)", PBUF_POOL, 1514);
+	bench_pbuf("PBUF_RAM 1514 (magazine)", PBUF_RAM, 1514);
+	bench_pbuf("PBUF_RAM 40 (magazine)", PBUF_RAM, 40);
+	bench_heap("heap 2500 (first fit)", 2500);
+
+	cprintf("high water: heap %u of %u bytes, PBUF_POOL %u of %u\n",
+		lwip_stats.mem.max, lwip_stats.mem.avail,
+		lwip_stats.memp[MEMP_PBUF_POOL].max,
+		lwip_stats.memp[MEMP_PBUF_POOL].avail);
+}
@@ -0,0 +1,120 @@
+// Echo load test: NCLIENT concurrent TCP connections to an echo server
+// with one env per connection, all over ns's loopback.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define IPADDR		"10.0.2.15"
+#define PORT		10001
+#define NCLIENT		200
+#define PERENV		20		// connections per client env, < MAXFD
+#define ROUNDS		4
+
+static void
+die(char *m)
+{
+	cprintf("echoload: %s\n", m);
+	exit();
+}
+
+// Echo one connection, then exit.
+static void
+server(int lsock)
+{
+	char buf[64];
+	int sock, n;
+
+	if ((sock = accept(lsock, NULL, NULL)) < 0)
+		die("accept failed");
+	close(lsock);
+	while ((n = read(sock, buf, sizeof(buf))) > 0)
+		if (write(sock, buf, n) != n)
+			die("server write failed");
+	close(sock);
+	exit();
+}
+
+// Open PERENV connections, then echo ROUNDS messages over each of them
+// in turn, so that all of them are open and busy at once.
+static void
+client(int id)
+{
+	struct sockaddr_in addr;
+	int sock[PERENV], i, j, n, len;
+	char msg[32], buf[32];
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(IPADDR);
+	addr.sin_port = htons(PORT);
+
+	for (i = 0; i < PERENV; i++) {
+		if ((sock[i] = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+			die("socket failed");
+		if (connect(sock[i], (struct sockaddr *) &addr, sizeof(addr)) < 0)
+			die("connect failed");
+	}
+	for (j = 0; j < ROUNDS; j++) {
+		for (i = 0; i < PERENV; i++) {
+			len = snprintf(msg, sizeof(msg), "client %d.%d round %d",
+				       id, i, j);
+			if (write(sock[i], msg, len) != len)
+				die("client write failed");
+		}
+		for (i = 0; i < PERENV; i++) {
+			len = snprintf(msg, sizeof(msg), "client %d.%d round %d",
+				       id, i, j);
+			if ((n = readn(sock[i], buf, len)) != len
+			    || memcmp(buf, msg, len) != 0)
+				die("bad echo");
+		}
+	}
+	for (i = 0; i < PERENV; i++)
+		close(sock[i]);
+	exit();
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	envid_t clients[NCLIENT / PERENV];
+	int lsock, i, r;
+	unsigned start;
+
+	binaryname = "echoload";
+
+	if ((lsock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		die("socket failed");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(PORT);
+	if (bind(lsock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("bind failed");
+	if (listen(lsock, NCLIENT) < 0)
+		die("listen failed");
+
+	for (i = 0; i < NCLIENT; i++) {
+		if ((r = fork()) < 0)
+			die("fork failed");
+		if (r == 0)
+			server(lsock);
+	}
+	cprintf("echoload: %d servers waiting\n", NCLIENT);
+
+	start = sys_time_msec();
+	for (i = 0; i < NCLIENT / PERENV; i++) {
+		if ((r = fork()) < 0)
+			die("fork failed");
+		if (r == 0)
+			client(i);
+		clients[i] = r;
+	}
+	for (i = 0; i < NCLIENT / PERENV; i++)
+		wait(clients[i]);
+	cprintf("echoload: %d clients x %d rounds done in %u msec\n",
+		NCLIENT, ROUNDS, sys_time_msec() - start);
+	close(lsock);
+}
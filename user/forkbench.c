@@ -0,0 +1,122 @@
+// Fork microbenchmarks, in cycles: a forktree of DEPTH levels, each env
+// forking two children and waiting for them; a fork of an env with
+// HEAPSIZE of memory whose child exits at once, and whose child writes
+// every page of it, which shows what a copy-on-write fault costs; a
+// spawn of echo -n, waited for; and a fork-exec loop, the child spawning
+// echo -n and waiting for it.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define DEPTH		6
+#define HEAPSIZE	(4 * 1024 * 1024)
+#define NFORK		100
+#define NEXEC		50
+
+static char heap[HEAPSIZE] __attribute__((aligned(PGSIZE)));
+
+static void
+forktree(int depth)
+{
+	envid_t kids[2];
+	int i;
+
+	if (depth == 0)
+		return;
+	for (i = 0; i < 2; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0) {
+			forktree(depth - 1);
+			exit();
+		}
+	}
+	for (i = 0; i < 2; i++)
+		wait(kids[i]);
+}
+
+static uint64_t
+bench_fork(bool write)
+{
+	uint64_t t0;
+	envid_t child;
+	int i, j;
+
+	t0 = read_tsc();
+	for (i = 0; i < NFORK; i++) {
+		if ((child = fork()) < 0)
+			panic("fork: %e", child);
+		if (child == 0) {
+			if (write)
+				for (j = 0; j < HEAPSIZE; j += PGSIZE)
+					heap[j] = 1;
+			exit();
+		}
+		wait(child);
+	}
+	return (read_tsc() - t0) / NFORK;
+}
+
+static uint64_t
+bench_spawn(void)
+{
+	uint64_t t0;
+	envid_t r;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < NEXEC; i++) {
+		if ((r = spawnl("echo", "echo", "-n", 0)) < 0)
+			panic("spawn echo: %e", r);
+		wait(r);
+	}
+	return (read_tsc() - t0) / NEXEC;
+}
+
+static uint64_t
+bench_exec(void)
+{
+	uint64_t t0;
+	envid_t child, r;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < NEXEC; i++) {
+		if ((child = fork()) < 0)
+			panic("fork: %e", child);
+		if (child == 0) {
+			if ((r = spawnl("echo", "echo", "-n", 0)) < 0)
+				panic("spawn echo: %e", r);
+			wait(r);
+			exit();
+		}
+		wait(child);
+	}
+	return (read_tsc() - t0) / NEXEC;
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t t0, quiet, dirty;
+	int i;
+
+	binaryname = "forkbench";
+
+	t0 = read_tsc();
+	forktree(DEPTH);
+	cprintf("forkbench: %10llu cycles per forktree of %d envs\n",
+		read_tsc() - t0, (2 << DEPTH) - 1);
+
+	// make every page of the heap present and writable
+	for (i = 0; i < HEAPSIZE; i += PGSIZE)
+		heap[i] = 0;
+	quiet = bench_fork(0);
+	dirty = bench_fork(1);
+	cprintf("forkbench: %10llu cycles per fork/exit/wait of %d KB\n",
+		quiet, HEAPSIZE / 1024);
+	cprintf("forkbench: %10llu cycles per copy-on-write fault\n",
+		dirty > quiet ? (dirty - quiet) / (HEAPSIZE / PGSIZE) : 0);
+	cprintf("forkbench: %10llu cycles per spawn/wait\n", bench_spawn());
+	cprintf("forkbench: %10llu cycles per fork/spawn/wait\n", bench_exec());
+}
@@ -3,31 +3,51 @@
 #include <lwip/inet.h>
 
 #define PORT 80
-#define VERSION "0.1"
-#define HTTP_VERSION "1.0"
+#define VERSION "0.2"
+#define HTTP_VERSION "1.1"
 
 #define E_BAD_REQ	1000
 
-#define BUFFSIZE 512
-#define MAXPENDING 5	// Max connection requests
+#define BUFFSIZE 2048	// Request bytes a connection can have outstanding
+#define MAXPENDING 64	// Max connection requests
+#define MAXEVENTS 32	// Ready connections handled per epoll_wait
+#define MAXCONN 256	// Connections per worker, MAXFD
+#define NWORKER 4	// Envs serving the listening socket
+
+#define NCACHE 32	// Files in the cache
+#define CACHE_MAXFILE 8192	// Largest file cached
+#define CACHE_MAXURL 64
 
 struct http_request {
 	int sock;
 	char *url;
 	char *version;
+	bool keepalive;
 };
 
-struct responce_header {
-	int code;
-	char *header;
+// Request bytes received on a connection and not yet answered.  With
+// pipelining, there may be several requests in there.
+struct http_conn {
+	int len;
+	char buf[BUFFSIZE];
 };
 
-struct responce_header headers[] = {
-	{ 200, 	"HTTP/" HTTP_VERSION " 200 OK\r\n"
-		"Server: jhttpd/" VERSION "\r\n"},
-	{0, 0},
+static struct http_conn conns[MAXCONN];
+
+// Small static files, so that a hot file costs no trip to the file
+// server.  The cache is direct-mapped on the URL and never checks the
+// file again, which is fine for the static content httpd serves.
+struct cache_entry {
+	char url[CACHE_MAXURL];
+	off_t size;
+	char data[CACHE_MAXFILE];
 };
 
+static struct cache_entry cache[NCACHE];
+
+// The headers and body of a cached response go out in one write.
+static char resp[CACHE_MAXFILE + 256];
+
 struct error_messages {
 	int code;
 	char *msg;
@@ -36,6 +56,7 @@ struct error_messages {
 struct error_messages errors[] = {
 	{400, "Bad Request"},
 	{404, "Not Found"},
+	{0, 0},
 };
 
 static void
@@ -52,25 +73,31 @@ req_free(struct http_request *req)
 	free(req->version);
 }
 
-static int
-send_header(struct http_request *req, int code)
+static const char*
+mime_type(const char *file)
 {
-	struct responce_header *h = headers;
-	while (h->code != 0 && h->header!= 0) {
-		if (h->code == code)
-			break;
-		h++;
-	}
-
-	if (h->code == 0)
-		return -1;
+	//TODO: for now only a single mime type
+	return "text/html";
+}
 
-	int len = strlen(h->header);
-	if (write(req->sock, h->header, len) != len) {
-		die("Failed to send bytes to client");
-	}
+// Put the status line and headers of a 200 response with a size-byte
+// body in buf.  Returns their length.
+static int
+make_header(struct http_request *req, off_t size, char *buf, int len)
+{
+	int r;
 
-	return 0;
+	r = snprintf(buf, len, "HTTP/" HTTP_VERSION " 200 OK\r\n"
+			       "Server: jhttpd/" VERSION "\r\n"
+			       "Content-Length: %ld\r\n"
+			       "Content-Type: %s\r\n"
+			       "Connection: %s\r\n"
+			       "\r\n",
+		     (long) size, mime_type(req->url),
+		     req->keepalive ? "keep-alive" : "close");
+	if (r > len - 1)
+		panic("buffer too small!");
+	return r;
 }
 
 static int
@@ -78,7 +105,15 @@ send_data(struct http_request *req, int fd)
 {
 	// LAB 6: Your code here.
 	int r = 0;
+	off_t off = 0;
 	char buf[128];
+
+	// Have ns take the file straight from the file server's cache.
+	while ((r = sendfile(req->sock, fd, off, 1 << 20)) > 0)
+		off += r;
+	if (r != -E_NOT_SUPP)
+		return r;
+
 	for(;;) {
 		r = read(fd, &buf, sizeof(buf));
 		if (r == 0)
@@ -87,65 +122,27 @@ send_data(struct http_request *req, int fd)
 			return r;
 
 		if (write(req->sock, buf, r) != r)
-			die("Failed to send bytes to client");
+			return -1;
 	}
 	return 0;
 }
 
-static int
-send_size(struct http_request *req, off_t size)
-{
-	char buf[64];
-	int r;
-
-	r = snprintf(buf, 64, "Content-Length: %ld\r\n", (long)size);
-	if (r > 63)
-		panic("buffer too small!");
-
-	if (write(req->sock, buf, r) != r)
-		return -1;
-
-	return 0;
-}
-
-static const char*
-mime_type(const char *file)
-{
-	//TODO: for now only a single mime type
-	return "text/html";
-}
-
-static int
-send_content_type(struct http_request *req)
-{
-	char buf[128];
-	int r;
-	const char *type;
-
-	type = mime_type(req->url);
-	if (!type)
-		return -1;
-
-	r = snprintf(buf, 128, "Content-Type: %s\r\n", type);
-	if (r > 127)
-		panic("buffer too small!");
-
-	if (write(req->sock, buf, r) != r)
-		return -1;
-
-	return 0;
-}
-
-static int
-send_header_fin(struct http_request *req)
+// Is the header line at line name: value, ignoring case in name?
+static bool
+header_is(const char *line, const char *name, const char *value)
 {
-	const char *fin = "\r\n";
-	int fin_len = strlen(fin);
-
-	if (write(req->sock, fin, fin_len) != fin_len)
-		return -1;
-
-	return 0;
+	char c;
+
+	for (; *name; line++, name++) {
+		c = *line;
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		if (c != *name)
+			return 0;
+	}
+	while (*line == ' ')
+		line++;
+	return strncmp(line, value, strlen(value)) == 0;
 }
 
 // given a request, this function creates a struct http_request
@@ -179,7 +176,7 @@ http_request_parse(struct http_request *req, char *request)
 	request++;
 
 	version = request;
-	while (*request && *request != '\n')
+	while (*request && *request != '\r' && *request != '\n')
 		request++;
 	version_len = request - version;
 
@@ -187,6 +184,17 @@ http_request_parse(struct http_request *req, char *request)
 	memmove(req->version, version, version_len);
 	req->version[version_len] = '\0';
 
+	// HTTP/1.1 connections stay open unless the client says otherwise,
+	// HTTP/1.0 ones only if it asks
+	req->keepalive = strcmp(req->version, "HTTP/1.1") == 0;
+	while ((request = strchr(request, '\n'))) {
+		request++;
+		if (header_is(request, "connection:", "close"))
+			req->keepalive = 0;
+		else if (header_is(request, "connection:", "keep-alive"))
+			req->keepalive = 1;
+	}
+
 	// no entity parsing
 
 	return 0;
@@ -222,12 +230,60 @@ send_error(struct http_request *req, int code)
 	return 0;
 }
 
+static struct cache_entry *
+cache_slot(const char *url)
+{
+	uint32_t h = 0;
+
+	while (*url)
+		h = h * 31 + *url++;
+	return &cache[h % NCACHE];
+}
+
+// Send the file for req from the cache, if it is there.
+// Returns 0 if it was sent, 1 if it is not cached, < 0 on error.
+static int
+send_cached(struct http_request *req)
+{
+	struct cache_entry *ce = cache_slot(req->url);
+	int n;
+
+	if (strcmp(ce->url, req->url) != 0)
+		return 1;
+	n = make_header(req, ce->size, resp, sizeof(resp) - CACHE_MAXFILE);
+	memmove(resp + n, ce->data, ce->size);
+	n += ce->size;
+	return write(req->sock, resp, n) == n ? 0 : -1;
+}
+
+// Read the size-byte file fd for req into the cache.
+static void
+cache_fill(struct http_request *req, int fd, off_t size)
+{
+	struct cache_entry *ce = cache_slot(req->url);
+
+	if (size > CACHE_MAXFILE || strlen(req->url) >= CACHE_MAXURL)
+		return;
+	ce->url[0] = '\0';
+	if (readn(fd, ce->data, size) != size)
+		return;
+	ce->size = size;
+	strcpy(ce->url, req->url);
+}
+
+// Send the file req asks for, or an error response.
+// Returns 0 if the file was sent, the HTTP status if an error response
+// was, < 0 if the connection failed.
 static int
 send_file(struct http_request *req)
 {
 	int r;
 	off_t file_size = -1;
 	int fd;
+	char buf[256];
+
+	if ((r = send_cached(req)) <= 0)
+		return r;
 
 	// open the requested url for reading
 	// if the file does not exist, send a 404 error using send_error
@@ -250,77 +306,167 @@ send_file(struct http_request *req)
 		r = 404;
 		goto error;
 	}
+	file_size = st.st_size;
 
-	if (req->url)
-	if ((r = send_header(req, 200)) < 0)
+	cache_fill(req, fd, file_size);
+	if ((r = send_cached(req)) <= 0)
 		goto end;
 
-	if ((r = send_size(req, file_size)) < 0)
-		goto end;
-
-	if ((r = send_content_type(req)) < 0)
-		goto end;
-
-	if ((r = send_header_fin(req)) < 0)
-		goto end;
-
-	if ((r = send_data(req, fd)) < 0) {
-		r = 400;
-		goto error;
-	} else {
+	r = make_header(req, file_size, buf, sizeof(buf));
+	if (write(req->sock, buf, r) != r) {
+		r = -1;
 		goto end;
 	}
 
+	if ((r = send_data(req, fd)) < 0)
+		goto end;
+	goto end;
 
 error:
-	send_error(req, r);
+	if (send_error(req, r) < 0)
+		r = -1;
 
 end:
-	close(fd);
+	if (fd >= 0)
+		close(fd);
 	return r;
 }
 
-static void
+// Where the request at the start of buf ends, or NULL if it has not all
+// arrived yet.
+static char *
+request_end(char *buf, int len)
+{
+	int i;
+
+	for (i = 0; i + 3 < len; i++)
+		if (buf[i] == '\r' && buf[i+1] == '\n'
+		    && buf[i+2] == '\r' && buf[i+3] == '\n')
+			return buf + i + 4;
+	return NULL;
+}
+
+// Read what client sock sent and answer every request complete in it,
+// in order.  Returns < 0 once the connection is to be closed.
+static int
 handle_client(int sock)
 {
 	struct http_request con_d;
-	int r;
-	char buffer[BUFFSIZE];
+	struct http_conn *c = &conns[sock];
+	int r, keepalive;
+	char *end;
 	int received = -1;
 	struct http_request *req = &con_d;
 
-	while (1)
-	{
-		// Receive message
-		if ((received = read(sock, buffer, BUFFSIZE)) < 0)
-			panic("failed to read");
+	// Receive message.  One client going away must not take the
+	// others down with it.
+	if ((received = read(sock, c->buf + c->len, BUFFSIZE - 1 - c->len)) <= 0)
+		return -1;
+	c->len += received;
+
+	while ((end = request_end(c->buf, c->len))) {
+		end[-1] = '\0';
 
-		memset(req, 0, sizeof(req));
+		memset(req, 0, sizeof(*req));
 
 		req->sock = sock;
 
-		r = http_request_parse(req, buffer);
+		r = http_request_parse(req, c->buf);
 		if (r == -E_BAD_REQ)
-			send_error(req, 400);
+			r = send_error(req, 400) < 0 ? -1 : 400;
 		else if (r < 0)
 			panic("parse failed");
 		else
-			send_file(req);
+			r = send_file(req);
+		keepalive = req->keepalive;
 
 		req_free(req);
 
-		// no keep alive
-		break;
+		// error responses close the connection
+		if (r != 0 || !keepalive)
+			return -1;
+
+		c->len -= end - c->buf;
+		memmove(c->buf, end, c->len);
+	}
+
+	if (c->len == BUFFSIZE - 1) {
+		// request too long
+		req->sock = sock;
+		send_error(req, 400);
+		return -1;
 	}
+	return 0;
+}
 
-	close(sock);
+// Serve connections off the shared listening socket serversock, and
+// every connection taken from it, until the env is killed.  Each worker
+// env runs one of these.
+static void
+serve(int serversock)
+{
+	int clientsock, epfd, i, n;
+	struct sockaddr_in client;
+	struct epoll_event ev, events[MAXEVENTS];
+
+	// Serve every connection from this one env: wait for any of them
+	// to have a request, or for the server socket to have a new
+	// connection, so that no single client holds up the others.
+	if ((epfd = epoll_create(MAXPENDING)) < 0)
+		die("Failed to create epoll instance");
+	ev.events = EPOLLIN;
+	ev.data.fd = serversock;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, serversock, &ev) < 0)
+		die("Failed to watch server socket");
+
+	while (1) {
+		if ((n = epoll_wait(epfd, events, MAXEVENTS, -1)) < 0)
+			die("Failed to wait for connections");
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd != serversock) {
+				clientsock = events[i].data.fd;
+				if (handle_client(clientsock) < 0) {
+					epoll_ctl(epfd, EPOLL_CTL_DEL,
+						  clientsock, NULL);
+					close(clientsock);
+				}
+				continue;
+			}
+
+			// Take the new client connections.  serversock is
+			// non-blocking, as another worker may have taken them
+			// first.
+			while (1) {
+				unsigned int clientlen = sizeof(client);
+				if ((clientsock = accept(serversock,
+							 (struct sockaddr *) &client,
+							 &clientlen)) < 0)
+					break;
+				if (clientsock >= MAXCONN) {
+					close(clientsock);
+					continue;
+				}
+				conns[clientsock].len = 0;
+				ev.events = EPOLLIN;
+				ev.data.fd = clientsock;
+				if (epoll_ctl(epfd, EPOLL_CTL_ADD, clientsock, &ev) < 0)
+					close(clientsock);
+			}
+			// out of file descriptors, most likely; try again
+			// once some connection is done
+			if (clientsock != -E_WOULDBLOCK)
+				cprintf("Failed to accept client connection: %e\n",
+					clientsock);
+		}
+	}
 }
 
 void
 umain(int argc, char **argv)
 {
-	int serversock, clientsock;
-	struct sockaddr_in server, client;
+	int serversock, i, r;
+	struct sockaddr_in server;
 
 	binaryname = "jhttpd";
 
@@ -344,20 +490,18 @@ umain(int argc, char **argv)
 	// Listen on the server socket
 	if (listen(serversock, MAXPENDING) < 0)
 		die("Failed to listen on server socket");
+	if (fcntl(serversock, F_SETFL, O_NONBLOCK) < 0)
+		die("Failed to make server socket non-blocking");
 
-	cprintf("Waiting for http connections...\n");
-
-	while (1) {
-		unsigned int clientlen = sizeof(client);
-		// Wait for client connection
-		if ((clientsock = accept(serversock,
-					 (struct sockaddr *) &client,
-					 &clientlen)) < 0)
-		{
-			die("Failed to accept client connection");
-		}
-		handle_client(clientsock);
+	// Pre-fork the workers; they all accept from serversock.
+	for (i = 1; i < NWORKER; i++) {
+		if ((r = fork()) < 0)
+			die("Failed to fork worker");
+		if (r == 0)
+			break;
 	}
 
-	close(serversock);
+	if (i == NWORKER)
+		cprintf("Waiting for http connections...\n");
+	serve(serversock);
 }
@@ -0,0 +1,196 @@
+// HTTP load generator: NCLIENT client envs each open PERENV keep-alive
+// connections to httpd and send ROUNDS batches of PIPELINE pipelined
+// requests on each, all batches in flight at once, so that the server
+// has to juggle all of them.  Reports requests/s and the 99th percentile
+// latency from sending a request to receiving all of its response, to
+// the 10 msec resolution of sys_time_msec.
+// Spawns httpd and talks to it over ns's loopback; from the host, point
+// any HTTP benchmark at the forwarded port instead.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define IPADDR		"10.0.2.15"
+#define PORT		80
+#define NCLIENT		8
+#define PERENV		16		// connections per client env, < MAXFD
+#define ROUNDS		4
+#define PIPELINE	4		// requests in flight per connection
+#define REQUEST		"GET /index.html HTTP/1.1\r\nHost: jos\r\n\r\n"
+#define NBUCKET		1024		// latency histogram, 1 msec buckets
+
+// Latency histograms, one per client env, in pages every env shares.
+static uint32_t hist[NCLIENT][NBUCKET] __attribute__((aligned(PGSIZE)));
+
+struct conn {
+	int sock;
+	int len;			// bytes in buf
+	char buf[1024];
+	unsigned sent[PIPELINE];	// when each request went out
+};
+
+static struct conn conns[PERENV];
+
+static void
+die(char *m)
+{
+	cprintf("httpload: %s\n", m);
+	exit();
+}
+
+static int
+http_connect(void)
+{
+	struct sockaddr_in addr;
+	int sock;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(IPADDR);
+	addr.sin_port = htons(PORT);
+
+	if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		die("socket failed");
+	if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+// If a whole response is at the start of c's buffer, the length of it,
+// else 0.
+static int
+http_parsed(struct conn *c)
+{
+	char *p, *end = c->buf + c->len;
+	long size = -1;
+
+	c->buf[c->len] = '\0';
+	for (p = c->buf; p + 3 < end; p++) {
+		if (strncmp(p, "\r\nContent-Length:", 17) == 0)
+			size = strtol(p + 17, NULL, 10);
+		if (strncmp(p, "\r\n\r\n", 4) == 0)
+			break;
+	}
+	if (p + 3 >= end)
+		return 0;
+	if (size < 0)
+		die("no content length");
+	if (end - (p + 4) < size)
+		return 0;
+	return p + 4 + size - c->buf;
+}
+
+// Read responses on c until the one to request i is complete, and
+// record its latency.
+static void
+http_response(struct conn *c, uint32_t *h, int i)
+{
+	int n, len;
+	unsigned ms;
+
+	while (!(len = http_parsed(c))) {
+		if (c->len == sizeof(c->buf) - 1)
+			die("response too long");
+		n = read(c->sock, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+		if (n <= 0)
+			die("short response");
+		c->len += n;
+	}
+	if (strncmp(c->buf, "HTTP/1.1 200", 12) != 0)
+		die("bad response");
+	c->len -= len;
+	memmove(c->buf, c->buf + len, c->len);
+
+	ms = sys_time_msec() - c->sent[i];
+	h[MIN(ms, NBUCKET - 1)]++;
+}
+
+static void
+client(int id)
+{
+	struct conn *c;
+	int i, j, k, len = strlen(REQUEST);
+
+	for (i = 0; i < PERENV; i++)
+		if ((conns[i].sock = http_connect()) < 0)
+			die("connect failed");
+	for (j = 0; j < ROUNDS; j++) {
+		for (i = 0; i < PERENV; i++) {
+			c = &conns[i];
+			for (k = 0; k < PIPELINE; k++) {
+				c->sent[k] = sys_time_msec();
+				if (write(c->sock, REQUEST, len) != len)
+					die("write failed");
+			}
+		}
+		for (i = 0; i < PERENV; i++)
+			for (k = 0; k < PIPELINE; k++)
+				http_response(&conns[i], hist[id], k);
+	}
+	for (i = 0; i < PERENV; i++)
+		close(conns[i].sock);
+	exit();
+}
+
+// Kill httpd and the workers it forked.
+static void
+kill_httpd(envid_t httpd)
+{
+	int i;
+
+	for (i = 0; i < NENV; i++)
+		if (envs[i].env_status != ENV_FREE
+		    && envs[i].env_parent_id == httpd)
+			sys_env_destroy(envs[i].env_id);
+	sys_env_destroy(httpd);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t httpd, clients[NCLIENT];
+	int i, r, sock, nreq = NCLIENT * PERENV * ROUNDS * PIPELINE;
+	unsigned start, ms, n, p99;
+	uintptr_t va;
+
+	binaryname = "httpload";
+
+	for (va = (uintptr_t) hist; va < (uintptr_t) (hist + NCLIENT); va += PGSIZE)
+		if ((r = sys_page_alloc(0, (void *) va,
+					PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+			panic("sys_page_alloc: %e", r);
+
+	if ((httpd = spawnl("httpd", "httpd", 0)) < 0)
+		die("cannot spawn httpd");
+	// wait for httpd to listen
+	while ((sock = http_connect()) < 0)
+		sys_yield();
+	close(sock);
+
+	start = sys_time_msec();
+	for (i = 0; i < NCLIENT; i++) {
+		if ((r = fork()) < 0)
+			die("fork failed");
+		if (r == 0)
+			client(i);
+		clients[i] = r;
+	}
+	for (i = 0; i < NCLIENT; i++)
+		wait(clients[i]);
+	ms = sys_time_msec() - start;
+	kill_httpd(httpd);
+
+	// the 99th percentile, counting from the slow end
+	for (p99 = NBUCKET, n = 0; p99 > 0 && n <= nreq / 100; ) {
+		p99--;
+		for (i = 0; i < NCLIENT; i++)
+			n += hist[i][p99];
+	}
+	cprintf("httpload: %d requests, %d keep-alive connections with "
+		"%d in flight, %u msec, %u requests/s, p99 latency %u msec\n",
+		nreq, NCLIENT * PERENV, PIPELINE, ms,
+		ms ? nreq * 1000 / ms : 0, p99);
+}
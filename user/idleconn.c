@@ -0,0 +1,147 @@
+// What idle connections cost ns: the share of its CPU time ns's workers
+// spend outside ipc_recv over MEASURE_MS, with no connections, then with
+// NPAIR * PERENV idle ones over ns's loopback.  Each connection is two
+// TCP pcbs, neither with anything to send or any timer running soon, so
+// with TCP_TIMER_WHEEL the second figure should be close to the first.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define IPADDR		"10.0.2.15"
+#define PORT		10004
+#define NPAIR		4
+#define PERENV		100		// connections per env, < MAXFD
+#define MEASURE_MS	10000
+
+// Set by each server env once it has accepted all its connections, in a
+// page every env shares.
+static volatile uint32_t accepted[NPAIR] __attribute__((aligned(PGSIZE)));
+
+static void
+die(char *m)
+{
+	cprintf("idleconn: %s\n", m);
+	exit();
+}
+
+// Hold the connections of one env open until killed.
+static void
+hold(void)
+{
+	while (1)
+		sys_env_sleep(~0U);
+}
+
+static void
+server(int lsock, int id)
+{
+	int i;
+
+	for (i = 0; i < PERENV; i++)
+		if (accept(lsock, NULL, NULL) < 0)
+			die("accept failed");
+	accepted[id] = 1;
+	hold();
+}
+
+static void
+client(void)
+{
+	struct sockaddr_in addr;
+	int i, sock;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(IPADDR);
+	addr.sin_port = htons(PORT);
+
+	for (i = 0; i < PERENV; i++) {
+		if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+			die("socket failed");
+		if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+			die("connect failed");
+	}
+	hold();
+}
+
+// Sum of every ns worker's TSC and of the cycles it spent blocked.
+static void
+sample(uint64_t *tsc, uint64_t *blocked)
+{
+	struct Nsret_stats st;
+	int w, r;
+
+	*tsc = *blocked = 0;
+	for (w = 0; (r = nsipc_stats(w, &st)) == 0; w++) {
+		*tsc += st.ret_tsc;
+		*blocked += st.ret_blocked;
+	}
+	if (r != -E_INVAL)
+		panic("nsipc_stats: %e", r);
+}
+
+static void
+measure(int nconn)
+{
+	uint64_t tsc0, blocked0, tsc1, blocked1, busy;
+	unsigned end;
+
+	sample(&tsc0, &blocked0);
+	end = sys_time_msec() + MEASURE_MS;
+	while (sys_time_msec() < end)
+		sys_env_sleep(end - sys_time_msec());
+	sample(&tsc1, &blocked1);
+
+	// in hundredths of a percent
+	busy = 10000 - (blocked1 - blocked0) * 10000 / (tsc1 - tsc0);
+	cprintf("idleconn: %4d idle connections: ns busy %u.%02u%% of the "
+		"time\n", nconn, (unsigned) (busy / 100), (unsigned) (busy % 100));
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	envid_t kids[2 * NPAIR];
+	int lsock, i, r;
+
+	binaryname = "idleconn";
+
+	if ((r = sys_page_alloc(0, (void *) accepted,
+				PTE_P|PTE_U|PTE_W|PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+
+	if ((lsock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		die("socket failed");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(PORT);
+	if (bind(lsock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("bind failed");
+	if (listen(lsock, PERENV) < 0)
+		die("listen failed");
+
+	measure(0);
+
+	for (i = 0; i < 2 * NPAIR; i++) {
+		if ((kids[i] = fork()) < 0)
+			die("fork failed");
+		if (kids[i] == 0) {
+			if (i < NPAIR)
+				server(lsock, i);
+			client();
+		}
+	}
+	close(lsock);
+
+	// wait for every connection to be accepted
+	for (i = 0; i < NPAIR; i++)
+		while (!accepted[i])
+			sys_yield();
+	measure(NPAIR * PERENV);
+
+	for (i = 0; i < 2 * NPAIR; i++)
+		sys_env_destroy(kids[i]);
+}
@@ -0,0 +1,144 @@
+// Kernel microbenchmarks: cycles per null system call, per page
+// allocated, mapped and unmapped, and per fork of a child that exits at
+// once, waited for, and per context switch between two envs playing IPC
+// ping-pong.  All of them go through the kernel's own data -- envs,
+// pages, page tables -- so they show what its mappings cost in the TLB;
+// compare a kernel with and without 4MB pages, or global pages, which
+// stay in the TLB across the CR3 load of each switch.  Fork takes its
+// page directory, page tables and exception stack zeroed; compare with
+// ZERO_POOL_MAX 0 in kern/pmap.c, and with CPUS=2 or more, so that an
+// idle CPU refills the pool of zeroed pages as the forks drain it.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSYSCALL	100000
+#define NPAGE		10000
+#define NFORK		200
+#define NPINGPONG	20000		// round trips, two switches each
+
+static char *va = (char *) 0x10000000;
+
+static uint64_t
+bench_syscall(void)
+{
+	uint64_t t0;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < NSYSCALL; i++)
+		sys_getenvid();
+	return (read_tsc() - t0) / NSYSCALL;
+}
+
+static uint64_t
+bench_page(void)
+{
+	uint64_t t0;
+	int i, r;
+
+	t0 = read_tsc();
+	for (i = 0; i < NPAGE; i++) {
+		if ((r = sys_page_alloc(0, va, PTE_P|PTE_U|PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+		if ((r = sys_page_map(0, va, 0, va + PGSIZE, PTE_P|PTE_U)) < 0)
+			panic("sys_page_map: %e", r);
+		sys_page_unmap(0, va + PGSIZE);
+		sys_page_unmap(0, va);
+	}
+	return (read_tsc() - t0) / NPAGE;
+}
+
+// The same, PAGEOP_MAX / 4 pages to a sys_page_map_batch.
+static uint64_t
+bench_page_batch(void)
+{
+	struct PageOp ops[PAGEOP_MAX], *op;
+	uint64_t t0;
+	int i, j, r, n = PAGEOP_MAX / 4;
+
+	for (j = 0, op = ops; j < n; j++) {
+		char *pg = va + 2 * j * PGSIZE;
+
+		*op++ = (struct PageOp) { PAGEOP_ALLOC, 0, 0, 0, pg,
+					  PTE_P|PTE_U|PTE_W };
+		*op++ = (struct PageOp) { PAGEOP_MAP, 0, pg, 0, pg + PGSIZE,
+					  PTE_P|PTE_U };
+	}
+	for (j = 0; j < n; j++) {
+		char *pg = va + 2 * j * PGSIZE;
+
+		*op++ = (struct PageOp) { PAGEOP_UNMAP, 0, 0, 0, pg + PGSIZE };
+		*op++ = (struct PageOp) { PAGEOP_UNMAP, 0, 0, 0, pg };
+	}
+
+	t0 = read_tsc();
+	for (i = 0; i < NPAGE; i += n)
+		if ((r = sys_page_map_batch(ops, PAGEOP_MAX)) < 0)
+			panic("sys_page_map_batch: %e", r);
+	return (read_tsc() - t0) / NPAGE;
+}
+
+static uint64_t
+bench_fork(void)
+{
+	uint64_t t0;
+	envid_t child;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < NFORK; i++) {
+		if ((child = fork()) < 0)
+			panic("fork: %e", child);
+		if (child == 0)
+			exit();
+		wait(child);
+	}
+	return (read_tsc() - t0) / NFORK;
+}
+
+static void
+bench_switch(void)
+{
+	uint64_t t0, cycles;
+	unsigned ms;
+	envid_t child;
+	int i;
+
+	if ((child = fork()) < 0)
+		panic("fork: %e", child);
+	if (child == 0) {
+		for (i = 0; i < NPINGPONG; i++)
+			ipc_send(thisenv->env_parent_id,
+				 ipc_recv(NULL, NULL, NULL), NULL, 0);
+		exit();
+	}
+
+	t0 = read_tsc();
+	ms = sys_time_msec();
+	for (i = 0; i < NPINGPONG; i++) {
+		ipc_send(child, i, NULL, 0);
+		if (ipc_recv(NULL, NULL, NULL) != i)
+			panic("pingpong out of step");
+	}
+	cycles = (read_tsc() - t0) / (2 * NPINGPONG);
+	ms = sys_time_msec() - ms;
+	wait(child);
+
+	cprintf("kernbench: %8llu cycles per context switch, %u switches/s\n",
+		cycles, ms ? 2 * NPINGPONG * 1000 / ms : 0);
+}
+
+void
+umain(int argc, char **argv)
+{
+	binaryname = "kernbench";
+
+	cprintf("kernbench: %8llu cycles per system call\n", bench_syscall());
+	cprintf("kernbench: %8llu cycles per page alloc/map/unmap\n",
+		bench_page());
+	cprintf("kernbench: %8llu cycles per page alloc/map/unmap, batched\n",
+		bench_page_batch());
+	cprintf("kernbench: %8llu cycles per fork/exit/wait\n", bench_fork());
+	bench_switch();
+}
@@ -0,0 +1,67 @@
+// What demand-paged program loading saves a big binary: a program with
+// TABLESIZE of initialized tables, started by the kernel (make
+// run-lazybench), counts the pages of its own program that are resident
+// when umain starts, then touches every page of its tables, timing the
+// faults that fill them in from the binary embedded in the kernel, and
+// touches them again, resident, for comparison.  Before load_icode
+// loaded segments on first touch, every env paid for every page of its
+// program before it ran.  The tables are only a few pages, since the
+// binary is linked into the kernel, which must end below KERNBASE+4MB.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define TABLESIZE	(16 * 1024)
+
+static const uint32_t table[TABLESIZE / 4] = { 1 };
+static uint32_t data[TABLESIZE / 4] = { 1 };
+
+extern char end[];
+
+// Pages of the program, and how many of them are resident.
+static void
+count_pages(int *npages, int *nresident)
+{
+	uintptr_t va;
+
+	*npages = *nresident = 0;
+	for (va = UTEXT; va < (uintptr_t) end; va += PGSIZE) {
+		++*npages;
+		if ((uvpd[PDX(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P))
+			++*nresident;
+	}
+}
+
+static uint64_t
+touch(void)
+{
+	uint64_t t0;
+	uint32_t sum = 0;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < TABLESIZE / 4; i += PGSIZE / 4)
+		sum += table[i] + data[i];
+	if (sum == 0)
+		panic("tables not loaded");
+	return (read_tsc() - t0) / (2 * TABLESIZE / PGSIZE);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int npages, nresident;
+	uint64_t first;
+
+	binaryname = "lazybench";
+
+	count_pages(&npages, &nresident);
+	cprintf("lazybench: %d of %d program pages resident at start\n",
+		nresident, npages);
+	first = touch();
+	cprintf("lazybench: %8llu cycles per page loaded on first touch, "
+		"%llu resident\n", first, touch());
+	count_pages(&npages, &nresident);
+	cprintf("lazybench: %d of %d program pages resident after\n",
+		nresident, npages);
+}
@@ -0,0 +1,111 @@
+// malloc benchmarks: cycles per malloc/free pair of the size ns mallocs
+// per socket request, NPAIR times over, with the heap pages mapped
+// after; and NOPS random mallocs and frees over NLIVE slots, mostly
+// small blocks with one in BIGEVERY up to BIGMAX bytes, with a
+// fragmentation report: the bytes in live blocks against the bytes of
+// heap mapped to hold them.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NPAIR		100000
+#define PAIRSIZE	40
+#define NOPS		200000
+#define NLIVE		2000
+#define BIGEVERY	50
+#define BIGMAX		(16 * 1024)
+
+static void *live[NLIVE];
+static size_t livesize[NLIVE];
+
+static uint32_t seed = 6828;
+
+static uint32_t
+rand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void
+report(const char *what)
+{
+	struct MallocStats ms;
+	unsigned frag;
+
+	malloc_stats(&ms);
+	// in tenths of a percent
+	frag = ms.ms_mapped ? 1000 - (uint64_t) ms.ms_inuse * 1000 / ms.ms_mapped
+			    : 0;
+	cprintf("mallocbench: %s: %u bytes in use, %u mapped, %u.%u%% "
+		"fragmentation\n", what, ms.ms_inuse, ms.ms_mapped,
+		frag / 10, frag % 10);
+}
+
+static uint64_t
+bench_pair(void)
+{
+	uint64_t t0;
+	void *v;
+	int i;
+
+	t0 = read_tsc();
+	for (i = 0; i < NPAIR; i++) {
+		if (!(v = malloc(PAIRSIZE)))
+			panic("malloc %d failed after %d", PAIRSIZE, i);
+		free(v);
+	}
+	return (read_tsc() - t0) / NPAIR;
+}
+
+static uint64_t
+bench_random(void)
+{
+	uint64_t t0;
+	size_t n, requested = 0;
+	int i, j;
+
+	t0 = read_tsc();
+	for (i = 0; i < NOPS; i++) {
+		j = rand() % NLIVE;
+		if (live[j]) {
+			free(live[j]);
+			live[j] = 0;
+			requested -= livesize[j];
+			continue;
+		}
+		n = rand() % BIGEVERY ? 8 + rand() % 500 : rand() % BIGMAX;
+		if (!(live[j] = malloc(n)))
+			panic("malloc %d failed after %d", n, i);
+		// touch it, as a real caller would
+		memset(live[j], 0, n);
+		livesize[j] = n;
+		requested += n;
+	}
+	t0 = (read_tsc() - t0) / NOPS;
+	cprintf("mallocbench: %u bytes asked for in live blocks\n", requested);
+	return t0;
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t cycles;
+	int i;
+
+	binaryname = "mallocbench";
+
+	cycles = bench_pair();
+	cprintf("mallocbench: %8llu cycles per malloc/free of %d bytes\n",
+		cycles, PAIRSIZE);
+	report("after the pairs");
+
+	cycles = bench_random();
+	cprintf("mallocbench: %8llu cycles per random malloc or free\n",
+		cycles);
+	report("random, live");
+
+	for (i = 0; i < NLIVE; i++)
+		free(live[i]);
+	report("random, all freed");
+}
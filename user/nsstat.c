@@ -0,0 +1,60 @@
+// Print how much of its heap and of each memory pool every ns worker
+// uses now and has used at most, to size MEM_SIZE, PBUF_POOL_SIZE and
+// the MEMP_NUM_* options in net/lwip/jos/lwipopts.h from a real load:
+// run the load, then nsstat.  Also print what each worker has sent and
+// the cycles it has spent running; the ratio of the differences between
+// two runs is the transmit cost.  Receive needs no page allocations, so
+// the only ones per frame are the pbufs jif_input copies it into.
+// Finally, sample the driver's counters a second apart for the receive
+// rate.
+
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+	struct Nsret_stats st;
+	struct Nspoolstat *ps;
+	uint32_t npkts, nstall, pbufs, start, end;
+	int w, i, r;
+
+	binaryname = "nsstat";
+
+	for (w = 0; (r = nsipc_stats(w, &st)) == 0; w++) {
+		cprintf("ns worker %d (%08x):\n", w,
+			w < st.ret_nworkers ? st.ret_workers[w] : 0);
+		cprintf("  sent %llu bytes, ran %llu cycles\n",
+			st.ret_tx_bytes, st.ret_tx_cycles);
+		pbufs = st.ret_rx_frames
+			? (uint64_t) st.ret_rx_pbufs * 100 / st.ret_rx_frames : 0;
+		cprintf("  received %u frames, %u.%02u pbuf allocations per frame\n",
+			st.ret_rx_frames, pbufs / 100, pbufs % 100);
+		cprintf("  %-16s %10s %10s %10s %6s\n",
+			"pool", "avail", "used", "max", "err");
+		for (i = 0; i < st.ret_npools; i++) {
+			ps = &st.ret_pools[i];
+			cprintf("  %-16s %10u %10u %10u %6u%s\n",
+				ps->ps_name, ps->ps_avail, ps->ps_used,
+				ps->ps_max, ps->ps_err,
+				ps->ps_max == ps->ps_avail ? "  full" : "");
+		}
+	}
+	if (r != -E_INVAL) {
+		cprintf("nsstat: %e\n", r);
+		return;
+	}
+
+	if ((r = nsipc_stats(0, &st)) < 0)
+		panic("nsipc_stats: %e", r);
+	npkts = st.ret_rx_npkts;
+	nstall = st.ret_rx_nstall;
+	start = sys_time_msec();
+	end = start + 1000;
+	while (sys_time_msec() < end)
+		sys_env_sleep(end - sys_time_msec());
+	if ((r = nsipc_stats(0, &st)) < 0)
+		panic("nsipc_stats: %e", r);
+	cprintf("rx: %u packets/s, %u times out of buffers\n",
+		(st.ret_rx_npkts - npkts) * 1000 / (sys_time_msec() - start),
+		st.ret_rx_nstall - nstall);
+}
@@ -0,0 +1,121 @@
+// Spawn benchmarks: cycles per spawn of sh and of ls, each child killed
+// as soon as spawn returns; the pages NSHELL shells take between them
+// once they are all waiting for input; and the time sh takes to run a
+// script of NCOMMAND short-lived commands.  Programs come from the file
+// server's cache of program images, so after the first spawn of one,
+// spawning it is just mapping its pages: text shared with every env
+// running it, and data copy-on-write.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSPAWN		50
+#define NSHELL		50
+#define SETTLE_MS	500
+#define NCOMMAND	1000
+#define SCRIPT		"/spawnbench.sh"
+
+static uint64_t
+bench_spawn(const char *prog, const char **argv)
+{
+	uint64_t t0, cycles = 0;
+	envid_t child;
+	int i;
+
+	for (i = 0; i < NSPAWN; i++) {
+		t0 = read_tsc();
+		if ((child = spawn(prog, argv)) < 0)
+			panic("spawn %s: %e", prog, child);
+		cycles += read_tsc() - t0;
+		sys_env_destroy(child);
+	}
+	return cycles / NSPAWN;
+}
+
+// The number of free pages, from the page structures at UPAGES.
+static int
+free_pages(void)
+{
+	uintptr_t va;
+	int i, n, nfree = 0;
+
+	for (va = UPAGES; va < UPAGES + PTSIZE
+		     && (uvpt[PGNUM(va)] & PTE_P); va += PGSIZE)
+		/* do nothing */;
+	n = (va - UPAGES) / sizeof(struct PageInfo);
+	for (i = 0; i < n; i++)
+		if (pages[i].pp_ref == 0)
+			nfree++;
+	return nfree;
+}
+
+static void
+bench_shells(void)
+{
+	const char *argv[] = { "sh", 0 };
+	envid_t kids[NSHELL];
+	int i, before, after;
+
+	before = free_pages();
+	for (i = 0; i < NSHELL; i++)
+		if ((kids[i] = spawn("sh", argv)) < 0)
+			panic("spawn sh: %e", kids[i]);
+	sys_env_sleep(SETTLE_MS);
+	after = free_pages();
+	for (i = 0; i < NSHELL; i++)
+		sys_env_destroy(kids[i]);
+
+	cprintf("spawnbench: %d shells take %d pages, %d each\n",
+		NSHELL, before - after, (before - after) / NSHELL);
+}
+
+static void
+bench_script(void)
+{
+	envid_t child;
+	unsigned ms;
+	int fd, i;
+
+	if ((fd = open(SCRIPT, O_WRONLY|O_CREAT|O_TRUNC)) < 0)
+		panic("open %s: %e", SCRIPT, fd);
+	for (i = 0; i < NCOMMAND; i++)
+		fprintf(fd, "echo -n\n");
+	close(fd);
+
+	ms = sys_time_msec();
+	if ((child = spawnl("sh", "sh", SCRIPT, 0)) < 0)
+		panic("spawn sh: %e", child);
+	wait(child);
+	ms = sys_time_msec() - ms;
+
+	cprintf("spawnbench: %d commands from a script in %u msec, "
+		"%u commands/s\n", NCOMMAND, ms,
+		ms ? NCOMMAND * 1000 / ms : 0);
+}
+
+void
+umain(int argc, char **argv)
+{
+	const char *sh_argv[] = { "sh", 0 };
+	const char *ls_argv[] = { "ls", "-F", "/", 0 };
+	int p[2], r;
+
+	binaryname = "spawnbench";
+
+	// The children read an empty pipe, which never ends while we hold
+	// its write end, and write to it, so that the shells wait and ls
+	// stays off the console.
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	if ((r = dup(p[0], 0)) < 0 || (r = dup(p[1], 1)) < 0)
+		panic("dup: %e", r);
+	close(p[0]);
+	close(p[1]);
+
+	cprintf("spawnbench: %8llu cycles per spawn of sh\n",
+		bench_spawn("sh", sh_argv));
+	cprintf("spawnbench: %8llu cycles per spawn of ls\n",
+		bench_spawn("ls", ls_argv));
+	bench_shells();
+	bench_script();
+}
@@ -0,0 +1,275 @@
+// Echo server benchmark: the same echo load, over ns's loopback, against
+// a server that forks an env per connection and against a single env
+// that serves every connection from an epoll loop on non-blocking
+// sockets.  The clients open their connections with non-blocking
+// connects, so that all of them are under way at once.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define IPADDR		"10.0.2.15"
+#define PORT		10003
+#define NCLIENT		8
+#define PERENV		16		// connections per client env, < MAXFD
+#define ROUNDS		8
+#define MSGSIZE		32
+#define MAXEVENTS	32
+#define PENDSIZE	256		// echo bytes a connection can hold back
+#define NCONN		256		// fds the event loop can serve, MAXFD
+
+static void
+die(char *m)
+{
+	cprintf("srvbench: %s\n", m);
+	exit();
+}
+
+static int
+server_socket(int port)
+{
+	struct sockaddr_in addr;
+	int lsock;
+
+	if ((lsock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		die("socket failed");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(lsock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("bind failed");
+	if (listen(lsock, NCLIENT * PERENV) < 0)
+		die("listen failed");
+	return lsock;
+}
+
+//
+// Fork-per-connection server.
+//
+
+static void
+fork_server(int lsock)
+{
+	char buf[MSGSIZE];
+	int sock, n, r;
+
+	while (1) {
+		if ((sock = accept(lsock, NULL, NULL)) < 0)
+			die("accept failed");
+		if ((r = fork()) < 0)
+			die("fork failed");
+		if (r > 0) {
+			close(sock);
+			continue;
+		}
+		close(lsock);
+		while ((n = read(sock, buf, sizeof(buf))) > 0)
+			if (write(sock, buf, n) != n)
+				die("server write failed");
+		close(sock);
+		exit();
+	}
+}
+
+//
+// Event-loop server.
+//
+
+// Echo data a connection could not take yet, indexed by fd.
+struct conn {
+	int c_len;
+	char c_buf[PENDSIZE];
+};
+
+static struct conn conns[NCONN];
+
+static void
+watch(int epfd, int op, int fd, uint32_t events)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, op, fd, &ev) < 0)
+		die("epoll_ctl failed");
+}
+
+// Accept every connection queued on lsock.
+static void
+ev_accept(int epfd, int lsock)
+{
+	int sock;
+
+	while ((sock = accept(lsock, NULL, NULL)) >= 0) {
+		if (sock >= NCONN || fcntl(sock, F_SETFL, O_NONBLOCK) < 0)
+			die("bad connection");
+		conns[sock].c_len = 0;
+		watch(epfd, EPOLL_CTL_ADD, sock, EPOLLIN);
+	}
+	if (sock != -E_WOULDBLOCK)
+		die("accept failed");
+}
+
+// Write out what sock has pending.  Returns 0 once it is all written.
+static int
+ev_flush(int sock)
+{
+	struct conn *c = &conns[sock];
+	int n;
+
+	while (c->c_len > 0) {
+		if ((n = write(sock, c->c_buf, c->c_len)) == -E_WOULDBLOCK)
+			return 1;
+		if (n < 0)
+			return n;
+		memmove(c->c_buf, c->c_buf + n, c->c_len - n);
+		c->c_len -= n;
+	}
+	return 0;
+}
+
+// Echo what sock has to read, as long as there is room to hold back
+// what it cannot take.  Returns < 0 once sock is done with.
+static int
+ev_echo(int sock)
+{
+	struct conn *c = &conns[sock];
+	int n, r;
+
+	while (c->c_len < PENDSIZE) {
+		n = read(sock, c->c_buf + c->c_len, PENDSIZE - c->c_len);
+		if (n == -E_WOULDBLOCK)
+			break;
+		if (n <= 0)
+			return -1;
+		c->c_len += n;
+		if ((r = ev_flush(sock)) != 0)
+			return r;
+	}
+	return 0;
+}
+
+static void
+event_server(int lsock)
+{
+	struct epoll_event events[MAXEVENTS];
+	int epfd, i, n, fd, r;
+
+	if (fcntl(lsock, F_SETFL, O_NONBLOCK) < 0)
+		die("fcntl failed");
+	if ((epfd = epoll_create(MAXEVENTS)) < 0)
+		die("epoll_create failed");
+	watch(epfd, EPOLL_CTL_ADD, lsock, EPOLLIN);
+
+	while (1) {
+		if ((n = epoll_wait(epfd, events, MAXEVENTS, -1)) < 0)
+			die("epoll_wait failed");
+		for (i = 0; i < n; i++) {
+			fd = events[i].data.fd;
+			if (fd == lsock) {
+				ev_accept(epfd, lsock);
+				continue;
+			}
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				r = -1;
+			else if (conns[fd].c_len > 0)
+				r = ev_flush(fd);
+			else
+				r = ev_echo(fd);
+			if (r < 0) {
+				epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+				close(fd);
+			} else
+				// wait for room if an echo is held back
+				watch(epfd, EPOLL_CTL_MOD, fd,
+				      conns[fd].c_len ? EPOLLOUT : EPOLLIN);
+		}
+	}
+}
+
+//
+// Load.
+//
+
+// Start PERENV connects at once, then echo ROUNDS messages over each
+// connection in turn.
+static void
+client(int port, int id)
+{
+	struct sockaddr_in addr;
+	int sock[PERENV], i, j, n, r;
+	char msg[MSGSIZE], buf[MSGSIZE];
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(IPADDR);
+	addr.sin_port = htons(port);
+
+	for (i = 0; i < PERENV; i++) {
+		if ((sock[i] = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0
+		    || fcntl(sock[i], F_SETFL, O_NONBLOCK) < 0)
+			die("socket failed");
+		r = connect(sock[i], (struct sockaddr *) &addr, sizeof(addr));
+		if (r < 0 && r != -E_INPROGRESS)
+			die("connect failed");
+	}
+	// reads and writes wait for their connect to finish
+	for (i = 0; i < PERENV; i++)
+		fcntl(sock[i], F_SETFL, 0);
+
+	memset(msg, 'a' + id % 26, sizeof(msg));
+	for (j = 0; j < ROUNDS; j++)
+		for (i = 0; i < PERENV; i++) {
+			msg[0] = j;
+			msg[1] = i;
+			if (write(sock[i], msg, sizeof(msg)) != sizeof(msg))
+				die("client write failed");
+			if ((n = readn(sock[i], buf, sizeof(buf))) != sizeof(buf)
+			    || memcmp(buf, msg, sizeof(buf)) != 0)
+				die("bad echo");
+		}
+	for (i = 0; i < PERENV; i++)
+		close(sock[i]);
+	exit();
+}
+
+static void
+bench(const char *name, void (*server)(int), int port)
+{
+	envid_t srv, clients[NCLIENT];
+	unsigned start, ms;
+	int lsock, i;
+
+	// listen before forking, so no client can connect too early
+	lsock = server_socket(port);
+	if ((srv = fork()) < 0)
+		die("fork failed");
+	if (srv == 0)
+		server(lsock);
+	close(lsock);
+
+	start = sys_time_msec();
+	for (i = 0; i < NCLIENT; i++) {
+		if ((clients[i] = fork()) < 0)
+			die("fork failed");
+		if (clients[i] == 0)
+			client(port, i);
+	}
+	for (i = 0; i < NCLIENT; i++)
+		wait(clients[i]);
+	ms = sys_time_msec() - start;
+	sys_env_destroy(srv);
+
+	cprintf("srvbench: %-14s %d connections x %d echoes: %u msec\n",
+		name, NCLIENT * PERENV, ROUNDS, ms);
+}
+
+void
+umain(int argc, char **argv)
+{
+	binaryname = "srvbench";
+
+	bench("fork-per-conn", fork_server, PORT);
+	bench("event-loop", event_server, PORT + 1);
+}
@@ -0,0 +1,109 @@
+// Bulk TCP throughput over ns's loopback: one env writes TOTAL bytes in
+// write() calls of each size in sizes[], another reads them back with
+// reads of the same size.  Small sizes go through the request page,
+// large ones as data pages, see nsipc_send.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define IPADDR		"10.0.2.15"
+#define PORT		10002
+#define TOTAL		(8 << 20)
+#define BUFSIZE		(64 << 10)
+
+static const int sizes[] = { 1024, NSIPC_INLINE, 4096, 16384, BUFSIZE };
+
+static char buf[BUFSIZE] __attribute__((aligned(PGSIZE)));
+
+static void
+die(char *m)
+{
+	cprintf("tcpbulk: %s\n", m);
+	exit();
+}
+
+// Read everything sent on one connection in chunks of size and check
+// the pattern in it.
+static void
+sink(int lsock, int size)
+{
+	int sock, n, i;
+	unsigned tot = 0;
+
+	if ((sock = accept(lsock, NULL, NULL)) < 0)
+		die("accept failed");
+	while ((n = read(sock, buf, size)) > 0) {
+		for (i = 0; i < n; i++)
+			if (buf[i] != (char) (tot + i))
+				die("bad data");
+		tot += n;
+	}
+	if (n < 0 || tot != TOTAL)
+		die("short read");
+	close(sock);
+	exit();
+}
+
+static unsigned
+source(int size)
+{
+	struct sockaddr_in addr;
+	int sock, i, n;
+	unsigned tot, start;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(IPADDR);
+	addr.sin_port = htons(PORT);
+
+	if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		die("socket failed");
+	if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("connect failed");
+
+	start = sys_time_msec();
+	for (tot = 0; tot < TOTAL; tot += n) {
+		n = MIN(size, TOTAL - tot);
+		for (i = 0; i < n; i++)
+			buf[i] = tot + i;
+		if (write(sock, buf, n) != n)
+			die("write failed");
+	}
+	close(sock);
+	return sys_time_msec() - start;
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	int lsock, i, r;
+	unsigned ms;
+
+	binaryname = "tcpbulk";
+
+	if ((lsock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		die("socket failed");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(PORT);
+	if (bind(lsock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("bind failed");
+	if (listen(lsock, 5) < 0)
+		die("listen failed");
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if ((r = fork()) < 0)
+			die("fork failed");
+		if (r == 0)
+			sink(lsock, sizes[i]);
+		ms = source(sizes[i]);
+		wait(r);
+		cprintf("tcpbulk: %d KB in %5d-byte writes: %u msec, %u KB/s\n",
+			TOTAL >> 10, sizes[i], ms,
+			ms ? (TOTAL >> 10) * 1000 / ms : 0);
+	}
+	close(lsock);
+}
@@ -0,0 +1,110 @@
+// Bulk TCP throughput against round trip time: ns holds the packets it
+// loops back to itself for half of each RTT in delays[] (see
+// nsipc_loopdelay), and one env writes TOTAL bytes to another over that
+// emulated path.  Without window scaling throughput tops out at 64 KB per
+// round trip; build with NET_PROFILE=BULK for a 256 KB window.
+
+#include <inc/lib.h>
+#include <lwip/sockets.h>
+#include <lwip/inet.h>
+
+#define IPADDR		"10.0.2.15"
+#define PORT		10005
+#define TOTAL		(2 << 20)
+#define BUFSIZE		(64 << 10)
+
+// Round trip times to try, in msec.
+static const int rtts[] = { 0, 10, 20, 50, 100, 200 };
+
+static char buf[BUFSIZE] __attribute__((aligned(PGSIZE)));
+
+static void
+die(char *m)
+{
+	nsipc_loopdelay(0);
+	cprintf("tcprtt: %s\n", m);
+	exit();
+}
+
+// Read everything sent on one connection.
+static void
+sink(int lsock)
+{
+	int sock, n;
+	unsigned tot = 0;
+
+	if ((sock = accept(lsock, NULL, NULL)) < 0)
+		die("accept failed");
+	while ((n = read(sock, buf, BUFSIZE)) > 0)
+		tot += n;
+	if (n < 0 || tot != TOTAL)
+		die("short read");
+	close(sock);
+	exit();
+}
+
+static unsigned
+source(void)
+{
+	struct sockaddr_in addr;
+	int sock, n;
+	unsigned tot, start;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(IPADDR);
+	addr.sin_port = htons(PORT);
+
+	if ((sock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		die("socket failed");
+	if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("connect failed");
+
+	start = sys_time_msec();
+	for (tot = 0; tot < TOTAL; tot += n) {
+		n = MIN(BUFSIZE, TOTAL - tot);
+		if (write(sock, buf, n) != n)
+			die("write failed");
+	}
+	close(sock);
+	return sys_time_msec() - start;
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	int lsock, i, r;
+	unsigned ms;
+
+	binaryname = "tcprtt";
+
+	if ((lsock = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+		die("socket failed");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(PORT);
+	if (bind(lsock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+		die("bind failed");
+	if (listen(lsock, 5) < 0)
+		die("listen failed");
+
+	cprintf("tcprtt: %d KB receive window, %d KB send buffer\n",
+		TCP_WND >> 10, TCP_SND_BUF >> 10);
+	for (i = 0; i < sizeof(rtts) / sizeof(rtts[0]); i++) {
+		if ((r = nsipc_loopdelay(rtts[i] / 2)) < 0)
+			die("cannot set the loopback delay");
+		if ((r = fork()) < 0)
+			die("fork failed");
+		if (r == 0)
+			sink(lsock);
+		ms = source();
+		wait(r);
+		cprintf("tcprtt: rtt %3d msec: %d KB in %u msec, %u KB/s\n",
+			rtts[i], TOTAL >> 10, ms,
+			ms ? (TOTAL >> 10) * 1000 / ms : 0);
+	}
+	nsipc_loopdelay(0);
+	close(lsock);
+}
@@ -0,0 +1,43 @@
+// Check that the kernel keeps each environment's SSE registers apart.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCHILD		4
+#define ROUNDS		200
+
+__attribute__((target("sse2"))) static void
+sse_round(uint32_t v, int i)
+{
+	uint32_t got;
+
+	asm volatile("movd %0, %%xmm5\n\tpshufd $0, %%xmm5, %%xmm5"
+		     : : "r" (v) : "xmm5");
+	sys_yield();
+	asm volatile("pshufd $0x93, %%xmm5, %%xmm5\n\tmovd %%xmm5, %0"
+		     : "=r" (got) : : "xmm5");
+	if (got != v)
+		panic("round %d: xmm5 holds %08x, not %08x", i, got, v);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint32_t edx, v;
+	int i, k;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if (!(edx & (1 << 26))) {
+		cprintf("testfpu: no SSE2\n");
+		return;
+	}
+
+	for (k = 0; k < NCHILD; k++)
+		if (fork() == 0)
+			break;
+
+	v = 0x6828 * (k + 1);
+	for (i = 0; i < ROUNDS; i++)
+		sse_round(v + i, i);
+	cprintf("testfpu: %08x ok\n", thisenv->env_id);
+}